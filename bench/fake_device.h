@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <memory.h>
+
+#include "ioig_transport.h"
+
+namespace ioig
+{
+    /**
+     * @class FakeLink
+     *
+     * @brief In-process device model for benchmarks.
+     *
+     * Every request is answered after `latency` (bus round trip), and the
+     * device handles one request at a time, each taking `processing`: a
+     * write chaining several frames gets one response per frame.
+     * By default the response echoes the request with status RSP.
+     */
+    class FakeLink : public Transport
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Responder = std::function<void(Packet &req, Packet &rsp)>;
+
+        FakeLink(std::chrono::microseconds latency, std::chrono::microseconds processing)
+            : _latency(latency),
+              _processing(processing),
+              _engine(nullptr),
+              _running(false),
+              _lastDone(Clock::now())
+        {
+            _responder = [](Packet &req, Packet &rsp)
+            {
+                rsp = Packet(req);
+                rsp.setStatus(Packet::Status::RSP);
+            };
+        }
+
+        ~FakeLink()
+        {
+            stop();
+        }
+
+        void setResponder(Responder responder)
+        {
+            _responder = responder;
+        }
+
+        int start(TransferEngine &engine) override
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_running)
+            {
+                return 0;
+            }
+            _engine = &engine;
+            _running = true;
+            _thread = std::thread(&FakeLink::deliveryLoop, this);
+            return 0;
+        }
+
+        void stop() override
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!_running)
+                {
+                    return;
+                }
+                _running = false;
+            }
+            _cv.notify_all();
+            _thread.join();
+        }
+
+        int write(const uint8_t *buf, size_t len, unsigned timeout_ms) override
+        {
+            (void)timeout_ms;
+
+            while (len > 0)
+            {
+                size_t frameLen = Packet::getFrameLength(buf, len);
+                if (frameLen > len)
+                {
+                    return -1; //cut frame
+                }
+
+                Packet req, rsp;
+                req.setFrame(buf, frameLen);
+                _responder(req, rsp);
+
+                Entry entry;
+                entry.len = rsp.writeFrame(entry.frame);
+
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+
+                    auto now = Clock::now();
+                    _lastDone = std::max(now + _latency, _lastDone + _processing);
+                    entry.due = _lastDone;
+                    _queue.push_back(entry);
+                }
+
+                buf += frameLen;
+                len -= frameLen;
+            }
+
+            _cv.notify_all();
+            return 0;
+        }
+
+    private:
+
+        struct Entry
+        {
+            Clock::time_point due;
+            size_t len;
+            uint8_t frame[Packet::MAX_FRAME_SIZE];
+        };
+
+        void deliveryLoop()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_running)
+            {
+                if (_queue.empty())
+                {
+                    _cv.wait(lock);
+                    continue;
+                }
+
+                auto due = _queue.front().due;
+                if (Clock::now() < due)
+                {
+                    _cv.wait_until(lock, due);
+                    continue;
+                }
+
+                Entry entry = _queue.front();
+                _queue.pop_front();
+
+                lock.unlock();
+                _engine->onReceive(entry.frame, entry.len);
+                lock.lock();
+            }
+        }
+
+        std::chrono::microseconds _latency;
+        std::chrono::microseconds _processing;
+        Responder _responder;
+        TransferEngine *_engine;
+
+        bool _running;
+        Clock::time_point _lastDone;
+        std::deque<Entry> _queue;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::thread _thread;
+    };
+}
@@ -0,0 +1,234 @@
+#include <mutex>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "ioig.h"
+#include "loopback_transport.h"
+#include "sim_clock.h"
+#include "sim_device.h"
+
+using namespace ioig;
+
+/*
+ * Firmware cost of MainTask::process dispatch and of the event queues,
+ * measured on the host build of the firmware (fw/sim) with the sim clock
+ * in virtual mode: the time reported is the firmware CPU cost on the PC,
+ * the "target_us" counter is the modeled target time per iteration, bus
+ * transfers plus the firmware sleeps and busy waits.
+ *
+ * Board wiring: GP19 + GP16 (SPI0 loopback), GP8 + GP9 (UART1 loopback).
+ */
+
+static constexpr unsigned SPI_FREQ = 1000000;
+static constexpr unsigned UART_BAUD = 115200;
+static constexpr unsigned GPIO_OUT_PIN = GP10;
+static constexpr unsigned GPIO_IRQ_PIN = GP11;
+
+static SimDevice &device = SimDevice::instance();
+static SimClock &simClock = SimClock::instance();
+
+static void run(Packet &cmd)
+{
+    Packet rsp;
+    device.process(cmd, rsp);
+}
+
+static void setup(const benchmark::State &)
+{
+    static std::once_flag once;
+    std::call_once(once, []()
+    {
+        simClock.setVirtual(true);
+
+        LoopbackTransport::wire(GP19, GP16);
+        LoopbackTransport::wire(GP8, GP9);
+
+        Packet gpioOut;
+        gpioOut.setType(Packet::Type::GPIO_INIT);
+        gpioOut.addPayloadItem8(GPIO_OUT_PIN);
+        gpioOut.addPayloadItem8(PullNone);
+        gpioOut.addPayloadItem8((uint8_t)PinDirection::Output);
+        run(gpioOut);
+
+        Packet gpioIn;
+        gpioIn.setType(Packet::Type::GPIO_INIT);
+        gpioIn.addPayloadItem8(GPIO_IRQ_PIN);
+        gpioIn.addPayloadItem8(PullNone);
+        gpioIn.addPayloadItem8((uint8_t)PinDirection::Input);
+        run(gpioIn);
+
+        Packet gpioIrq;
+        gpioIrq.setType(Packet::Type::GPIO_SET_IRQ);
+        gpioIrq.addPayloadItem8(GPIO_IRQ_PIN);
+        gpioIrq.addPayloadItem8(1);
+        gpioIrq.addPayloadItem32(RiseEdge | FallEdge);
+        run(gpioIrq);
+
+        Packet spiInit;
+        spiInit.setType(Packet::Type::SPI_INIT);
+        spiInit.addPayloadItem8(SPI_0);
+        spiInit.addPayloadItem8(GP18);
+        spiInit.addPayloadItem8(GP19);
+        spiInit.addPayloadItem8(GP16);
+        spiInit.addPayloadItem8(GP17);
+        spiInit.addPayloadItem32(SPI_FREQ);
+        run(spiInit);
+
+        Packet uartInit;
+        uartInit.setType(Packet::Type::SERIAL_INIT);
+        uartInit.addPayloadItem8(UART_1);
+        uartInit.addPayloadItem8(GP8);
+        uartInit.addPayloadItem8(GP9);
+        uartInit.addPayloadItem32(UART_BAUD);
+        run(uartInit);
+
+        Packet uartIrq;
+        uartIrq.setType(Packet::Type::SERIAL_SET_IRQ);
+        uartIrq.addPayloadItem8(UART_1);
+        uartIrq.addPayloadItem8(1);
+        uartIrq.addPayloadItem8(RxIrq);
+        run(uartIrq);
+    });
+}
+
+enum Command
+{
+    CMD_GET_FW_VER,
+    CMD_GPIO_SET_VALUE,
+    CMD_GPIO_GET_VALUE,
+    CMD_SPI_TRANSFER_32,
+    CMD_ANALOG_READ_TEMP,
+    CMD_BATCH_8_GPIO_SET_VALUE,
+};
+
+static Packet makeCommand(Command cmd)
+{
+    Packet pkt;
+
+    switch (cmd)
+    {
+    case CMD_GET_FW_VER:
+        pkt.setType(Packet::Type::SYS_GET_FW_VER);
+        break;
+    case CMD_GPIO_SET_VALUE:
+        pkt.setType(Packet::Type::GPIO_SET_VALUE);
+        pkt.addPayloadItem8(GPIO_OUT_PIN);
+        pkt.addPayloadItem8(1);
+        break;
+    case CMD_GPIO_GET_VALUE:
+        pkt.setType(Packet::Type::GPIO_GET_VALUE);
+        pkt.addPayloadItem8(GPIO_OUT_PIN);
+        break;
+    case CMD_SPI_TRANSFER_32:
+        pkt.setType(Packet::Type::SPI_TRANSFER);
+        pkt.addPayloadItem8(SPI_0);
+        pkt.addPayloadItem8(32);
+        pkt.addRepeatedPayloadItems(0xA5, 32);
+        break;
+    case CMD_ANALOG_READ_TEMP:
+        pkt.setType(Packet::Type::ANALOG_READ_TEMP);
+        break;
+    case CMD_BATCH_8_GPIO_SET_VALUE:
+    {
+        PacketBatch batch;
+        for (int i = 0; i < 8; i++)
+        {
+            Packet sub(2);
+            sub.setType(Packet::Type::GPIO_SET_VALUE);
+            sub.addPayloadItem8(GPIO_OUT_PIN);
+            sub.addPayloadItem8(i & 1);
+            batch.add(sub);
+        }
+        pkt = Packet(batch.getRequest());
+        break;
+    }
+    }
+
+    pkt.setStatus(Packet::Status::CMD);
+    return pkt;
+}
+
+static void BM_FwProcess(benchmark::State &state)
+{
+    Packet cmd = makeCommand((Command)state.range(0));
+    Packet rsp;
+
+    uint64_t start = simClock.elapsed();
+    for (auto _ : state)
+    {
+        device.process(cmd, rsp);
+        benchmark::DoNotOptimize(rsp.getBuffer());
+    }
+    state.counters["target_us"] = benchmark::Counter(simClock.elapsed() - start, benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(BM_FwProcess)
+    ->ArgName("cmd")
+    ->DenseRange(CMD_GET_FW_VER, CMD_BATCH_8_GPIO_SET_VALUE)
+    ->Setup(setup);
+
+/*
+ * GPIO irq -> event queue -> EVENT interface: the edges are raised outside
+ * the timed region, the timed region is the core1 loop draining them.
+ */
+static void BM_FwGpioEvents(benchmark::State &state)
+{
+    const int edges = state.range(0);
+    bool level = false;
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (int i = 0; i < edges; i++)
+        {
+            level = !level;
+            LoopbackTransport::setInput(GPIO_IRQ_PIN, level);
+        }
+        state.ResumeTiming();
+
+        device.poll();
+    }
+    state.SetItemsProcessed(state.iterations() * edges);
+}
+
+// the firmware event queue holds 8 edges
+BENCHMARK(BM_FwGpioEvents)
+    ->ArgName("edges")
+    ->Arg(1)->Arg(4)->Arg(8)
+    ->Setup(setup);
+
+/*
+ * SERIAL_WRITE looped back to the UART1 rx irq, then the core1 loop
+ * draining the serial event queue.
+ */
+static void BM_FwSerialEvents(benchmark::State &state)
+{
+    const int len = state.range(0);
+    std::vector<uint8_t> data(len, 'x');
+
+    Packet cmd;
+    cmd.setType(Packet::Type::SERIAL_WRITE);
+    cmd.addPayloadItem8(UART_1);
+    cmd.addPayloadItem8(len);
+    cmd.addPayloadBuffer(data.data(), len);
+    cmd.setStatus(Packet::Status::CMD);
+
+    Packet rsp;
+
+    uint64_t start = simClock.elapsed();
+    for (auto _ : state)
+    {
+        device.process(cmd, rsp);
+        device.poll();
+    }
+    state.counters["target_us"] = benchmark::Counter(simClock.elapsed() - start, benchmark::Counter::kAvgIterations);
+    state.SetBytesProcessed(state.iterations() * len);
+}
+
+BENCHMARK(BM_FwSerialEvents)
+    ->ArgName("bytes")
+    ->Arg(1)->Arg(16)->Arg(56)
+    ->Setup(setup);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,413 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "ioig.h"
+#include "ioig_usb.h"
+
+#ifdef IOIG_FW_SIM
+#include "loopback_transport.h"
+#endif
+
+using namespace ioig;
+using namespace std::chrono_literals;
+
+/*
+ * End to end benchmarks of the native API, to track regressions between
+ * releases. Runs against the dongle(s), or with --sim against the firmware
+ * built for the host (fw/sim).
+ *
+ * Board wiring, as for ioig_tests:
+ *   UART1: GP8 + GP9, GPIO: GP10 + GP11, SPI0: GP19 + GP16
+ * I2C0 runs on GP20/GP21 with no device attached.
+ *
+ * Options:
+ *   --sim          use the in-process firmware instead of a dongle
+ *   --devices=N    run the multi-device scenario on ports 0..N-1 (default 1)
+ *
+ * Output is JSON, unless --benchmark_format is given. Every benchmark
+ * reports the send to receive latency percentiles of its transfers
+ * (p50_us, p99_us) from UsbManager::getStats().
+ */
+
+static constexpr unsigned GPIO_OUT_PIN = GP10;
+static constexpr unsigned GPIO_IN_PIN  = GP11;
+static constexpr unsigned UART_BAUD    = 115200;
+static constexpr unsigned I2C_ADDR     = 0x12; //no device, measures a NACKed read
+
+static constexpr auto EVENT_TIMEOUT = 2s;
+
+/**
+ * Peripherals of one port, created on first use and kept for the whole run.
+ */
+class PortBench
+{
+public:
+    explicit PortBench(unsigned usb_port)
+        : out(Gpio(GPIO_OUT_PIN)),
+          in(Gpio(GPIO_IN_PIN)),
+          spi(Spi(SPI0_PINOUT0)),
+          i2c(I2C(I2C0_PINOUT2, 100'000, I2C_0)),
+          serial(UART(UART1_PINOUT1, UART_BAUD, UART_1)),
+          _edges(0),
+          _rxBytes(0)
+    {
+        out.attachToUsbPort(usb_port);
+        in.attachToUsbPort(usb_port);
+        spi.attachToUsbPort(usb_port);
+        i2c.attachToUsbPort(usb_port);
+        serial.attachToUsbPort(usb_port);
+
+        out.output();
+        in.input();
+        in.mode(PullNone);
+        i2c.setTimeout(50'000);
+
+        in.setInterrupt(RiseEdge | FallEdge, [this](const int, const uint32_t, void *)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _edges++;
+            _cv.notify_all();
+        });
+
+        serial.setInterrupt([this](const char *, size_t len)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _rxBytes += len;
+            _cv.notify_all();
+        });
+    }
+
+    static PortBench &get(unsigned usb_port)
+    {
+        static std::mutex mutex;
+        static std::unique_ptr<PortBench> ports[MAX_USB_DEVICES];
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ports[usb_port])
+        {
+            ports[usb_port].reset(new PortBench(usb_port));
+        }
+        return *ports[usb_port];
+    }
+
+    uint64_t edges() { std::lock_guard<std::mutex> lock(_mutex); return _edges; }
+    uint64_t rxBytes() { std::lock_guard<std::mutex> lock(_mutex); return _rxBytes; }
+
+    bool waitEdges(uint64_t count)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _cv.wait_for(lock, EVENT_TIMEOUT, [&] { return _edges >= count; });
+    }
+
+    bool waitRxBytes(uint64_t count)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _cv.wait_for(lock, EVENT_TIMEOUT, [&] { return _rxBytes >= count; });
+    }
+
+    Gpio out;
+    Gpio in;
+    Spi spi;
+    I2C i2c;
+    UART serial;
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    uint64_t _edges;
+    uint64_t _rxBytes;
+};
+
+static int deviceCount = 1;
+
+static void resetStats(const benchmark::State &)
+{
+    for (int port = 0; port < deviceCount; port++)
+    {
+        PortBench::get(port);
+        UsbManager::resetStats(port);
+    }
+}
+
+static void reportLatency(benchmark::State &state, int ports = 1)
+{
+    TransferStats::Counters total;
+    for (int port = 0; port < ports; port++)
+    {
+        total.merge(UsbManager::getStats(port).total());
+    }
+    state.counters["p50_us"] = total.latency.percentile(50);
+    state.counters["p99_us"] = total.latency.percentile(99);
+    state.counters["retries"] = total.retries;
+}
+
+
+static void BM_GpioWrite(benchmark::State &state)
+{
+    auto &bench = PortBench::get(0);
+    int value = 0;
+
+    for (auto _ : state)
+    {
+        bench.out.write(value);
+        value ^= 1;
+    }
+    state.SetItemsProcessed(state.iterations());
+    reportLatency(state);
+}
+BENCHMARK(BM_GpioWrite)->Setup(resetStats)->UseRealTime();
+
+
+static void BM_GpioRead(benchmark::State &state)
+{
+    auto &bench = PortBench::get(0);
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(bench.in.read());
+    }
+    state.SetItemsProcessed(state.iterations());
+    reportLatency(state);
+}
+BENCHMARK(BM_GpioRead)->Setup(resetStats)->UseRealTime();
+
+
+static void BM_SpiTransfer(benchmark::State &state)
+{
+    auto &bench = PortBench::get(0);
+    const size_t len = state.range(0);
+    std::vector<uint8_t> tx(len, 0xA5);
+    std::vector<uint8_t> rx(len);
+
+    for (auto _ : state)
+    {
+        bench.spi.transfer(tx.data(), rx.data(), len);
+    }
+
+    if (rx != tx)
+    {
+        state.SkipWithError("SPI loopback mismatch, check wiring GP19 + GP16");
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+    reportLatency(state);
+}
+BENCHMARK(BM_SpiTransfer)
+    ->ArgName("bytes")
+    ->Arg(1)->Arg(16)->Arg(56) //single packet transfers
+    ->Arg(256)->Arg(1024)->Arg(4096) //staged transfers, see PacketXfer
+    ->Setup(resetStats)
+    ->UseRealTime();
+
+
+static void BM_I2CRead(benchmark::State &state)
+{
+    auto &bench = PortBench::get(0);
+    const int len = state.range(0);
+    std::vector<uint8_t> rx(len);
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(bench.i2c.read(I2C_ADDR, rx.data(), len));
+    }
+    state.SetItemsProcessed(state.iterations());
+    reportLatency(state);
+}
+BENCHMARK(BM_I2CRead)
+    ->ArgName("bytes")
+    ->Arg(1)->Arg(16)
+    ->Setup(resetStats)
+    ->UseRealTime();
+
+
+/*
+ * UART1 loopback: write `bytes`, wait until all of them came back through
+ * the rx interrupt handler.
+ */
+static void BM_SerialStream(benchmark::State &state)
+{
+    auto &bench = PortBench::get(0);
+    const size_t len = state.range(0);
+    std::vector<uint8_t> data(len, 'x');
+
+    for (auto _ : state)
+    {
+        uint64_t expected = bench.rxBytes() + len;
+        bench.serial.write(data.data(), len);
+        if (!bench.waitRxBytes(expected))
+        {
+            state.SkipWithError("UART bytes lost, check wiring GP8 + GP9");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * len);
+    reportLatency(state);
+}
+BENCHMARK(BM_SerialStream)
+    ->ArgName("bytes")
+    ->Arg(16)->Arg(56)
+    ->Setup(resetStats)
+    ->UseRealTime();
+
+
+/*
+ * Gpio::write() call on GP10 to the GP11 interrupt handler.
+ */
+static void BM_GpioIrqLatency(benchmark::State &state)
+{
+    auto &bench = PortBench::get(0);
+    int value = bench.in.read() ^ 1;
+
+    for (auto _ : state)
+    {
+        uint64_t expected = bench.edges() + 1;
+        auto start = std::chrono::steady_clock::now();
+        bench.out.write(value);
+        if (!bench.waitEdges(expected))
+        {
+            state.SkipWithError("GPIO interrupt lost, check wiring GP10 + GP11");
+            break;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        state.SetIterationTime(std::chrono::duration<double>(elapsed).count());
+        value ^= 1;
+    }
+    reportLatency(state);
+}
+BENCHMARK(BM_GpioIrqLatency)->Setup(resetStats)->UseManualTime();
+
+
+/*
+ * Several threads sharing one device: requests are pipelined by the
+ * TransferEngine, the rate should grow until the device is saturated.
+ */
+static void BM_MultiThreadGpioRead(benchmark::State &state)
+{
+    auto &bench = PortBench::get(0);
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(bench.in.read());
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0)
+    {
+        reportLatency(state);
+    }
+}
+BENCHMARK(BM_MultiThreadGpioRead)
+    ->ThreadRange(1, 8)
+    ->Setup(resetStats)
+    ->UseRealTime();
+
+
+/*
+ * One thread per device, registered from main() with the --devices count:
+ * the rate should scale linearly with the number of devices.
+ */
+static void BM_MultiDeviceGpioRead(benchmark::State &state)
+{
+    const int port = state.thread_index();
+    auto &bench = PortBench::get(port);
+
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(bench.in.read());
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0)
+    {
+        reportLatency(state, state.threads());
+    }
+}
+
+
+#ifdef IOIG_FW_SIM
+static void attachSimulator()
+{
+    LoopbackTransport::wire(GP8, GP9);
+    LoopbackTransport::wire(GP10, GP11);
+    LoopbackTransport::wire(GP12, GP13);
+    LoopbackTransport::wire(GP19, GP16);
+
+    if (UsbManager::attachTransport(std::unique_ptr<Transport>(new LoopbackTransport()), 0) != 0)
+    {
+        std::cerr << "Can't attach the simulator" << std::endl;
+        std::exit(-1);
+    }
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    bool sim = false;
+    bool hasFormat = false;
+    std::vector<char *> args;
+
+    for (int i = 0; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        if (arg == "--sim")
+        {
+            sim = true;
+        }
+        else if (arg.find("--devices=") == 0)
+        {
+            deviceCount = std::stoi(arg.substr(10));
+        }
+        else
+        {
+            hasFormat |= arg.find("--benchmark_format=") == 0;
+            args.push_back(argv[i]);
+        }
+    }
+
+    static char jsonFormat[] = "--benchmark_format=json";
+    if (!hasFormat)
+    {
+        args.push_back(jsonFormat);
+    }
+
+    if (sim)
+    {
+#ifdef IOIG_FW_SIM
+        attachSimulator();
+        deviceCount = 1; //single simulated device per process
+#else
+        std::cerr << "--sim: built without the firmware simulator" << std::endl;
+        return -1;
+#endif
+    }
+
+    if (deviceCount < 1 || deviceCount > MAX_USB_DEVICES)
+    {
+        std::cerr << "--devices: 1 to " << MAX_USB_DEVICES << std::endl;
+        return -1;
+    }
+
+    benchmark::RegisterBenchmark("BM_MultiDeviceGpioRead", BM_MultiDeviceGpioRead)
+        ->DenseThreadRange(1, deviceCount)
+        ->Setup(resetStats)
+        ->UseRealTime();
+
+    benchmark::AddCustomContext("ioig_device", sim ? "sim" : "usb");
+    benchmark::AddCustomContext("ioig_devices", std::to_string(deviceCount));
+
+    int benchArgc = args.size();
+    benchmark::Initialize(&benchArgc, args.data());
+    if (benchmark::ReportUnrecognizedArguments(benchArgc, args.data()))
+    {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <benchmark/benchmark.h>
+
+#include "ioig_protocol.h"
+
+using namespace ioig;
+
+/*
+ * Packet construction/encode/decode cost, as paid by every peripheral call
+ * (one tx and one rx Packet per call).
+ */
+
+static void BM_PacketCallPattern(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        Packet txPkt(8);
+        Packet rxPkt;
+
+        txPkt.setType(Packet::Type::GPIO_SET_VALUE);
+        txPkt.addPayloadItem8(25);
+        txPkt.addPayloadItem32(0x12345678);
+
+        //device echo
+        memcpy(rxPkt.getBuffer(), txPkt.getBuffer(), txPkt.getBufferLength());
+
+        //packets escape to UsbManager::transfer() in real calls
+        benchmark::DoNotOptimize(txPkt);
+        benchmark::DoNotOptimize(rxPkt.getPayloadItem8(0));
+        benchmark::DoNotOptimize(rxPkt.getPayloadItem32(1));
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_PacketCallPattern);
+
+static void BM_PacketEncodeDecode(benchmark::State &state)
+{
+    Packet pkt;
+
+    for (auto _ : state)
+    {
+        pkt.reset();
+        pkt.setType(Packet::Type::SPI_TRANSFER);
+        pkt.addPayloadItem16(0xBEEF);
+        pkt.addPayloadItem32(0x12345678);
+        pkt.addPayloadItem64(0x0123456789ABCDEF);
+        benchmark::DoNotOptimize(pkt);
+
+        benchmark::DoNotOptimize(pkt.getPayloadItem16(0));
+        benchmark::DoNotOptimize(pkt.getPayloadItem32(2));
+        benchmark::DoNotOptimize(pkt.getPayloadItem64(6));
+        benchmark::ClobberMemory();
+    }
+}
+BENCHMARK(BM_PacketEncodeDecode);
+
+static void BM_PacketCopy(benchmark::State &state)
+{
+    Packet pkt;
+    pkt.setType(Packet::Type::SPI_TRANSFER);
+    pkt.addRepeatedPayloadItems(0xA5, 32);
+
+    for (auto _ : state)
+    {
+        Packet copy(pkt);
+        benchmark::DoNotOptimize(copy);
+    }
+}
+BENCHMARK(BM_PacketCopy);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,65 @@
+#include <memory>
+#include <mutex>
+#include <chrono>
+
+#include <benchmark/benchmark.h>
+
+#include "ioig.h"
+#include "ioig_usb.h"
+#include "fake_device.h"
+
+using namespace ioig;
+using namespace std::chrono_literals;
+
+/*
+ * UsbManager::transfer throughput from several threads.
+ * Each thread uses port (thread index % ports): with one fake device per
+ * thread the rate should scale linearly, with a single device it is
+ * bounded by that device, one request per PROCESSING (2k/s).
+ *
+ * The service time is half the round trip, so that a lone thread doesn't
+ * keep its device busy and two threads already saturate a single one.
+ */
+
+static constexpr auto LATENCY    = 1000us;
+static constexpr auto PROCESSING = 500us;
+
+static void setup(const benchmark::State &)
+{
+    static std::once_flag once;
+    std::call_once(once, []()
+    {
+        for (int port = 0; port < MAX_USB_DEVICES; port++)
+        {
+            std::unique_ptr<Transport> link(new FakeLink(LATENCY, PROCESSING));
+            UsbManager::attachTransport(std::move(link), port);
+        }
+    });
+}
+
+static void BM_UsbManagerTransfer(benchmark::State &state)
+{
+    const int ports = state.range(0);
+    const int port = state.thread_index() % ports;
+
+    Packet txPkt(8);
+    Packet rxPkt;
+
+    txPkt.setType(Packet::Type::GPIO_GET_VALUE);
+    txPkt.addPayloadItem8(25);
+
+    for (auto _ : state)
+    {
+        UsbManager::transfer(txPkt, rxPkt, port);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_UsbManagerTransfer)
+    ->ArgName("ports")
+    ->Arg(1)->Arg(MAX_USB_DEVICES)
+    ->ThreadRange(1, MAX_USB_DEVICES)
+    ->Setup(setup)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
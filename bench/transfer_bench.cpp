@@ -0,0 +1,66 @@
+#include <memory>
+#include <chrono>
+
+#include <benchmark/benchmark.h>
+
+#include "ioig_engine.h"
+#include "fake_device.h"
+
+using namespace ioig;
+using namespace std::chrono_literals;
+
+/*
+ * Request/response throughput of the TransferEngine against a fake device
+ * with a full speed like round trip (~1 ms) and a short firmware processing time.
+ * Window 1 is the behavior of the former synchronous transfer.
+ */
+
+static constexpr auto LATENCY    = 1000us;
+static constexpr auto PROCESSING = 50us;
+
+static std::unique_ptr<FakeLink> fakeLink;
+static std::unique_ptr<TransferEngine> engine;
+
+static void setup(const benchmark::State &state)
+{
+    fakeLink.reset(new FakeLink(LATENCY, PROCESSING));
+    engine.reset(new TransferEngine(*fakeLink, state.range(0)));
+    engine->start();
+}
+
+static void teardown(const benchmark::State &)
+{
+    engine->stop();
+    engine.reset();
+    fakeLink.reset();
+}
+
+static void BM_Transfer(benchmark::State &state)
+{
+    Packet txPkt(8);
+    Packet rxPkt;
+
+    txPkt.setType(Packet::Type::GPIO_SET_VALUE);
+    txPkt.addPayloadItem8(25);
+    txPkt.addPayloadItem8(1);
+
+    for (auto _ : state)
+    {
+        if (engine->transfer(txPkt, rxPkt, 1000) != 0)
+        {
+            state.SkipWithError("transfer failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_Transfer)
+    ->ArgName("window")
+    ->Arg(1)->Arg(2)->Arg(4)
+    ->Threads(1)->Threads(4)
+    ->Setup(setup)
+    ->Teardown(teardown)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -13,6 +13,8 @@ enum CDCItf
 };
 
 
+// Built with IOIG_USB_VENDOR, the data and event channels are vendor class
+// interfaces: same bulk endpoints, without the CDC notification endpoints.
 #define CDC_DATA_EP_NOTIF    0x81
 #define CDC_DATA_EP_OUT      0x02
 #define CDC_DATA_EP_IN       0x82
@@ -21,12 +23,16 @@ enum CDCItf
 #define CDC_EVENT_EP_OUT     0x04
 #define CDC_EVENT_EP_IN      0x84
 
+#define IOIG_CDC_ITF_COUNT     4  // data notif, data, event notif, event
+#define IOIG_VENDOR_ITF_COUNT  2  // data, event
+
 
 
 #define IOIG_MANUFACTURER_STR "INGECOM"
 #define IOIG_PRODUCT_STR      "IoIg Multi Protocol Dongle"
 #define IOIG_VID              0xcafe
 #define IOIG_PID              0x4002
+#define IOIG_VENDOR_PID       0x4012 // IOIG_USB_VENDOR firmware
 
 
 
@@ -1,8 +1,11 @@
+#include <algorithm>
+
 #include "tasks/analog.h"
 #include "tasks/gpio.h"
 #include "tasks/i2c.h"
 #include "tasks/serial.h"
 #include "tasks/spi.h"
+#include "tasks/xfer.h"
 
 #include "tusb.h"
 
@@ -12,6 +15,21 @@
 #define ENABLE_MULTICORE 1
 #define ENABLE_WD 1
 
+//Data and event channel FIFOs, CDC-ACM or vendor class (IOIG_USB_VENDOR)
+#if IOIG_USB_VENDOR
+#define itf_read(itf, buf, len)      tud_vendor_n_read(itf, buf, len)
+#define itf_read_flush(itf)          tud_vendor_n_read_flush(itf)
+#define itf_write(itf, buf, len)     tud_vendor_n_write(itf, buf, len)
+#define itf_write_available(itf)     tud_vendor_n_write_available(itf)
+#define itf_write_flush(itf)         tud_vendor_n_write_flush(itf)
+#else
+#define itf_read(itf, buf, len)      tud_cdc_n_read(itf, buf, len)
+#define itf_read_flush(itf)          tud_cdc_n_read_flush(itf)
+#define itf_write(itf, buf, len)     tud_cdc_n_write(itf, buf, len)
+#define itf_write_available(itf)     tud_cdc_n_write_available(itf)
+#define itf_write_flush(itf)         tud_cdc_n_write_flush(itf)
+#endif
+
 MainTask & mainTask = MainTask::instance();
 Board & board = Board::instance();
 
@@ -46,8 +64,20 @@ Task::State Task::getState()
 
 
 void MainTask::init()
+{
+  initTasks();
+
+#if ENABLE_MULTICORE
+  multicore_reset_core1();
+  multicore_launch_core1(mainTask.mainLoop1);
+#endif  
+  mainLoop0();
+}
+
+void MainTask::initTasks()
 {
   _rxPktIdx = 0;
+  _rxPartialLen = 0;
 
   queue_init(&_rxPktIndexQueue, sizeof(uint32_t), RX_PKT_QUEUE_MAX_SIZE);
   
@@ -56,27 +86,24 @@ void MainTask::init()
   i2cTask.init();
   spiTask.init();
   serialTask.init();
-
-#if ENABLE_MULTICORE
-  multicore_reset_core1();
-  multicore_launch_core1(mainTask.mainLoop1);
-#endif  
-  mainLoop0();
+  xferTask.init();
 }
 
 void MainTask::reset()
 {
   auto prevState = Task::getState();
 
+  //No need to wait for in-flight irq handlers: reset() runs on core1 from
+  //poll(), like the gpio/uart irqs, so none of them is half way through.
+  //Commands received on core0 meanwhile are dropped, the host sends
+  //nothing until the SYS_INIT response.
   setState(Task::State::STOPPED);
 
-  sleep_ms(2); //wait stable state on getStateUnsafe()
+  itf_read_flush(CDCItf::DATA);
+  itf_write_flush(CDCItf::DATA);
 
-  tud_cdc_n_read_flush(CDCItf::DATA);
-  tud_cdc_n_write_flush(CDCItf::DATA);
-
-  tud_cdc_n_read_flush(CDCItf::EVENT);
-  tud_cdc_n_write_flush(CDCItf::EVENT);
+  itf_read_flush(CDCItf::EVENT);
+  itf_write_flush(CDCItf::EVENT);
 
   while (queue_get_level(&_rxPktIndexQueue) > 0) 
   {
@@ -84,12 +111,15 @@ void MainTask::reset()
     queue_remove_blocking(&_rxPktIndexQueue, &tmp);
   }
   _rxPktIdx = 0;
+  _rxPartialLen = 0;
+  _protocol = Packet::PROTOCOL_V1;
 
   analogTask.reset();
   gpioTask.reset();
   i2cTask.reset();
   serialTask.reset();
   spiTask.reset();
+  xferTask.reset();
 
   setState(prevState);
 }
@@ -102,10 +132,58 @@ void MainTask::process(Packet &rxPkt, Packet &txPkt)
   txPkt.cloneHeader(rxPkt);
   txPkt.setStatus(Packet::Status::RSP);
 
+  if (rxPkt.getType() == Packet::Type::BATCH)
+  {
+    processBatch(rxPkt, txPkt);
+  }
+  else
+  {
+    dispatch(rxPkt, txPkt);
+  }
+
+  txPkt.flush();
+  
+  if (txPkt.getType() != Packet::Type::GPIO_EVENT && txPkt.getType() != Packet::Type::SERIAL_EVENT) 
+  {
+    //Responses to queued commands are written back to back, and sent
+    //together once no command is waiting anymore
+    bool flush = queue_get_level(&_rxPktIndexQueue) == 0;
+
+    if (rxPkt.getFlags() & Packet::FLAG_NO_RESPONSE)
+    {
+      if (flush)
+      {
+        itf_write_flush(CDCItf::DATA);
+      }
+    }
+    else
+    {
+      //same framing as the request
+      uint8_t frame[Packet::MAX_FRAME_SIZE];
+      unsigned frameLen = txPkt.writeFrame(frame);
+      mainTask.cdcWrite(CDCItf::DATA, frame, frameLen, flush);
+    }
+  }
+
+}
+
+void MainTask::dispatch(Packet &rxPkt, Packet &txPkt)
+{
   auto op = rxPkt.getType();
   switch (op)
   {
     case Packet::Type::SYS_INIT:
+      //Handshake: the response is only sent once the reset is done,
+      //the host recognizes it by its ready token. The header version
+      //follows, hosts predating it only read the token. The host sends
+      //its own version after the token, none before v2
+      reset();
+      if (rxPkt.getPayloadLength() > 4)
+      {
+        _protocol = std::min<uint8_t>(rxPkt.getPayloadItem8(4), Packet::PROTOCOL_VERSION);
+      }
+      txPkt.addPayloadItem32(rxPkt.getPayloadItem32(0));
+      txPkt.addPayloadItem8(Packet::PROTOCOL_VERSION);
       break;
     case Packet::Type::SYS_DEINIT:
       break;
@@ -128,14 +206,57 @@ void MainTask::process(Packet &rxPkt, Packet &txPkt)
   analogTask.process(rxPkt, txPkt);
   i2cTask.process(rxPkt, txPkt);
   serialTask.process(rxPkt, txPkt);
+  xferTask.process(rxPkt, txPkt);
+}
 
-  txPkt.flush();
-  
-  if (txPkt.getType() != Packet::Type::GPIO_EVENT && txPkt.getType() != Packet::Type::SERIAL_EVENT) 
+void MainTask::processBatch(Packet &rxPkt, Packet &txPkt)
+{
+  const uint8_t * pld = rxPkt.getPayloadBuffer();
+  const unsigned pldLen = rxPkt.getPayloadLength();
+  unsigned offset = 0;
+
+  while (offset + PacketBatch::ENTRY_HEADER_SIZE <= pldLen)
   {
-    mainTask.cdcWrite(CDCItf::DATA, txPkt.getBuffer(), txPkt.getBufferLength());  
-  }
+    const unsigned len = pld[offset];
+    const auto type = static_cast<Packet::Type>(pld[offset + 1]);
+    offset += PacketBatch::ENTRY_HEADER_SIZE;
+
+    if (offset + len > pldLen)
+    {
+      DBG_MSG("Error: malformed batch entry!\n");
+      txPkt.setStatus(Packet::Status::ERR);
+      return;
+    }
+
+    _batchRxPkt.reset();
+    _batchRxPkt.setType(type);
+    _batchRxPkt.setSeqNum(rxPkt.getSeqNum());
+    _batchRxPkt.setStatus(Packet::Status::CMD);
+    _batchRxPkt.addPayloadBuffer(pld + offset, len);
+    _batchRxPkt.flush();
+    offset += len;
+
+    _batchTxPkt.reset();
+    _batchTxPkt.cloneHeader(_batchRxPkt);
+    _batchTxPkt.setStatus(Packet::Status::RSP);
 
+    if (PacketBatch::isBatchable(type))
+    {
+      dispatch(_batchRxPkt, _batchTxPkt);
+    }
+    else
+    {
+      _batchTxPkt.setStatus(Packet::Status::ERR);
+    }
+
+    if (PacketBatch::appendEntry(txPkt, static_cast<uint8_t>(_batchTxPkt.getStatus()),
+                                 _batchTxPkt.getPayloadBuffer(), _batchTxPkt.getPayloadLength()) < 0)
+    {
+      //no room left for this result, the host sees the remaining entries as not executed
+      txPkt.setStatus(Packet::Status::ERR);
+      return;
+    }
+  }
 }
 
 
@@ -160,37 +281,39 @@ void MainTask::mainLoop0()
 
 void MainTask::mainLoop1()
 {
-  auto &rxPktIndexQueue  = mainTask._rxPktIndexQueue; 
-  auto &rxPacketVec = mainTask._rxPacketVec;
-  uint32_t rxPktIdx=0; 
   Packet eventReqPkt(2);
   Packet txPkt;  
 
   while (1)
   {        
-    //----------------------------------------
-    //poll events
-    //----------------------------------------
-    eventReqPkt.setType(Packet::Type::GPIO_EVENT);
-    mainTask.process(eventReqPkt, txPkt);
-  
-    eventReqPkt.setType(Packet::Type::SERIAL_EVENT);
-    mainTask.process(eventReqPkt, txPkt);
-    
+    mainTask.poll(eventReqPkt, txPkt);
+  }
+}
 
-    //----------------------------------------
-    //process incoming commands
-    //----------------------------------------
-    rxPktIdx=0;
-    if (!queue_try_remove(&rxPktIndexQueue, &rxPktIdx)) 
-    {
-      continue; //nothing to do
-    }
+bool MainTask::poll(Packet &eventReqPkt, Packet &txPkt)
+{
+  //----------------------------------------
+  //poll events
+  //----------------------------------------
+  eventReqPkt.setType(Packet::Type::GPIO_EVENT);
+  process(eventReqPkt, txPkt);
+
+  eventReqPkt.setType(Packet::Type::SERIAL_EVENT);
+  process(eventReqPkt, txPkt);
+    
 
-    Packet & rxPkt = rxPacketVec[rxPktIdx]; //get the next available rx packet index
-    mainTask.process(rxPkt, txPkt);
- 
+  //----------------------------------------
+  //process incoming commands
+  //----------------------------------------
+  uint32_t rxPktIdx=0; 
+  if (!queue_try_remove(&_rxPktIndexQueue, &rxPktIdx)) 
+  {
+    return false; //nothing to do
   }
+
+  Packet & rxPkt = _rxPacketVec[rxPktIdx]; //get the next available rx packet index
+  process(rxPkt, txPkt);
+  return true;
 }
 
 inline void MainTask::onRx(const CDCItf itf)
@@ -201,19 +324,45 @@ inline void MainTask::onRx(const CDCItf itf)
     return;
   }
 
-  uint32_t idx = _rxPktIdx++ % RX_PKT_QUEUE_MAX_SIZE; //circular buff
+  //The FIFO is a byte stream: a bulk transfer can carry several commands,
+  //or only part of one. Commands are assembled in _rxFrame, then loaded
+  //in the next rx packet slot.
+  while (true)
+  {
+    unsigned pktLen = Packet::getFrameLength(_rxFrame, _rxPartialLen);
+
+    if (pktLen > Packet::MAX_FRAME_SIZE)
+    {
+      DBG_MSG("Error: rx packet length %d > max, flushing rx fifo...\n", pktLen);
+      _rxPartialLen = 0;
+      itf_read_flush(itf);
+      return;
+    }
 
-  Packet & rxPkt = _rxPacketVec[idx];
+    if (_rxPartialLen < pktLen)
+    {
+      uint32_t n = itf_read(itf, _rxFrame + _rxPartialLen, pktLen - _rxPartialLen);
+      if (n == 0)
+      {
+        return; //the rest comes with the next transfer
+      }
+      _rxPartialLen += n;
+      continue;
+    }
 
-  mainTask.cdcRead(itf, rxPkt.getBuffer() , Packet::MAX_SIZE);
+    //command complete
+    _rxPartialLen = 0;
+    uint32_t idx = _rxPktIdx++ % RX_PKT_QUEUE_MAX_SIZE; //circular buff
+    _rxPacketVec[idx].setFrame(_rxFrame, pktLen);
 
-  if (!queue_try_add(&_rxPktIndexQueue, &idx))
-  {
-    DBG_MSG("Error: rx queue is full! discarding an item...\n");
-    int lostIdx;
-    queue_remove_blocking(&_rxPktIndexQueue, &lostIdx);
-    queue_add_blocking(&_rxPktIndexQueue, &idx);
-  }    
+    if (!queue_try_add(&_rxPktIndexQueue, &idx))
+    {
+      DBG_MSG("Error: rx queue is full! discarding an item...\n");
+      int lostIdx;
+      queue_remove_blocking(&_rxPktIndexQueue, &lostIdx);
+      queue_add_blocking(&_rxPktIndexQueue, &idx);
+    }    
+  }
 
 }
 
@@ -222,24 +371,7 @@ inline void MainTask::onTx(const CDCItf itf)
 
 }
 
-inline
-void MainTask::cdcRead(const CDCItf itf, uint8_t *buf, const unsigned len)
-{ 
-
-  // Check if there is any data available in the CDC buffer.
-  if (tud_cdc_n_available(itf) == 0)
-  {
-    tud_cdc_n_read_flush(itf);
-  }
-
-  tud_cdc_n_read(itf, buf, len);
-
-  // Clear the received FIFO
-  tud_cdc_n_read_flush(itf);
-  
-}
-
-void MainTask::cdcWrite(const CDCItf itf, uint8_t *buf, const unsigned len)
+void MainTask::cdcWrite(const CDCItf itf, uint8_t *buf, const unsigned len, const bool flush)
 {
   //https://github.com/espressif/arduino-esp32/blob/master/cores/esp32/USBCDC.cpp
 
@@ -247,10 +379,10 @@ void MainTask::cdcWrite(const CDCItf itf, uint8_t *buf, const unsigned len)
   size_t to_send = len, so_far = 0;
   while (to_send && retry-- > 0)
   {
-    size_t space = tud_cdc_n_write_available(itf);
+    size_t space = itf_write_available(itf);
     if (!space)
     {
-      tud_cdc_n_write_flush(itf);
+      itf_write_flush(itf);
       DBG_MSG("Waiting space on wr fifo itf=%d, retry flush... (%d/10)\n", itf, 10-retry);
       busy_wait_us_32(200);
       continue;
@@ -259,12 +391,15 @@ void MainTask::cdcWrite(const CDCItf itf, uint8_t *buf, const unsigned len)
     {
       space = to_send;
     }
-    size_t sent = tud_cdc_n_write(itf, buf + so_far, space);
+    size_t sent = itf_write(itf, buf + so_far, space);
     if (sent)
     {
       so_far += sent;
       to_send -= sent;
-      tud_cdc_n_write_flush(itf);
+      if (flush)
+      {
+        itf_write_flush(itf);
+      }
     }
     else
     {
@@ -332,14 +467,19 @@ void Board::ledBlink()
 
 void Board::reset()
 {
+#ifdef IOIG_FW_SIM
+  mainTask.reset(); // no watchdog on the simulator, reset the tasks only
+#else
   watchdog_enable(1, 1); // Enable the watchdog timer 
   while (1) 
   { 
     // Do nothing.
     // force watchdog to reset the system
   }  
+#endif
 }
 
+#ifndef IOIG_FW_SIM
 uint32_t Board::getTotalHeap()
 {
    extern char __StackLimit, __bss_end__;
@@ -352,6 +492,10 @@ uint32_t Board::getFreeHeap()
   struct mallinfo m = mallinfo();
   return getTotalHeap() - m.uordblks;
 }
+#else
+uint32_t Board::getTotalHeap() { return 0; }
+uint32_t Board::getFreeHeap() { return 0; }
+#endif
 
 void Board::onDeviceMounted()
 {
@@ -378,6 +522,7 @@ void Board::onReseume()
 //--------------------------------------------------------------------+
 // Main
 //--------------------------------------------------------------------+
+#ifndef IOIG_FW_SIM
 int main(void)
 {
   
@@ -386,6 +531,7 @@ int main(void)
 
   return 0;
 }
+#endif
 
 //--------------------------------------------------------------------+
 // TinyUSB Device callbacks
@@ -419,6 +565,23 @@ void tud_resume_cb(void)
 }
 
 
+#if IOIG_USB_VENDOR
+
+// Invoked when vendor interface received data from host
+void tud_vendor_rx_cb(uint8_t itf)
+{
+  mainTask.onRx((CDCItf)itf);
+}
+
+// Invoked when the data written on the vendor interface (itf) has been sent
+void tud_vendor_tx_cb(uint8_t itf, uint32_t sent_bytes)
+{
+  (void)sent_bytes;
+  mainTask.onTx((CDCItf)itf);
+}
+
+#else
+
 // Invoked when cdc when line state changed e.g connected/disconnected
 void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts)
 {
@@ -441,3 +604,5 @@ void tud_cdc_tx_complete_cb(uint8_t itf)
   mainTask.onTx((CDCItf)itf);
 }
 
+#endif
+
@@ -86,17 +86,39 @@ class MainTask : public Task
 public:
     void init() override;   
 
+    /**
+     * @brief Initializes the sub-tasks, without starting the main loops.
+     */
+    void initTasks();
+
     void reset() override;
 
+    /**
+     * @brief One iteration of the core1 loop: polls events, then processes one queued command.
+     * @return true if a command was processed
+     */
+    bool poll(Packet &eventReqPkt, Packet &txPkt);
+
     void onRx(const CDCItf itf);
 
     void onTx(const CDCItf itf);
 
     void process(Packet &rxPkt,Packet &txPkt) override;
 
-    void cdcRead(const CDCItf itf, uint8_t *buf,  const unsigned len);
+    void dispatch(Packet &rxPkt,Packet &txPkt);
+
+    void processBatch(Packet &rxPkt,Packet &txPkt);
 
-    void cdcWrite(const CDCItf itf, uint8_t *buf, const unsigned len);
+    /**
+     * @param flush false to leave the data in the tx FIFO, sent with the next flushed write
+     */
+    void cdcWrite(const CDCItf itf, uint8_t *buf, const unsigned len, const bool flush = true);
+
+    /**
+     * @return the header version of the session, agreed by SYS_INIT. PROTOCOL_V1 until then,
+     *         and after SYS_SW_RESET: the hosts predating the handshake only know v1.
+     */
+    uint8_t getProtocol() const { return _protocol; }
 
 
     // singleton
@@ -117,10 +139,17 @@ private:
     static void mainLoop1();
     void mainLoop0();    
 
-    static constexpr unsigned RX_PKT_QUEUE_MAX_SIZE = 6;        
+    static constexpr unsigned RX_PKT_QUEUE_MAX_SIZE = 16; /**< Above the host window (TransferEngine::DEFAULT_WINDOW) */
     Packet   _rxPacketVec[RX_PKT_QUEUE_MAX_SIZE];
     queue_t  _rxPktIndexQueue; 
     uint32_t _rxPktIdx;
+    uint8_t  _rxFrame[Packet::MAX_FRAME_SIZE]; /**< Command being assembled, v1 or v2 frame */
+    unsigned _rxPartialLen; /**< Bytes received in _rxFrame */
+
+    uint8_t  _protocol = Packet::PROTOCOL_V1; /**< Session header version, see getProtocol() */
+
+    Packet   _batchRxPkt; /**< BATCH sub-command */
+    Packet   _batchTxPkt; /**< BATCH sub-response */
 
 };
 
@@ -0,0 +1,304 @@
+#pragma once
+
+/*
+ * Subset of the Pico SDK / TinyUSB API used by the firmware, implemented on
+ * the host by fw/sim. The SDK headers in this directory all include this file.
+ */
+
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#include <sys/types.h>
+
+typedef unsigned int uint;
+
+//--------------------------------------------------------------
+// pico/types, pico/error
+//--------------------------------------------------------------
+
+enum pico_error_codes
+{
+    PICO_OK = 0,
+    PICO_ERROR_GENERIC = -1,
+    PICO_ERROR_TIMEOUT = -2,
+};
+
+//--------------------------------------------------------------
+// pico/time, pico/stdlib, pico/stdio
+//--------------------------------------------------------------
+
+uint64_t time_us_64();
+uint32_t time_us_32();
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+void busy_wait_us_32(uint32_t us);
+void tight_loop_contents();
+bool stdio_init_all();
+bool set_sys_clock_khz(uint32_t freq_khz, bool required);
+
+//--------------------------------------------------------------
+// pico/sync
+//--------------------------------------------------------------
+
+struct mutex_t
+{
+    std::mutex lock;
+};
+
+void mutex_init(mutex_t *mtx);
+void mutex_enter_blocking(mutex_t *mtx);
+void mutex_exit(mutex_t *mtx);
+
+//--------------------------------------------------------------
+// pico/util/queue
+//--------------------------------------------------------------
+
+struct queue_t
+{
+    std::mutex lock;
+    std::condition_variable cv;
+    std::vector<uint8_t> data;
+    uint elementSize = 0;
+    uint capacity = 0;
+    uint head = 0;
+    uint count = 0;
+};
+
+void queue_init(queue_t *q, uint element_size, uint element_count);
+void queue_free(queue_t *q);
+uint queue_get_level(queue_t *q);
+bool queue_try_add(queue_t *q, const void *data);
+bool queue_try_remove(queue_t *q, void *data);
+void queue_add_blocking(queue_t *q, const void *data);
+void queue_remove_blocking(queue_t *q, void *data);
+
+//--------------------------------------------------------------
+// pico/multicore
+//--------------------------------------------------------------
+
+void multicore_reset_core1();
+void multicore_launch_core1(void (*entry)(void));
+
+//--------------------------------------------------------------
+// hardware/watchdog, hardware/clocks
+//--------------------------------------------------------------
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+bool watchdog_caused_reboot();
+void watchdog_update();
+
+enum clock_index
+{
+    clk_gpout0 = 0,
+    clk_gpout1,
+    clk_gpout2,
+    clk_gpout3,
+    clk_ref,
+    clk_sys,
+    clk_peri,
+    clk_usb,
+    clk_adc,
+    clk_rtc,
+};
+
+uint32_t clock_get_hz(enum clock_index clk_index);
+
+//--------------------------------------------------------------
+// hardware/irq
+//--------------------------------------------------------------
+
+typedef void (*irq_handler_t)(void);
+
+#define UART0_IRQ 20
+#define UART1_IRQ 21
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+
+//--------------------------------------------------------------
+// hardware/gpio
+//--------------------------------------------------------------
+
+enum gpio_function
+{
+    GPIO_FUNC_XIP = 0,
+    GPIO_FUNC_SPI = 1,
+    GPIO_FUNC_UART = 2,
+    GPIO_FUNC_I2C = 3,
+    GPIO_FUNC_PWM = 4,
+    GPIO_FUNC_SIO = 5,
+    GPIO_FUNC_PIO0 = 6,
+    GPIO_FUNC_PIO1 = 7,
+    GPIO_FUNC_GPCK = 8,
+    GPIO_FUNC_USB = 9,
+    GPIO_FUNC_NULL = 0x1f,
+};
+
+enum gpio_irq_level
+{
+    GPIO_IRQ_LEVEL_LOW = 0x1u,
+    GPIO_IRQ_LEVEL_HIGH = 0x2u,
+    GPIO_IRQ_EDGE_FALL = 0x4u,
+    GPIO_IRQ_EDGE_RISE = 0x8u,
+};
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+
+void gpio_init(uint gpio);
+void gpio_deinit(uint gpio);
+void gpio_set_function(uint gpio, enum gpio_function fn);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_pull_up(uint gpio);
+void gpio_pull_down(uint gpio);
+void gpio_disable_pulls(uint gpio);
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled, gpio_irq_callback_t callback);
+
+//--------------------------------------------------------------
+// hardware/uart
+//--------------------------------------------------------------
+
+struct uart_inst
+{
+    uint index;
+    uint baudrate;
+};
+typedef struct uart_inst uart_inst_t;
+
+extern uart_inst_t sim_uart_inst[2];
+#define uart0 (&sim_uart_inst[0])
+#define uart1 (&sim_uart_inst[1])
+
+typedef enum
+{
+    UART_PARITY_NONE,
+    UART_PARITY_EVEN,
+    UART_PARITY_ODD
+} uart_parity_t;
+
+uint uart_init(uart_inst_t *uart, uint baudrate);
+bool uart_is_enabled(uart_inst_t *uart);
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled);
+void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity);
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data);
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts);
+void uart_set_break(uart_inst_t *uart, bool en);
+bool uart_is_readable(uart_inst_t *uart);
+bool uart_is_writable(uart_inst_t *uart);
+char uart_getc(uart_inst_t *uart);
+void uart_putc_raw(uart_inst_t *uart, char c);
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len);
+void uart_read_blocking(uart_inst_t *uart, uint8_t *dst, size_t len);
+
+//--------------------------------------------------------------
+// hardware/spi
+//--------------------------------------------------------------
+
+struct spi_inst
+{
+    uint index;
+    uint baudrate;
+};
+typedef struct spi_inst spi_inst_t;
+
+extern spi_inst_t sim_spi_inst[2];
+#define spi0 (&sim_spi_inst[0])
+#define spi1 (&sim_spi_inst[1])
+
+typedef enum { SPI_CPOL_0 = 0, SPI_CPOL_1 = 1 } spi_cpol_t;
+typedef enum { SPI_CPHA_0 = 0, SPI_CPHA_1 = 1 } spi_cpha_t;
+typedef enum { SPI_LSB_FIRST = 0, SPI_MSB_FIRST = 1 } spi_order_t;
+
+uint spi_init(spi_inst_t *spi, uint baudrate);
+void spi_deinit(spi_inst_t *spi);
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate);
+void spi_set_format(spi_inst_t *spi, uint data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order);
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len);
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len);
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len);
+
+//--------------------------------------------------------------
+// hardware/i2c
+//--------------------------------------------------------------
+
+struct i2c_inst
+{
+    uint index;
+    uint baudrate;
+};
+typedef struct i2c_inst i2c_inst_t;
+
+extern i2c_inst_t sim_i2c_inst[2];
+#define i2c0 (&sim_i2c_inst[0])
+#define i2c1 (&sim_i2c_inst[1])
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate);
+void i2c_deinit(i2c_inst_t *i2c);
+uint i2c_set_baudrate(i2c_inst_t *i2c, uint baudrate);
+int i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint timeout_us);
+int i2c_read_timeout_us(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint timeout_us);
+
+//--------------------------------------------------------------
+// hardware/adc
+//--------------------------------------------------------------
+
+void adc_init();
+void adc_gpio_init(uint gpio);
+void adc_set_temp_sensor_enabled(bool enable);
+void adc_select_input(uint input);
+uint16_t adc_read();
+
+//--------------------------------------------------------------
+// hardware/pwm
+//--------------------------------------------------------------
+
+typedef struct
+{
+    uint32_t csr;
+    uint32_t div;
+    uint32_t top;
+} pwm_config;
+
+uint pwm_gpio_to_slice_num(uint gpio);
+uint pwm_gpio_to_channel(uint gpio);
+pwm_config pwm_get_default_config();
+void pwm_config_set_wrap(pwm_config *c, uint16_t wrap);
+void pwm_config_set_clkdiv(pwm_config *c, float div);
+void pwm_init(uint slice_num, pwm_config *c, bool start);
+void pwm_set_enabled(uint slice_num, bool enabled);
+void pwm_set_gpio_level(uint gpio, uint16_t level);
+
+//--------------------------------------------------------------
+// bsp/board_api
+//--------------------------------------------------------------
+
+void board_init();
+uint32_t board_millis();
+void board_led_write(bool state);
+
+//--------------------------------------------------------------
+// tusb (CDC device)
+//--------------------------------------------------------------
+
+#define BOARD_TUD_RHPORT 0
+
+bool tud_init(uint8_t rhport);
+void tud_task();
+uint32_t tud_cdc_n_available(uint8_t itf);
+uint32_t tud_cdc_n_read(uint8_t itf, void *buffer, uint32_t bufsize);
+void tud_cdc_n_read_flush(uint8_t itf);
+uint32_t tud_cdc_n_write_available(uint8_t itf);
+uint32_t tud_cdc_n_write(uint8_t itf, const void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_n_write_flush(uint8_t itf);
+
+// device callbacks, implemented by the firmware
+void tud_cdc_rx_cb(uint8_t itf);
+void tud_cdc_tx_complete_cb(uint8_t itf);
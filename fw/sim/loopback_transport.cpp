@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "ioig_private.h"
+#include "loopback_transport.h"
+#include "sim_board.h"
+#include "sim_device.h"
+
+using namespace ioig;
+
+constexpr unsigned LoopbackTransport::EVENT_QUEUE_MAX_SIZE;
+constexpr unsigned LoopbackTransport::READY_TIMEOUT_MS;
+constexpr uint32_t LoopbackTransport::READY_TOKEN;
+
+//==========================================================
+// LoopbackTransport
+//==========================================================
+
+LoopbackTransport::LoopbackTransport(uint8_t max_protocol)
+    : _open(false),
+      _engine(nullptr),
+      _maxProtocol(max_protocol),
+      _protocol(Packet::PROTOCOL_V1),
+      _readyType(Packet::Type::NONE),
+      _ready(false)
+{
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+    close();
+}
+
+int LoopbackTransport::open()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_open)
+        {
+            return 0;
+        }
+        _open = true;
+    }
+
+    SimDevice::instance().start(
+        [this](const uint8_t *buf, size_t len) { onData(buf, len); },
+        [this](const uint8_t *buf, size_t len) { onEvent(buf, len); });
+
+    if (waitReady() != 0)
+    {
+        LOG_ERR(TAG, "No ready token from the simulated device");
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+int LoopbackTransport::waitReady()
+{
+    Packet txPkt(16);
+    makeReadyRequest(txPkt, READY_TOKEN, _maxProtocol);
+
+    if (request(txPkt) != 0)
+    {
+        return -1;
+    }
+
+    int version = checkReadyResponse(_readyPkt, READY_TOKEN);
+    if (version == LEGACY_FIRMWARE)
+    {
+        LOG_WARN(TAG, "Simulated firmware predates the ready handshake, using v1");
+
+        Packet resetPkt(16);
+        resetPkt.setType(Packet::Type::SYS_SW_RESET);
+        resetPkt.setStatus(Packet::Status::CMD);
+        request(resetPkt);
+        std::this_thread::sleep_for(std::chrono::milliseconds(LEGACY_RESET_DELAY_MS)); //wait fw reset
+
+        _protocol = Packet::PROTOCOL_V1;
+        return 0;
+    }
+
+    _protocol = std::min<int>(version, _maxProtocol);
+    return 0;
+}
+
+int LoopbackTransport::request(Packet &txPkt)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _ready = false;
+    _readyType = txPkt.getType();
+
+    lock.unlock();
+    SimDevice::instance().write(txPkt.getBuffer(), txPkt.getBufferLength());
+    lock.lock();
+
+    if (!_readyCv.wait_for(lock, std::chrono::milliseconds(READY_TIMEOUT_MS), [this] { return _ready; }))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+void LoopbackTransport::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_open)
+        {
+            return;
+        }
+        _open = false;
+        _engine = nullptr;
+    }
+
+    SimDevice::instance().stop();
+    _eventCv.notify_all();
+}
+
+int LoopbackTransport::start(TransferEngine &engine)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _engine = &engine;
+    return 0;
+}
+
+void LoopbackTransport::stop()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _engine = nullptr;
+}
+
+int LoopbackTransport::write(const uint8_t *buf, size_t len, unsigned timeout_ms)
+{
+    (void)timeout_ms;
+
+    if (len > TransferEngine::MAX_WRITE_SIZE)
+    {
+        LOG_ERR(TAG, "Tx length(%d) > max(%d)", (int)len, TransferEngine::MAX_WRITE_SIZE);
+        return -1;
+    }
+
+    if (!_open.load())
+    {
+        return -1;
+    }
+
+    SimDevice::instance().write(buf, len);
+    return 0;
+}
+
+void LoopbackTransport::onData(const uint8_t *buf, size_t len)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_engine != nullptr)
+    {
+        _engine->onReceive(buf, len);
+        return;
+    }
+
+    //handshake responses, the only data before the engine starts
+    if (!_ready && _readyPkt.setFrame(buf, len) == 0 && _readyPkt.getType() == _readyType &&
+        (_readyType != Packet::Type::SYS_INIT || checkReadyResponse(_readyPkt, READY_TOKEN) >= 0))
+    {
+        _ready = true;
+        _readyCv.notify_all();
+    }
+}
+
+void LoopbackTransport::onEvent(const uint8_t *buf, size_t len)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _eventStream.insert(_eventStream.end(), buf, buf + len);
+
+    size_t offset = 0;
+    while (_eventStream.size() - offset >= Packet::Header::SIZE)
+    {
+        size_t pktLen = Packet::Header::SIZE + _eventStream[offset + Packet::Header::PLD_LEN];
+        if (_eventStream.size() - offset < pktLen)
+        {
+            break; //wait for the rest
+        }
+
+        if (_events.size() >= EVENT_QUEUE_MAX_SIZE)
+        {
+            LOG_WARN(TAG, "Event queue full, dropping the oldest event");
+            _events.pop_front();
+        }
+
+        _events.emplace_back(_eventStream.begin() + offset, _eventStream.begin() + offset + pktLen);
+        offset += pktLen;
+    }
+
+    _eventStream.erase(_eventStream.begin(), _eventStream.begin() + offset);
+    _eventCv.notify_one();
+}
+
+int LoopbackTransport::readEvent(Packet &evtPkt, unsigned timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto ready = [this] { return !_events.empty() || !_open; };
+    if (timeout_ms == 0)
+    {
+        _eventCv.wait(lock, ready);
+    }
+    else
+    {
+        _eventCv.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+    }
+
+    if (_events.empty())
+    {
+        return -1;
+    }
+
+    const auto &data = _events.front();
+    size_t n = std::min(data.size(), evtPkt.getBufferSize());
+    evtPkt.reset();
+    memcpy(evtPkt.getBuffer(), data.data(), n);
+    evtPkt.flush();
+    _events.pop_front();
+
+    return 0;
+}
+
+void LoopbackTransport::wire(unsigned pin_a, unsigned pin_b)
+{
+    SimBoard::instance().wire(pin_a, pin_b);
+}
+
+void LoopbackTransport::setBaselineHandshake(bool enable)
+{
+    SimDevice::instance().setBaselineHandshake(enable);
+}
+
+void LoopbackTransport::setInput(unsigned pin, bool level)
+{
+    SimBoard::instance().setInput(pin, level);
+    SimDevice::instance().notify();
+}
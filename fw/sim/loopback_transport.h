@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "ioig_transport.h"
+
+namespace ioig
+{
+
+    /**
+     * @class LoopbackTransport
+     *
+     * @brief Transport to the firmware tasks running in-process against the
+     *        simulated board of fw/sim, no dongle needed.
+     *
+     * There is a single simulated device per process: attach at most one
+     * LoopbackTransport at a time.
+     */
+    class LoopbackTransport : public Transport
+    {
+    public:
+        /**
+         * @param max_protocol Highest header version to negotiate, PROTOCOL_V1 talks as to an old firmware.
+         */
+        explicit LoopbackTransport(uint8_t max_protocol = Packet::PROTOCOL_VERSION);
+        ~LoopbackTransport();
+
+        int open() override;
+        void close() override;
+
+        int start(TransferEngine &engine) override;
+        void stop() override;
+        int write(const uint8_t *buf, size_t len, unsigned timeout_ms) override;
+
+        bool hasEvents() const override { return true; }
+        int readEvent(Packet &evtPkt, unsigned timeout_ms) override;
+
+        uint8_t getProtocol() const override { return _protocol; }
+
+        /**
+         * @brief Connects two pins of the simulated board.
+         */
+        static void wire(unsigned pin_a, unsigned pin_b);
+
+        /**
+         * @brief Drives a pin of the simulated board from outside.
+         */
+        static void setInput(unsigned pin, bool level);
+
+        /**
+         * @brief Makes the simulated firmware answer SYS_INIT as the firmware
+         *        predating the ready handshake, for the next open().
+         */
+        static void setBaselineHandshake(bool enable);
+
+    private:
+        /**
+         * @brief SYS_INIT handshake, as LibUsbTransport does: resets the firmware and gets its header version.
+         *        The firmware predating the handshake gets SYS_SW_RESET and the fixed delay instead.
+         * @return zero on success, negative value if the firmware never answered
+         */
+        int waitReady();
+
+        /**
+         * @brief Sends a command before the engine starts, the response lands in _readyPkt.
+         * @return zero on success, negative value if the firmware never answered
+         */
+        int request(Packet &txPkt);
+
+        void onData(const uint8_t *buf, size_t len);
+        void onEvent(const uint8_t *buf, size_t len);
+
+        static constexpr unsigned EVENT_QUEUE_MAX_SIZE = 64;
+        static constexpr unsigned READY_TIMEOUT_MS = 1000;
+        static constexpr uint32_t READY_TOKEN = 0x10106;
+
+        std::mutex _mutex;
+        std::condition_variable _eventCv;
+        std::atomic_bool _open;    /**< Read by write() without _mutex: onData() holds it while the completions send the next requests */
+        TransferEngine *_engine;
+
+        uint8_t _maxProtocol;
+        uint8_t _protocol;
+        std::condition_variable _readyCv;
+        Packet _readyPkt;    /**< Response to request(), received before the engine starts */
+        Packet::Type _readyType;
+        bool _ready;
+
+        std::vector<uint8_t> _eventStream; /**< EVENT interface bytes not yet framed */
+        std::deque<std::vector<uint8_t>> _events;
+
+        static constexpr const char* TAG = "LoopbackTransport";
+    };
+
+}
@@ -0,0 +1,552 @@
+#include "sim_board.h"
+
+constexpr unsigned SimBoard::PINS_COUNT;
+constexpr unsigned SimBoard::UART_COUNT;
+constexpr unsigned SimBoard::SPI_COUNT;
+constexpr uint16_t SimBoard::ADC_TEMP_RAW;
+
+SimBoard::SimBoard()
+    : _gpioCallback(nullptr),
+      _adcInput(0)
+{
+    for (unsigned i = 0; i < PINS_COUNT; i++)
+    {
+        Pin &pin = _pins[i];
+        pin.fn = GPIO_FUNC_NULL;
+        pin.out = false;
+        pin.value = false;
+        pin.pullUp = false;
+        pin.pullDown = true; // RP2040 reset state
+        pin.extDriven = false;
+        pin.extLevel = false;
+        pin.level = false;
+        pin.irqMask = 0;
+        pin.net = i;
+    }
+
+    for (unsigned i = 0; i < UART_COUNT; i++)
+    {
+        _uartIrqHandler[i] = nullptr;
+        _uartIrqEnabled[i] = false;
+        _uartRxIrq[i] = false;
+        _uartEnabled[i] = false;
+    }
+}
+
+//--------------------------------------------------------------
+// Wiring
+//--------------------------------------------------------------
+
+void SimBoard::wire(unsigned pin_a, unsigned pin_b)
+{
+    if (!isValid(pin_a) || !isValid(pin_b))
+    {
+        return;
+    }
+
+    EdgeList edges;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        unsigned from = _pins[pin_b].net;
+        unsigned to = _pins[pin_a].net;
+        for (auto &pin : _pins)
+        {
+            if (pin.net == from)
+            {
+                pin.net = to;
+            }
+        }
+        update(to, edges);
+    }
+    fireEdges(edges);
+}
+
+void SimBoard::setInput(unsigned pin, bool level)
+{
+    if (!isValid(pin))
+    {
+        return;
+    }
+
+    EdgeList edges;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pins[pin].extDriven = true;
+        _pins[pin].extLevel = level;
+        update(_pins[pin].net, edges);
+    }
+    fireEdges(edges);
+}
+
+void SimBoard::releaseInput(unsigned pin)
+{
+    if (!isValid(pin))
+    {
+        return;
+    }
+
+    EdgeList edges;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pins[pin].extDriven = false;
+        update(_pins[pin].net, edges);
+    }
+    fireEdges(edges);
+}
+
+void SimBoard::unwireAll()
+{
+    EdgeList edges;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (unsigned i = 0; i < PINS_COUNT; i++)
+        {
+            _pins[i].net = i;
+            _pins[i].extDriven = false;
+        }
+        update(edges);
+    }
+    fireEdges(edges);
+}
+
+bool SimBoard::netLevel(unsigned net) const
+{
+    bool pullUp = false;
+    bool uartIdle = false;
+    int ext = -1;
+
+    for (const auto &pin : _pins)
+    {
+        if (pin.net != net)
+        {
+            continue;
+        }
+
+        if (pin.fn == GPIO_FUNC_SIO && pin.out)
+        {
+            return pin.value; // first driver wins
+        }
+
+        if (pin.extDriven && ext < 0)
+        {
+            ext = pin.extLevel;
+        }
+
+        if (pin.fn == GPIO_FUNC_UART && uartRole((unsigned)(&pin - _pins)) == UART_TX)
+        {
+            uartIdle = true;
+        }
+
+        pullUp |= pin.pullUp;
+    }
+
+    if (ext >= 0)
+    {
+        return ext;
+    }
+
+    return uartIdle || pullUp;
+}
+
+int SimBoard::findPin(gpio_function fn, unsigned inst, unsigned role) const
+{
+    for (unsigned i = 0; i < PINS_COUNT; i++)
+    {
+        if (_pins[i].fn != fn)
+        {
+            continue;
+        }
+
+        if (fn == GPIO_FUNC_UART && uartInstance(i) == inst && uartRole(i) == role)
+        {
+            return i;
+        }
+
+        if (fn == GPIO_FUNC_SPI && spiInstance(i) == inst && spiRole(i) == role)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void SimBoard::update(EdgeList &edges)
+{
+    for (unsigned i = 0; i < PINS_COUNT; i++)
+    {
+        if (_pins[i].net == i)
+        {
+            update(i, edges);
+        }
+    }
+}
+
+void SimBoard::update(unsigned net, EdgeList &edges)
+{
+    bool level = netLevel(net);
+
+    for (unsigned i = 0; i < PINS_COUNT; i++)
+    {
+        Pin &pin = _pins[i];
+        if (pin.net != net || pin.level == level)
+        {
+            continue;
+        }
+
+        pin.level = level;
+
+        uint32_t edge = level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+        if (pin.fn == GPIO_FUNC_SIO && (pin.irqMask & edge))
+        {
+            edges.emplace_back(i, edge);
+        }
+    }
+}
+
+void SimBoard::fireEdges(const EdgeList &edges)
+{
+    // the handlers take the board lock again, as on the target they run in irq context
+    gpio_irq_callback_t callback;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        callback = _gpioCallback;
+    }
+
+    if (callback == nullptr)
+    {
+        return;
+    }
+
+    for (const auto &edge : edges)
+    {
+        callback(edge.first, edge.second);
+    }
+}
+
+//--------------------------------------------------------------
+// GPIO
+//--------------------------------------------------------------
+
+void SimBoard::gpioInit(unsigned pin)
+{
+    if (!isValid(pin))
+    {
+        return;
+    }
+
+    EdgeList edges;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pins[pin].fn = GPIO_FUNC_SIO;
+        _pins[pin].out = false;
+        _pins[pin].value = false;
+        update(_pins[pin].net, edges);
+    }
+    fireEdges(edges);
+}
+
+void SimBoard::gpioDeinit(unsigned pin)
+{
+    if (!isValid(pin))
+    {
+        return;
+    }
+
+    EdgeList edges;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pins[pin].fn = GPIO_FUNC_NULL;
+        _pins[pin].out = false;
+        update(_pins[pin].net, edges);
+    }
+    fireEdges(edges);
+}
+
+void SimBoard::gpioSetFunction(unsigned pin, gpio_function fn)
+{
+    if (!isValid(pin))
+    {
+        return;
+    }
+
+    EdgeList edges;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pins[pin].fn = fn;
+        update(_pins[pin].net, edges);
+    }
+    fireEdges(edges);
+}
+
+void SimBoard::gpioSetDir(unsigned pin, bool out)
+{
+    if (!isValid(pin))
+    {
+        return;
+    }
+
+    EdgeList edges;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pins[pin].out = out;
+        update(_pins[pin].net, edges);
+    }
+    fireEdges(edges);
+}
+
+void SimBoard::gpioPut(unsigned pin, bool value)
+{
+    if (!isValid(pin))
+    {
+        return;
+    }
+
+    EdgeList edges;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pins[pin].value = value;
+        update(_pins[pin].net, edges);
+    }
+    fireEdges(edges);
+}
+
+bool SimBoard::gpioGet(unsigned pin)
+{
+    if (!isValid(pin))
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pins[pin].level;
+}
+
+void SimBoard::gpioSetPulls(unsigned pin, bool up, bool down)
+{
+    if (!isValid(pin))
+    {
+        return;
+    }
+
+    EdgeList edges;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pins[pin].pullUp = up;
+        _pins[pin].pullDown = down;
+        update(_pins[pin].net, edges);
+    }
+    fireEdges(edges);
+}
+
+void SimBoard::gpioSetIrq(unsigned pin, uint32_t event_mask, bool enabled)
+{
+    if (!isValid(pin))
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (enabled)
+    {
+        _pins[pin].irqMask |= event_mask;
+    }
+    else
+    {
+        _pins[pin].irqMask &= ~event_mask;
+    }
+}
+
+void SimBoard::gpioSetIrqCallback(gpio_irq_callback_t callback)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _gpioCallback = callback;
+}
+
+//--------------------------------------------------------------
+// IRQ
+//--------------------------------------------------------------
+
+void SimBoard::irqSetHandler(unsigned num, irq_handler_t handler)
+{
+    if (num == UART0_IRQ || num == UART1_IRQ)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _uartIrqHandler[num - UART0_IRQ] = handler;
+    }
+}
+
+void SimBoard::irqSetEnabled(unsigned num, bool enabled)
+{
+    if (num == UART0_IRQ || num == UART1_IRQ)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _uartIrqEnabled[num - UART0_IRQ] = enabled;
+        }
+        fireUartIrq(num - UART0_IRQ);
+    }
+}
+
+//--------------------------------------------------------------
+// UART
+//--------------------------------------------------------------
+
+void SimBoard::uartInit(unsigned inst)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _uartEnabled[inst % UART_COUNT] = true;
+    _uartRxFifo[inst % UART_COUNT].clear();
+}
+
+bool SimBoard::uartIsEnabled(unsigned inst)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _uartEnabled[inst % UART_COUNT];
+}
+
+void SimBoard::uartSetRxIrq(unsigned inst, bool enabled)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _uartRxIrq[inst % UART_COUNT] = enabled;
+    }
+    fireUartIrq(inst % UART_COUNT);
+}
+
+void SimBoard::uartPutc(unsigned inst, uint8_t c)
+{
+    bool received[UART_COUNT] = {false, false};
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        int tx = findPin(GPIO_FUNC_UART, inst % UART_COUNT, UART_TX);
+        if (tx < 0)
+        {
+            return; // no pin routed, the byte is lost
+        }
+
+        for (unsigned i = 0; i < PINS_COUNT; i++)
+        {
+            if (_pins[i].net != _pins[tx].net || _pins[i].fn != GPIO_FUNC_UART || uartRole(i) != UART_RX)
+            {
+                continue;
+            }
+
+            unsigned rx = uartInstance(i);
+            if (_uartEnabled[rx])
+            {
+                _uartRxFifo[rx].push_back(c);
+                received[rx] = true;
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < UART_COUNT; i++)
+    {
+        if (received[i])
+        {
+            fireUartIrq(i);
+        }
+    }
+}
+
+bool SimBoard::uartIsReadable(unsigned inst)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return !_uartRxFifo[inst % UART_COUNT].empty();
+}
+
+uint8_t SimBoard::uartGetc(unsigned inst)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto &fifo = _uartRxFifo[inst % UART_COUNT];
+    if (fifo.empty())
+    {
+        return 0;
+    }
+
+    uint8_t c = fifo.front();
+    fifo.pop_front();
+    return c;
+}
+
+void SimBoard::fireUartIrq(unsigned inst)
+{
+    while (true)
+    {
+        irq_handler_t handler = nullptr;
+        size_t pending = 0;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            pending = _uartRxFifo[inst].size();
+            if (_uartIrqEnabled[inst] && _uartRxIrq[inst] && pending > 0)
+            {
+                handler = _uartIrqHandler[inst];
+            }
+        }
+
+        if (handler == nullptr)
+        {
+            return;
+        }
+
+        handler();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_uartRxFifo[inst].size() >= pending)
+        {
+            return; // handler didn't drain the fifo, don't spin on it
+        }
+    }
+}
+
+//--------------------------------------------------------------
+// SPI
+//--------------------------------------------------------------
+
+uint8_t SimBoard::spiTransfer(unsigned inst, uint8_t tx)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    int txPin = findPin(GPIO_FUNC_SPI, inst % SPI_COUNT, SPI_TX);
+    int rxPin = findPin(GPIO_FUNC_SPI, inst % SPI_COUNT, SPI_RX);
+
+    if (rxPin < 0)
+    {
+        return 0;
+    }
+
+    if (txPin >= 0 && _pins[txPin].net == _pins[rxPin].net)
+    {
+        return tx; // MOSI wired to MISO
+    }
+
+    return netLevel(_pins[rxPin].net) ? 0xFF : 0x00;
+}
+
+//--------------------------------------------------------------
+// ADC
+//--------------------------------------------------------------
+
+void SimBoard::adcSelectInput(unsigned input)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _adcInput = input;
+}
+
+uint16_t SimBoard::adcRead()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_adcInput == 4)
+    {
+        return ADC_TEMP_RAW;
+    }
+
+    unsigned pin = GP26 + _adcInput;
+    if (!isValid(pin))
+    {
+        return 0;
+    }
+
+    return netLevel(_pins[pin].net) ? 0x0FFF : 0;
+}
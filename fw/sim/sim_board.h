@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "sim_hal.h"
+#include "fw/targets/rp2040/hw_defs.h"
+
+/**
+ * @brief Pin level model of a RP2040 board, backing the sim HAL.
+ *
+ * Pins are connected by wire(), each group of connected pins is a net.
+ * A net is driven by its first GPIO output, else by an external input set
+ * with setInput(), else it reads the pull-up state.
+ * UART and SPI pins follow the RP2040 function select table, so a wire
+ * between a TX and a RX pin behaves like on the bench.
+ */
+class SimBoard
+{
+public:
+    static constexpr unsigned PINS_COUNT = TARGET_PINS_COUNT;
+    static constexpr unsigned UART_COUNT = 2;
+    static constexpr unsigned SPI_COUNT = 2;
+    static constexpr uint16_t ADC_TEMP_RAW = 876; /**< ~27 °C */
+
+    /**
+     * @brief Connects two pins, merging their nets.
+     */
+    void wire(unsigned pin_a, unsigned pin_b);
+
+    /**
+     * @brief Drives a pin from outside the board, as a push button would.
+     */
+    void setInput(unsigned pin, bool level);
+
+    /**
+     * @brief Stops driving a pin set by setInput().
+     */
+    void releaseInput(unsigned pin);
+
+    /**
+     * @brief Removes all the wires and external inputs.
+     */
+    void unwireAll();
+
+    //--------------------------------------------------------------
+    // HAL backend
+    //--------------------------------------------------------------
+
+    void gpioInit(unsigned pin);
+    void gpioDeinit(unsigned pin);
+    void gpioSetFunction(unsigned pin, gpio_function fn);
+    void gpioSetDir(unsigned pin, bool out);
+    void gpioPut(unsigned pin, bool value);
+    bool gpioGet(unsigned pin);
+    void gpioSetPulls(unsigned pin, bool up, bool down);
+    void gpioSetIrq(unsigned pin, uint32_t event_mask, bool enabled);
+    void gpioSetIrqCallback(gpio_irq_callback_t callback);
+
+    void irqSetHandler(unsigned num, irq_handler_t handler);
+    void irqSetEnabled(unsigned num, bool enabled);
+
+    void uartInit(unsigned inst);
+    bool uartIsEnabled(unsigned inst);
+    void uartSetRxIrq(unsigned inst, bool enabled);
+    void uartPutc(unsigned inst, uint8_t c);
+    bool uartIsReadable(unsigned inst);
+    uint8_t uartGetc(unsigned inst);
+
+    uint8_t spiTransfer(unsigned inst, uint8_t tx);
+
+    void adcSelectInput(unsigned input);
+    uint16_t adcRead();
+
+    // singleton
+public:
+    static SimBoard &instance()
+    {
+        static SimBoard inst;
+        return inst;
+    }
+    SimBoard(const SimBoard &) = delete;
+    SimBoard &operator=(const SimBoard &) = delete;
+
+private:
+    SimBoard();
+
+    struct Pin
+    {
+        gpio_function fn;
+        bool out;
+        bool value;
+        bool pullUp;
+        bool pullDown;
+        bool extDriven;
+        bool extLevel;
+        bool level; /**< last computed net level, used for edge detection */
+        uint32_t irqMask;
+        unsigned net;
+    };
+
+    enum UartRole { UART_TX = 0, UART_RX = 1 };
+    enum SpiRole { SPI_RX = 0, SPI_CS = 1, SPI_SCK = 2, SPI_TX = 3 };
+
+    using EdgeList = std::vector<std::pair<unsigned, uint32_t>>;
+
+    static bool isValid(unsigned pin) { return pin < PINS_COUNT; }
+    static unsigned uartInstance(unsigned pin) { return ((pin + 4) >> 3) & 1; }
+    static unsigned uartRole(unsigned pin) { return pin % 4; }
+    static unsigned spiInstance(unsigned pin) { return (pin >> 3) & 1; }
+    static unsigned spiRole(unsigned pin) { return pin % 4; }
+
+    bool netLevel(unsigned net) const;
+    int findPin(gpio_function fn, unsigned inst, unsigned role) const;
+    void update(EdgeList &edges);
+    void update(unsigned net, EdgeList &edges);
+    void fireEdges(const EdgeList &edges);
+    void fireUartIrq(unsigned inst);
+
+    std::mutex _mutex;
+    Pin _pins[PINS_COUNT];
+    gpio_irq_callback_t _gpioCallback;
+
+    irq_handler_t _uartIrqHandler[UART_COUNT];
+    bool _uartIrqEnabled[UART_COUNT];
+    bool _uartRxIrq[UART_COUNT];
+    bool _uartEnabled[UART_COUNT];
+    std::deque<uint8_t> _uartRxFifo[UART_COUNT];
+
+    unsigned _adcInput;
+};
@@ -0,0 +1,35 @@
+#include <thread>
+
+#include "sim_clock.h"
+
+constexpr uint32_t SimClock::ADC_CONVERSION_US;
+
+uint64_t SimClock::now() const
+{
+    if (_virtual.load())
+    {
+        return elapsed();
+    }
+
+    auto wall = std::chrono::steady_clock::now() - _boot;
+    return std::chrono::duration_cast<std::chrono::microseconds>(wall).count();
+}
+
+void SimClock::chargeBits(uint64_t bits, uint32_t baud)
+{
+    if (baud == 0)
+    {
+        return;
+    }
+    advanceNs(bits * 1000000000ull / baud);
+}
+
+void SimClock::sleep(uint64_t us)
+{
+    if (_virtual.load())
+    {
+        advanceNs(us * 1000);
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+
+/**
+ * @brief Time base of the sim HAL.
+ *
+ * Bus operations charge the time they would take on the target (SPI/UART/I2C
+ * bits at the configured baud rate, ADC conversions), accumulated in
+ * elapsed(). GPIO and register accesses are free.
+ *
+ * In real mode (default) time_us_64() is the wall clock and sleeps block.
+ * In virtual mode time_us_64() is elapsed(), and sleeps, busy waits and
+ * tight_loop_contents() advance it instead of blocking, so benchmarks measure
+ * the firmware CPU cost alone and read the modeled bus time separately.
+ */
+class SimClock
+{
+public:
+    static constexpr uint32_t ADC_CONVERSION_US = 2; /**< 96 cycles at 48 MHz */
+
+    void setVirtual(bool enabled) { _virtual.store(enabled); }
+    bool isVirtual() const { return _virtual.load(); }
+
+    /**
+     * @return microseconds since boot, see class description
+     */
+    uint64_t now() const;
+
+    /**
+     * @return modeled target time charged so far, in microseconds
+     */
+    uint64_t elapsed() const { return _elapsedNs.load() / 1000; }
+
+    /**
+     * @brief Charges time spent by the target.
+     */
+    void advanceNs(uint64_t ns) { _elapsedNs.fetch_add(ns); }
+
+    /**
+     * @brief Charges the time to shift bits on a bus at baud bits/s.
+     */
+    void chargeBits(uint64_t bits, uint32_t baud);
+
+    /**
+     * @brief Waits us microseconds, advancing the virtual clock in virtual mode.
+     */
+    void sleep(uint64_t us);
+
+    // singleton
+public:
+    static SimClock &instance()
+    {
+        static SimClock inst;
+        return inst;
+    }
+    SimClock(const SimClock &) = delete;
+    SimClock &operator=(const SimClock &) = delete;
+
+private:
+    SimClock() : _boot(std::chrono::steady_clock::now()), _virtual(false), _elapsedNs(0) {}
+
+    const std::chrono::steady_clock::time_point _boot;
+    std::atomic_bool _virtual;
+    std::atomic<uint64_t> _elapsedNs;
+};
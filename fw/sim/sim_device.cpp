@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <chrono>
+
+#include "main.h"
+#include "sim_device.h"
+
+constexpr unsigned SimDevice::ITF_COUNT;
+constexpr unsigned SimDevice::CDC_FIFO_SIZE;
+
+SimDevice::SimDevice()
+    : _pending(false),
+      _running(false),
+      _baselineHandshake(false),
+      _tasksInitialized(false),
+      _eventReqPkt(2)
+{
+    MainTask::instance(); // constructed first, so it outlives the device thread at exit
+}
+
+SimDevice::~SimDevice()
+{
+    stop();
+}
+
+void SimDevice::start(Sink data_sink, Sink event_sink)
+{
+    if (_running.load())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _sinks[CDCItf::DATA] = data_sink;
+        _sinks[CDCItf::EVENT] = event_sink;
+        _pending = false;
+    }
+
+    if (_tasksInitialized)
+    {
+        mainTask.reset(); // same state a host reset leaves on the target
+    }
+    init();
+
+    _running.store(true);
+    _thread = std::thread(&SimDevice::loop, this);
+}
+
+void SimDevice::init()
+{
+    if (_tasksInitialized)
+    {
+        return;
+    }
+
+    board.init();
+    mainTask.initTasks();
+    mainTask.setState(Task::State::RUNNING);
+    _tasksInitialized = true;
+}
+
+void SimDevice::stop()
+{
+    if (!_running.load())
+    {
+        return;
+    }
+
+    _running.store(false);
+    notify();
+
+    if (_thread.joinable())
+    {
+        _thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto &sink : _sinks)
+    {
+        sink = nullptr;
+    }
+}
+
+void SimDevice::write(const uint8_t *buf, size_t len)
+{
+    if (_baselineHandshake.load() && answerBaselineInit(buf, len))
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> rxLock(_rxMutex);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto &fifo = _rxFifo[CDCItf::DATA];
+            fifo.insert(fifo.end(), buf, buf + len);
+        }
+        tud_cdc_rx_cb(CDCItf::DATA);
+    }
+    notify();
+}
+
+bool SimDevice::answerBaselineInit(const uint8_t *buf, size_t len)
+{
+    if (len < Packet::Header::SIZE || Packet::getFrameLength(buf, len) != len ||
+        Packet::getFrameType(buf) != Packet::Type::SYS_INIT)
+    {
+        return false;
+    }
+
+    //MainTask::process() of the baseline: SYS_INIT is a no-op, the header comes back
+    Packet rxPkt;
+    Packet txPkt;
+    rxPkt.setFrame(buf, len);
+    txPkt.cloneHeader(rxPkt);
+    txPkt.setStatus(Packet::Status::RSP);
+    txPkt.flush();
+
+    uint8_t frame[Packet::MAX_FRAME_SIZE];
+    cdcWrite(CDCItf::DATA, frame, txPkt.writeFrame(frame));
+    cdcWriteFlush(CDCItf::DATA);
+    return true;
+}
+
+void SimDevice::notify()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _pending = true;
+    _cv.notify_one();
+}
+
+void SimDevice::process(Packet &rxPkt, Packet &txPkt)
+{
+    init();
+    mainTask.process(rxPkt, txPkt);
+}
+
+bool SimDevice::poll()
+{
+    init();
+    return mainTask.poll(_eventReqPkt, _txPkt);
+}
+
+void SimDevice::loop()
+{
+    while (_running.load())
+    {
+        if (mainTask.poll(_eventReqPkt, _txPkt))
+        {
+            continue; // keep draining queued commands
+        }
+
+        //idle: wait for a command, still polling the event queues every ms
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait_for(lock, std::chrono::milliseconds(1), [this] { return _pending; });
+        _pending = false;
+    }
+}
+
+//--------------------------------------------------------------
+// CDC fifos
+//--------------------------------------------------------------
+
+uint32_t SimDevice::cdcAvailable(uint8_t itf)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _rxFifo[itf % ITF_COUNT].size();
+}
+
+uint32_t SimDevice::cdcRead(uint8_t itf, void *buf, uint32_t len)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto &fifo = _rxFifo[itf % ITF_COUNT];
+    uint32_t n = std::min<uint32_t>(len, fifo.size());
+    std::copy(fifo.begin(), fifo.begin() + n, (uint8_t *)buf);
+    fifo.erase(fifo.begin(), fifo.begin() + n);
+    return n;
+}
+
+void SimDevice::cdcReadFlush(uint8_t itf)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _rxFifo[itf % ITF_COUNT].clear();
+}
+
+uint32_t SimDevice::cdcWriteAvailable(uint8_t itf)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return CDC_FIFO_SIZE - _txFifo[itf % ITF_COUNT].size();
+}
+
+uint32_t SimDevice::cdcWrite(uint8_t itf, const void *buf, uint32_t len)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto &fifo = _txFifo[itf % ITF_COUNT];
+    uint32_t n = std::min<uint32_t>(len, CDC_FIFO_SIZE - fifo.size());
+    fifo.insert(fifo.end(), (const uint8_t *)buf, (const uint8_t *)buf + n);
+    return n;
+}
+
+uint32_t SimDevice::cdcWriteFlush(uint8_t itf)
+{
+    std::vector<uint8_t> data;
+    Sink sink;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        data.swap(_txFifo[itf % ITF_COUNT]);
+        sink = _sinks[itf % ITF_COUNT];
+    }
+
+    if (data.empty())
+    {
+        return 0;
+    }
+
+    //sink outside the lock, the host may send the next command from it
+    if (sink)
+    {
+        sink(data.data(), data.size());
+    }
+
+    tud_cdc_tx_complete_cb(itf);
+    return data.size();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ioig_protocol.h"
+
+/**
+ * @brief In-process stand-in for the USB device side of the firmware.
+ *
+ * Owns the two CDC interfaces (DATA and EVENT) used by the tud_cdc_* HAL
+ * functions, and a thread running the core1 loop (MainTask::poll()).
+ * Bytes written by the host are handed to the firmware rx callback; bytes
+ * flushed by the firmware are handed to the sink of their interface.
+ */
+class SimDevice
+{
+public:
+    using Sink = std::function<void(const uint8_t *buf, size_t len)>;
+
+    static constexpr unsigned ITF_COUNT = 2;
+    static constexpr unsigned CDC_FIFO_SIZE = 1024; /**< CFG_TUD_CDC_TX_BUFSIZE on full speed */
+
+    /**
+     * @brief Initializes the firmware tasks, first call only.
+     */
+    void init();
+
+    /**
+     * @brief Initializes the firmware tasks (first call only) and starts the device thread.
+     * @param data_sink Receives the responses written on the DATA interface.
+     * @param event_sink Receives the packets written on the EVENT interface.
+     */
+    void start(Sink data_sink, Sink event_sink);
+
+    /**
+     * @brief Stops the device thread, the firmware state is kept.
+     */
+    void stop();
+
+    /**
+     * @brief Host to device transfer on the DATA interface.
+     */
+    void write(const uint8_t *buf, size_t len);
+
+    /**
+     * @brief Wakes up the device thread.
+     */
+    void notify();
+
+    /**
+     * @brief Answers SYS_INIT as the firmware predating the ready handshake
+     *        did: at once, with an empty payload and without reset.
+     *        SYS_SW_RESET is left to the firmware.
+     */
+    void setBaselineHandshake(bool enable) { _baselineHandshake.store(enable); }
+
+    /**
+     * @brief Runs one command through MainTask::process() on the calling thread.
+     * @note For benchmarks, the device thread must not be running.
+     */
+    void process(ioig::Packet &rxPkt, ioig::Packet &txPkt);
+
+    /**
+     * @brief Runs one iteration of the core1 loop on the calling thread.
+     * @note For benchmarks, the device thread must not be running.
+     * @return true if a queued command was processed
+     */
+    bool poll();
+
+    //--------------------------------------------------------------
+    // HAL backend
+    //--------------------------------------------------------------
+
+    uint32_t cdcAvailable(uint8_t itf);
+    uint32_t cdcRead(uint8_t itf, void *buf, uint32_t len);
+    void cdcReadFlush(uint8_t itf);
+    uint32_t cdcWriteAvailable(uint8_t itf);
+    uint32_t cdcWrite(uint8_t itf, const void *buf, uint32_t len);
+    uint32_t cdcWriteFlush(uint8_t itf);
+
+    // singleton
+public:
+    static SimDevice &instance()
+    {
+        static SimDevice inst;
+        return inst;
+    }
+    SimDevice(const SimDevice &) = delete;
+    SimDevice &operator=(const SimDevice &) = delete;
+    ~SimDevice();
+
+private:
+    SimDevice();
+    void loop();
+
+    /**
+     * @return true if buf is a SYS_INIT answered by the baseline firmware
+     */
+    bool answerBaselineInit(const uint8_t *buf, size_t len);
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _pending;
+
+    std::mutex _rxMutex; /**< serializes the rx callbacks, as the usb task on core0 does */
+    std::thread _thread;
+    std::atomic_bool _running;
+    std::atomic_bool _baselineHandshake;
+    bool _tasksInitialized;
+
+    ioig::Packet _eventReqPkt;
+    ioig::Packet _txPkt;
+
+    std::vector<uint8_t> _rxFifo[ITF_COUNT];
+    std::vector<uint8_t> _txFifo[ITF_COUNT];
+    Sink _sinks[ITF_COUNT];
+};
@@ -0,0 +1,623 @@
+#include <cstring>
+#include <thread>
+
+#include "sim_hal.h"
+#include "sim_board.h"
+#include "sim_clock.h"
+#include "sim_device.h"
+
+static SimBoard &simBoard = SimBoard::instance();
+static SimDevice &simDevice = SimDevice::instance();
+static SimClock &simClock = SimClock::instance();
+
+uart_inst_t sim_uart_inst[2] = {{0, 0}, {1, 0}};
+spi_inst_t sim_spi_inst[2] = {{0, 0}, {1, 0}};
+i2c_inst_t sim_i2c_inst[2] = {{0, 0}, {1, 0}};
+
+static constexpr unsigned UART_FRAME_BITS = 10; // 8N1
+static constexpr unsigned I2C_FRAME_BITS = 9;   // 8 data + ack
+
+//--------------------------------------------------------------
+// pico/time, pico/stdlib, pico/stdio
+//--------------------------------------------------------------
+
+uint64_t time_us_64()
+{
+    return simClock.now();
+}
+
+uint32_t time_us_32()
+{
+    return (uint32_t)simClock.now();
+}
+
+void sleep_ms(uint32_t ms)
+{
+    simClock.sleep((uint64_t)ms * 1000);
+}
+
+void sleep_us(uint64_t us)
+{
+    simClock.sleep(us);
+}
+
+void busy_wait_us_32(uint32_t us)
+{
+    simClock.sleep(us);
+}
+
+void tight_loop_contents()
+{
+    if (simClock.isVirtual())
+    {
+        simClock.sleep(1); // polling loops on time_us_64() must make progress
+        return;
+    }
+    std::this_thread::yield();
+}
+
+bool stdio_init_all()
+{
+    return true;
+}
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required)
+{
+    (void)freq_khz;
+    (void)required;
+    return true;
+}
+
+//--------------------------------------------------------------
+// pico/sync
+//--------------------------------------------------------------
+
+void mutex_init(mutex_t *mtx)
+{
+    (void)mtx;
+}
+
+void mutex_enter_blocking(mutex_t *mtx)
+{
+    mtx->lock.lock();
+}
+
+void mutex_exit(mutex_t *mtx)
+{
+    mtx->lock.unlock();
+}
+
+//--------------------------------------------------------------
+// pico/util/queue
+//--------------------------------------------------------------
+
+void queue_init(queue_t *q, uint element_size, uint element_count)
+{
+    std::lock_guard<std::mutex> lock(q->lock);
+    q->elementSize = element_size;
+    q->capacity = element_count;
+    q->data.assign((size_t)element_size * element_count, 0);
+    q->head = 0;
+    q->count = 0;
+}
+
+void queue_free(queue_t *q)
+{
+    std::lock_guard<std::mutex> lock(q->lock);
+    q->data.clear();
+    q->capacity = 0;
+    q->head = 0;
+    q->count = 0;
+}
+
+uint queue_get_level(queue_t *q)
+{
+    std::lock_guard<std::mutex> lock(q->lock);
+    return q->count;
+}
+
+static bool queuePush(queue_t *q, const void *data)
+{
+    if (q->count >= q->capacity)
+    {
+        return false;
+    }
+
+    uint tail = (q->head + q->count) % q->capacity;
+    memcpy(q->data.data() + (size_t)tail * q->elementSize, data, q->elementSize);
+    q->count++;
+    return true;
+}
+
+static bool queuePop(queue_t *q, void *data)
+{
+    if (q->count == 0)
+    {
+        return false;
+    }
+
+    memcpy(data, q->data.data() + (size_t)q->head * q->elementSize, q->elementSize);
+    q->head = (q->head + 1) % q->capacity;
+    q->count--;
+    return true;
+}
+
+bool queue_try_add(queue_t *q, const void *data)
+{
+    std::lock_guard<std::mutex> lock(q->lock);
+    bool ret = queuePush(q, data);
+    q->cv.notify_all();
+    return ret;
+}
+
+bool queue_try_remove(queue_t *q, void *data)
+{
+    std::lock_guard<std::mutex> lock(q->lock);
+    bool ret = queuePop(q, data);
+    q->cv.notify_all();
+    return ret;
+}
+
+void queue_add_blocking(queue_t *q, const void *data)
+{
+    std::unique_lock<std::mutex> lock(q->lock);
+    q->cv.wait(lock, [q] { return q->count < q->capacity; });
+    queuePush(q, data);
+    q->cv.notify_all();
+}
+
+void queue_remove_blocking(queue_t *q, void *data)
+{
+    std::unique_lock<std::mutex> lock(q->lock);
+    q->cv.wait(lock, [q] { return q->count > 0; });
+    queuePop(q, data);
+    q->cv.notify_all();
+}
+
+//--------------------------------------------------------------
+// pico/multicore
+//--------------------------------------------------------------
+
+// SimDevice runs the core1 loop, MainTask::init() isn't used on the simulator
+
+void multicore_reset_core1()
+{
+}
+
+void multicore_launch_core1(void (*entry)(void))
+{
+    (void)entry;
+}
+
+//--------------------------------------------------------------
+// hardware/watchdog, hardware/clocks
+//--------------------------------------------------------------
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug)
+{
+    (void)delay_ms;
+    (void)pause_on_debug;
+}
+
+bool watchdog_caused_reboot()
+{
+    return false;
+}
+
+void watchdog_update()
+{
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+    return clk_index == clk_usb || clk_index == clk_adc ? 48000000 : 125000000;
+}
+
+//--------------------------------------------------------------
+// hardware/irq
+//--------------------------------------------------------------
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+    simBoard.irqSetHandler(num, handler);
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+    simBoard.irqSetEnabled(num, enabled);
+}
+
+//--------------------------------------------------------------
+// hardware/gpio
+//--------------------------------------------------------------
+
+void gpio_init(uint gpio)
+{
+    simBoard.gpioInit(gpio);
+}
+
+void gpio_deinit(uint gpio)
+{
+    simBoard.gpioDeinit(gpio);
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn)
+{
+    simBoard.gpioSetFunction(gpio, fn);
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+    simBoard.gpioSetDir(gpio, out);
+}
+
+void gpio_put(uint gpio, bool value)
+{
+    simBoard.gpioPut(gpio, value);
+}
+
+bool gpio_get(uint gpio)
+{
+    return simBoard.gpioGet(gpio);
+}
+
+void gpio_pull_up(uint gpio)
+{
+    simBoard.gpioSetPulls(gpio, true, false);
+}
+
+void gpio_pull_down(uint gpio)
+{
+    simBoard.gpioSetPulls(gpio, false, true);
+}
+
+void gpio_disable_pulls(uint gpio)
+{
+    simBoard.gpioSetPulls(gpio, false, false);
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t event_mask, bool enabled)
+{
+    simBoard.gpioSetIrq(gpio, event_mask, enabled);
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled, gpio_irq_callback_t callback)
+{
+    simBoard.gpioSetIrqCallback(callback);
+    simBoard.gpioSetIrq(gpio, event_mask, enabled);
+}
+
+//--------------------------------------------------------------
+// hardware/uart
+//--------------------------------------------------------------
+
+uint uart_init(uart_inst_t *uart, uint baudrate)
+{
+    uart->baudrate = baudrate;
+    simBoard.uartInit(uart->index);
+    return baudrate;
+}
+
+bool uart_is_enabled(uart_inst_t *uart)
+{
+    return simBoard.uartIsEnabled(uart->index);
+}
+
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled)
+{
+    (void)uart;
+    (void)enabled;
+}
+
+void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity)
+{
+    (void)uart;
+    (void)data_bits;
+    (void)stop_bits;
+    (void)parity;
+}
+
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data)
+{
+    (void)tx_needs_data;
+    simBoard.uartSetRxIrq(uart->index, rx_has_data);
+}
+
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts)
+{
+    (void)uart;
+    (void)cts;
+    (void)rts;
+}
+
+void uart_set_break(uart_inst_t *uart, bool en)
+{
+    (void)uart;
+    (void)en;
+}
+
+bool uart_is_readable(uart_inst_t *uart)
+{
+    return simBoard.uartIsReadable(uart->index);
+}
+
+bool uart_is_writable(uart_inst_t *uart)
+{
+    (void)uart;
+    return true;
+}
+
+char uart_getc(uart_inst_t *uart)
+{
+    return (char)simBoard.uartGetc(uart->index);
+}
+
+void uart_putc_raw(uart_inst_t *uart, char c)
+{
+    simClock.chargeBits(UART_FRAME_BITS, uart->baudrate);
+    simBoard.uartPutc(uart->index, (uint8_t)c);
+}
+
+void uart_write_blocking(uart_inst_t *uart, const uint8_t *src, size_t len)
+{
+    simClock.chargeBits((uint64_t)len * UART_FRAME_BITS, uart->baudrate);
+    for (size_t i = 0; i < len; i++)
+    {
+        simBoard.uartPutc(uart->index, src[i]);
+    }
+}
+
+void uart_read_blocking(uart_inst_t *uart, uint8_t *dst, size_t len)
+{
+    // blocking on the target, here missing bytes would hang the device thread: read them as 0
+    for (size_t i = 0; i < len; i++)
+    {
+        dst[i] = simBoard.uartGetc(uart->index);
+    }
+}
+
+//--------------------------------------------------------------
+// hardware/spi
+//--------------------------------------------------------------
+
+uint spi_init(spi_inst_t *spi, uint baudrate)
+{
+    spi->baudrate = baudrate;
+    return baudrate;
+}
+
+void spi_deinit(spi_inst_t *spi)
+{
+    (void)spi;
+}
+
+uint spi_set_baudrate(spi_inst_t *spi, uint baudrate)
+{
+    spi->baudrate = baudrate;
+    return baudrate;
+}
+
+void spi_set_format(spi_inst_t *spi, uint data_bits, spi_cpol_t cpol, spi_cpha_t cpha, spi_order_t order)
+{
+    (void)spi;
+    (void)data_bits;
+    (void)cpol;
+    (void)cpha;
+    (void)order;
+}
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, size_t len)
+{
+    simClock.chargeBits((uint64_t)len * 8, spi->baudrate);
+    for (size_t i = 0; i < len; i++)
+    {
+        simBoard.spiTransfer(spi->index, src[i]);
+    }
+    return (int)len;
+}
+
+int spi_read_blocking(spi_inst_t *spi, uint8_t repeated_tx_data, uint8_t *dst, size_t len)
+{
+    simClock.chargeBits((uint64_t)len * 8, spi->baudrate);
+    for (size_t i = 0; i < len; i++)
+    {
+        dst[i] = simBoard.spiTransfer(spi->index, repeated_tx_data);
+    }
+    return (int)len;
+}
+
+int spi_write_read_blocking(spi_inst_t *spi, const uint8_t *src, uint8_t *dst, size_t len)
+{
+    simClock.chargeBits((uint64_t)len * 8, spi->baudrate);
+    for (size_t i = 0; i < len; i++)
+    {
+        dst[i] = simBoard.spiTransfer(spi->index, src[i]);
+    }
+    return (int)len;
+}
+
+//--------------------------------------------------------------
+// hardware/i2c
+//--------------------------------------------------------------
+
+// no target on the simulated bus: every address NACKs, after the address byte
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate)
+{
+    i2c->baudrate = baudrate;
+    return baudrate;
+}
+
+void i2c_deinit(i2c_inst_t *i2c)
+{
+    (void)i2c;
+}
+
+uint i2c_set_baudrate(i2c_inst_t *i2c, uint baudrate)
+{
+    i2c->baudrate = baudrate;
+    return baudrate;
+}
+
+int i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop, uint timeout_us)
+{
+    simClock.chargeBits(I2C_FRAME_BITS, i2c->baudrate);
+    (void)addr;
+    (void)src;
+    (void)len;
+    (void)nostop;
+    (void)timeout_us;
+    return PICO_ERROR_GENERIC;
+}
+
+int i2c_read_timeout_us(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop, uint timeout_us)
+{
+    simClock.chargeBits(I2C_FRAME_BITS, i2c->baudrate);
+    (void)addr;
+    (void)dst;
+    (void)len;
+    (void)nostop;
+    (void)timeout_us;
+    return PICO_ERROR_GENERIC;
+}
+
+//--------------------------------------------------------------
+// hardware/adc
+//--------------------------------------------------------------
+
+void adc_init()
+{
+}
+
+void adc_gpio_init(uint gpio)
+{
+    simBoard.gpioSetFunction(gpio, GPIO_FUNC_NULL);
+    simBoard.gpioSetPulls(gpio, false, false);
+}
+
+void adc_set_temp_sensor_enabled(bool enable)
+{
+    (void)enable;
+}
+
+void adc_select_input(uint input)
+{
+    simBoard.adcSelectInput(input);
+}
+
+uint16_t adc_read()
+{
+    simClock.advanceNs(SimClock::ADC_CONVERSION_US * 1000);
+    return simBoard.adcRead();
+}
+
+//--------------------------------------------------------------
+// hardware/pwm
+//--------------------------------------------------------------
+
+uint pwm_gpio_to_slice_num(uint gpio)
+{
+    return (gpio >> 1) & 7;
+}
+
+uint pwm_gpio_to_channel(uint gpio)
+{
+    return gpio & 1;
+}
+
+pwm_config pwm_get_default_config()
+{
+    pwm_config c = {0, 1 << 4, 0xFFFF};
+    return c;
+}
+
+void pwm_config_set_wrap(pwm_config *c, uint16_t wrap)
+{
+    c->top = wrap;
+}
+
+void pwm_config_set_clkdiv(pwm_config *c, float div)
+{
+    c->div = (uint32_t)(div * (1 << 4));
+}
+
+void pwm_init(uint slice_num, pwm_config *c, bool start)
+{
+    (void)slice_num;
+    (void)c;
+    (void)start;
+}
+
+void pwm_set_enabled(uint slice_num, bool enabled)
+{
+    (void)slice_num;
+    (void)enabled;
+}
+
+void pwm_set_gpio_level(uint gpio, uint16_t level)
+{
+    (void)gpio;
+    (void)level;
+}
+
+//--------------------------------------------------------------
+// bsp/board_api
+//--------------------------------------------------------------
+
+void board_init()
+{
+}
+
+uint32_t board_millis()
+{
+    return (uint32_t)(time_us_64() / 1000);
+}
+
+void board_led_write(bool state)
+{
+    (void)state;
+}
+
+//--------------------------------------------------------------
+// tusb (CDC device)
+//--------------------------------------------------------------
+
+bool tud_init(uint8_t rhport)
+{
+    (void)rhport;
+    return true;
+}
+
+void tud_task()
+{
+}
+
+uint32_t tud_cdc_n_available(uint8_t itf)
+{
+    return simDevice.cdcAvailable(itf);
+}
+
+uint32_t tud_cdc_n_read(uint8_t itf, void *buffer, uint32_t bufsize)
+{
+    return simDevice.cdcRead(itf, buffer, bufsize);
+}
+
+void tud_cdc_n_read_flush(uint8_t itf)
+{
+    simDevice.cdcReadFlush(itf);
+}
+
+uint32_t tud_cdc_n_write_available(uint8_t itf)
+{
+    return simDevice.cdcWriteAvailable(itf);
+}
+
+uint32_t tud_cdc_n_write(uint8_t itf, const void *buffer, uint32_t bufsize)
+{
+    return simDevice.cdcWrite(itf, buffer, bufsize);
+}
+
+uint32_t tud_cdc_n_write_flush(uint8_t itf)
+{
+    return simDevice.cdcWriteFlush(itf);
+}
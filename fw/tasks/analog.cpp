@@ -5,6 +5,7 @@
 
 #include "fw/tasks/analog.h"
 #include "fw/main.h"
+#include "host/ioig_messages.h"
 
 
 AnalogTask &analogTask = AnalogTask::instance();
@@ -19,24 +20,29 @@ void AnalogTask::reset()
 {
     auto prevState = getState();
     setState(Task::State::STOPPED);
-    sleep_ms(2);
     setState(prevState);    
 }
 
 
 inline void AnalogTask::processInit(Packet & rxPkt, Packet & txPkt)
 {
-    
-    auto pin=rxPkt.getPayloadItem8(0);    
-    auto mode=rxPkt.getPayloadItem8(1);  
-    
-    //send back the received parameters to host
-    txPkt.addPayloadItem8(pin);
-    txPkt.addPayloadItem8(mode);     
+    using Init = msg::AnalogInit;
+
+    if (!Init::fits(rxPkt))
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
 
+    auto pin  = Init::get<Init::PIN>(rxPkt);
+    auto mode = Init::get<Init::MODE>(rxPkt);
 
     if (mode==0) // AnalogIn
     {        
+        //send back the received parameters to host
+        Init::encode(txPkt, pin, mode);
+
+
         adc_init();        
 
 
@@ -53,11 +59,19 @@ inline void AnalogTask::processInit(Packet & rxPkt, Packet & txPkt)
         
     }else      // AnalogOut
     {
+        using InitPwm = msg::AnalogInitPwm;
+
+        if (!InitPwm::fits(rxPkt))
+        {
+            txPkt.setStatus(Packet::Status::ERR);
+            return;
+        }
+
         /* Populate PWM object with default values. */
         auto slice        = pwm_gpio_to_slice_num(pin);
         auto channel      = pwm_gpio_to_channel(pin);
-        auto count_top    = rxPkt.getPayloadItem32(2);
-        auto period_us    = rxPkt.getPayloadItem64(6);        
+        auto count_top    = InitPwm::get<InitPwm::COUNT_TOP>(rxPkt);
+        auto period_us    = InitPwm::get<InitPwm::PERIOD_US>(rxPkt);
 
         auto cfg = pwm_get_default_config();
         pwm_config_set_wrap(&cfg, count_top);        
@@ -69,31 +83,35 @@ inline void AnalogTask::processInit(Packet & rxPkt, Packet & txPkt)
         pwm_init(slice, &cfg, false);
         gpio_set_function(pin, GPIO_FUNC_PWM);           
 
-        txPkt.addPayloadItem32(count_top);
-        txPkt.addPayloadItem64(period_us);
-        txPkt.addPayloadItem8(slice);
-        txPkt.addPayloadItem8(channel);
+        //send back the received parameters to host, with the pwm slice and channel
+        msg::AnalogInitPwmRsp::encode(txPkt, pin, mode, count_top, period_us, slice, channel);
     }
-
-    
-
 }
 
 inline void AnalogTask::processDeInit(Packet & rxPkt, Packet & txPkt)
 {    
-    auto pin=rxPkt.getPayloadItem8(0);
-    auto mode=rxPkt.getPayloadItem8(1);   
+    using DeInit = msg::AnalogDeinit;
+    using DeInitPwm = msg::AnalogDeinitPwm;
+
+    if (!DeInit::fits(rxPkt))
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
+
+    auto pin  = DeInit::get<DeInit::PIN>(rxPkt);
+    auto mode = DeInit::get<DeInit::MODE>(rxPkt);
 
     //send back the received parameters to host
-    txPkt.addPayloadItem8(pin);
-    txPkt.addPayloadItem8(mode);     
-    
-    if (mode==1)   // AnalogOut
+    if (mode==1 && DeInitPwm::fits(rxPkt))   // AnalogOut
     {
-        auto slice=rxPkt.getPayloadItem8(2);
+        auto slice = DeInitPwm::get<DeInitPwm::SLICE>(rxPkt);
         pwm_set_enabled(slice, false);
-        gpio_deinit(pin);
-        txPkt.addPayloadItem8(slice);     
+        DeInitPwm::encode(txPkt, pin, mode, slice);
+    }
+    else
+    {
+        DeInit::encode(txPkt, pin, mode);
     }
     gpio_deinit(pin); 
 
@@ -101,12 +119,19 @@ inline void AnalogTask::processDeInit(Packet & rxPkt, Packet & txPkt)
 
 inline void AnalogTask::processWrite(Packet & rxPkt, Packet & txPkt)
 {    
-    auto pin          = rxPkt.getPayloadItem8(0); 
-    auto slice        = rxPkt.getPayloadItem32(1);       
-    auto val          = rxPkt.getPayloadItem16(5);
-    auto count_top    = rxPkt.getPayloadItem32(7);
-    auto wrResolution = rxPkt.getPayloadItem8(11);      
-    
+    using Write = msg::AnalogWrite;
+
+    if (!Write::fits(rxPkt))
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
+
+    auto pin          = Write::get<Write::PIN>(rxPkt);
+    auto slice        = Write::get<Write::SLICE>(rxPkt);
+    auto val          = Write::get<Write::VALUE>(rxPkt);
+    auto count_top    = Write::get<Write::COUNT_TOP>(rxPkt);
+    auto wrResolution = Write::get<Write::RESOLUTION>(rxPkt);
 
     float percent = (float)val/(float)((1 << wrResolution)-1);
 
@@ -118,13 +143,21 @@ inline void AnalogTask::processWrite(Packet & rxPkt, Packet & txPkt)
         pwm_set_enabled(slice, true);        
     }
 
-    txPkt.addPayloadItemFloat(percent);
+    msg::AnalogWriteRsp::encode(txPkt, percent);
 }
 
 inline void AnalogTask::processRead(Packet & rxPkt, Packet & txPkt)
 {    
-    auto channel=rxPkt.getPayloadItem8(0);    
-    auto readResolution=rxPkt.getPayloadItem8(1);  
+    using Read = msg::AnalogRead;
+
+    if (!Read::fits(rxPkt))
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
+
+    auto channel        = Read::get<Read::CHANNEL>(rxPkt);
+    auto readResolution = Read::get<Read::RESOLUTION>(rxPkt);
 
     /* Select the desired ADC input channel. */
     adc_select_input(channel);
@@ -134,8 +167,7 @@ inline void AnalogTask::processRead(Packet & rxPkt, Packet & txPkt)
 
     uint16_t result = (adcRead16 >> (16 - readResolution));
 
-    txPkt.addPayloadItem8(channel);
-    txPkt.addPayloadItem16(result);
+    msg::AnalogReadRsp::encode(txPkt, channel, result);
 
 }
 
@@ -147,7 +179,7 @@ inline void AnalogTask::processReadTemp(Packet & rxPkt, Packet & txPkt)
     float adc = (float)adc_read() * ADC_CONVERSION_FACTOR;
     float tempC = 27.0f - (adc - 0.706f) / 0.001721f;    
     
-    txPkt.addPayloadItemFloat(tempC);
+    msg::AnalogReadTempRsp::encode(txPkt, tempC);
 }
 
 
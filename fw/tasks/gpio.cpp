@@ -8,13 +8,14 @@
 
 #include "fw/tasks/gpio.h"
 #include "fw/main.h"
+#include "host/ioig_messages.h"
 
 
 GpioTask &gpioTask = GpioTask::instance();
 
 void GpioTask::init()
 {
-    queue_init(&_irqEventQueue, sizeof(uint32_t), EVT_QUEUE_MAX_SIZE);  //TODO: move to processSetIrq
+    queue_init(&_irqEventQueue, sizeof(IrqEvent), EVT_QUEUE_MAX_SIZE);  //TODO: move to processSetIrq
     setState(Task::State::RUNNING);
 }
 
@@ -22,10 +23,9 @@ void GpioTask::reset()
 {
     auto prevState = getState();
     setState(Task::State::STOPPED);
-    sleep_ms(2); 
     while (queue_get_level(&_irqEventQueue) > 0) 
     {
-      uint32_t tmp=0;
+      IrqEvent tmp;
       queue_remove_blocking(&_irqEventQueue, &tmp);
     }    
     setState(prevState);
@@ -33,6 +33,9 @@ void GpioTask::reset()
 
 void GpioTask::irqHandler(unsigned pin, uint32_t evt)
 {
+    //first, so the host sees when the edge happened, not when it was sent
+    uint32_t timestamp = time_us_32();
+
     if (gpioTask.getStateUnsafe() == Task::State::STOPPED)
     {
       return;
@@ -43,14 +46,14 @@ void GpioTask::irqHandler(unsigned pin, uint32_t evt)
     uint32_t event_ = (uint16_t)(evt & 0xFFFF);
 
     // Combine the low bits
-    uint32_t combined = static_cast<uint32_t>((pin_ << 16) | event_);
+    IrqEvent irqEvent = { static_cast<uint32_t>((pin_ << 16) | event_), timestamp };
 
-    if (!queue_try_add(&gpioTask._irqEventQueue, &combined))
+    if (!queue_try_add(&gpioTask._irqEventQueue, &irqEvent))
     {   
         //queue if full
-        uint32_t tmp=0;
+        IrqEvent tmp;
         queue_remove_blocking(&gpioTask._irqEventQueue, &tmp);    
-        queue_add_blocking(&gpioTask._irqEventQueue, &combined);
+        queue_add_blocking(&gpioTask._irqEventQueue, &irqEvent);
         DBG_MSG("Gpio: event queue full! discarging items...\n");
     }
 }
@@ -119,7 +122,11 @@ inline void GpioTask::processEvents(Packet &txPkt)
 {        
     uint8_t qsz = (uint8_t)queue_get_level(&gpioTask._irqEventQueue);   
 
-    int evt_cnt = qsz < txPkt.getFreePayloadSlots() ? qsz : txPkt.getFreePayloadSlots()-1 /*env_cnt slot*/;
+    //[count][pin:16|events:16][timestamp:32]..., the rest goes in the next packet.
+    //A v1 host reads 4 bytes per event: no timestamp before a v2 session
+    bool timestamps = mainTask.getProtocol() >= Packet::PROTOCOL_V2;
+    unsigned max_cnt = (txPkt.getFreePayloadSlots() - 1 /*evt_cnt slot*/) / (timestamps ? EVT_SIZE_V2 : EVT_SIZE_V1);
+    int evt_cnt = qsz < max_cnt ? qsz : max_cnt;
 
     if (evt_cnt == 0) 
     {
@@ -131,10 +138,14 @@ inline void GpioTask::processEvents(Packet &txPkt)
     //chain events in a single pkt
     while (evt_cnt-- > 0) 
     {
-        uint32_t gpio_event = 0;
+        IrqEvent gpio_event;
 
         queue_remove_blocking(&gpioTask._irqEventQueue, &gpio_event);
-        txPkt.addPayloadItem32(gpio_event);
+        txPkt.addPayloadItem32(gpio_event.pinEvents);
+        if (timestamps)
+        {
+            txPkt.addPayloadItem32(gpio_event.timestamp);
+        }
     }   
 
 
@@ -144,17 +155,30 @@ inline void GpioTask::processEvents(Packet &txPkt)
 
 inline void GpioTask::processSetValue(Packet &rxPkt,Packet &txPkt)
 {    
-    auto pin = rxPkt.getPayloadItem8(0);
-    auto val = rxPkt.getPayloadItem8(1);
-    gpio_put(pin, val);
+    using SetValue = msg::GpioSetValue;
+
+    if (!SetValue::fits(rxPkt))
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
+
+    gpio_put(SetValue::get<SetValue::PIN>(rxPkt), SetValue::get<SetValue::VALUE>(rxPkt));
 }
 
 
 inline void GpioTask::processGetValue(Packet &rxPkt,Packet &txPkt)
 {
-    auto pin = rxPkt.getPayloadItem8(0);
-    auto val = gpio_get(pin);
-    txPkt.addPayloadItem8(val);
+    using GetValue = msg::GpioGetValue;
+
+    if (!GetValue::fits(rxPkt))
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
+
+    auto val = gpio_get(GetValue::get<GetValue::PIN>(rxPkt));
+    msg::GpioGetValueRsp::encode(txPkt, val);
 }
 
 inline void GpioTask::processSetIrq(Packet &rxPkt,Packet &txPkt)
@@ -190,10 +214,17 @@ inline void GpioTask::processSetDir(Packet &rxPkt,Packet &txPkt)
 
 inline void GpioTask::processPulseIn(Packet &rxPkt,Packet &txPkt)
 {
-    
-    auto pin = rxPkt.getPayloadItem8(0); 
-    auto state = rxPkt.getPayloadItem8(1);
-    uint64_t timeout = rxPkt.getPayloadItem64(2);
+    using PulseIn = msg::GpioPulseIn;
+
+    if (!PulseIn::fits(rxPkt))
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
+
+    auto pin = PulseIn::get<PulseIn::PIN>(rxPkt);
+    auto state = PulseIn::get<PulseIn::STATE>(rxPkt);
+    uint64_t timeout = PulseIn::get<PulseIn::TIMEOUT_US>(rxPkt);
 
     unsigned long startMicros = time_us_64();
 
@@ -224,7 +255,7 @@ inline void GpioTask::processPulseIn(Packet &rxPkt,Packet &txPkt)
 
     uint64_t result = time_us_64() - start;
 
-    txPkt.addPayloadItem64(result);
+    msg::GpioPulseInRsp::encode(txPkt, result);
 }
 
 
@@ -42,6 +42,15 @@ private:
     void processPulseIn(Packet &rxPkt,Packet &txPkt);
 
     static void irqHandler(unsigned gpio, uint32_t event_mask);
+
+    struct IrqEvent
+    {
+        uint32_t pinEvents;  /**< pin:16 | event_mask:16 */
+        uint32_t timestamp;  /**< time_us_32() in the irq handler */
+    };
+    static constexpr unsigned EVT_SIZE_V1 = sizeof(uint32_t);     /**< pinEvents only, in a GPIO_EVENT payload of a v1 session */
+    static constexpr unsigned EVT_SIZE_V2 = 2 * sizeof(uint32_t); /**< IrqEvent in a GPIO_EVENT payload from v2 */
+
     queue_t _irqEventQueue;    
     static constexpr uint8_t EVT_QUEUE_MAX_SIZE=8;    
 
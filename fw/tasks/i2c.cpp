@@ -20,7 +20,6 @@ void I2CTask::reset()
 {
     auto prevState = getState();
     setState(Task::State::STOPPED);
-    sleep_ms(2);
     setState(prevState);    
 }
 
@@ -137,6 +136,34 @@ inline void I2CTask::processRead(Packet &rxPkt, Packet &txPkt)
     }
 }
 
+int I2CTask::processStaged(Packet::Type type, Packet &rxPkt, Packet &txPkt, const uint8_t *txBuf, uint8_t *rxBuf, unsigned len)
+{
+    auto hwInstance = rxPkt.getPayloadItem8(PacketXfer::EXEC_PARAMS) == I2C_0 ? i2c0 : i2c1;
+    auto addr   = rxPkt.getPayloadItem8(PacketXfer::EXEC_PARAMS + 1);
+    auto nostop = rxPkt.getPayloadItem8(PacketXfer::EXEC_PARAMS + 2);
+
+    int ret = 0;
+
+    if (type == Packet::Type::I2C_WRITE)
+    {
+        ret = i2c_write_timeout_us(hwInstance, addr, txBuf, len, nostop, _timeout_us);
+    }else 
+    {
+        ret = i2c_read_timeout_us(hwInstance, addr, rxBuf, len, nostop, _timeout_us);
+    }
+
+    if (ret == PICO_ERROR_GENERIC)
+    {
+        txPkt.setStatus(Packet::Status::RSP_I2C_NACK);
+    }else 
+    if (ret == PICO_ERROR_TIMEOUT) 
+    {
+        txPkt.setStatus(Packet::Status::RSP_I2C_TIMEOUT);
+    }
+
+    return (type == Packet::Type::I2C_READ && ret > 0) ? ret : 0;
+}
+
 void I2CTask::process(Packet &rxPkt,Packet &txPkt)
 {
      
@@ -13,6 +13,12 @@ public:
 
     void process(Packet &rxPkt,Packet &txPkt) override;       
 
+    /**
+     * @brief Runs a command on a staged buffer, see XferTask.
+     * @return the number of bytes read back in rxBuf
+     */
+    int processStaged(Packet::Type type, Packet &rxPkt, Packet &txPkt, const uint8_t *txBuf, uint8_t *rxBuf, unsigned len);
+
 
 public:
     static I2CTask & instance() 
@@ -22,7 +22,6 @@ void SerialTask::reset()
 {
     auto prevState = getState();
     setState(Task::State::STOPPED);    
-    sleep_ms(2); 
     for (int q=0; q < UART_INSTANCES ; q++) 
     {
         while (queue_get_level(&_irqEventQueue[q]) > 0) 
@@ -263,13 +262,32 @@ void SerialTask::processRead(Packet & rxPkt, Packet & txPkt)
     auto hwInstance = rxPkt.getPayloadItem8(0) == UART_0 ? uart0 : uart1;
     auto len = rxPkt.getPayloadItem8(1);
 
-    if (uart_is_readable(hwInstance)) 
+    if (!uart_is_readable(hwInstance)) 
     {
-        uart_read_blocking(hwInstance, txPkt.getBuffer(), len);
+        txPkt.setStatus(Packet::Status::RSP_SERIAL_NOT_READABLE);
+        return;
+    }
+
+    //the bytes already received, up to len: never stall the task waiting for more
+    while (len-- > 0 && uart_is_readable(hwInstance) && txPkt.getFreePayloadSlots() > 0)
+    {
+        txPkt.addPayloadItem8(uart_getc(hwInstance));
+    }
+}
+
+int SerialTask::processStaged(Packet::Type type, Packet &rxPkt, Packet &txPkt, const uint8_t *txBuf, uint8_t *rxBuf, unsigned len)
+{
+    auto hwInstance = rxPkt.getPayloadItem8(PacketXfer::EXEC_PARAMS) == UART_0 ? uart0 : uart1;
+
+    if (uart_is_writable(hwInstance)) 
+    {
+        uart_write_blocking(hwInstance, txBuf, len);
     }else 
     {
-        txPkt.setStatus(Packet::Status::RSP_SERIAL_NOT_READABLE);
+        txPkt.setStatus(Packet::Status::RSP_SERIAL_NOT_WRITABLE);
     }
+
+    return 0;
 }
 
 void SerialTask::processEvents(Packet & txPkt)
@@ -279,13 +297,15 @@ void SerialTask::processEvents(Packet & txPkt)
     {
         uint8_t qsz = (uint8_t)queue_get_level(&_irqEventQueue[q]);  
     
-        int evt_cnt = qsz < txPkt.getFreePayloadSlots() ? qsz : txPkt.getFreePayloadSlots()-1 /*env_cnt slot*/;        
+        int evt_cnt = qsz < txPkt.getFreePayloadSlots()-1 ? qsz : txPkt.getFreePayloadSlots()-2 /*instance and env_cnt slots*/;        
     
         if (evt_cnt == 0) 
         {
             continue;
         }
 
+        //the instance lets the host route the event to its UART only
+        txPkt.addPayloadItem8(q);
         txPkt.addPayloadItem8(evt_cnt); 
     
         //chain events in a single pkt
@@ -315,6 +335,11 @@ void SerialTask::processEvents(Packet & txPkt)
         //txPkt.print();
     
         mainTask.cdcWrite(CDCItf::EVENT, txPkt.getBuffer(), txPkt.getBufferLength());        
+
+        //one packet per instance
+        txPkt.reset();
+        txPkt.setType(Packet::Type::SERIAL_EVENT);
+        txPkt.setStatus(Packet::Status::RSP);
     }
 }
 
@@ -23,7 +23,6 @@ void SpiTask::reset()
 {
     auto prevState = getState();
     setState(Task::State::STOPPED);
-    sleep_ms(2);
     setState(prevState);    
 }
 
@@ -137,6 +136,35 @@ inline void SpiTask::processSetFormat(Packet & rxPkt, Packet & txPkt)
 }
 
 
+int SpiTask::processStaged(Packet::Type type, Packet &rxPkt, Packet &txPkt, const uint8_t *txBuf, uint8_t *rxBuf, unsigned len)
+{
+    auto hwInstance = rxPkt.getPayloadItem8(PacketXfer::EXEC_PARAMS) == SPI_0 ? spi0 : spi1;
+    int trBytes = 0;
+
+    switch (type)
+    {
+    case Packet::Type::SPI_WRITE:
+        trBytes = spi_write_blocking(hwInstance, txBuf, len);
+        break;
+    case Packet::Type::SPI_READ:
+        trBytes = spi_read_blocking(hwInstance, rxPkt.getPayloadItem8(PacketXfer::EXEC_PARAMS + 1), rxBuf, len);
+        break;
+    case Packet::Type::SPI_TRANSFER:
+        trBytes = spi_write_read_blocking(hwInstance, txBuf, rxBuf, len);
+        break;
+    default:
+        break;
+    }
+
+    if (trBytes != (int)len)
+    {
+        txPkt.setStatus(Packet::Status::RSP_SPI_LEN_MISMATCH);
+    }
+
+    return type == Packet::Type::SPI_WRITE ? 0 : trBytes;
+}
+
+
 void SpiTask::process(Packet &rxPkt,Packet &txPkt)
 {
      
@@ -0,0 +1,174 @@
+#include <string.h>
+
+#include "fw/tasks/xfer.h"
+#include "fw/tasks/i2c.h"
+#include "fw/tasks/serial.h"
+#include "fw/tasks/spi.h"
+#include "fw/main.h"
+
+
+XferTask &xferTask = XferTask::instance();
+
+
+void XferTask::init()
+{
+    discard(-1);
+    setState(Task::State::RUNNING);
+}
+
+void XferTask::reset()
+{
+    auto prevState = getState();
+    setState(Task::State::STOPPED);
+    discard(-1);
+    setState(prevState);    
+}
+
+void XferTask::discard(const int id)
+{
+    _id = id;
+    _length = -1;
+    _rxLength = 0;
+    _fragments.reset();
+}
+
+bool XferTask::isComplete(const unsigned len)
+{
+    unsigned fragments = (len + PacketXfer::MAX_FRAGMENT_SIZE - 1) / PacketXfer::MAX_FRAGMENT_SIZE;
+    return _length == (int)len && _fragments.count() == fragments;
+}
+
+inline void XferTask::processData(Packet & rxPkt, Packet & txPkt)
+{
+    if (rxPkt.getPayloadLength() < PacketXfer::HEADER_SIZE)
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
+
+    auto id     = rxPkt.getPayloadItem8(0);
+    auto offset = rxPkt.getPayloadItem16(1);
+    auto flags  = rxPkt.getPayloadItem8(3);
+    unsigned len = rxPkt.getPayloadLength() - PacketXfer::HEADER_SIZE;
+    bool final  = flags & PacketXfer::FLAG_FINAL;
+
+    if (id != _id)
+    {
+        discard(id); //new transfer, the previous one is dropped
+    }
+
+    //a resent fragment lands on the same offset, fragments are idempotent
+    if (offset % PacketXfer::MAX_FRAGMENT_SIZE != 0 ||
+        offset + len > PacketXfer::STAGING_SIZE ||
+        (!final && len != PacketXfer::MAX_FRAGMENT_SIZE))
+    {
+        DBG_MSG("Error: bad xfer fragment offset=%d len=%d!\n", offset, len);
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
+
+    memcpy(_txStage + offset, rxPkt.getPayloadBuffer(PacketXfer::HEADER_SIZE), len);
+    _fragments.set(offset / PacketXfer::MAX_FRAGMENT_SIZE);
+
+    if (final)
+    {
+        _length = offset + len;
+    }
+}
+
+inline void XferTask::processExec(Packet & rxPkt, Packet & txPkt)
+{
+    auto id   = rxPkt.getPayloadItem8(0);
+    auto type = static_cast<Packet::Type>(rxPkt.getPayloadItem8(1));
+    unsigned len = rxPkt.getPayloadItem16(2);
+
+    if (len > PacketXfer::STAGING_SIZE)
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
+
+    if (PacketXfer::hasTxData(type))
+    {
+        if (id != _id || !isComplete(len))
+        {
+            DBG_MSG("Error: xfer %d is incomplete!\n", id);
+            txPkt.setStatus(Packet::Status::ERR);
+            return;
+        }
+    }
+    else if (id != _id)
+    {
+        discard(id); //read only command, nothing staged
+    }
+
+    int rxLen = 0;
+
+    switch (type)
+    {
+    case Packet::Type::SPI_TRANSFER:
+    case Packet::Type::SPI_WRITE:
+    case Packet::Type::SPI_READ:
+        rxLen = spiTask.processStaged(type, rxPkt, txPkt, _txStage, _rxStage, len);
+    break;
+    case Packet::Type::I2C_WRITE:
+    case Packet::Type::I2C_READ:
+        rxLen = i2cTask.processStaged(type, rxPkt, txPkt, _txStage, _rxStage, len);
+    break;
+    case Packet::Type::SERIAL_WRITE:
+        rxLen = serialTask.processStaged(type, rxPkt, txPkt, _txStage, _rxStage, len);
+    break;
+    default:
+        txPkt.setStatus(Packet::Status::ERR);
+    break;
+    }
+
+    _rxLength = rxLen;
+    txPkt.addPayloadItem16(_rxLength);
+}
+
+inline void XferTask::processRead(Packet & rxPkt, Packet & txPkt)
+{
+    auto id     = rxPkt.getPayloadItem8(0);
+    unsigned offset = rxPkt.getPayloadItem16(1);
+    unsigned len    = rxPkt.getPayloadItem8(3);
+
+    if (id != _id || offset + len > _rxLength)
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+        return;
+    }
+
+    if (txPkt.addPayloadBuffer(_rxStage + offset, len) < 0)
+    {
+        txPkt.setStatus(Packet::Status::ERR);
+    }
+}
+
+
+void XferTask::process(Packet &rxPkt,Packet &txPkt)
+{
+     
+
+    CHECK_STATE();  
+
+    auto rxPktType = rxPkt.getType();   
+
+    switch (rxPktType)
+    {
+    case Packet::Type::XFER_DATA:
+        processData(rxPkt,txPkt);
+    break;
+    case Packet::Type::XFER_EXEC:
+        processExec(rxPkt,txPkt);
+    break;
+    case Packet::Type::XFER_READ:
+        processRead(rxPkt,txPkt);
+    break;
+
+    default:                   
+        break;
+    } 
+                
+        
+}
@@ -0,0 +1,54 @@
+#pragma once 
+
+#include <bitset>
+
+#include "main.h"
+
+/**
+ * @brief Staging buffers of the transfers larger than a packet, see PacketXfer.
+ *
+ * XFER_EXEC hands the whole staged buffer to the bus task, which runs it
+ * as a single transaction (processStaged).
+ */
+class XferTask : public Task {
+
+public:   
+
+    void init() override;
+    void reset() override;
+
+    void process(Packet &rxPkt,Packet &txPkt) override;       
+
+
+public:
+    static XferTask & instance() 
+    {
+        static XferTask inst;
+        return inst;
+    }
+    // Prevent copy construction and assignment
+    XferTask(const XferTask&) = delete;
+    XferTask& operator=(const XferTask&) = delete;
+    virtual ~XferTask() {}  
+
+private:  
+    XferTask() {};        
+    
+    //task actions
+    void processData(Packet & rxPkt, Packet & txPkt);
+    void processExec(Packet & rxPkt, Packet & txPkt);
+    void processRead(Packet & rxPkt, Packet & txPkt);
+
+    void discard(const int id);
+    bool isComplete(const unsigned len);
+
+    uint8_t  _txStage[PacketXfer::STAGING_SIZE];
+    uint8_t  _rxStage[PacketXfer::STAGING_SIZE];
+    std::bitset<PacketXfer::MAX_FRAGMENTS> _fragments; /**< Received XFER_DATA fragments */
+    int      _id;        /**< Staged transfer ID, -1 if none */
+    int      _length;    /**< Staged length, -1 until the final fragment is received */
+    unsigned _rxLength;  /**< Bytes read back by the last XFER_EXEC */
+
+};
+
+extern XferTask & xferTask;
@@ -91,19 +91,37 @@
 #endif
 
 //------------- CLASS -------------//
+// Data and event channels: two CDC-ACM functions, or two vendor class
+// interfaces when built with IOIG_USB_VENDOR
+#if IOIG_USB_VENDOR
+#define CFG_TUD_CDC               0
+#define CFG_TUD_VENDOR            2
+#else
 #define CFG_TUD_CDC               2
+#define CFG_TUD_VENDOR            0
+#endif
 #define CFG_TUD_MSC               0
 #define CFG_TUD_HID               0
 #define CFG_TUD_MIDI              0
-#define CFG_TUD_VENDOR            0
 
 // CDC FIFO size of TX and RX
-#define CFG_TUD_CDC_RX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
-#define CFG_TUD_CDC_TX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
+// Holds a whole window of commands (host TransferEngine::MAX_WRITE_SIZE),
+// and the responses written while the previous ones are still on the bus
+#define CFG_TUD_CDC_RX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 2048 : 1024)
+#define CFG_TUD_CDC_TX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 2048 : 1024)
 
 // CDC Endpoint transfer buffer size, more is faster
+// Kept at one max-size packet: an OUT transfer then completes on every
+// packet, the host doesn't have to end its multi-packet writes with a ZLP.
+// IN transfers still go out back to back, tinyUSB adds the ZLP when the
+// FIFO drains on a packet boundary.
 #define CFG_TUD_CDC_EP_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
 
+// Vendor class FIFOs and endpoint buffers, same sizes as CDC
+#define CFG_TUD_VENDOR_RX_BUFSIZE  CFG_TUD_CDC_RX_BUFSIZE
+#define CFG_TUD_VENDOR_TX_BUFSIZE  CFG_TUD_CDC_TX_BUFSIZE
+#define CFG_TUD_VENDOR_EPSIZE      CFG_TUD_CDC_EP_BUFSIZE
+
 #ifdef __cplusplus
  }
 #endif
@@ -57,7 +57,11 @@ tusb_desc_device_t const desc_device =
     .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
 
     .idVendor           = IOIG_VID,
+#if IOIG_USB_VENDOR
+    .idProduct          = IOIG_VENDOR_PID,
+#else
     .idProduct          = IOIG_PID,
+#endif
     .bcdDevice          = 0x0100,
 
     .iManufacturer      = 0x01,
@@ -77,6 +81,33 @@ uint8_t const * tud_descriptor_device_cb(void)
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
+#if IOIG_USB_VENDOR
+
+enum
+{
+  ITF_NUM_VENDOR_DATA = 0,
+  ITF_NUM_VENDOR_EVENT,
+  ITF_NUM_TOTAL
+};
+
+
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + CFG_TUD_VENDOR * TUD_VENDOR_DESC_LEN)
+
+uint8_t const desc_configuration[] =
+{
+  // Config number, interface count, string index, total length, attribute, power in mA
+  TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 300),
+
+  // Data: Interface number, string index, EP Out & IN address, EP size
+  TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR_DATA, 4, CDC_DATA_EP_OUT, CDC_DATA_EP_IN, CFG_TUD_VENDOR_EPSIZE),
+
+  // Event: Interface number, string index, EP Out & IN address, EP size
+  TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR_EVENT, 5, CDC_EVENT_EP_OUT, CDC_EVENT_EP_IN, CFG_TUD_VENDOR_EPSIZE),
+
+};
+
+#else
+
 enum
 {
   ITF_NUM_CDC_0 = 0,
@@ -102,6 +133,8 @@ uint8_t const desc_configuration[] =
 
 };
 
+#endif
+
 
 // device qualifier is mostly similar to device descriptor since we don't change configuration based on speed
 tusb_desc_device_qualifier_t const desc_device_qualifier =
@@ -1,4 +1,5 @@
 #include "ioig_private.h"
+#include "ioig_messages.h"
 #include <iostream>
 #include "analog.h"
 
@@ -40,9 +41,7 @@ AnalogIn::~AnalogIn()
 {    
     Packet txPkt;
     Packet rxPkt;
-    txPkt.setType(Packet::Type::ANALOG_DEINIT);
-    txPkt.addPayloadItem8(_pin);
-    txPkt.addPayloadItem8(0); 
+    msg::AnalogDeinit::encode(txPkt, _pin, 0);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 }
@@ -50,31 +49,62 @@ AnalogIn::~AnalogIn()
 
 void AnalogIn::initialize()
 {
+    using Init = msg::AnalogInit;
+
     Packet txPkt;
     Packet rxPkt;
 
-    txPkt.setType(Packet::Type::ANALOG_INIT);
-    
-    auto txp0 = txPkt.addPayloadItem8(_pin);
-    auto txp1 = txPkt.addPayloadItem8(0); //mode 0 = ADC , 1 = PWM
+    Init::encode(txPkt, _pin, 0); //mode 0 = ADC , 1 = PWM
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-    auto rxp0 = rxPkt.getPayloadItem8(0);
-    auto rxp1 = rxPkt.getPayloadItem8(1);
+    if (!Init::fits(rxPkt))
+    {
+        LOG_ERR(TAG, "Invalid response from device : %zu bytes", rxPkt.getPayloadLength());
+        return;
+    }
+
+    auto txp0 = Init::get<Init::PIN>(txPkt);
+    auto rxp0 = Init::get<Init::PIN>(rxPkt);
+    auto rxp1 = Init::get<Init::MODE>(rxPkt);
 
     if (  txp0 != rxp0  ) 
     {
         LOG_ERR(TAG, "Invalid response from device ( pin ) : expected = %d, received = %d", txp0, rxp0);
     }
 
-    if (  txp1 != rxp1  ) 
+    if (  rxp1 != 0  ) 
     {
-        LOG_ERR(TAG, "Invalid response from device ( mode ) : expected = %d, received = %d", txp1, rxp1);
+        LOG_ERR(TAG, "Invalid response from device ( mode ) : expected = %d, received = %d", 0, rxp1);
     }
 }
 
 
+static void addRead(Packet &txPkt, uint8_t channel, uint8_t resolution)
+{
+    msg::AnalogRead::encode(txPkt, channel, resolution);
+}
+
+static uint16_t getRead(Packet &rxPkt, uint8_t channel)
+{
+    using Rsp = msg::AnalogReadRsp;
+
+    if (!Rsp::fits(rxPkt))
+    {
+        LOG_ERR("AnalogIn", "Invalid response from device : %zu bytes", rxPkt.getPayloadLength());
+        return 0;
+    }
+
+    auto rxp0 = Rsp::get<Rsp::CHANNEL>(rxPkt);
+
+    if (rxp0 != channel) 
+    {
+        LOG_ERR("AnalogIn", "Invalid response from device ( channel ) : expected = %d, received = %d", channel, rxp0);
+    }
+
+    return Rsp::get<Rsp::VALUE>(rxPkt);
+}
+
 uint16_t AnalogIn::read_u16()
 {
     checkAndInitialize();
@@ -82,37 +112,45 @@ uint16_t AnalogIn::read_u16()
     Packet txPkt(8);
     Packet rxPkt(16);
 
-    txPkt.setType(Packet::Type::ANALOG_READ);    
-    txPkt.addPayloadItem8(_channel);
-    txPkt.addPayloadItem8(_resolution);
+    addRead(txPkt, _channel, _resolution);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-    auto rxp0 = rxPkt.getPayloadItem8(0);
+    return getRead(rxPkt, _channel);
+}
 
-    if (rxp0 != _channel) 
-    {
-        LOG_ERR(TAG, "Invalid response from device ( channel ) : expected = %d, received = %d", _channel, rxp0);
-    }
+AsyncResult<uint16_t> AnalogIn::read_u16Async()
+{
+    checkAndInitialize();
+
+    AsyncResult<uint16_t> result;
+    auto xfer = std::make_shared<AsyncXfer>();
+    addRead(xfer->txPkt, _channel, _resolution);
 
-    uint16_t readVal = rxPkt.getPayloadItem16(1);
+    UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer, result, channel = _channel](int ret)
+    {
+        result.complete(ret < 0 ? 0 : getRead(xfer->rxPkt, channel));
+    });
 
-    return readVal;
+    return result;
 }
 
 
+
 float AnalogIn::readOnboardTemp()
 {
     checkAndInitialize();
 
+    using Rsp = msg::AnalogReadTempRsp;
+
     Packet txPkt(8);
     Packet rxPkt(8);
 
-    txPkt.setType(Packet::Type::ANALOG_READ_TEMP);    
+    msg::AnalogReadTemp::encode(txPkt);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-    return rxPkt.getPayloadItemFloat(0);
+    return Rsp::fits(rxPkt) ? Rsp::get<Rsp::CELSIUS>(rxPkt) : -1;
 }
 
 
@@ -144,34 +182,40 @@ AnalogOut::~AnalogOut()
     Packet txPkt;
     Packet rxPkt;
 
-    txPkt.setType(Packet::Type::ANALOG_DEINIT);
-    txPkt.addPayloadItem8(_pin);
-    txPkt.addPayloadItem8(1); //PWM Mode
-    txPkt.addPayloadItem8(_pwmSlice); 
+    msg::AnalogDeinitPwm::encode(txPkt, _pin, 1 /*PWM Mode*/, _pwmSlice);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 }
 
 void AnalogOut::initialize()
 {
+    using Init = msg::AnalogInitPwm;
+    using Rsp = msg::AnalogInitPwmRsp;
+
     Packet txPkt;
     Packet rxPkt;
 
-    txPkt.setType(Packet::Type::ANALOG_INIT);
-    
-    auto txp0 = txPkt.addPayloadItem8(_pin);
-    auto txp1 = txPkt.addPayloadItem8(1); //PWM Mode
-    auto txp2 = txPkt.addPayloadItem32(_pwmCountTop); 
-    auto txp3 = txPkt.addPayloadItem64(_pwmPeriod_us); 
+    Init::encode(txPkt, _pin, 1 /*PWM Mode*/, _pwmCountTop, _pwmPeriod_us);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-    auto rxp0 = rxPkt.getPayloadItem8(0);   //pin
-    auto rxp1 = rxPkt.getPayloadItem8(1);   //mode
-    auto rxp2 = rxPkt.getPayloadItem32(2);  //count top
-    auto rxp3 = rxPkt.getPayloadItem64(6);  //period us
-    _pwmSlice = rxPkt.getPayloadItem8(14);  //slice
-    auto rxp4 = rxPkt.getPayloadItem8(15);  //channel
+    if (!Rsp::fits(rxPkt))
+    {
+        LOG_ERR(TAG, "Invalid response from device : %zu bytes", rxPkt.getPayloadLength());
+        return;
+    }
+
+    auto txp0 = Init::get<Init::PIN>(txPkt);
+    auto txp1 = Init::get<Init::MODE>(txPkt);
+    auto txp2 = Init::get<Init::COUNT_TOP>(txPkt);
+    auto txp3 = Init::get<Init::PERIOD_US>(txPkt);
+
+    auto rxp0 = Rsp::get<Rsp::PIN>(rxPkt);
+    auto rxp1 = Rsp::get<Rsp::MODE>(rxPkt);
+    auto rxp2 = Rsp::get<Rsp::COUNT_TOP>(rxPkt);
+    auto rxp3 = Rsp::get<Rsp::PERIOD_US>(rxPkt);
+    _pwmSlice = Rsp::get<Rsp::SLICE>(rxPkt);
+    auto rxp4 = Rsp::get<Rsp::CHANNEL>(rxPkt);
 
 
     if (  txp0 != rxp0  ) 
@@ -213,20 +257,19 @@ void AnalogOut::write_u16(uint16_t value)
 {
     checkAndInitialize();
 
+    using Rsp = msg::AnalogWriteRsp;
+
     Packet txPkt;
     Packet rxPkt(16);
 
-    txPkt.setType(Packet::Type::ANALOG_WRITE);
-    
-    txPkt.addPayloadItem8(_pin);
-    txPkt.addPayloadItem32(_pwmSlice);
-    txPkt.addPayloadItem16(value);
-    txPkt.addPayloadItem32(_pwmCountTop);
-    txPkt.addPayloadItem8(_resolution);
+    msg::AnalogWrite::encode(txPkt, _pin, _pwmSlice, value, _pwmCountTop, _resolution);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-    _pwmPercent = rxPkt.getPayloadItemFloat(0);    
+    if (Rsp::fits(rxPkt))
+    {
+        _pwmPercent = Rsp::get<Rsp::PERCENT>(rxPkt);
+    }
     
 }
 
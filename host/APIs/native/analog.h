@@ -50,6 +50,14 @@ namespace ioig
          */
         uint16_t read_u16();
 
+        /** 
+         * @brief Read the input voltage, without waiting for the device.
+         *
+         * @note Non blocking.
+         * @returns once completed, the input voltage normalized to a 16-bit value, 0 on error.
+         */
+        AsyncResult<uint16_t> read_u16Async();
+
         /**
          * @brief Read onboard temperature sensor.
          * 
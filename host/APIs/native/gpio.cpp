@@ -1,4 +1,5 @@
 #include "ioig_private.h"
+#include "ioig_messages.h"
 #include "gpio.h"
 
 using namespace ioig;
@@ -8,41 +9,74 @@ using namespace std::chrono_literals;
 class ioig::GpioImpl : public EventHandler 
 {
 public:
-    GpioImpl(Gpio& parent): _parent(parent), _eventMask(0), _eventCallback(nullptr) {}
+    GpioImpl(Gpio& parent): _parent(parent), _eventMask(0), _eventCallback(nullptr), _irqMask(0), _registered(false) {}
     ~GpioImpl() {  UsbManager::removeEventHandler(this, _parent._usbPort ); };
     
-    void onEvent(Packet &eventPkt) override
+    void onEvent(const Event &evt) override
     {
-        int event_cnt = eventPkt.getPayloadItem8(0);
-        auto pktType = eventPkt.getType();
+        uint32_t evtFilter = evt.flags & _eventMask;
 
-        if (pktType != Packet::Type::GPIO_EVENT)
+        if (evtFilter != 0 && _eventCallback != nullptr)
         {
-            return;
+            _eventCallback(evt.key.id, evt.flags, evt.timestamp, _callbackArg);
         }
 
-        for (int i = 1; i < event_cnt * 4; i += 4) // skip four bytes on every iteration
-        {
-            uint32_t gpio_evt = eventPkt.getPayloadItem32(i);
-
-            uint32_t evt_pin = ((gpio_evt >> 16) & 0xFFFF); // hi
-            uint32_t evts = (gpio_evt & 0xFFFF);            // lo
-
-            uint32_t evtFilter = evts & _eventMask;
+        completeWaits(evt.flags, {evt.key.id, evt.flags, evt.timestamp});
+    }
 
-            if (_parent._pin == (int)evt_pin && evtFilter != 0 && _eventCallback != nullptr)
+    /**
+     * Completes the waitForEdge() results matching events, all of them if events is ~0.
+     */
+    void completeWaits(uint32_t events, const GpioEdge &edge)
+    {
+        std::vector<EdgeWait> done;
+        {
+            std::lock_guard<std::mutex> lock(_waitMutex);
+            for (auto it = _edgeWaits.begin(); it != _edgeWaits.end();)
             {
-                _eventCallback(evt_pin, evts, _callbackArg);
+                if ((it->events & events) != 0)
+                {
+                    done.push_back(*it);
+                    it = _edgeWaits.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
             }
         }
+
+        for (auto &wait : done)
+        {
+            wait.result.complete(edge);
+        }
     }
 
+    struct EdgeWait
+    {
+        uint32_t events;
+        AsyncResult<GpioEdge> result;
+    };
+
     Gpio & _parent;
     uint32_t _eventMask;
-    Gpio::InterruptHandler _eventCallback;
+    Gpio::TimedInterruptHandler _eventCallback;
     void * _callbackArg;
+
+    std::mutex _waitMutex;
+    std::vector<EdgeWait> _edgeWaits;
+    uint32_t _irqMask;  ///< Events enabled on the device, setInterrupt() and waits
+    bool _registered;   ///< Routed by the UsbManager
 };
 
+static void addSetIrq(Packet &txPkt, int pin, bool enable, uint32_t events)
+{
+    txPkt.setType(Packet::Type::GPIO_SET_IRQ);
+    txPkt.addPayloadItem8(pin);
+    txPkt.addPayloadItem8(enable);
+    txPkt.addPayloadItem32(events);
+}
+
 
 Gpio::Gpio(Gpio&& other) noexcept
     : Peripheral(std::move(other)),  // Move base class
@@ -143,27 +177,66 @@ void Gpio::write(int value)
     Packet txPkt(4);
     Packet rxPkt(4);
 
-    txPkt.setType(Packet::Type::GPIO_SET_VALUE);    
-    txPkt.addPayloadItem8(_pin);
-    txPkt.addPayloadItem8(value);
+    msg::GpioSetValue::encode(txPkt, _pin, value);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
 }
 
+AsyncResult<int> Gpio::writeAsync(int value)
+{
+    checkAndInitialize();
+
+    if ( _dir == PinDirection::Input )
+    {
+        LOG_ERR(TAG, "Can't write on input pin");
+    }
+
+    AsyncResult<int> result;
+    auto xfer = std::make_shared<AsyncXfer>();
+
+    msg::GpioSetValue::encode(xfer->txPkt, _pin, value);
+
+    UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer, result](int ret)
+    {
+        result.complete(ret < 0 ? -1 : 0);
+    });
+
+    return result;
+}
+
 int Gpio::read()
 {
     checkAndInitialize();
 
+    using Rsp = msg::GpioGetValueRsp;
+
     Packet txPkt(4);
     Packet rxPkt(4);
 
-    txPkt.setType(Packet::Type::GPIO_GET_VALUE);
-    txPkt.addPayloadItem8(_pin);
+    msg::GpioGetValue::encode(txPkt, _pin);
     
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-    return rxPkt.getPayloadItem8(0);    
+    return Rsp::fits(rxPkt) ? Rsp::get<Rsp::VALUE>(rxPkt) : -1;
+}
+
+AsyncResult<int> Gpio::readAsync()
+{
+    checkAndInitialize();
+
+    AsyncResult<int> result;
+    auto xfer = std::make_shared<AsyncXfer>();
+
+    msg::GpioGetValue::encode(xfer->txPkt, _pin);
+
+    UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer, result](int ret)
+    {
+        using Rsp = msg::GpioGetValueRsp;
+        result.complete(ret < 0 || !Rsp::fits(xfer->rxPkt) ? -1 : Rsp::get<Rsp::VALUE>(xfer->rxPkt));
+    });
+
+    return result;
 }
 
 void Gpio::output()
@@ -266,18 +339,25 @@ unsigned long Gpio::pulseIn(uint8_t state, unsigned long timeout)
     Packet txPkt;
     Packet rxPkt;
 
-    txPkt.setType(Packet::Type::GPIO_PULSE_IN);
-    
-    txPkt.addPayloadItem8(_pin);
-    txPkt.addPayloadItem8(state);
-    txPkt.addPayloadItem64(timeout);
+    using Rsp = msg::GpioPulseInRsp;
+
+    msg::GpioPulseIn::encode(txPkt, _pin, state, timeout);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-    return rxPkt.getPayloadItem64(0);
+    //no duration on timeout
+    return Rsp::fits(rxPkt) ? Rsp::get<Rsp::DURATION_US>(rxPkt) : -1;
 }
 
 void Gpio::setInterrupt(const uint32_t events, const InterruptHandler &cbk, void * arg)
+{
+    setInterrupt(events, [cbk](const int pin, const uint32_t evts, const uint32_t, void * cbkArg)
+    {
+        cbk(pin, evts, cbkArg);
+    }, arg);
+}
+
+void Gpio::setInterrupt(const uint32_t events, const TimedInterruptHandler &cbk, void * arg)
 { 
     checkAndInitialize();
 
@@ -295,8 +375,13 @@ void Gpio::setInterrupt(const uint32_t events, const InterruptHandler &cbk, void
     pimpl->_eventMask = events;    
     pimpl->_eventCallback = cbk;
 
+    {
+        std::lock_guard<std::mutex> lock(pimpl->_waitMutex);
+        pimpl->_irqMask |= events;
+        pimpl->_registered = true;
+    }
 
-    UsbManager::registerEventHandler( pimpl.get() , _usbPort);
+    UsbManager::registerEventHandler( pimpl.get() , {Packet::Type::GPIO_EVENT, (uint8_t)_pin}, _usbPort);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
@@ -321,12 +406,54 @@ void Gpio::setInterrupt(const uint32_t events, const InterruptHandler &cbk, void
 }
 
 
+AsyncResult<GpioEdge> Gpio::waitForEdge(const uint32_t events)
+{
+    checkAndInitialize();
+
+    AsyncResult<GpioEdge> result;
+    uint32_t irqMask;
+    bool registered;
+
+    {
+        std::lock_guard<std::mutex> lock(pimpl->_waitMutex);
+        pimpl->_edgeWaits.push_back({events, result});
+
+        if ((pimpl->_irqMask & events) == events)
+        {
+            return result; //enabled already
+        }
+        registered = pimpl->_registered;
+        pimpl->_registered = true;
+        pimpl->_irqMask |= events;
+        irqMask = pimpl->_irqMask;
+    }
+
+    if (!registered)
+    {
+        UsbManager::registerEventHandler(pimpl.get(), {Packet::Type::GPIO_EVENT, (uint8_t)_pin}, _usbPort);
+    }
+
+    //the response is not waited for, only the event
+    auto xfer = std::make_shared<AsyncXfer>();
+    addSetIrq(xfer->txPkt, _pin, true, irqMask);
+    UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer](int) {});
+
+    return result;
+}
+
+
 void Gpio::disableInterrupt()
 {
     checkAndInitialize();
 
     pimpl->_callbackArg = nullptr;
 
+    {
+        std::lock_guard<std::mutex> lock(pimpl->_waitMutex);
+        pimpl->_irqMask = 0;
+    }
+    pimpl->completeWaits(~0u, {_pin, 0, 0});
+
     //TODO: usbDevice.removeEventHandler
 
     Packet txPkt(16);
@@ -360,3 +487,7 @@ void Gpio::disableInterrupt()
     }    
 }
 
+uint64_t Gpio::getDroppedEvents()
+{
+    return pimpl->getDroppedEvents();
+}
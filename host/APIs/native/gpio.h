@@ -65,6 +65,16 @@ namespace ioig
     // Forward declaration of the implementation class
     class GpioImpl;
 
+    /**
+     * @brief A GPIO interrupt event, result of Gpio::waitForEdge().
+     */
+    struct GpioEdge
+    {
+        int pin;                ///< The GPIO pin number.
+        uint32_t events;        ///< PinEvent flags, 0 if the wait was cancelled.
+        uint32_t timestamp_us;  ///< Device time of the interrupt, in microseconds.
+    };
+
     /**
      * @brief Gpio Class for General Purpose Input/Output Operations.
      *
@@ -82,6 +92,15 @@ namespace ioig
          */
         using InterruptHandler = std::function<void(const int pin, const uint32_t events, void * arg)>;
 
+        /**
+         * @brief Interrupt handler that also receives the device time of the interrupt.
+         *
+         * timestamp_us is the device clock, in microseconds, read in the irq handler.
+         * It wraps around every ~71 minutes: take intervals as unsigned differences.
+         * Always 0 with a firmware predating the v2 protocol, see UsbManager::getProtocol().
+         */
+        using TimedInterruptHandler = std::function<void(const int pin, const uint32_t events, const uint32_t timestamp_us, void * arg)>;
+
         /**
          * @brief Default constructor.
          *
@@ -127,6 +146,15 @@ namespace ioig
          */
         void write(int value);
 
+        /**
+         * @brief Write a value to the GPIO pin, without waiting for the device.
+         *
+         * @note Non blocking.
+         * @param value The value to write (0 for logical low, 1 for logical high).
+         * @return once completed, 0 on success, -1 on error.
+         */
+        AsyncResult<int> writeAsync(int value);
+
         /**
          * @brief Read the value from the GPIO pin.
          *
@@ -134,6 +162,14 @@ namespace ioig
          */
         int read();
 
+        /**
+         * @brief Read the value from the GPIO pin, without waiting for the device.
+         *
+         * @note Non blocking.
+         * @return once completed, the value read from the pin, -1 on error.
+         */
+        AsyncResult<int> readAsync();
+
         /**
          * @brief Set the Gpio as an output.
          */
@@ -187,11 +223,37 @@ namespace ioig
          */
         void setInterrupt(const uint32_t events, const InterruptHandler &cbk, void * arg=nullptr);
 
+        /**
+         * @brief Enable interrupts for the GPIO pin, the callback gets the device timestamp of each event.
+         *
+         * @param events The event mask specifying which events to listen for.
+         * @param cbk The callback function invoked on interrupt events.
+         */
+        void setInterrupt(const uint32_t events, const TimedInterruptHandler &cbk, void * arg=nullptr);
+
+        /**
+         * @brief Wait for the next interrupt event on the GPIO pin, without blocking.
+         *
+         * Enables the interrupt for events on the device if needed, along with
+         * the ones of setInterrupt(). The handler set by setInterrupt() is still called.
+         *
+         * @note Non blocking. disableInterrupt() cancels the waits, with no event.
+         * @param events The event mask to wait for, e.g. RiseEdge.
+         * @return once an event matches, the event
+         */
+        AsyncResult<GpioEdge> waitForEdge(const uint32_t events);
+
         /**
          * @brief Disable interrupts for the GPIO pin.
          */
         void disableInterrupt();
 
+        /**
+         * @brief Interrupt events of this pin lost because the host event queue was full.
+         * @see UsbManager::setEventOverflowPolicy
+         */
+        uint64_t getDroppedEvents();
+
     private:
         /**
          * @brief Initialize the GPIO pin.
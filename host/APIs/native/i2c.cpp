@@ -6,13 +6,91 @@
 using namespace ioig;
 using namespace std::chrono_literals;
 
+static int getResult(Packet &rspPkt)
+{
+    switch (rspPkt.getStatus())
+    {
+    case Packet::Status::RSP:
+        return 0;
+    case Packet::Status::RSP_I2C_NACK:
+        return -1;        
+    case Packet::Status::RSP_I2C_TIMEOUT:
+        return -2;
+    default:
+        return -3;
+    } 
+}
+
+/**
+ * Reads and writes larger than a packet go through the device staging
+ * buffer, still as a single I2C transaction (up to PacketXfer::STAGING_SIZE).
+ */
+static int transferStaged(int usb_port, int hw_instance, Packet::Type type, int address,
+                          const uint8_t *tx_buffer, uint8_t *rx_buffer, int length, bool nostop,
+                          uint32_t timeout_us)
+{
+    Packet execPkt;
+    Packet rspPkt;
+    PacketXfer::addExec(execPkt, 0, type, length);
+    execPkt.addPayloadItem8(hw_instance);
+    execPkt.addPayloadItem8(address);
+    execPkt.addPayloadItem8(nostop);
+
+    //the bus transaction may take up to the device timeout
+    unsigned timeout_ms = 600 + timeout_us / 1000;
+
+    if (UsbManager::transferStaged(execPkt, tx_buffer, rx_buffer, rspPkt, usb_port, timeout_ms) < 0)
+    {
+        return -3;
+    }
+
+    return getResult(rspPkt);
+}
+
+static void addRead(Packet &txPkt, int hw_instance, int address, int length, bool nostop)
+{
+    txPkt.setType(Packet::Type::I2C_READ);
+    txPkt.addPayloadItem8(hw_instance);
+    txPkt.addPayloadItem8(address);
+    txPkt.addPayloadItem8(length);
+    txPkt.addPayloadItem8(nostop);
+}
+
+static void addWrite(Packet &txPkt, int hw_instance, int address, const uint8_t *data, int length, bool nostop)
+{
+    txPkt.setType(Packet::Type::I2C_WRITE);
+    txPkt.addPayloadItem8(hw_instance);
+    txPkt.addPayloadItem8(address);
+    txPkt.addPayloadItem8(length);
+    txPkt.addPayloadItem8(nostop);
+
+    if (txPkt.addPayloadBuffer(data,length) < 0)
+    {
+        LOG_ERR("I2C", "Wr buffer overflow, requested %d bytes, available %d bytes", length, txPkt.getFreePayloadSlots());
+    }  
+}
+
+static int getRead(Packet &rxPkt, uint8_t *data, int length)
+{
+    if (rxPkt.getPayloadLength() > (size_t)length) 
+    {
+        LOG_ERR("I2C", "Invalid rx length : %d", length);
+        return -1;
+    }
+    
+    memcpy(data, rxPkt.getPayloadBuffer(), rxPkt.getPayloadLength());
+
+    return getResult(rxPkt);
+}
+
 
 I2C::I2C(int sda, int scl, unsigned long freq_hz, unsigned hw_instance)
     :_sda(sda),
      _scl(scl),
      _freq(freq_hz),
      _addr(0),
-     _hwInstance(hw_instance)
+     _hwInstance(hw_instance),
+     _timeout(1000'000) /*firmware default, 1s*/
 {  
 
     if (_sda >= TARGET_PINS_COUNT) 
@@ -118,6 +196,8 @@ void I2C::setTimeout(unsigned long timeout)
 {
     checkAndInitialize();
 
+    _timeout = timeout;
+
     Packet txPkt(8);
     Packet rxPkt(8);
 
@@ -138,36 +218,51 @@ int I2C::read(int address, uint8_t *data, int length, bool nostop)
 {
     checkAndInitialize();
 
+    if (length > (int)(Packet::MAX_SIZE - Packet::Header::SIZE))
+    {
+        if (length > (int)PacketXfer::STAGING_SIZE)
+        {
+            LOG_ERR(TAG, "Transfer too large, requested %d bytes, max %d bytes", length, PacketXfer::STAGING_SIZE);
+            return -3;
+        }
+        return transferStaged(_usbPort, _hwInstance, Packet::Type::I2C_READ, address, nullptr, data, length, nostop, _timeout);
+    }
+
     Packet txPkt;
     Packet rxPkt;    
 
-    txPkt.setType(Packet::Type::I2C_READ);
-    txPkt.addPayloadItem8(_hwInstance);  
-    txPkt.addPayloadItem8(address);
-    txPkt.addPayloadItem8(length); 
-    txPkt.addPayloadItem8(nostop); 
+    addRead(txPkt, _hwInstance, address, length, nostop);
        
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-    if (rxPkt.getPayloadLength() > (size_t)length) 
+    return getRead(rxPkt, data, length);
+}
+
+AsyncResult<int> I2C::readAsync(int address, uint8_t *data, int length, bool nostop)
+{
+    checkAndInitialize();
+
+    AsyncResult<int> result;
+
+    if (length > (int)(Packet::MAX_SIZE - Packet::Header::SIZE))
     {
-        LOG_ERR(TAG, "Invalid rx length : %d", length);
-        return -1;
+        LOG_ERR(TAG, "Async read too large, requested %d bytes, max %d bytes", length, (int)(Packet::MAX_SIZE - Packet::Header::SIZE));
+        result.complete(-3);
+        return result;
     }
-    
-    memcpy(data, rxPkt.getPayloadBuffer(), rxPkt.getPayloadLength());
 
-    switch (rxPkt.getStatus())
+    auto xfer = std::make_shared<AsyncXfer>();
+    addRead(xfer->txPkt, _hwInstance, address, length, nostop);
+
+    //the bus transaction may take up to the device timeout
+    unsigned timeout_ms = 600 + _timeout / 1000;
+
+    UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer, result, data, length](int ret)
     {
-    case Packet::Status::RSP:
-        return 0;
-    case Packet::Status::RSP_I2C_NACK:
-        return -1;        
-    case Packet::Status::RSP_I2C_TIMEOUT:
-        return -2;
-    default:
-        return -3;
-    } 
+        result.complete(ret < 0 ? -3 : getRead(xfer->rxPkt, data, length));
+    }, timeout_ms);
+
+    return result;
 }
 
 
@@ -175,33 +270,50 @@ int I2C::write(int address, const uint8_t *data, int length, bool nostop)
 {
     checkAndInitialize();
 
+    if (length > (int)(Packet::MAX_SIZE - Packet::Header::SIZE - 4))
+    {
+        if (length > (int)PacketXfer::STAGING_SIZE)
+        {
+            LOG_ERR(TAG, "Transfer too large, requested %d bytes, max %d bytes", length, PacketXfer::STAGING_SIZE);
+            return -3;
+        }
+        return transferStaged(_usbPort, _hwInstance, Packet::Type::I2C_WRITE, address, data, nullptr, length, nostop, _timeout);
+    }
+
     Packet txPkt;
     Packet rxPkt;    
 
-    txPkt.setType(Packet::Type::I2C_WRITE);
-    txPkt.addPayloadItem8(_hwInstance);        
-    txPkt.addPayloadItem8(address);
-    txPkt.addPayloadItem8(length);    
-    txPkt.addPayloadItem8(nostop); 
-
-    if (txPkt.addPayloadBuffer(data,length) < 0)
-    {
-        LOG_ERR(TAG, "Wr buffer overflow, requested %d bytes, available %d bytes", length, txPkt.getFreePayloadSlots());
-    }  
+    addWrite(txPkt, _hwInstance, address, data, length, nostop);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);        
     
-    switch (rxPkt.getStatus())
+    return getResult(rxPkt);
+}
+
+AsyncResult<int> I2C::writeAsync(int address, const uint8_t *data, int length, bool nostop)
+{
+    checkAndInitialize();
+
+    AsyncResult<int> result;
+
+    if (length > (int)(Packet::MAX_SIZE - Packet::Header::SIZE - 4))
     {
-    case Packet::Status::RSP:
-        return 0;
-    case Packet::Status::RSP_I2C_NACK:
-        return -1;        
-    case Packet::Status::RSP_I2C_TIMEOUT:
-        return -2;
-    default:
-        return -3;
-    }    
+        LOG_ERR(TAG, "Async write too large, requested %d bytes, max %d bytes", length, (int)(Packet::MAX_SIZE - Packet::Header::SIZE - 4));
+        result.complete(-3);
+        return result;
+    }
+
+    auto xfer = std::make_shared<AsyncXfer>();
+    addWrite(xfer->txPkt, _hwInstance, address, data, length, nostop);
+
+    //the bus transaction may take up to the device timeout
+    unsigned timeout_ms = 600 + _timeout / 1000;
+
+    UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer, result](int ret)
+    {
+        result.complete(ret < 0 ? -3 : getResult(xfer->rxPkt));
+    }, timeout_ms);
 
+    return result;
 }
 
@@ -100,6 +100,20 @@ namespace ioig
          */
         int read(int address, uint8_t *data, int length, bool nostop = false);
 
+        /** Read from an I2C slave, without waiting for the device
+         *
+         *  @note Non blocking. data must stay valid until completion.
+         *        Up to a packet of data (60 bytes), larger reads complete with -3.
+         *
+         *  @param address 8-bit I2C slave address [ addr | 1 ]
+         *  @param data Pointer to the byte-array to read data in to
+         *  @param length Number of bytes to read
+         *  @param nostop Repeated start, true - don't send stop at end
+         *
+         *  @returns once completed, 0 on success, -1 on NAC, -2 on Timeout, -3 unknown error
+         */
+        AsyncResult<int> readAsync(int address, uint8_t *data, int length, bool nostop = false);
+
 
         /** Write to an I2C slave
          *
@@ -116,6 +130,20 @@ namespace ioig
          */
         int write(int address, const uint8_t *data, int length, bool nostop = false);
 
+        /** Write to an I2C slave, without waiting for the device
+         *
+         *  @note Non blocking. data is copied before return.
+         *        Up to a packet of data (56 bytes), larger writes complete with -3.
+         *
+         *  @param address 8-bit I2C slave address [ addr | 0 ]
+         *  @param data Pointer to the byte-array data to send
+         *  @param length Number of bytes to send
+         *  @param nostop Repeated start, true - do not send stop at end
+         *
+         *  @returns once completed, 0 on success, -1 on NAC, -2 on Timeout, -3 unknown error
+         */
+        AsyncResult<int> writeAsync(int address, const uint8_t *data, int length, bool nostop = false);
+
 
         void set_addr(int addr) { _addr = addr; }
         int get_addr() { return _addr; }
@@ -15,6 +15,7 @@ static constexpr int MAX_USB_DEVICES = 8;
 
 
 #include "ioig_periph.h"
+#include "ioig_async.h"
 #include "analog.h"
 #include "gpio.h"
 #include "spi.h"
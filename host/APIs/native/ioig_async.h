@@ -0,0 +1,185 @@
+/**
+ * @file ioig_async.h
+ * @brief Result of the asynchronous peripheral calls.
+ */
+
+#pragma once
+
+#ifdef IOIG_HOST
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define IOIG_HAS_COROUTINES 1
+#endif
+#endif
+
+namespace ioig
+{
+
+    /**
+     * @class AsyncResult
+     * @brief Value of a peripheral call completing later, set from the transport completion path.
+     *
+     * Awaitable from a C++20 coroutine:
+     *
+     *     int len = co_await spi.transferAsync(tx, rx, 16);
+     *
+     * The coroutine resumes on the completion path: it must not make blocking
+     * calls on the library before its next co_await, that would stall the
+     * responses of the device. The first call of a peripheral blocks, it
+     * initializes the peripheral.
+     *
+     * Without coroutines, get() waits for the value and then() registers a
+     * callback. It also converts to a std::future, to wait on results of
+     * several calls, or of several dongles, together:
+     *
+     *     std::future<int> spiDone = spi.transferAsync(tx, rx, 16);
+     *     std::future<int> i2cDone = i2c.readAsync(0x40, data, 2);
+     *
+     * @note Copies share the same value. A single continuation: co_await, then() or future(), once.
+     */
+    template <typename T>
+    class AsyncResult
+    {
+    public:
+        AsyncResult() : _state(std::make_shared<State>()) {}
+
+        /**
+         * @return true once the value is set
+         */
+        bool ready() const
+        {
+            std::lock_guard<std::mutex> lock(_state->mutex);
+            return _state->ready;
+        }
+
+        /**
+         * @brief Waits for the value.
+         * @note Blocking operation, not to be called from a callback of the library.
+         */
+        T get() const
+        {
+            std::unique_lock<std::mutex> lock(_state->mutex);
+            _state->cv.wait(lock, [this] { return _state->ready; });
+            return _state->value;
+        }
+
+        /**
+         * @brief Calls cbk with the value, right away if it is already set.
+         * @note cbk runs on the completion path and must not block.
+         */
+        void then(std::function<void(T)> cbk) const
+        {
+            auto state = _state;
+            if (!suspend([state, cbk] { cbk(state->value); }))
+            {
+                cbk(_state->value);
+            }
+        }
+
+        /**
+         * @brief A std::future of the value, set from the completion path.
+         */
+        std::future<T> future() const
+        {
+            auto promise = std::make_shared<std::promise<T>>();
+            auto fut = promise->get_future();
+            then([promise](T value) { promise->set_value(std::move(value)); });
+            return fut;
+        }
+
+        operator std::future<T>() const { return future(); }
+
+        /**
+         * @brief Sets the value and runs the continuation, if any.
+         * @note Called once, by the library.
+         */
+        void complete(T value) const
+        {
+            std::function<void()> continuation;
+            {
+                std::lock_guard<std::mutex> lock(_state->mutex);
+                _state->value = std::move(value);
+                _state->ready = true;
+                continuation.swap(_state->continuation);
+                _state->cv.notify_all();
+            }
+
+            if (continuation)
+            {
+                continuation();
+            }
+        }
+
+        //Awaitable: a template, so the library itself builds in C++14
+        bool await_ready() const { return ready(); }
+
+        template <typename Handle>
+        bool await_suspend(Handle handle) const
+        {
+            return suspend([handle]() mutable { handle.resume(); });
+        }
+
+        T await_resume() const { return _state->value; }
+
+    private:
+        struct State
+        {
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool ready = false;
+            T value{};
+            std::function<void()> continuation;
+        };
+
+        /**
+         * @return false if the value is already set, the continuation is not stored then
+         */
+        bool suspend(std::function<void()> continuation) const
+        {
+            std::lock_guard<std::mutex> lock(_state->mutex);
+            if (_state->ready)
+            {
+                return false;
+            }
+            _state->continuation = std::move(continuation);
+            return true;
+        }
+
+        std::shared_ptr<State> _state;
+    };
+
+#if IOIG_HAS_COROUTINES
+    /**
+     * @brief Coroutine type of the fire-and-forget coroutines awaiting AsyncResults.
+     *
+     *     DetachedTask poll(Spi &spi) { ... co_await spi.transferAsync(...); ... }
+     *
+     * The coroutine runs until its first co_await on the caller's thread, then
+     * on the completion paths. It owns its frame, nothing waits for its end.
+     */
+    struct DetachedTask
+    {
+        struct promise_type
+        {
+            DetachedTask get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+#endif
+
+} // namespace ioig
+
+#endif
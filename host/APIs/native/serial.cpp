@@ -1,10 +1,88 @@
 #include <iostream>
+#include <algorithm>
 
 #include "ioig_private.h"
 #include "serial.h"
 
 using namespace std::chrono_literals;
 
+static int addWrite(ioig::Packet &txPkt, int hw_instance, const uint8_t *buffer, size_t length)
+{
+    using namespace ioig;
+
+    txPkt.setType(Packet::Type::SERIAL_WRITE);
+    txPkt.addPayloadItem8(hw_instance);
+    txPkt.addPayloadItem8(length);
+
+    if (txPkt.addPayloadBuffer(buffer, length) < 0)
+    {
+        LOG_ERR("UART", "Wr buffer overflow, requested %d bytes, available %d bytes", (int)length, (int)txPkt.getFreePayloadSlots());
+        return -1;
+    }
+    return 0;
+}
+
+static void addRead(ioig::Packet &txPkt, int hw_instance, size_t length)
+{
+    using namespace ioig;
+
+    txPkt.setType(Packet::Type::SERIAL_READ);
+    txPkt.addPayloadItem8(hw_instance);
+    txPkt.addPayloadItem8(length);
+}
+
+/**
+ * @return the number of bytes read, copied to buffer unless it is null; -1 on error
+ */
+static int getRead(ioig::Packet &rxPkt, uint8_t *buffer)
+{
+    using namespace ioig;
+
+    if (rxPkt.getStatus() != Packet::Status::RSP)
+    {
+        return -1;
+    }
+
+    if (buffer != nullptr)
+    {
+        memcpy(buffer, rxPkt.getPayloadBuffer(), rxPkt.getPayloadLength());
+    }
+    return rxPkt.getPayloadLength();
+}
+
+/**
+ * Writes larger than a packet go through the device staging buffer, one
+ * uart_write_blocking() per PacketXfer::STAGING_SIZE bytes.
+ */
+static int writeStaged(int usb_port, int hw_instance, int baud, const uint8_t *buffer, size_t length)
+{
+    using namespace ioig;
+
+    size_t done = 0;
+
+    while (done < length)
+    {
+        size_t len = std::min<size_t>(length - done, PacketXfer::STAGING_SIZE);
+
+        Packet execPkt;
+        Packet rspPkt;
+        PacketXfer::addExec(execPkt, 0, Packet::Type::SERIAL_WRITE, len);
+        execPkt.addPayloadItem8(hw_instance);
+
+        //10 bits per frame on the line
+        unsigned timeout_ms = 600 + len * 10 * 1000 / baud;
+
+        if (UsbManager::transferStaged(execPkt, buffer + done, nullptr, rspPkt, usb_port, timeout_ms) < 0 ||
+            rspPkt.getStatus() != Packet::Status::RSP)
+        {
+            return -1;
+        }
+        done += len;
+    }
+
+    return length;
+}
+
 namespace ioig
 {
     class UARTImpl : public EventHandler
@@ -13,18 +91,9 @@ namespace ioig
         UARTImpl(UART &parent) : _parent(parent), _event(0), _eventCallback(nullptr) {}
         ~UARTImpl() { UsbManager::removeEventHandler(this, _parent._usbPort); };
 
-        void onEvent(Packet &eventPkt) override
+        void onEvent(const Event &evt) override
         {
-            auto pktType = eventPkt.getType();
-    
-            if (pktType != Packet::Type::SERIAL_EVENT)
-            {
-                return;
-            }
-            size_t  len = eventPkt.getPayloadItem8(0);
-            if (len > 0) {
-                _eventCallback((const char *)eventPkt.getPayloadBuffer(1), len);
-            }           
+            _eventCallback((const char *)evt.data, evt.len);
         }
 
         UART &_parent;
@@ -196,26 +265,46 @@ namespace ioig
     {
         checkAndInitialize();
 
+        if (length > Packet::MAX_SIZE - Packet::Header::SIZE - 2)
+        {
+            return writeStaged(_usbPort, _hwInstance, _baud, buffer, length);
+        }
+
         Packet txPkt;
         Packet rxPkt;
 
-        txPkt.setType(Packet::Type::SERIAL_WRITE);
-        txPkt.addPayloadItem8(_hwInstance);
-        txPkt.addPayloadItem8(length);
-
-        if (txPkt.addPayloadBuffer(buffer, length) < 0)
+        if (addWrite(txPkt, _hwInstance, buffer, length) < 0)
         {
-            LOG_ERR(TAG, "Wr buffer overflow, requested %d bytes, available %d bytes", (int)length, (int)txPkt.getFreePayloadSlots());
             return -1;
         }
 
         UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-        if (rxPkt.getStatus() == Packet::Status::RSP)
+        return getRead(rxPkt, nullptr) < 0 ? -1 : (int)length;
+    }
+
+    AsyncResult<int> UART::writeAsync(const uint8_t *buffer, size_t length)
+    {
+        checkAndInitialize();
+
+        AsyncResult<int> result;
+        auto xfer = std::make_shared<AsyncXfer>();
+
+        if (addWrite(xfer->txPkt, _hwInstance, buffer, length) < 0)
         {
-            return length;
+            result.complete(-1);
+            return result;
         }
-        return -1;
+
+        //10 bits per frame on the line
+        unsigned timeout_ms = 600 + length * 10 * 1000 / _baud;
+
+        UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer, result, length](int ret)
+        {
+            result.complete(ret < 0 || getRead(xfer->rxPkt, nullptr) < 0 ? -1 : (int)length);
+        }, timeout_ms);
+
+        return result;
     }
 
     int UART::read(uint8_t *buffer, size_t length)
@@ -225,18 +314,28 @@ namespace ioig
         Packet txPkt;
         Packet rxPkt;
 
-        txPkt.setType(Packet::Type::SERIAL_READ);
-        txPkt.addPayloadItem8(_hwInstance);
-        txPkt.addPayloadItem8(length);
+        addRead(txPkt, _hwInstance, length);
 
         UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-        if (rxPkt.getStatus() == Packet::Status::RSP)
+        return getRead(rxPkt, buffer);
+    }
+
+    AsyncResult<int> UART::readAsync(uint8_t *buffer, size_t length)
+    {
+        checkAndInitialize();
+
+        AsyncResult<int> result;
+        auto xfer = std::make_shared<AsyncXfer>();
+
+        addRead(xfer->txPkt, _hwInstance, length);
+
+        UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer, result, buffer](int ret)
         {
-            memcpy(buffer, rxPkt.getPayloadBuffer(), rxPkt.getPayloadLength());
-            return rxPkt.getPayloadLength();
-        }
-        return -1;
+            result.complete(ret < 0 ? -1 : getRead(xfer->rxPkt, buffer));
+        });
+
+        return result;
     }
 
     void UART::setFormat(int bits, int parity, int stop_bits)
@@ -389,7 +488,7 @@ namespace ioig
         pimpl->_eventCallback = func;
         pimpl->_event = type;
 
-        UsbManager::registerEventHandler(pimpl.get(), _usbPort);
+        UsbManager::registerEventHandler(pimpl.get(), {Packet::Type::SERIAL_EVENT, (uint8_t)_hwInstance}, _usbPort);
 
         UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
@@ -454,4 +553,9 @@ namespace ioig
         return -1;
     }
 
+    uint64_t UART::getDroppedEvents()
+    {
+        return pimpl->getDroppedEvents();
+    }
+
 } // namespace
\ No newline at end of file
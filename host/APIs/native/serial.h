@@ -134,6 +134,12 @@ namespace ioig
          */
         void setInterrupt(const InterruptHandler &func, int type = RxIrq);
 
+        /**
+         * @brief Rx events of this UART lost because the host event queue was full.
+         * @see UsbManager::setEventOverflowPolicy
+         */
+        uint64_t getDroppedEvents();
+
         /**
          * @brief Get character. This is a blocking call, waiting for a character.
          * @return The character read or negative error on failure.
@@ -163,6 +169,25 @@ namespace ioig
          */
         int read(uint8_t *buffer, size_t length);
 
+        /**
+         * @brief Write the contents of a buffer, without waiting for the device.
+         * @note Non blocking. buffer is copied before return.
+         *       Up to a packet of data (58 bytes), larger writes complete with -1.
+         * @param buffer The buffer to write from.
+         * @param length The number of bytes to write.
+         * @return once completed, the number of bytes written, negative error on failure.
+         */
+        AsyncResult<int> writeAsync(const uint8_t *buffer, size_t length);
+
+        /**
+         * @brief Read the contents of a file into a buffer, without waiting for the device.
+         * @note Non blocking. buffer must stay valid until completion.
+         * @param buffer The buffer to read into.
+         * @param length The number of bytes to read.
+         * @return once completed, the number of bytes read, negative error on failure.
+         */
+        AsyncResult<int> readAsync(uint8_t *buffer, size_t length);
+
     private:
         void initialize() override; /**< Initialize function from the base class. */
 
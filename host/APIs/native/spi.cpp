@@ -1,10 +1,98 @@
 #include <iostream>
+#include <algorithm>
 
 #include "ioig_private.h"
 #include "i2c.h"
 
 using namespace ioig;
 
+/** Largest buffer sent in a single SPI_TRANSFER / SPI_WRITE packet */
+static constexpr size_t MAX_PACKET_DATA = Packet::MAX_SIZE - Packet::Header::SIZE - 2;
+
+/**
+ * Transfers larger than a packet go through the device staging buffer,
+ * one bus transaction per PacketXfer::STAGING_SIZE bytes.
+ */
+static int transferStaged(int usb_port, int hw_instance, Packet::Type type,
+                          const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t length,
+                          uint8_t repeated_tx_data = 0)
+{
+    size_t done = 0;
+
+    while (done < length)
+    {
+        size_t len = std::min<size_t>(length - done, PacketXfer::STAGING_SIZE);
+
+        Packet execPkt;
+        Packet rspPkt;
+        PacketXfer::addExec(execPkt, 0, type, len);
+        execPkt.addPayloadItem8(hw_instance);
+        if (type == Packet::Type::SPI_READ)
+        {
+            execPkt.addPayloadItem8(repeated_tx_data);
+        }
+
+        int ret = UsbManager::transferStaged(execPkt,
+                                             tx_buffer ? tx_buffer + done : nullptr,
+                                             rx_buffer ? rx_buffer + done : nullptr,
+                                             rspPkt, usb_port);
+
+        if (ret < 0 || rspPkt.getStatus() != Packet::Status::RSP)
+        {
+            return -1;
+        }
+        done += len;
+    }
+
+    return length;
+}
+
+static void addTransfer(Packet &txPkt, int hw_instance, const uint8_t *tx_buffer, size_t length)
+{
+    txPkt.setType(Packet::Type::SPI_TRANSFER);
+    txPkt.addPayloadItem8(hw_instance);
+    txPkt.addPayloadItem8(length);
+
+    if (txPkt.addPayloadBuffer(tx_buffer, length) < 0)
+    {
+        LOG_ERR("Spi", "Transfer buffer overflow, requested %d bytes, available %d bytes", (int)length, txPkt.getFreePayloadSlots());
+    }
+}
+
+static void addWrite(Packet &txPkt, int hw_instance, const uint8_t *buf, size_t length)
+{
+    txPkt.setType(Packet::Type::SPI_WRITE);
+    txPkt.addPayloadItem8(hw_instance);
+    txPkt.addPayloadItem8(length);
+
+    if (txPkt.addPayloadBuffer(buf,length) < 0)
+    {
+        LOG_ERR("Spi", "Write buffer overflow, requested %d bytes, available %d bytes", (int)length, txPkt.getFreePayloadSlots());
+    }
+}
+
+static void addRead(Packet &txPkt, int hw_instance, size_t len, uint8_t repeated_tx_data)
+{
+    txPkt.setType(Packet::Type::SPI_READ);
+    txPkt.addPayloadItem8(hw_instance);
+    txPkt.addPayloadItem8(len);
+    txPkt.addPayloadItem8(repeated_tx_data);
+}
+
+static int getTransfer(Packet &rxPkt, uint8_t *rx_buffer)
+{
+    if ( rxPkt.getStatus() == Packet::Status::RSP )
+    {
+        if (rx_buffer != nullptr)
+        {
+            memcpy(rx_buffer, rxPkt.getPayloadBuffer(), rxPkt.getPayloadLength());
+        }
+        return rxPkt.getPayloadLength();
+    }
+
+    return -1;
+}
+
 Spi::Spi(int sclk, int tx, int rx, int cs, unsigned long freq_hz, unsigned hw_instance)
        :_sclk(sclk),
         _tx(tx),
@@ -130,33 +218,56 @@ int Spi::transfer(const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t length)
 {
     checkAndInitialize();
 
+    if (length > MAX_PACKET_DATA)
+    {
+        auto type = tx_buffer ? Packet::Type::SPI_TRANSFER : Packet::Type::SPI_READ;
+        return transferStaged(_usbPort, _hwInstance, type, tx_buffer, rx_buffer, length);
+    }
+
     Packet txPkt;
     Packet rxPkt;
 
-    txPkt.setType(Packet::Type::SPI_TRANSFER);
-    txPkt.addPayloadItem8(_hwInstance);    
-    txPkt.addPayloadItem8(length);
+    addTransfer(txPkt, _hwInstance, tx_buffer, length);
 
-    if (txPkt.addPayloadBuffer(tx_buffer, length) < 0)
+    UsbManager::transfer(txPkt, rxPkt, _usbPort); 
+
+    return getTransfer(rxPkt, rx_buffer);
+}
+
+AsyncResult<int> Spi::transferAsync(const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t length)
+{
+    checkAndInitialize();
+
+    AsyncResult<int> result;
+
+    if (length > MAX_PACKET_DATA)
     {
-        LOG_ERR(TAG, "Transfer buffer overflow, requested %d bytes, available %d bytes", (int)length, txPkt.getFreePayloadSlots());
-    }      
+        LOG_ERR(TAG, "Async transfer too large, requested %d bytes, max %d bytes", (int)length, (int)MAX_PACKET_DATA);
+        result.complete(-1);
+        return result;
+    }
 
-    UsbManager::transfer(txPkt, rxPkt, _usbPort); 
+    auto xfer = std::make_shared<AsyncXfer>();
+    addTransfer(xfer->txPkt, _hwInstance, tx_buffer, length);
 
-    if ( rxPkt.getStatus() == Packet::Status::RSP ) 
-    {        
-        memcpy(rx_buffer, rxPkt.getPayloadBuffer(), rxPkt.getPayloadLength());
-        return rxPkt.getPayloadLength();
-    }    
+    UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer, result, rx_buffer](int ret)
+    {
+        result.complete(ret < 0 ? -1 : getTransfer(xfer->rxPkt, rx_buffer));
+    });
 
-    return -1;        
+    return result;
 }
 
 int Spi::transfer(const uint8_t val, uint8_t *rx_buffer, size_t length)
 {
     checkAndInitialize();
 
+    if (length > MAX_PACKET_DATA)
+    {
+        //same bytes on the bus as a repeated SPI_TRANSFER, without staging them
+        return transferStaged(_usbPort, _hwInstance, Packet::Type::SPI_READ, nullptr, rx_buffer, length, val);
+    }
+
     Packet txPkt;
     Packet rxPkt;    
 
@@ -184,26 +295,43 @@ int Spi::write(const uint8_t *buf, size_t length)
 {
     checkAndInitialize();
 
+    if (length > MAX_PACKET_DATA)
+    {
+        return transferStaged(_usbPort, _hwInstance, Packet::Type::SPI_WRITE, buf, nullptr, length);
+    }
+
     Packet txPkt;
     Packet rxPkt;    
 
-    txPkt.setType(Packet::Type::SPI_WRITE);
-    txPkt.addPayloadItem8(_hwInstance); 
-    txPkt.addPayloadItem8(length);  
-
-    if (txPkt.addPayloadBuffer(buf,length) < 0)
-    {
-        LOG_ERR(TAG, "Write buffer overflow, requested %d bytes, available %d bytes", (int)length, txPkt.getFreePayloadSlots());
-    }  
+    addWrite(txPkt, _hwInstance, buf, length);
 
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-    if ( rxPkt.getStatus() == Packet::Status::RSP ) 
+    return getTransfer(rxPkt, nullptr) < 0 ? -1 : (int)length;
+}
+
+AsyncResult<int> Spi::writeAsync(const uint8_t *buf, size_t length)
+{
+    checkAndInitialize();
+
+    AsyncResult<int> result;
+
+    if (length > MAX_PACKET_DATA)
     {
-        return length;
+        LOG_ERR(TAG, "Async write too large, requested %d bytes, max %d bytes", (int)length, (int)MAX_PACKET_DATA);
+        result.complete(-1);
+        return result;
     }
 
-    return -1;
+    auto xfer = std::make_shared<AsyncXfer>();
+    addWrite(xfer->txPkt, _hwInstance, buf, length);
+
+    UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer, result, length](int ret)
+    {
+        result.complete(ret < 0 || getTransfer(xfer->rxPkt, nullptr) < 0 ? -1 : (int)length);
+    });
+
+    return result;
 }
 
 
@@ -233,23 +361,42 @@ int Spi::read(uint8_t *buf, size_t len, uint8_t repeated_tx_data)
 {
     checkAndInitialize();
 
+    if (len > MAX_PACKET_DATA)
+    {
+        return transferStaged(_usbPort, _hwInstance, Packet::Type::SPI_READ, nullptr, buf, len, repeated_tx_data);
+    }
+
     Packet txPkt;
     Packet rxPkt;    
 
-    txPkt.setType(Packet::Type::SPI_READ);
-    txPkt.addPayloadItem8(_hwInstance);        
-    txPkt.addPayloadItem8(len);
-    txPkt.addPayloadItem8(repeated_tx_data); 
+    addRead(txPkt, _hwInstance, len, repeated_tx_data);
      
     UsbManager::transfer(txPkt, rxPkt, _usbPort);
 
-    if ( rxPkt.getStatus() == Packet::Status::RSP ) 
+    return getTransfer(rxPkt, buf);
+}
+
+AsyncResult<int> Spi::readAsync(uint8_t *buf, size_t len, uint8_t repeated_tx_data)
+{
+    checkAndInitialize();
+
+    AsyncResult<int> result;
+
+    if (len > MAX_PACKET_DATA)
     {
-        memcpy(buf, rxPkt.getPayloadBuffer(), rxPkt.getPayloadLength());
-        return rxPkt.getPayloadLength();
+        LOG_ERR(TAG, "Async read too large, requested %d bytes, max %d bytes", (int)len, (int)MAX_PACKET_DATA);
+        result.complete(-1);
+        return result;
     }
 
-    return -1;
-    
+    auto xfer = std::make_shared<AsyncXfer>();
+    addRead(xfer->txPkt, _hwInstance, len, repeated_tx_data);
+
+    UsbManager::transferAsync(xfer->txPkt, xfer->rxPkt, _usbPort, [xfer, result, buf](int ret)
+    {
+        result.complete(ret < 0 ? -1 : getTransfer(xfer->rxPkt, buf));
+    });
+
+    return result;
 }
 
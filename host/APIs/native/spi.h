@@ -103,6 +103,20 @@ namespace ioig
          */
         int transfer(const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t length);
 
+        /**
+         * @brief Transfer Spi data, without waiting for the device.
+         *
+         * @note Non blocking. The buffers must stay valid until completion.
+         *       Up to a packet of data (56 bytes), larger transfers complete with -1.
+         *
+         * @param tx_buffer The TX buffer with data to be transferred.
+         * @param rx_buffer The RX buffer which is used for received data. If NULL is passed,
+         *                  received data are ignored.
+         * @param length Length of BOTH buffers.
+         * @return the number of bytes transferred, -1 on error, once completed
+         */
+        AsyncResult<int> transferAsync(const uint8_t *tx_buffer, uint8_t *rx_buffer, size_t length);
+
         /**
          * @brief Transfer repeated Spi data.
          *
@@ -124,6 +138,18 @@ namespace ioig
          */
         int write(const uint8_t *buf, size_t length);
 
+        /**
+         * @brief Write Spi data, without waiting for the device.
+         *
+         * @note Non blocking. buf is copied before return.
+         *       Up to a packet of data (56 bytes), larger writes complete with -1.
+         *
+         * @param buf       The buffer to be sent.
+         * @param length    The length of buffer in bytes.
+         * @return once completed, the number of bytes written, -1 on error
+         */
+        AsyncResult<int> writeAsync(const uint8_t *buf, size_t length);
+
         /**
          * @brief Read Spi data.
          *
@@ -135,6 +161,19 @@ namespace ioig
          */
         int read(uint8_t *buf, size_t len, uint8_t repeated_tx_data = 0);
 
+        /**
+         * @brief Read Spi data, without waiting for the device.
+         *
+         * @note Non blocking. buf must stay valid until completion.
+         *       Up to a packet of data (56 bytes), larger reads complete with -1.
+         *
+         * @param buf The buffer to receive read data.
+         * @param len The buffer length.
+         * @param repeated_tx_data Data to send during read operations.
+         * @return once completed, the number of bytes read, -1 on error
+         */
+        AsyncResult<int> readAsync(uint8_t *buf, size_t len, uint8_t repeated_tx_data = 0);
+
         /**
          * @brief Transfer a single byte.
          *
@@ -0,0 +1,226 @@
+#include <cstring>
+
+#include "ioig_private.h"
+#include "ioig_capture.h"
+
+using namespace ioig;
+
+constexpr unsigned PacketCapture::DEFAULT_CAPACITY;
+constexpr unsigned PacketCapture::WRITER_PERIOD_MS;
+constexpr char PacketCapture::MAGIC[];
+constexpr uint8_t PacketCapture::FILE_VERSION;
+constexpr unsigned PacketCapture::FILE_HEADER_SIZE;
+constexpr unsigned PacketCapture::RECORD_HEADER_SIZE;
+
+
+static void putLE64(uint8_t *out, uint64_t value)
+{
+    for (unsigned i = 0; i < 8; i++)
+    {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint64_t getLE64(const uint8_t *in)
+{
+    uint64_t value = 0;
+    for (unsigned i = 0; i < 8; i++)
+    {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+
+//==========================================================
+// PacketCapture
+//==========================================================
+
+PacketCapture::PacketCapture(unsigned capacity)
+    : _writer(capacity, WRITER_PERIOD_MS),
+      _file(nullptr)
+{
+}
+
+PacketCapture::~PacketCapture()
+{
+    stop();
+}
+
+int PacketCapture::start(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_file != nullptr)
+    {
+        LOG_ERR(TAG, "Capture already running");
+        return -1;
+    }
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        LOG_ERR(TAG, "Can't create capture file %s", path.c_str());
+        return -1;
+    }
+
+    uint8_t header[FILE_HEADER_SIZE] = {0};
+    memcpy(header, MAGIC, sizeof(MAGIC) - 1);
+    header[7] = FILE_VERSION;
+    header[8] = RECORD_HEADER_SIZE;
+
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+    {
+        LOG_ERR(TAG, "Can't write capture file %s", path.c_str());
+        fclose(file);
+        return -1;
+    }
+
+    _file = file;
+    _startedAt = std::chrono::steady_clock::now();
+    _writer.start([this](MpscRing<CaptureRecord> &ring) { return drain(ring); });
+    return 0;
+}
+
+void PacketCapture::stop()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!_writer.stop())
+    {
+        return;
+    }
+
+    fflush(_file);
+    fclose(_file);
+    _file = nullptr;
+}
+
+void PacketCapture::push(CaptureRecord::Direction dir, const uint8_t *frame, size_t len)
+{
+    len = std::min<size_t>(len, Packet::MAX_FRAME_SIZE);
+
+    //a full ring drops the frame, counted by the writer
+    _writer.push([&](CaptureRecord &rec) {
+        rec.timestampNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - _startedAt).count());
+        rec.direction = dir;
+        rec.len = static_cast<uint8_t>(len);
+        memcpy(rec.frame, frame, len);
+    });
+}
+
+void PacketCapture::recordStream(CaptureRecord::Direction dir, const uint8_t *buf, size_t len)
+{
+    if (!_writer.enabled())
+    {
+        return;
+    }
+
+    while (len > 0)
+    {
+        size_t frameLen = Packet::getFrameLength(buf, len);
+        if (frameLen > len || frameLen > Packet::MAX_FRAME_SIZE)
+        {
+            frameLen = std::min<size_t>(len, Packet::MAX_FRAME_SIZE); //not framed, kept as is
+        }
+
+        push(dir, buf, frameLen);
+        buf += frameLen;
+        len -= frameLen;
+    }
+}
+
+size_t PacketCapture::drain(MpscRing<CaptureRecord> &ring)
+{
+    constexpr size_t BATCH = 64;
+    uint8_t out[BATCH * (RECORD_HEADER_SIZE + Packet::MAX_FRAME_SIZE)];
+    CaptureRecord rec;
+    size_t total = 0;
+
+    while (true)
+    {
+        size_t len = 0;
+        size_t count = 0;
+
+        while (count < BATCH && ring.pop(rec))
+        {
+            putLE64(out + len, rec.timestampNs);
+            out[len + 8] = static_cast<uint8_t>(rec.direction);
+            out[len + 9] = rec.len;
+            memcpy(out + len + RECORD_HEADER_SIZE, rec.frame, rec.len);
+            len += RECORD_HEADER_SIZE + rec.len;
+            count++;
+        }
+
+        if (count == 0)
+        {
+            return total;
+        }
+
+        if (fwrite(out, 1, len, _file) != len)
+        {
+            LOG_ERR(TAG, "Capture file write error, %d frames lost", (int)count);
+            _writer.addDropped(count);
+        }
+        else
+        {
+            total += count;
+        }
+    }
+}
+
+
+//==========================================================
+// CaptureReader
+//==========================================================
+
+int CaptureReader::open(const std::string &path)
+{
+    close();
+
+    _file = fopen(path.c_str(), "rb");
+    if (_file == nullptr)
+    {
+        return -1;
+    }
+
+    uint8_t header[PacketCapture::FILE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), _file) != sizeof(header) ||
+        memcmp(header, PacketCapture::MAGIC, sizeof(PacketCapture::MAGIC) - 1) != 0 ||
+        header[7] == 0 || header[8] < PacketCapture::RECORD_HEADER_SIZE)
+    {
+        close();
+        return -1;
+    }
+
+    //later versions may only append to the record header
+    _recordHeaderSize = header[8];
+    return 0;
+}
+
+bool CaptureReader::next(CaptureRecord &record)
+{
+    uint8_t header[256];
+
+    if (_file == nullptr || fread(header, 1, _recordHeaderSize, _file) != _recordHeaderSize)
+    {
+        return false;
+    }
+
+    record.timestampNs = getLE64(header);
+    record.direction = static_cast<CaptureRecord::Direction>(header[8]);
+    record.len = header[9];
+
+    return record.len <= Packet::MAX_FRAME_SIZE &&
+           fread(record.frame, 1, record.len, _file) == record.len;
+}
+
+void CaptureReader::close()
+{
+    if (_file != nullptr)
+    {
+        fclose(_file);
+        _file = nullptr;
+    }
+}
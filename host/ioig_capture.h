@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include "ioig_protocol.h"
+#include "ioig_ring.h"
+
+namespace ioig
+{
+
+    /**
+     * @brief One captured frame.
+     */
+    struct CaptureRecord
+    {
+        enum class Direction : uint8_t
+        {
+            TX = 0,  /**< Request written to the device */
+            RX,      /**< Response read from the device */
+            EVENT    /**< Event packet read from the device */
+        };
+
+        uint64_t timestampNs;  /**< Since the start of the capture, monotonic per recording thread */
+        Direction direction;
+        uint8_t len;
+        uint8_t frame[Packet::MAX_FRAME_SIZE];  /**< v1 or v2 framed, as on the wire */
+    };
+
+
+    /**
+     * @class PacketCapture
+     *
+     * @brief Binary capture of the frames exchanged with a device, switched on at runtime.
+     *
+     * record() copies the frame and a timestamp into a RingWriter and
+     * returns, its writer thread formats the frames to the file. A stopped
+     * capture costs one relaxed load per frame.
+     *
+     * The threads read the clock and claim their ring cells independently,
+     * so the records are in timestamp order per recording thread only: the
+     * requests of the caller threads and the responses and events of the
+     * reader may reach the file slightly out of order. Sort on the timestamp
+     * when it matters.
+     *
+     * File layout, integers little endian:
+     *
+     *     header: "IOIGCAP" [version:8] [record header size:8] [reserved:24]
+     *     record: [timestamp ns:64] [direction:8] [len:8] [frame:len]
+     */
+    class PacketCapture
+    {
+    public:
+        static constexpr unsigned DEFAULT_CAPACITY = 4096;  /**< Frames buffered for the writer */
+        static constexpr unsigned WRITER_PERIOD_MS = 10;
+
+        static constexpr char MAGIC[] = "IOIGCAP";
+        static constexpr uint8_t FILE_VERSION = 1;
+        static constexpr unsigned FILE_HEADER_SIZE = 12;
+        static constexpr unsigned RECORD_HEADER_SIZE = 10;
+
+        explicit PacketCapture(unsigned capacity = DEFAULT_CAPACITY);
+        ~PacketCapture();
+
+        PacketCapture(const PacketCapture &) = delete;
+        PacketCapture &operator=(const PacketCapture &) = delete;
+
+        /**
+         * @brief Creates the file and starts recording, timestamps count from now.
+         * @return zero on success, negative value if the file can't be created or a capture is running
+         */
+        int start(const std::string &path);
+
+        /**
+         * @brief Stops recording, writes the frames still buffered and closes the file.
+         */
+        void stop();
+
+        bool running() const { return _writer.enabled(); }
+
+        /**
+         * @brief Records one frame.
+         * @note Thread safe, lock-free, never blocks.
+         */
+        inline void record(CaptureRecord::Direction dir, const uint8_t *frame, size_t len)
+        {
+            if (_writer.enabled())
+            {
+                push(dir, frame, len);
+            }
+        }
+
+        /**
+         * @brief Records the frames of a write or read made of several frames back to back.
+         */
+        void recordStream(CaptureRecord::Direction dir, const uint8_t *buf, size_t len);
+
+        /**
+         * @return the frames written to the file, since start()
+         */
+        uint64_t getRecorded() const { return _writer.getRecorded(); }
+
+        /**
+         * @return the frames lost because the ring was full, since start()
+         */
+        uint64_t getDropped() const { return _writer.getDropped(); }
+
+    private:
+
+        void push(CaptureRecord::Direction dir, const uint8_t *frame, size_t len);
+
+        /**
+         * @return the number of frames written
+         */
+        size_t drain(MpscRing<CaptureRecord> &ring);
+
+        RingWriter<CaptureRecord> _writer;
+        std::chrono::steady_clock::time_point _startedAt;  /**< Set before the writer starts */
+
+        FILE *_file;
+        std::mutex _mutex;  /**< start() and stop() */
+
+        static constexpr const char* TAG = "PacketCapture";
+    };
+
+
+    /**
+     * @class CaptureReader
+     *
+     * @brief Reads back a file written by PacketCapture.
+     */
+    class CaptureReader
+    {
+    public:
+        CaptureReader() : _file(nullptr) {}
+        ~CaptureReader() { close(); }
+
+        CaptureReader(const CaptureReader &) = delete;
+        CaptureReader &operator=(const CaptureReader &) = delete;
+
+        /**
+         * @return zero on success, negative value if the file is missing or not a capture
+         */
+        int open(const std::string &path);
+
+        /**
+         * @return false at the end of the file, or on a truncated record
+         */
+        bool next(CaptureRecord &record);
+
+        void close();
+
+    private:
+        FILE *_file;
+        unsigned _recordHeaderSize;
+    };
+
+}
@@ -0,0 +1,709 @@
+#include <chrono>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <cstdlib>
+#include <memory.h>
+
+#include "ioig_private.h"
+#include "ioig_engine.h"
+#include "ioig_trace.h"
+
+using namespace ioig;
+
+constexpr unsigned TransferEngine::DEFAULT_WINDOW;
+constexpr unsigned TransferEngine::MAX_WINDOW;
+constexpr unsigned TransferEngine::MAX_WRITE_SIZE;
+
+//==========================================================
+// TransferEngine
+//==========================================================
+
+TransferEngine::TransferEngine(Link &link, unsigned window)
+    : _link(link),
+      _protocol(Packet::PROTOCOL_V1),
+      _window(window),
+      _inFlight(0),
+      _nextRequestId(0),
+      _rxStreamLen(0),
+      _capture(nullptr),
+      _asyncInFlight(0),
+      _asyncRunning(false),
+      _asyncRescan(false)
+{
+    if (_window == 0)
+    {
+        _window = 1;
+    }
+
+    if (_window > MAX_WINDOW)
+    {
+        LOG_WARN(TAG, "Window %d > max(%d), using max", _window, MAX_WINDOW);
+        _window = MAX_WINDOW;
+    }
+
+    for (auto &slot : _slots)
+    {
+        slot.state = SlotState::FREE;
+        slot.requestId = 0;
+        slot.rxPkt = nullptr;
+        slot.txPkt = nullptr;
+    }
+}
+
+TransferEngine::~TransferEngine()
+{
+    stopAsync();
+}
+
+int TransferEngine::start()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _protocol = _link.getProtocol();
+    }
+    return _link.start(*this);
+}
+
+void TransferEngine::stop()
+{
+    _link.stop();
+    stopAsync();
+}
+
+int TransferEngine::acquireSlot(std::unique_lock<std::mutex> &lock)
+{
+    if (_inFlight >= _window)
+    {
+        TraceSpan span("engine", "wait slot", {{"window", _window}});
+        _slotCv.wait(lock, [this] { return _inFlight < _window; });
+    }
+
+    //Skip the ids whose slot is still owned by a pending request
+    while (_slots[_nextRequestId % SLOT_COUNT].state != SlotState::FREE)
+    {
+        nextRequestId();
+    }
+
+    uint16_t id = nextRequestId();
+    uint8_t slotIdx = id % SLOT_COUNT;
+    _slots[slotIdx].state = SlotState::PENDING;
+    _slots[slotIdx].requestId = id;
+    _inFlight++;
+
+    return slotIdx;
+}
+
+uint16_t TransferEngine::nextRequestId()
+{
+    uint16_t id = _nextRequestId;
+
+    //a v1 header only carries the low byte
+    _nextRequestId = _protocol >= Packet::PROTOCOL_V2 ? id + 1 : (id + 1) % SLOT_COUNT;
+    return id;
+}
+
+void TransferEngine::stamp(Packet &txPkt, uint8_t slotIdx)
+{
+    txPkt.setProtocol(_protocol);
+    txPkt.setRequestId(_slots[slotIdx].requestId);
+    txPkt.setFlags(0);
+    txPkt.setStatus(Packet::Status::CMD);
+}
+
+void TransferEngine::releaseSlot(uint8_t slotIdx)
+{
+    auto &slot = _slots[slotIdx];
+
+    if (slot.txPkt != nullptr)
+    {
+        slot.txPkt = nullptr;
+        slot.done = nullptr;
+        _asyncInFlight--;
+    }
+
+    slot.state = SlotState::FREE;
+    slot.rxPkt = nullptr;
+    _inFlight--;
+    _slotCv.notify_one();
+
+    if (!_asyncBacklog.empty())
+    {
+        _asyncCv.notify_one();
+    }
+}
+
+int TransferEngine::transfer(Packet &txPkt, Packet &rxPkt, unsigned timeout_ms, unsigned retries)
+{
+    std::unique_lock<std::mutex> lock(_mutex, std::defer_lock);
+    lockTraced(lock, "engine mutex");
+
+    while (retries-- > 0)
+    {
+        int slotIdx = acquireSlot(lock);
+        auto &slot = _slots[slotIdx];
+        slot.rxPkt = &rxPkt;
+        rxPkt.reset();
+
+        stamp(txPkt, slotIdx);
+        uint8_t frame[Packet::MAX_FRAME_SIZE];
+        size_t frameLen = txPkt.writeFrame(frame);
+        slot.sentAt = Clock::now();
+
+        //The response may be delivered before write() returns, slot state is checked under lock
+        lock.unlock();
+        int ret = writeLink(frame, frameLen, timeout_ms);
+        lock.lock();
+
+        bool done = false;
+        if (ret == 0)
+        {
+            auto isDone = [&slot] { return slot.state == SlotState::DONE; };
+            if (timeout_ms == 0)
+            {
+                _rspCv.wait(lock, isDone);
+                done = true;
+            }
+            else
+            {
+                done = _rspCv.wait_for(lock, std::chrono::milliseconds(timeout_ms), isDone);
+            }
+        }
+
+        auto latency = slot.receivedAt - slot.sentAt;
+        releaseSlot(slotIdx);
+
+        if (done)
+        {
+            rxPkt.flush();
+            _stats.onComplete(txPkt.getType(), txPkt.getFrameLength(), rxPkt.getFrameLength(),
+                              std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+            return 0;
+        }
+
+        LOG_WARN(TAG, "No response for request id = %d", (int)slot.requestId);
+        _stats.onTimeout(txPkt.getType());
+
+        if (retries > 0)
+        {
+            _stats.onRetry(txPkt.getType());
+            if (auto span = TraceSpan::current())
+            {
+                span->add("retries", 1);
+            }
+        }
+    }
+
+    _stats.onFailure(txPkt.getType());
+    return -1;
+}
+
+int TransferEngine::transfer(Packet *txPkts, Packet *rxPkts, size_t count, unsigned timeout_ms, unsigned retries)
+{
+    struct Pending
+    {
+        uint8_t slotIdx;
+        size_t idx;
+        Clock::time_point deadline;
+    };
+
+    std::unique_lock<std::mutex> lock(_mutex, std::defer_lock);
+    lockTraced(lock, "engine mutex");
+
+    std::vector<Pending> pending;
+    std::deque<size_t> toSend;
+    std::vector<unsigned> attempts(count, 0);
+    std::vector<uint8_t> txStream;
+    size_t completed = 0;
+    bool failed = false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        toSend.push_back(i);
+    }
+
+    while (completed < count && !failed)
+    {
+        //Fill the window. The new packets go out back to back in as few
+        //writes as possible, each one a multi-packet USB transfer
+        size_t firstNew = pending.size();
+        txStream.clear();
+
+        auto flush = [&](size_t first) {
+            if (txStream.empty())
+            {
+                return;
+            }
+
+            lock.unlock();
+            int ret = writeLink(txStream.data(), txStream.size(), timeout_ms);
+            lock.lock();
+            txStream.clear();
+
+            for (size_t i = first; i < pending.size(); i++)
+            {
+                auto &p = pending[i];
+                if (ret != 0)
+                {
+                    p.deadline = _slots[p.slotIdx].sentAt; //handled as a timeout below
+                }
+                else if (timeout_ms != 0)
+                {
+                    p.deadline = _slots[p.slotIdx].sentAt + std::chrono::milliseconds(timeout_ms);
+                }
+            }
+        };
+
+        while (!toSend.empty() && _inFlight < _window)
+        {
+            size_t idx = toSend.front();
+            toSend.pop_front();
+
+            Packet &txPkt = txPkts[idx];
+            txPkt.setProtocol(_protocol);
+            if (txStream.size() + txPkt.getFrameLength() > MAX_WRITE_SIZE)
+            {
+                flush(firstNew);
+                firstNew = pending.size();
+            }
+
+            int slotIdx = acquireSlot(lock);
+            auto &slot = _slots[slotIdx];
+            slot.rxPkt = &rxPkts[idx];
+            rxPkts[idx].reset();
+
+            stamp(txPkt, slotIdx);
+            slot.sentAt = Clock::now();
+            attempts[idx]++;
+
+            size_t pos = txStream.size();
+            txStream.resize(pos + txPkt.getFrameLength());
+            txPkt.writeFrame(txStream.data() + pos);
+            pending.push_back({(uint8_t)slotIdx, idx, Clock::time_point::max()});
+        }
+        flush(firstNew);
+
+        if (pending.empty())
+        {
+            //the window is full of other callers requests
+            TraceSpan span("engine", "wait slot", {{"window", _window}});
+            _slotCv.wait(lock, [this] { return _inFlight < _window; });
+            continue;
+        }
+
+        auto anyDone = [&] {
+            for (auto &p : pending)
+            {
+                if (_slots[p.slotIdx].state == SlotState::DONE)
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        auto earliest = pending.front().deadline;
+        for (auto &p : pending)
+        {
+            earliest = std::min(earliest, p.deadline);
+        }
+
+        if (earliest == Clock::time_point::max())
+        {
+            _rspCv.wait(lock, anyDone);
+        }
+        else
+        {
+            _rspCv.wait_until(lock, earliest, anyDone);
+        }
+
+        auto now = Clock::now();
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            auto &slot = _slots[it->slotIdx];
+            Packet &txPkt = txPkts[it->idx];
+
+            if (slot.state == SlotState::DONE)
+            {
+                auto latency = slot.receivedAt - slot.sentAt;
+                releaseSlot(it->slotIdx);
+
+                rxPkts[it->idx].flush();
+                _stats.onComplete(txPkt.getType(), txPkt.getFrameLength(), rxPkts[it->idx].getFrameLength(),
+                                  std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+                completed++;
+                it = pending.erase(it);
+            }
+            else if (now >= it->deadline)
+            {
+                releaseSlot(it->slotIdx);
+
+                LOG_WARN(TAG, "No response for request id = %d", (int)slot.requestId);
+                _stats.onTimeout(txPkt.getType());
+
+                if (attempts[it->idx] < retries)
+                {
+                    _stats.onRetry(txPkt.getType());
+                    toSend.push_back(it->idx);
+                    if (auto span = TraceSpan::current())
+                    {
+                        span->add("retries", 1);
+                    }
+                }
+                else
+                {
+                    _stats.onFailure(txPkt.getType());
+                    failed = true;
+                }
+                it = pending.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    //Given up: late responses of the packets still in flight are dropped
+    for (auto &p : pending)
+    {
+        releaseSlot(p.slotIdx);
+    }
+
+    return failed ? -1 : 0;
+}
+
+void TransferEngine::transferAsync(Packet &txPkt, Packet &rxPkt, unsigned timeout_ms, Completion done)
+{
+    Completions completed;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (!_asyncThread.joinable())
+        {
+            _asyncRunning = true;
+            _asyncThread = std::thread(&TransferEngine::asyncLoop, this);
+        }
+
+        _asyncBacklog.push_back({&txPkt, &rxPkt, timeout_ms, std::move(done)});
+        sendAsync(lock, completed);
+    }
+
+    complete(completed);
+}
+
+int TransferEngine::send(Packet &txPkt, unsigned timeout_ms)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_protocol >= Packet::PROTOCOL_V2)
+        {
+            //no slot: nothing comes back to match
+            txPkt.setProtocol(_protocol);
+            txPkt.setRequestId(nextRequestId());
+            txPkt.setFlags(Packet::FLAG_NO_RESPONSE);
+            txPkt.setStatus(Packet::Status::CMD);
+        }
+    }
+
+    if (txPkt.getProtocol() < Packet::PROTOCOL_V2)
+    {
+        Packet rxPkt;
+        return transfer(txPkt, rxPkt, timeout_ms);
+    }
+
+    uint8_t frame[Packet::MAX_FRAME_SIZE];
+    size_t frameLen = txPkt.writeFrame(frame);
+    return writeLink(frame, frameLen, timeout_ms) == 0 ? 0 : -1;
+}
+
+void TransferEngine::sendAsync(std::unique_lock<std::mutex> &lock, Completions &completed)
+{
+    struct Sent
+    {
+        uint8_t slotIdx;
+        Packet *txPkt;
+    };
+
+    uint8_t txStream[MAX_WRITE_SIZE];
+    Sent sent[MAX_WINDOW];
+
+    while (!_asyncBacklog.empty() && _inFlight < _window)
+    {
+        //As for the batch transfers, the requests fitting in the window go out in one write
+        size_t len = 0;
+        unsigned count = 0;
+        unsigned timeout_ms = _asyncBacklog.front().timeout_ms;
+
+        while (!_asyncBacklog.empty() && _inFlight < _window)
+        {
+            auto &req = _asyncBacklog.front();
+            req.txPkt->setProtocol(_protocol);
+            size_t pktLen = req.txPkt->getFrameLength();
+            if (len + pktLen > MAX_WRITE_SIZE)
+            {
+                break;
+            }
+
+            int slotIdx = acquireSlot(lock); //doesn't wait, the window has room
+            auto &slot = _slots[slotIdx];
+            slot.rxPkt = req.rxPkt;
+            slot.txPkt = req.txPkt;
+            slot.done = std::move(req.done);
+            slot.rxPkt->reset();
+            _asyncInFlight++;
+
+            stamp(*req.txPkt, slotIdx);
+            slot.sentAt = Clock::now();
+            slot.deadline = req.timeout_ms != 0 ? slot.sentAt + std::chrono::milliseconds(req.timeout_ms)
+                                                : Clock::time_point::max();
+            _asyncRescan |= req.timeout_ms != 0;
+
+            req.txPkt->writeFrame(txStream + len);
+            len += pktLen;
+            sent[count++] = {(uint8_t)slotIdx, req.txPkt};
+            _asyncBacklog.pop_front();
+        }
+
+        if (_asyncRescan)
+        {
+            _asyncCv.notify_one();
+        }
+
+        lock.unlock();
+        int ret = writeLink(txStream, len, timeout_ms);
+        lock.lock();
+
+        if (ret == 0)
+        {
+            continue;
+        }
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            auto &slot = _slots[sent[i].slotIdx];
+            if (slot.state != SlotState::PENDING || slot.txPkt != sent[i].txPkt)
+            {
+                continue; //answered already
+            }
+
+            _stats.onFailure(slot.txPkt->getType());
+            completed.emplace_back(std::move(slot.done), -1);
+            releaseSlot(sent[i].slotIdx);
+        }
+    }
+}
+
+TransferEngine::Clock::time_point TransferEngine::expireAsync(Completions &completed)
+{
+    auto earliest = Clock::time_point::max();
+
+    if (_asyncInFlight == 0)
+    {
+        return earliest;
+    }
+
+    auto now = Clock::now();
+    for (unsigned slotIdx = 0; slotIdx < SLOT_COUNT; slotIdx++)
+    {
+        auto &slot = _slots[slotIdx];
+        if (slot.state != SlotState::PENDING || slot.txPkt == nullptr)
+        {
+            continue;
+        }
+
+        if (now < slot.deadline)
+        {
+            earliest = std::min(earliest, slot.deadline);
+            continue;
+        }
+
+        LOG_WARN(TAG, "No response for request id = %d", (int)slot.requestId);
+        _stats.onTimeout(slot.txPkt->getType());
+        _stats.onFailure(slot.txPkt->getType());
+        completed.emplace_back(std::move(slot.done), -1);
+        releaseSlot(slotIdx);
+    }
+
+    return earliest;
+}
+
+void TransferEngine::asyncLoop()
+{
+    Tracer::setThreadName("ioig async");
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (_asyncRunning)
+    {
+        Completions completed;
+
+        sendAsync(lock, completed);
+        _asyncRescan = false;
+        auto deadline = expireAsync(completed);
+
+        if (!completed.empty())
+        {
+            lock.unlock();
+            complete(completed);
+            lock.lock();
+            continue;
+        }
+
+        auto wakeUp = [this] {
+            return !_asyncRunning || _asyncRescan || (!_asyncBacklog.empty() && _inFlight < _window);
+        };
+
+        if (deadline == Clock::time_point::max())
+        {
+            _asyncCv.wait(lock, wakeUp);
+        }
+        else
+        {
+            _asyncCv.wait_until(lock, deadline, wakeUp);
+        }
+    }
+}
+
+void TransferEngine::stopAsync()
+{
+    Completions completed;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _asyncRunning = false;
+        _asyncCv.notify_all();
+    }
+
+    if (_asyncThread.joinable())
+    {
+        _asyncThread.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (unsigned slotIdx = 0; slotIdx < SLOT_COUNT; slotIdx++)
+        {
+            auto &slot = _slots[slotIdx];
+            if (slot.state == SlotState::PENDING && slot.txPkt != nullptr)
+            {
+                completed.emplace_back(std::move(slot.done), -1);
+                releaseSlot(slotIdx);
+            }
+        }
+
+        for (auto &req : _asyncBacklog)
+        {
+            completed.emplace_back(std::move(req.done), -1);
+        }
+        _asyncBacklog.clear();
+    }
+
+    complete(completed);
+}
+
+void TransferEngine::complete(Completions &completed)
+{
+    for (auto &c : completed)
+    {
+        c.first(c.second);
+    }
+}
+
+void TransferEngine::onReceive(const uint8_t *buf, size_t len)
+{
+    Completions completed;
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (len > 0)
+    {
+        size_t n = std::min(len, sizeof(_rxStream) - _rxStreamLen);
+        memcpy(_rxStream + _rxStreamLen, buf, n);
+        _rxStreamLen += n;
+        buf += n;
+        len -= n;
+
+        //A bulk IN transfer can carry several responses, or only part of one
+        size_t offset = 0;
+        while (_rxStreamLen > offset)
+        {
+            size_t pktLen = Packet::getFrameLength(_rxStream + offset, _rxStreamLen - offset);
+
+            if (pktLen > Packet::MAX_FRAME_SIZE)
+            {
+                LOG_ERR(TAG, "Rx packet length(%d) > max(%d), dropping %d bytes",
+                        (int)pktLen, Packet::MAX_FRAME_SIZE, (int)(_rxStreamLen - offset));
+                offset = _rxStreamLen;
+                break;
+            }
+
+            if (_rxStreamLen - offset < pktLen)
+            {
+                break; //wait for the rest, or for the header
+            }
+
+            deliver(_rxStream + offset, pktLen, completed);
+            offset += pktLen;
+        }
+
+        _rxStreamLen -= offset;
+        memmove(_rxStream, _rxStream + offset, _rxStreamLen);
+    }
+
+    //async callbacks may start new transfers
+    lock.unlock();
+    complete(completed);
+}
+
+int TransferEngine::writeLink(const uint8_t *buf, size_t len, unsigned timeout_ms)
+{
+    if (_capture != nullptr)
+    {
+        _capture->recordStream(CaptureRecord::Direction::TX, buf, len);
+    }
+    return _link.write(buf, len, timeout_ms);
+}
+
+void TransferEngine::deliver(const uint8_t *buf, size_t len, Completions &completed)
+{
+    if (_capture != nullptr)
+    {
+        _capture->record(CaptureRecord::Direction::RX, buf, len);
+    }
+
+    uint16_t id = Packet::getFrameRequestId(buf);
+    uint8_t slotIdx = id % SLOT_COUNT;
+    auto &slot = _slots[slotIdx];
+
+    if (slot.state != SlotState::PENDING || slot.requestId != id)
+    {
+        //late response of a timed out request
+        LOG_WARN(TAG, "Unexpected request id = %d, dropping", (int)id);
+        _stats.onSeqMismatch(Packet::getFrameType(buf));
+        return;
+    }
+
+    Packet &rxPkt = *slot.rxPkt;
+    if (rxPkt.setFrame(buf, len) < 0)
+    {
+        LOG_ERR(TAG, "Rx packet length(%d) > buffer size(%d)", (int)len, (int)rxPkt.getBufferSize());
+    }
+
+    slot.receivedAt = Clock::now();
+
+    if (slot.txPkt != nullptr)
+    {
+        rxPkt.flush();
+        _stats.onComplete(slot.txPkt->getType(), slot.txPkt->getFrameLength(), rxPkt.getFrameLength(),
+                          std::chrono::duration_cast<std::chrono::microseconds>(slot.receivedAt - slot.sentAt).count());
+        completed.emplace_back(std::move(slot.done), 0);
+        releaseSlot(slotIdx);
+        return;
+    }
+
+    slot.state = SlotState::DONE;
+    _rspCv.notify_all();
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "ioig_protocol.h"
+#include "ioig_stats.h"
+#include "ioig_capture.h"
+
+namespace ioig
+{
+
+    /**
+     * @class TransferEngine
+     *
+     * @brief Pipelines request/response packets on a device data channel.
+     *
+     * Up to `window` requests can be outstanding at the same time. Every
+     * response is matched to its request using the request id of the header,
+     * so concurrent callers share the USB round trip instead of waiting on
+     * each other. The id is 16 bits wide on a v2 link: a late response to a
+     * timed out request is told apart from the one of the next request
+     * reusing the slot.
+     */
+    class TransferEngine
+    {
+    public:
+
+        /**
+         * @brief Byte pipe underneath the engine (libusb, fake device, ...).
+         */
+        class Link
+        {
+        public:
+            virtual ~Link() {}
+
+            /**
+             * @brief Starts the link.
+             *        Received data must be forwarded to TransferEngine::onReceive().
+             * @return zero on success, negative value on error
+             */
+            virtual int start(TransferEngine &engine) = 0;
+
+            /**
+             * @brief Stops the link, no more data is forwarded to the engine after return.
+             */
+            virtual void stop() = 0;
+
+            /**
+             * @brief Queues a buffer for transmission.
+             * @note Non blocking, the buffer is copied before return.
+             *       The buffer holds one packet, or up to MAX_WRITE_SIZE bytes
+             *       of packets back to back, to be sent as a single USB transfer.
+             * @return zero on success, negative value on error
+             */
+            virtual int write(const uint8_t *buf, size_t len, unsigned timeout_ms) = 0;
+
+            /**
+             * @return the header version agreed with the device, Packet::PROTOCOL_V1
+             *         for a device predating the v2 header
+             */
+            virtual uint8_t getProtocol() const { return Packet::PROTOCOL_V1; }
+        };
+
+        /**
+         * @brief Default number of outstanding requests.
+         * @note Must stay below the firmware rx queue depth (RX_PKT_QUEUE_MAX_SIZE),
+         *       a full window fits in one MAX_WRITE_SIZE transfer.
+         */
+        static constexpr unsigned DEFAULT_WINDOW = 8;
+        static constexpr unsigned MAX_WINDOW = 64;
+
+        /**
+         * @brief Largest Link::write(), packets sent together by a multi-packet transfer.
+         */
+        static constexpr unsigned MAX_WRITE_SIZE = 8 * Packet::MAX_SIZE;
+
+        TransferEngine(Link &link, unsigned window = DEFAULT_WINDOW);
+        ~TransferEngine();
+
+        TransferEngine(const TransferEngine &) = delete;
+        TransferEngine &operator=(const TransferEngine &) = delete;
+
+        /**
+         * @brief Starts the underlying link, and frames the requests with its protocol.
+         * @return zero on success, negative value on error
+         */
+        int start();
+
+        /**
+         * @brief Stops the underlying link.
+         */
+        void stop();
+
+        /**
+         * @brief Transfers a packet and waits for the matching response.
+         * @note Blocking operation, thread safe.
+         *
+         * @param txPkt The packet to transmit.
+         * @param rxPkt The packet to receive.
+         * @param timeout_ms Time to wait for the response.
+         * @param retries Attempts before giving up.
+         * @return zero on success, negative value on error
+         */
+        int transfer(Packet &txPkt, Packet &rxPkt, unsigned timeout_ms, unsigned retries = 4);
+
+        /**
+         * @brief Transfers a sequence of packets, keeping up to `window` of them in flight.
+         * @note Blocking operation, thread safe. Packets may be executed out of
+         *       order and a lost one is resent, so they must not depend on each other.
+         *
+         * @param txPkts The packets to transmit.
+         * @param rxPkts The packets to receive, rxPkts[i] is the response of txPkts[i].
+         * @param count Number of packets.
+         * @param timeout_ms Time to wait for each response.
+         * @param retries Attempts per packet before giving up.
+         * @return zero on success, negative value if a packet got no response
+         */
+        int transfer(Packet *txPkts, Packet *rxPkts, size_t count, unsigned timeout_ms, unsigned retries = 4);
+
+        /**
+         * @brief Called with zero on success, negative value on error.
+         */
+        using Completion = std::function<void(int)>;
+
+        /**
+         * @brief Transfers a packet, done is called when the matching response arrives.
+         * @note Non blocking, thread safe. Requests beyond the window wait in a
+         *       backlog. done runs on the link completion path, or on the engine
+         *       timer thread after timeout_ms, and must not block. The packets
+         *       must stay valid until done is called. Sent once, no retry.
+         *
+         * @param txPkt The packet to transmit.
+         * @param rxPkt The packet to receive.
+         * @param timeout_ms Time to wait for the response, zero waits forever.
+         * @param done Completion callback.
+         */
+        void transferAsync(Packet &txPkt, Packet &rxPkt, unsigned timeout_ms, Completion done);
+
+        /**
+         * @brief Sends a packet the device executes without answering (Packet::FLAG_NO_RESPONSE).
+         * @note Thread safe, takes no window slot. On a v1 link the device
+         *       answers anyway: the response is waited for and dropped.
+         *
+         * @param txPkt The packet to transmit.
+         * @param timeout_ms Time to wait for the write.
+         * @return zero on success, negative value on error
+         */
+        int send(Packet &txPkt, unsigned timeout_ms);
+
+        /**
+         * @brief Feeds received bytes to the engine.
+         *
+         * Called by the link from its completion path. Data is handled as a
+         * stream, so a buffer may carry several packets or a partial one.
+         */
+        void onReceive(const uint8_t *buf, size_t len);
+
+        unsigned getWindow() const { return _window; }
+
+        uint8_t getProtocol() const { return _protocol; }
+
+        /**
+         * @brief Counters and latency histograms of the transfers done so far.
+         */
+        TransferStats::Snapshot getStats() const { return _stats.snapshot(); }
+        void resetStats() { _stats.reset(); }
+
+        /**
+         * @brief Records the frames written and received to capture, while it runs.
+         * @note Called before start(), capture must outlive the engine.
+         */
+        void setCapture(PacketCapture *capture) { _capture = capture; }
+
+    private:
+
+        enum class SlotState : uint8_t
+        {
+            FREE = 0,
+            PENDING,
+            DONE
+        };
+
+        using Clock = std::chrono::steady_clock;
+
+        struct Slot
+        {
+            SlotState state;
+            uint16_t  requestId;
+            Packet   *rxPkt;
+            Clock::time_point sentAt;
+            Clock::time_point receivedAt;
+
+            //async transfers only
+            Packet   *txPkt;
+            Completion done;
+            Clock::time_point deadline;
+        };
+
+        struct AsyncRequest
+        {
+            Packet *txPkt;
+            Packet *rxPkt;
+            unsigned timeout_ms;
+            Completion done;
+        };
+
+        using Completions = std::vector<std::pair<Completion, int>>;
+
+        void deliver(const uint8_t *buf, size_t len, Completions &completed);
+
+        /**
+         * @brief Link::write(), the frames are captured first.
+         */
+        int writeLink(const uint8_t *buf, size_t len, unsigned timeout_ms);
+
+        /**
+         * @return the slot of a new request id, the low byte of the id
+         */
+        int  acquireSlot(std::unique_lock<std::mutex> &lock);
+        void releaseSlot(uint8_t slotIdx);
+
+        /**
+         * @brief Frames a request with the link protocol and the request id of its slot.
+         */
+        void stamp(Packet &txPkt, uint8_t slotIdx);
+
+        uint16_t nextRequestId();
+
+        /**
+         * @brief Sends the backlog requests that fit in the window.
+         */
+        void sendAsync(std::unique_lock<std::mutex> &lock, Completions &completed);
+
+        /**
+         * @brief Fails the async requests past their deadline.
+         * @return the earliest deadline left
+         */
+        Clock::time_point expireAsync(Completions &completed);
+
+        /**
+         * @brief Timer thread: async timeouts, and the backlog when blocking callers free slots.
+         */
+        void asyncLoop();
+
+        /**
+         * @brief Stops the timer thread, pending async requests fail.
+         */
+        void stopAsync();
+
+        static void complete(Completions &completed);
+
+        static constexpr unsigned SLOT_COUNT = 256;
+
+        Link    &_link;
+        uint8_t  _protocol;
+        unsigned _window;
+        unsigned _inFlight;
+        uint16_t _nextRequestId;
+        Slot     _slots[SLOT_COUNT];
+
+        uint8_t  _rxStream[2 * Packet::MAX_FRAME_SIZE];
+        size_t   _rxStreamLen;
+
+        TransferStats _stats;
+        PacketCapture *_capture;
+
+        std::deque<AsyncRequest> _asyncBacklog;
+        unsigned _asyncInFlight;
+        bool _asyncRunning;
+        bool _asyncRescan;         /**< Requests sent with a deadline, for the timer thread */
+        std::thread _asyncThread;  /**< Started by the first transferAsync() */
+        std::condition_variable _asyncCv;
+
+        std::mutex _mutex;
+        std::condition_variable _slotCv;   /**< A slot was released */
+        std::condition_variable _rspCv;    /**< A response was delivered */
+
+        static constexpr const char* TAG = "TransferEngine";
+    };
+
+}
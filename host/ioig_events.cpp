@@ -0,0 +1,368 @@
+#include <cstring>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "ioig_events.h"
+#include "ioig_trace.h"
+
+using namespace ioig;
+
+constexpr unsigned EventRecord::MAX_DATA;
+constexpr unsigned EventRecord::GPIO_ENTRY_SIZE_V1;
+constexpr unsigned EventRecord::GPIO_ENTRY_SIZE_V2;
+constexpr unsigned EventRecord::MAX_PER_PACKET;
+constexpr unsigned ThreadPoolExecutor::DEFAULT_THREADS;
+
+static_assert(sizeof(EventRecord) == 8, "EventRecord is sized for the GPIO events");
+
+
+//==========================================================
+// EventRecord
+//==========================================================
+
+unsigned EventRecord::decode(Packet &evtPkt, EventRecord *records, unsigned max, uint8_t protocol)
+{
+    unsigned count = 0;
+    auto type = evtPkt.getType();
+
+    switch (type)
+    {
+    case Packet::Type::GPIO_EVENT:
+    {
+        //[count][pin:16|events:16]..., a [timestamp:32] after each one from v2
+        unsigned evtCnt = evtPkt.getPayloadItem8(0);
+        bool timestamps = protocol >= Packet::PROTOCOL_V2;
+        unsigned entrySize = timestamps ? GPIO_ENTRY_SIZE_V2 : GPIO_ENTRY_SIZE_V1;
+
+        for (unsigned i = 0; i < evtCnt && count < max; i++)
+        {
+            if (1 + (i + 1) * entrySize > evtPkt.getPayloadLength())
+            {
+                break;
+            }
+
+            uint32_t gpioEvt = evtPkt.getPayloadItem32(1 + i * entrySize);
+            unsigned pin = (gpioEvt >> 16) & 0xFFFF;
+
+            if (pin > 0xFF)
+            {
+                continue; //not a pin
+            }
+
+            EventRecord &rec = records[count++];
+            rec.type = static_cast<uint8_t>(type);
+            rec.id = static_cast<uint8_t>(pin);
+            rec.flags = gpioEvt & 0xFFFF;
+            rec.timestamp = timestamps ? evtPkt.getPayloadItem32(5 + i * entrySize) : 0;
+        }
+        break;
+    }
+    case Packet::Type::SERIAL_EVENT:
+    {
+        //[instance][count][data]...
+        unsigned instance = evtPkt.getPayloadItem8(0);
+        size_t len = evtPkt.getPayloadItem8(1);
+
+        if (max == 0 || len == 0 || len > MAX_DATA || len + 2 > evtPkt.getPayloadLength())
+        {
+            break;
+        }
+
+        EventRecord &rec = records[count++];
+        rec.type = static_cast<uint8_t>(type);
+        rec.id = static_cast<uint8_t>(instance);
+        rec.len = len;
+        rec.offset = 2;
+        break;
+    }
+    default:
+        break;
+    }
+
+    return count;
+}
+
+
+//==========================================================
+// EventRing
+//==========================================================
+
+static size_t roundUpPow2(size_t value)
+{
+    size_t size = 1;
+    while (size < value)
+    {
+        size <<= 1;
+    }
+    return size;
+}
+
+EventRing::EventRing(unsigned capacity, unsigned dataCapacity)
+    : _head(0),
+      _dataHead(0),
+      _tail(0),
+      _dataTail(0)
+{
+    _records.resize(roundUpPow2(capacity));
+    _mask = _records.size() - 1;
+
+    if (dataCapacity > 0)
+    {
+        _data.resize(roundUpPow2(dataCapacity));
+    }
+    _dataMask = _data.size() - 1;
+}
+
+bool EventRing::push(const EventRecord &record, const uint8_t *data)
+{
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    bool serial = record.type == static_cast<uint8_t>(Packet::Type::SERIAL_EVENT);
+    size_t len = serial && data != nullptr ? record.len : 0;
+
+    if (tail - _head.load(std::memory_order_acquire) == _records.size() ||
+        _dataTail - _dataHead.load(std::memory_order_acquire) + len > _data.size())
+    {
+        return false;
+    }
+
+    //the bytes in the order of their records, published with the record
+    for (size_t i = 0; i < len; i++)
+    {
+        _data[(_dataTail + i) & _dataMask] = data[i];
+    }
+    _dataTail += len;
+
+    EventRecord &cell = _records[tail & _mask];
+    cell = record;
+    if (serial)
+    {
+        cell.len = static_cast<uint16_t>(len);
+        cell.offset = 0;
+    }
+
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool EventRing::pop(EventRecord &record, uint8_t *data)
+{
+    size_t head = _head.load(std::memory_order_relaxed);
+
+    if (head == _tail.load(std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    record = _records[head & _mask];
+
+    if (record.type == static_cast<uint8_t>(Packet::Type::SERIAL_EVENT) && record.len > 0)
+    {
+        size_t dataHead = _dataHead.load(std::memory_order_relaxed);
+        for (size_t i = 0; data != nullptr && i < record.len; i++)
+        {
+            data[i] = _data[(dataHead + i) & _dataMask];
+        }
+        _dataHead.store(dataHead + record.len, std::memory_order_release);
+    }
+
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+const EventRecord *EventRing::front() const
+{
+    size_t head = _head.load(std::memory_order_relaxed);
+    return head != _tail.load(std::memory_order_acquire) ? &_records[head & _mask] : nullptr;
+}
+
+
+//==========================================================
+// ThreadPoolExecutor
+//==========================================================
+
+ThreadPoolExecutor::ThreadPoolExecutor(unsigned threads)
+    : _stopping(false)
+{
+    for (unsigned i = 0; i < (threads > 0 ? threads : 1); i++)
+    {
+        _threads.emplace_back(&ThreadPoolExecutor::run, this);
+    }
+}
+
+ThreadPoolExecutor::~ThreadPoolExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+        _cv.notify_all();
+    }
+
+    for (auto &th : _threads)
+    {
+        th.join();
+    }
+}
+
+void ThreadPoolExecutor::post(std::function<void()> task)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tasks.push_back(std::move(task));
+    _cv.notify_one();
+}
+
+void ThreadPoolExecutor::run()
+{
+    Tracer::setThreadName("ioig executor");
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true)
+    {
+        _cv.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+
+        if (_tasks.empty())
+        {
+            return; //stopping, nothing left
+        }
+
+        auto task = std::move(_tasks.front());
+        _tasks.pop_front();
+
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+
+//==========================================================
+// ManualExecutor
+//==========================================================
+
+void ManualExecutor::post(std::function<void()> task)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tasks.push_back(std::move(task));
+    _cv.notify_one();
+}
+
+size_t ManualExecutor::run(unsigned timeout_ms)
+{
+    std::deque<std::function<void()>> tasks;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return !_tasks.empty(); });
+        tasks.swap(_tasks);
+    }
+
+    for (auto &task : tasks)
+    {
+        task();
+    }
+
+    return tasks.size();
+}
+
+
+//==========================================================
+// PollExecutor
+//==========================================================
+
+PollExecutor::PollExecutor()
+    : _readFd(-1),
+      _writeFd(-1)
+{
+#if defined(__linux__)
+    _readFd = _writeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(_WIN32)
+    int fds[2];
+    if (pipe(fds) == 0)
+    {
+        for (int fd : fds)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        _readFd = fds[0];
+        _writeFd = fds[1];
+    }
+#endif
+}
+
+PollExecutor::~PollExecutor()
+{
+#if !defined(_WIN32)
+    if (_writeFd != _readFd && _writeFd >= 0)
+    {
+        ::close(_writeFd);
+    }
+    if (_readFd >= 0)
+    {
+        ::close(_readFd);
+    }
+#endif
+}
+
+void PollExecutor::post(std::function<void()> task)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    //readable already, unless the queue was drained
+    bool signal = _tasks.empty();
+    _tasks.push_back(std::move(task));
+
+    if (!signal || _writeFd < 0)
+    {
+        return;
+    }
+
+#if defined(__linux__)
+    uint64_t one = 1;
+    ssize_t ret = ::write(_writeFd, &one, sizeof(one));
+#elif !defined(_WIN32)
+    uint8_t one = 1;
+    ssize_t ret = ::write(_writeFd, &one, sizeof(one));
+#else
+    int ret = 0;
+#endif
+    (void)ret; //a full eventfd or pipe is readable anyway
+}
+
+size_t PollExecutor::drain()
+{
+    std::deque<std::function<void()>> tasks;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_readFd >= 0)
+        {
+#if defined(__linux__)
+            uint64_t count;
+            ssize_t ret = ::read(_readFd, &count, sizeof(count));
+            (void)ret;
+#elif !defined(_WIN32)
+            uint8_t buf[64];
+            while (::read(_readFd, buf, sizeof(buf)) > 0)
+            {
+            }
+#endif
+        }
+
+        tasks.swap(_tasks);
+    }
+
+    for (auto &task : tasks)
+    {
+        task();
+    }
+
+    return tasks.size();
+}
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ioig_protocol.h"
+
+namespace ioig
+{
+
+    /**
+     * @brief Routing key of an event: GPIO_EVENT and a pin, or SERIAL_EVENT and a UART instance.
+     */
+    struct EventKey
+    {
+        Packet::Type type;
+        uint8_t id;
+    };
+
+    /**
+     * @brief One decoded event, delivered only to the handler registered for its key.
+     */
+    struct Event
+    {
+        EventKey key;
+        uint32_t flags;       /**< GPIO event flags */
+        uint32_t timestamp;   /**< GPIO device time of the irq, in microseconds, 0 in a v1 session */
+        const uint8_t *data;  /**< SERIAL rx bytes, valid during the callback only */
+        size_t len;
+    };
+
+    class EventHandler
+    {
+        public:
+            EventHandler() : _dropped(0) {}
+            virtual ~EventHandler() {}
+            virtual void onEvent(const Event & evt) = 0;
+
+            /**
+             * @return the events of this handler dropped because the event queue was full
+             */
+            uint64_t getDroppedEvents() const { return _dropped.load(std::memory_order_relaxed); }
+
+            void onDropped() { _dropped.fetch_add(1, std::memory_order_relaxed); }
+
+        private:
+            std::atomic<uint64_t> _dropped;
+    };
+
+
+    /**
+     * @brief An event as queued between the reader and the callbacks, 8 bytes.
+     *
+     * Sized for the GPIO events: the SERIAL bytes are kept out of line, the
+     * record only holds their count and offset. Also the record of the pull
+     * API, see UsbManager::pollEvents().
+     */
+    struct EventRecord
+    {
+        static constexpr unsigned MAX_DATA = Packet::MAX_SIZE - Packet::Header::SIZE - 2; /**< [instance][count] */
+
+        uint8_t type;             /**< Packet::Type, GPIO_EVENT or SERIAL_EVENT */
+        uint8_t id;               /**< The pin or the UART instance */
+        union
+        {
+            uint16_t flags;       /**< GPIO event flags */
+            uint16_t len;         /**< SERIAL rx byte count */
+        };
+        union
+        {
+            uint32_t timestamp;   /**< GPIO device time of the irq, in microseconds, 0 in a v1 session */
+            uint32_t offset;      /**< SERIAL bytes position: in the payload once decoded, in the data buffer once pulled */
+        };
+
+        EventKey key() const { return {static_cast<Packet::Type>(type), id}; }
+
+        /**
+         * @brief Decodes a GPIO_EVENT or SERIAL_EVENT packet, the SERIAL bytes are left in it.
+         * @param protocol The version of the session, GPIO events carry the device timestamp from v2
+         * @return the number of records written, at most max
+         */
+        static unsigned decode(Packet &evtPkt, EventRecord *records, unsigned max, uint8_t protocol);
+
+        static constexpr unsigned GPIO_ENTRY_SIZE_V1 = 4;   /**< [pin:16|events:16] */
+        static constexpr unsigned GPIO_ENTRY_SIZE_V2 = 8;   /**< [pin:16|events:16][timestamp:32] */
+        static constexpr unsigned MAX_PER_PACKET = (Packet::MAX_SIZE - Packet::Header::SIZE - 1) / GPIO_ENTRY_SIZE_V1; /**< GPIO: [count][entry]... */
+    };
+
+
+    /**
+     * @class EventRing
+     *
+     * @brief Bounded single producer, single consumer queue of event records.
+     *
+     * Lock-free: the producer only writes the tail, the consumer only the head.
+     * The SERIAL bytes go to a byte ring of their own, in the order of their
+     * records. The capacities are rounded up to a power of two.
+     */
+    class EventRing
+    {
+    public:
+        /**
+         * @param capacity Records
+         * @param dataCapacity SERIAL bytes, over all the queued records
+         */
+        explicit EventRing(unsigned capacity, unsigned dataCapacity = 0);
+
+        EventRing(const EventRing &) = delete;
+        EventRing &operator=(const EventRing &) = delete;
+
+        /**
+         * @note Producer side only.
+         * @param data The record.len SERIAL bytes
+         * @return false if the ring, or its byte ring, is full
+         */
+        bool push(const EventRecord &record, const uint8_t *data = nullptr);
+
+        /**
+         * @note Consumer side only.
+         * @param data Receives the record.len SERIAL bytes, at offset 0, up to EventRecord::MAX_DATA
+         * @return false if the ring is empty
+         */
+        bool pop(EventRecord &record, uint8_t *data = nullptr);
+
+        /**
+         * @note Consumer side only.
+         * @return the next record to pop, nullptr if the ring is empty
+         */
+        const EventRecord *front() const;
+
+        bool empty() const { return size() == 0; }
+        size_t size() const { return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire); }
+        size_t capacity() const { return _records.size(); }
+        size_t dataCapacity() const { return _data.size(); }
+
+    private:
+        std::vector<EventRecord> _records;
+        size_t _mask;
+        std::vector<uint8_t> _data;
+        size_t _dataMask;
+
+        std::atomic<size_t> _head;      /**< Next record to pop */
+        std::atomic<size_t> _dataHead;  /**< Next byte to pop */
+        char _pad[64 - 2 * sizeof(std::atomic<size_t>)]; /**< Head and tail on distinct cache lines */
+        std::atomic<size_t> _tail;      /**< Next record to push */
+        size_t _dataTail;               /**< Next byte to push, producer only */
+    };
+
+
+    /**
+     * @brief What the event reader does when the event queue of a device is full.
+     */
+    enum class EventOverflowPolicy
+    {
+        DROP_NEWEST,  /**< The event is dropped and counted, the reader keeps draining the device */
+        BLOCK         /**< The reader waits for room, the device queues may overflow instead */
+    };
+
+    /**
+     * @brief Event counters of one device.
+     */
+    struct EventStats
+    {
+        uint64_t queued;      /**< Events put in the queue by the reader */
+        uint64_t dispatched;  /**< Events given to their handler, or pulled */
+        uint64_t dropped;     /**< Events lost because the queue was full */
+        uint64_t maxDepth;    /**< Highest queue level seen by the reader */
+    };
+
+
+    /**
+     * @class EventExecutor
+     *
+     * @brief Runs the event callbacks, away from the thread reading the device.
+     *
+     * A device posts a task when events are queued and no task of its own
+     * is pending, so its callbacks are never run concurrently and keep the
+     * device order.
+     */
+    class EventExecutor
+    {
+    public:
+        virtual ~EventExecutor() {}
+
+        /**
+         * @brief Runs task later, on a thread of the executor.
+         * @note Called by the event reader threads, must not block.
+         */
+        virtual void post(std::function<void()> task) = 0;
+    };
+
+    /**
+     * @class ThreadPoolExecutor
+     *
+     * @brief Runs the callbacks on its own threads. The default executor has DEFAULT_THREADS threads.
+     */
+    class ThreadPoolExecutor : public EventExecutor
+    {
+    public:
+        static constexpr unsigned DEFAULT_THREADS = 2;
+
+        explicit ThreadPoolExecutor(unsigned threads = DEFAULT_THREADS);
+
+        /**
+         * @brief Runs the tasks already posted, then stops the threads.
+         */
+        ~ThreadPoolExecutor();
+
+        void post(std::function<void()> task) override;
+
+    private:
+        void run();
+
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::deque<std::function<void()>> _tasks;
+        std::vector<std::thread> _threads;
+        bool _stopping;
+    };
+
+    /**
+     * @class ManualExecutor
+     *
+     * @brief Runs the callbacks on the caller's thread, from its own loop.
+     */
+    class ManualExecutor : public EventExecutor
+    {
+    public:
+        void post(std::function<void()> task) override;
+
+        /**
+         * @brief Runs the pending tasks, waits up to timeout_ms for one if there are none.
+         * @return the number of tasks run
+         */
+        size_t run(unsigned timeout_ms = 0);
+
+    private:
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        std::deque<std::function<void()>> _tasks;
+    };
+
+    /**
+     * @class PollExecutor
+     *
+     * @brief Runs the callbacks from an application event loop (epoll, poll, select).
+     *
+     * The file descriptor becomes readable when tasks are posted, drain()
+     * runs them on the caller's thread and never blocks. One executor may
+     * serve several usb ports, they then share the file descriptor.
+     *
+     * @note An eventfd on Linux, a non-blocking pipe on the other POSIX
+     * systems. Not available on Windows: fd() returns -1.
+     */
+    class PollExecutor : public EventExecutor
+    {
+    public:
+        PollExecutor();
+        ~PollExecutor();
+
+        PollExecutor(const PollExecutor &) = delete;
+        PollExecutor &operator=(const PollExecutor &) = delete;
+
+        void post(std::function<void()> task) override;
+
+        /**
+         * @return the file descriptor to watch for reading, -1 if it can't be created
+         */
+        int fd() const { return _readFd; }
+
+        /**
+         * @brief Clears the file descriptor and runs the pending tasks.
+         * @return the number of tasks run
+         */
+        size_t drain();
+
+    private:
+        std::mutex _mutex;
+        std::deque<std::function<void()>> _tasks;
+        int _readFd;
+        int _writeFd;  /**< Same as _readFd for an eventfd */
+    };
+
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "ioig_protocol.h"
+
+namespace ioig
+{
+namespace msg
+{
+    /**
+     * @brief Wire encoding of a field: integers big endian, floats in the byte order of the device.
+     *
+     * Same bytes as Packet::addPayloadItem16/32/64 and addPayloadItemFloat,
+     * written with a single memcpy.
+     */
+    template <typename T, typename Enable = void>
+    struct Wire;
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    inline uint8_t toBigEndian(uint8_t v) { return v; }
+    inline uint16_t toBigEndian(uint16_t v) { return __builtin_bswap16(v); }
+    inline uint32_t toBigEndian(uint32_t v) { return __builtin_bswap32(v); }
+    inline uint64_t toBigEndian(uint64_t v) { return __builtin_bswap64(v); }
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    template <typename U>
+    inline U toBigEndian(U v) { return v; }
+#else
+    //Any byte order: the big endian bytes of v, as a U. Its own inverse.
+    template <typename U>
+    inline U toBigEndian(U v)
+    {
+        uint8_t bytes[sizeof(U)];
+        for (unsigned i = 0; i < sizeof(U); i++)
+        {
+            bytes[i] = static_cast<uint8_t>(v >> (8 * (sizeof(U) - 1 - i)));
+        }
+        U out;
+        memcpy(&out, bytes, sizeof(U));
+        return out;
+    }
+#endif
+
+    template <typename T>
+    struct Wire<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+    {
+        using U = typename std::make_unsigned<T>::type;
+
+        static inline void store(uint8_t *out, T value)
+        {
+            U be = toBigEndian(static_cast<U>(value));
+            memcpy(out, &be, sizeof(U));
+        }
+
+        static inline T load(const uint8_t *in)
+        {
+            U be;
+            memcpy(&be, in, sizeof(U));
+            return static_cast<T>(toBigEndian(be));
+        }
+    };
+
+    template <>
+    struct Wire<float>
+    {
+        static inline void store(uint8_t *out, float value) { memcpy(out, &value, sizeof(float)); }
+
+        static inline float load(const uint8_t *in)
+        {
+            float value;
+            memcpy(&value, in, sizeof(float));
+            return value;
+        }
+    };
+
+
+    //Sum of the field sizes, out of Message: its own functions are not constant expressions inside the class
+    template <typename... Fields>
+    constexpr unsigned fieldsOffset(unsigned count)
+    {
+        const unsigned sizes[] = {static_cast<unsigned>(sizeof(Fields))..., 0u};
+        unsigned off = 0;
+        for (unsigned f = 0; f < count && f < sizeof...(Fields); f++)
+        {
+            off += sizes[f];
+        }
+        return off;
+    }
+
+
+    /**
+     * @brief Payload layout of a command, or of its response: the field types in wire order.
+     *
+     * Offsets and size are compile time constants, encode() writes the type
+     * and the whole payload with one capacity check, get() reads a field at
+     * its fixed offset. The host API and the firmware task both use the same
+     * definition, see the messages below.
+     *
+     * @note get() does not check the payload length, call fits() once first.
+     * The packet storage is always Packet::MAX_SIZE, a short payload reads
+     * stale bytes, never out of bounds.
+     */
+    template <Packet::Type TYPE, typename... Fields>
+    struct Message
+    {
+        static constexpr Packet::Type type = TYPE;
+        static constexpr unsigned COUNT = sizeof...(Fields);
+
+        template <unsigned I>
+        using FieldType = typename std::tuple_element<I, std::tuple<Fields...>>::type;
+
+        /**
+         * @return the payload offset of field i
+         */
+        static constexpr unsigned offset(unsigned i) { return fieldsOffset<Fields...>(i); }
+
+        static constexpr unsigned SIZE = fieldsOffset<Fields...>(sizeof...(Fields));
+
+        static_assert(SIZE <= Packet::MAX_SIZE - Packet::Header::SIZE, "Message payload larger than a packet");
+
+        /**
+         * @brief Sets the packet type and replaces the payload with the fields.
+         * @return false if the packet capacity is too small, the packet is then unchanged
+         */
+        static inline bool encode(Packet &pkt, const Fields &... values)
+        {
+            if (pkt.getBufferSize() < Packet::Header::SIZE + SIZE)
+            {
+                return false;
+            }
+
+            pkt.setType(TYPE);
+            store(pkt.getPayloadBuffer(), std::index_sequence_for<Fields...>(), values...);
+            pkt.setPayloadLength(SIZE);
+            return true;
+        }
+
+        /**
+         * @return true if the payload holds all the fields
+         */
+        static inline bool fits(const Packet &pkt)
+        {
+            return pkt.getPayloadLength() >= SIZE;
+        }
+
+        template <unsigned I>
+        static inline FieldType<I> get(Packet &pkt)
+        {
+            constexpr unsigned off = offset(I);
+            return Wire<FieldType<I>>::load(pkt.getPayloadBuffer(off));
+        }
+
+    private:
+        template <size_t... I>
+        static inline void store(uint8_t *pld, std::index_sequence<I...>, const Fields &... values)
+        {
+            int expand[] = {0, (Wire<Fields>::store(pld + offset(I), values), 0)...};
+            (void)expand;
+        }
+    };
+
+    template <Packet::Type TYPE, typename... Fields>
+    constexpr Packet::Type Message<TYPE, Fields...>::type;
+
+    template <Packet::Type TYPE, typename... Fields>
+    constexpr unsigned Message<TYPE, Fields...>::COUNT;
+
+    template <Packet::Type TYPE, typename... Fields>
+    constexpr unsigned Message<TYPE, Fields...>::SIZE;
+
+
+    //==========================================================
+    // Analog
+    //==========================================================
+
+    /** Request and response, ADC mode (mode 0) */
+    struct AnalogInit : Message<Packet::Type::ANALOG_INIT, uint8_t, uint8_t>
+    {
+        enum { PIN, MODE };
+    };
+
+    /** Request, PWM mode (mode 1) */
+    struct AnalogInitPwm : Message<Packet::Type::ANALOG_INIT, uint8_t, uint8_t, uint32_t, uint64_t>
+    {
+        enum { PIN, MODE, COUNT_TOP, PERIOD_US };
+    };
+
+    struct AnalogInitPwmRsp : Message<Packet::Type::ANALOG_INIT, uint8_t, uint8_t, uint32_t, uint64_t, uint8_t, uint8_t>
+    {
+        enum { PIN, MODE, COUNT_TOP, PERIOD_US, SLICE, CHANNEL };
+    };
+
+    /** Request and response, ADC mode */
+    struct AnalogDeinit : Message<Packet::Type::ANALOG_DEINIT, uint8_t, uint8_t>
+    {
+        enum { PIN, MODE };
+    };
+
+    /** Request and response, PWM mode */
+    struct AnalogDeinitPwm : Message<Packet::Type::ANALOG_DEINIT, uint8_t, uint8_t, uint8_t>
+    {
+        enum { PIN, MODE, SLICE };
+    };
+
+    struct AnalogRead : Message<Packet::Type::ANALOG_READ, uint8_t, uint8_t>
+    {
+        enum { CHANNEL, RESOLUTION };
+    };
+
+    struct AnalogReadRsp : Message<Packet::Type::ANALOG_READ, uint8_t, uint16_t>
+    {
+        enum { CHANNEL, VALUE };
+    };
+
+    struct AnalogReadTemp : Message<Packet::Type::ANALOG_READ_TEMP>
+    {
+    };
+
+    struct AnalogReadTempRsp : Message<Packet::Type::ANALOG_READ_TEMP, float>
+    {
+        enum { CELSIUS };
+    };
+
+    struct AnalogWrite : Message<Packet::Type::ANALOG_WRITE, uint8_t, uint32_t, uint16_t, uint32_t, uint8_t>
+    {
+        enum { PIN, SLICE, VALUE, COUNT_TOP, RESOLUTION };
+    };
+
+    struct AnalogWriteRsp : Message<Packet::Type::ANALOG_WRITE, float>
+    {
+        enum { PERCENT };
+    };
+
+
+    //==========================================================
+    // Gpio
+    //==========================================================
+
+    struct GpioSetValue : Message<Packet::Type::GPIO_SET_VALUE, uint8_t, uint8_t>
+    {
+        enum { PIN, VALUE };
+    };
+
+    struct GpioGetValue : Message<Packet::Type::GPIO_GET_VALUE, uint8_t>
+    {
+        enum { PIN };
+    };
+
+    struct GpioGetValueRsp : Message<Packet::Type::GPIO_GET_VALUE, uint8_t>
+    {
+        enum { VALUE };
+    };
+
+    struct GpioPulseIn : Message<Packet::Type::GPIO_PULSE_IN, uint8_t, uint8_t, uint64_t>
+    {
+        enum { PIN, STATE, TIMEOUT_US };
+    };
+
+    struct GpioPulseInRsp : Message<Packet::Type::GPIO_PULSE_IN, uint64_t>
+    {
+        enum { DURATION_US };
+    };
+
+} // namespace msg
+} // namespace ioig
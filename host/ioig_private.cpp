@@ -4,6 +4,19 @@
 using namespace ioig;
 
 constexpr unsigned Packet::MAX_SIZE; 
+constexpr uint8_t Packet::PROTOCOL_V1;
+constexpr uint8_t Packet::PROTOCOL_V2;
+constexpr uint8_t Packet::PROTOCOL_VERSION;
+constexpr uint8_t Packet::V2_TAG;
+constexpr unsigned Packet::MAX_FRAME_SIZE;
+constexpr unsigned PacketBatch::ENTRY_HEADER_SIZE;
+constexpr unsigned PacketBatch::MAX_ENTRIES;
+constexpr unsigned PacketXfer::STAGING_SIZE;
+constexpr unsigned PacketXfer::HEADER_SIZE;
+constexpr unsigned PacketXfer::MAX_FRAGMENT_SIZE;
+constexpr unsigned PacketXfer::MAX_FRAGMENTS;
+constexpr unsigned PacketXfer::EXEC_PARAMS;
+constexpr uint8_t PacketXfer::FLAG_FINAL;
 
 Peripheral::Peripheral()
 { 
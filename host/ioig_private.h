@@ -57,6 +57,19 @@
 #define LIBUSB_ERR(code) libusb_strerror(static_cast<libusb_error>(code))    
 
 
+namespace ioig
+{
+    /**
+     * @brief Packets of an asynchronous call, kept alive by its completion callback.
+     */
+    struct AsyncXfer
+    {
+        Packet txPkt;
+        Packet rxPkt;
+    };
+}
+
+
 
 
 
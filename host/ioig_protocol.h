@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <memory.h>
 #include <cstdint>
+#include <array>
+#include <algorithm>
 
 namespace ioig
 {
@@ -75,6 +77,14 @@ namespace ioig
             SERIAL_WRITE,
             SERIAL_READ,
             SERIAL_EVENT,
+
+            // Container of length-prefixed sub-commands, see PacketBatch
+            BATCH,
+
+            // Buffers larger than a packet, see PacketXfer
+            XFER_DATA,
+            XFER_EXEC,
+            XFER_READ,
                         
             NONE = 0xFF
         };
@@ -99,7 +109,7 @@ namespace ioig
         Packet() : Packet(MAX_SIZE){};
 
 
-        Packet(size_t pld_len)
+        Packet(size_t pld_len) : _bufLength(Header::SIZE)
         {
             auto maxPldLen = MAX_SIZE-Header::SIZE;
 
@@ -110,30 +120,28 @@ namespace ioig
             {
                 _bufSize = Header::SIZE + pld_len;
             }
-            _buffer = new uint8_t[_bufSize];
-            memset(_buffer, 0, _bufSize);
+            //payload bytes are only valid up to PLD_LEN, zero the header only
+            memset(_buffer.data(), 0, Header::SIZE);
+            memset(_ext, 0, sizeof(_ext));
         }
         
         
-        ~Packet()
-        {            
-            delete[] _buffer;
-        }
+        ~Packet() = default;
 
         //Copy constructor
-        Packet(const Packet& other) : _bufLength(other._bufLength),
+        Packet(const Packet& other) : _buffer(other._buffer),
+                                      _bufLength(other._bufLength),
                                       _bufSize(other._bufSize)
         {
-           _buffer = new uint8_t[_bufSize];
-           memcpy(_buffer, other._buffer, _bufSize);
+            memcpy(_ext, other._ext, sizeof(_ext));
         }
 
         // Move Constructor
-        Packet(Packet &&other) noexcept : _bufLength(other._bufLength),
-                                          _bufSize(other._bufSize),
-                                          _buffer(other._buffer)
+        Packet(Packet &&other) noexcept : _buffer(other._buffer),
+                                          _bufLength(other._bufLength),
+                                          _bufSize(other._bufSize)
         {
-            other._buffer = nullptr;
+            memcpy(_ext, other._ext, sizeof(_ext));
             other._bufLength = 0;
             other._bufSize = 0;
         }
@@ -143,11 +151,10 @@ namespace ioig
         {
             if (this != &other)
             {
-                delete[] _buffer;        
                 _bufLength = other._bufLength;
                 _buffer = other._buffer;
                 _bufSize = other._bufSize;
-                other._buffer = nullptr;
+                memcpy(_ext, other._ext, sizeof(_ext));
                 other._bufLength = 0;
                 other._bufSize = 0;
             }
@@ -156,16 +163,23 @@ namespace ioig
 
         inline void reset()
         {            
+            memset(_ext, 0, sizeof(_ext));
             _buffer[Header::TYPE]    = static_cast<uint8_t>(Type::NONE);
             _buffer[Header::SEQ_NUM] = 0;
             _buffer[Header::PLD_LEN] = 0;
             _buffer[Header::STATUS]  = static_cast<uint8_t>(Status::NONE);  
         }
 
+        /**
+         * @brief Copies the type, the request id and the header version, the flags are cleared.
+         */
         inline void cloneHeader(const Packet &other)
         {
             _buffer[Header::TYPE] = other._buffer[Header::TYPE];
             _buffer[Header::SEQ_NUM] = other._buffer[Header::SEQ_NUM];
+            _ext[HeaderExt::EXT_TAG] = other._ext[HeaderExt::EXT_TAG];
+            _ext[HeaderExt::EXT_FLAGS] = 0;
+            _ext[HeaderExt::EXT_ID_HI] = other._ext[HeaderExt::EXT_ID_HI];
         }
 
         int getPayloadItem8(const unsigned index)
@@ -200,18 +214,14 @@ namespace ioig
 
         inline int addPayloadItem16(const uint16_t value) 
         {
-            int ret=0;
-            ret |= addPayloadItem8((value >> 8) & 0xFF);             
-            ret |= addPayloadItem8(value & 0xFF);    
-
-            return ret >= 0 ? value : -1;
+            return addPayloadItemBE(value, 2) ? value : -1;
         }
 
         inline int getPayloadItem16(const unsigned i)
         {
             if ((i + 1) < getBufferLength()) 
             { 
-                uint8_t * pldBuf = &_buffer[Header::SIZE + i];
+                uint8_t * pldBuf = _buffer.data() + Header::SIZE + i;
                 uint16_t value = 0;             
                 value |= static_cast<uint16_t>(pldBuf[0]) << 8;
                 value |= static_cast<uint16_t>(pldBuf[1]);
@@ -222,13 +232,7 @@ namespace ioig
 
         inline int addPayloadItem32(const uint32_t value) 
         {
-            int ret=0;
-            ret |= addPayloadItem8((value >> 24) & 0xFF);
-            ret |= addPayloadItem8((value >> 16) & 0xFF);
-            ret |= addPayloadItem8((value >> 8) & 0xFF);
-            ret |= addPayloadItem8(value & 0xFF);    
-            
-            return ret >= 0 ? value : -1;
+            return addPayloadItemBE(value, 4) ? value : -1;
         }
 
 
@@ -236,7 +240,7 @@ namespace ioig
         {
             if ((i + 3) < getBufferLength()) 
             {
-                uint8_t * pldBuf = &_buffer[Header::SIZE + i];
+                uint8_t * pldBuf = _buffer.data() + Header::SIZE + i;
                 uint32_t value = 0;
                 value |= static_cast<uint32_t>(pldBuf[0]) << 24;
                 value |= static_cast<uint32_t>(pldBuf[1]) << 16;
@@ -249,23 +253,14 @@ namespace ioig
 
         inline int64_t addPayloadItem64(const uint64_t value) 
         {
-            int ret=0;
-            ret |= addPayloadItem8((value >> 56) & 0xFF);
-            ret |= addPayloadItem8((value >> 48) & 0xFF);
-            ret |= addPayloadItem8((value >> 40) & 0xFF);
-            ret |= addPayloadItem8((value >> 32) & 0xFF);
-            ret |= addPayloadItem8((value >> 24) & 0xFF);
-            ret |= addPayloadItem8((value >> 16) & 0xFF);
-            ret |= addPayloadItem8((value >> 8) & 0xFF);
-            ret |= addPayloadItem8(value & 0xFF);             
-            return ret >= 0 ? value : -1;
+            return addPayloadItemBE(value, 8) ? value : -1;
         }
 
         inline int64_t getPayloadItem64(const unsigned i)
         {
             if ((i + 7) < getBufferLength()) 
             {
-               uint8_t * pldBuf = &_buffer[Header::SIZE + i]; 
+               uint8_t * pldBuf = _buffer.data() + Header::SIZE + i; 
                uint64_t value = 0;
                value |= static_cast<uint64_t>(pldBuf[0]) << 56;
                value |= static_cast<uint64_t>(pldBuf[1]) << 48;
@@ -284,7 +279,7 @@ namespace ioig
         {
             if (getFreePayloadSlots() > sizeof(float))
             {
-                memcpy(&_buffer[getBufferLength()], &val, sizeof(float));
+                memcpy(_buffer.data() + getBufferLength(), &val, sizeof(float));
                 increasePayloadLength(sizeof(float));
                 return val;
             }             
@@ -296,7 +291,7 @@ namespace ioig
             if ((i + sizeof(float)) < getBufferLength()) 
             { 
                 float value=0;
-                uint8_t * pldBuf = &_buffer[Header::SIZE + i];
+                uint8_t * pldBuf = _buffer.data() + Header::SIZE + i;
                 memcpy(&value, pldBuf, sizeof(float));
                 return value;
             }
@@ -308,7 +303,7 @@ namespace ioig
             if ( n <= getFreePayloadSlots() )  
             {
                 auto idx = getBufferLength();                                                
-                memset(_buffer + idx , item , n); 
+                memset(_buffer.data() + idx , item , n); 
                 increasePayloadLength(n);
                 return n;
             }
@@ -320,7 +315,7 @@ namespace ioig
             if ( len <= getFreePayloadSlots() ) 
             {               
                 auto idx = getBufferLength();
-                memcpy(_buffer + idx , buf , len); 
+                memcpy(_buffer.data() + idx , buf , len); 
                 increasePayloadLength(len);
                 return len;
             }
@@ -344,12 +339,15 @@ namespace ioig
 
         inline uint8_t *getPayloadBuffer(const unsigned offset = 0)
         {
-            return &_buffer[Header::SIZE + offset];
+            return _buffer.data() + Header::SIZE + offset;
         }
       
+        /**
+         * @return the packet storage, nullptr if the packet was moved from
+         */
         inline uint8_t *getBuffer()
         {            
-            return _buffer;
+            return _bufSize > 0 ? _buffer.data() : nullptr;
         }
 
         inline size_t getBufferLength() const
@@ -357,6 +355,20 @@ namespace ioig
             return Header::SIZE + getPayloadLength();
         }
 
+        /**
+         * @brief Sets the payload length, the payload bytes are written in place.
+         * @return -1 if len exceeds the packet capacity
+         */
+        inline int setPayloadLength(const unsigned len)
+        {
+            if (Header::SIZE + len <= _bufSize)
+            {
+                _buffer[Header::PLD_LEN] = len;
+                return len;
+            }
+            return -1;
+        }
+
         inline int increasePayloadLength(const unsigned len)
         {
             if (len <= getFreePayloadSlots())
@@ -412,6 +424,134 @@ namespace ioig
             _buffer[Header::SEQ_NUM] = static_cast<uint8_t>(s);
         }
 
+        /**
+         * @return the request id: SEQ_NUM, with ID_HI above it in a v2 frame
+         */
+        inline uint16_t getRequestId() const
+        {
+            uint16_t hi = getProtocol() >= PROTOCOL_V2 ? _ext[HeaderExt::EXT_ID_HI] : 0;
+            return static_cast<uint16_t>(hi << 8) | _buffer[Header::SEQ_NUM];
+        }
+
+        /**
+         * @note Only the low byte is sent in a v1 frame.
+         */
+        inline void setRequestId(const uint16_t id)
+        {
+            _ext[HeaderExt::EXT_ID_HI] = static_cast<uint8_t>(id >> 8);
+            _buffer[Header::SEQ_NUM] = static_cast<uint8_t>(id);
+        }
+
+        /**
+         * @return the FLAG_* bits, zero in a v1 frame
+         */
+        inline uint8_t getFlags() const
+        {
+            return getProtocol() >= PROTOCOL_V2 ? _ext[HeaderExt::EXT_FLAGS] : 0;
+        }
+
+        /**
+         * @note Only sent in a v2 frame.
+         */
+        inline void setFlags(const uint8_t flags)
+        {
+            _ext[HeaderExt::EXT_FLAGS] = flags;
+        }
+
+        /**
+         * @return the header version of the frame, PROTOCOL_V1 or PROTOCOL_V2
+         */
+        inline uint8_t getProtocol() const
+        {
+            return _ext[HeaderExt::EXT_TAG] == V2_TAG ? PROTOCOL_V2 : PROTOCOL_V1;
+        }
+
+        inline void setProtocol(const uint8_t version)
+        {
+            _ext[HeaderExt::EXT_TAG] = version >= PROTOCOL_V2 ? V2_TAG : 0;
+        }
+
+        /**
+         * @return the bytes on the wire: the buffer, after the header extension in a v2 frame
+         */
+        inline size_t getFrameLength() const
+        {
+            return getExtLength(_ext) + getBufferLength();
+        }
+
+        /**
+         * @brief Copies the frame to send, out must hold getFrameLength() bytes.
+         * @return the frame length
+         */
+        inline size_t writeFrame(uint8_t *out) const
+        {
+            const unsigned ext = getExtLength(_ext);
+            memcpy(out, _ext, ext);
+            memcpy(out + ext, _buffer.data(), getBufferLength());
+            return ext + getBufferLength();
+        }
+
+        /**
+         * @brief Loads a frame received from the wire, v1 or v2.
+         * @return zero on success, negative value if the frame is cut to the buffer size
+         */
+        inline int setFrame(const uint8_t *frame, const size_t len)
+        {
+            const unsigned ext = getExtLength(frame);
+
+            reset();
+            if (len < ext + Header::SIZE)
+            {
+                return -1;
+            }
+
+            memcpy(_ext, frame, ext);
+            memcpy(_buffer.data(), frame + ext, std::min<size_t>(len - ext, _bufSize));
+
+            if (len - ext > _bufSize)
+            {
+                _buffer[Header::PLD_LEN] = _bufSize - Header::SIZE;
+                return -1;
+            }
+            return 0;
+        }
+
+        /**
+         * @brief Length of the frame at the start of a byte stream.
+         * @param len The bytes available, the frame may be incomplete.
+         * @return the frame length, or its header length while the header is incomplete
+         */
+        static inline size_t getFrameLength(const uint8_t *frame, const size_t len)
+        {
+            const size_t hdrLen = (len > 0 ? getExtLength(frame) : 0) + Header::SIZE;
+            if (len < hdrLen)
+            {
+                return hdrLen;
+            }
+            return hdrLen + frame[hdrLen - Header::SIZE + Header::PLD_LEN];
+        }
+
+        /**
+         * @note frame must hold a complete header.
+         */
+        static inline uint16_t getFrameRequestId(const uint8_t *frame)
+        {
+            if (getExtLength(frame) > 0)
+            {
+                return static_cast<uint16_t>(frame[HeaderExt::EXT_ID_HI] << 8) |
+                       frame[static_cast<size_t>(HeaderExt::EXT_SIZE) + static_cast<size_t>(Header::SEQ_NUM)];
+            }
+            return frame[Header::SEQ_NUM];
+        }
+
+        /**
+         * @note frame must hold a complete header.
+         */
+        static inline Type getFrameType(const uint8_t *frame)
+        {
+            return static_cast<Type>(frame[getExtLength(frame) + Header::TYPE]);
+        }
+
         inline void setStatus(const Status st) 
         {
             _buffer[Header::STATUS] = static_cast<uint8_t>(st);
@@ -526,6 +666,14 @@ namespace ioig
                     return "SERIAL_READ";
                 case Type::SERIAL_EVENT:
                     return "SERIAL_EVENT";
+                case Type::BATCH:
+                    return "BATCH";
+                case Type::XFER_DATA:
+                    return "XFER_DATA";
+                case Type::XFER_EXEC:
+                    return "XFER_EXEC";
+                case Type::XFER_READ:
+                    return "XFER_READ";
                 case Type::NONE:
                     return "NONE";
                 default:
@@ -569,16 +717,16 @@ namespace ioig
                 }
             };            
 
-            printf("Pkt: Typ: %s (0x%02x), St:%s, Buf(Sz:%d,Len:%d), SeqN: %d, PldLen: %d, Pld: ",
+            printf("Pkt: Typ: %s (0x%02x), St:%s, Buf(Sz:%d,Len:%d), Id: %d, PldLen: %d, Pld: ",
                    getTypeName(getType()), 
                    static_cast<int>(getType()) , 
                    getStatusName(getStatus()),
                    static_cast<int>(getBufferSize()),
                    static_cast<int>(getBufferLength()),
-                   static_cast<int>(getSeqNum()),
+                   static_cast<int>(getRequestId()),
                    static_cast<int>(getPayloadLength()));
             // Print the payload data
-            for (size_t i = Header::SIZE; i < _bufSize; ++i)
+            for (size_t i = Header::SIZE; i < getBufferLength(); ++i)
             {
                 printf("%02x ", static_cast<int>(_buffer[i]));
 
@@ -596,7 +744,9 @@ namespace ioig
             }
         }
 
-    private:        
+        /**
+         * @brief Header byte offsets
+         */
         enum Header : unsigned
         {
             TYPE = 0,
@@ -606,9 +756,314 @@ namespace ioig
             SIZE
         };
 
+        /**
+         * @brief Header extension byte offsets, in front of the header in a v2 frame
+         *
+         * v1 frame: [TYPE][SEQ_NUM][PLD_LEN][STATUS][payload]
+         * v2 frame: [V2_TAG][FLAGS][ID_HI][TYPE][SEQ_NUM][PLD_LEN][STATUS][payload]
+         *
+         * V2_TAG is not a Type, so every frame tells its version: the device
+         * answers a request with the framing it came with. The host sends v2
+         * frames once the SYS_INIT response reported PROTOCOL_V2, a device
+         * predating it only gets v1 frames. The request id is 16 bits wide
+         * in a v2 frame, SEQ_NUM holding its low byte.
+         */
+        enum HeaderExt : unsigned
+        {
+            EXT_TAG = 0,
+            EXT_FLAGS,
+            EXT_ID_HI,
+            EXT_SIZE
+        };
+
+        static constexpr uint8_t PROTOCOL_V1 = 1;
+        static constexpr uint8_t PROTOCOL_V2 = 2;
+        static constexpr uint8_t PROTOCOL_VERSION = PROTOCOL_V2;  /**< Highest header version supported */
+        static constexpr uint8_t V2_TAG = 0xC2;
+        static constexpr unsigned MAX_FRAME_SIZE = HeaderExt::EXT_SIZE + MAX_SIZE;
+
+        /**
+         * @brief Request flags of a v2 frame, the other bits are reserved and zero
+         */
+        enum Flags : uint8_t
+        {
+            FLAG_NO_RESPONSE = 0x01  /**< The device executes the request without answering it */
+        };
+
+    private:        
+
+        /**
+         * @return the header extension length of a frame, zero for a v1 frame
+         */
+        static inline unsigned getExtLength(const uint8_t *frame)
+        {
+            return frame[HeaderExt::EXT_TAG] == V2_TAG ? static_cast<unsigned>(HeaderExt::EXT_SIZE) : 0u;
+        }
+
+        //Big endian encoding, the payload length is updated once all bytes are written
+        inline bool addPayloadItemBE(const uint64_t value, const unsigned n)
+        {
+            if (n > getFreePayloadSlots())
+            {
+                return false;
+            }
+
+            uint8_t *pldBuf = _buffer.data() + getBufferLength();
+            for (unsigned i = 0; i < n; i++)
+            {
+                pldBuf[i] = static_cast<uint8_t>(value >> (8 * (n - 1 - i)));
+            }
+            _buffer[Header::PLD_LEN] += n;
+            return true;
+        }
+
+        std::array<uint8_t, MAX_SIZE> _buffer;  /**< First member, aligned with the Packet */
         size_t _bufLength;
-        size_t _bufSize;
-        uint8_t *_buffer;
+        size_t _bufSize;   /**< Usable capacity, the storage is always MAX_SIZE */
+        uint8_t _ext[HeaderExt::EXT_SIZE];  /**< v2 header extension, sent in front of the buffer */
+
+    };
 
+
+    /**
+     * @brief Several commands carried by a single BATCH packet.
+     *
+     * Request payload : [len][type][payload] ... 
+     * Response payload: [len][status][payload] ...
+     * 
+     * `len` is the sub-command payload length. The device answers the
+     * sub-commands in order; if the responses don't fit, it stops and the
+     * BATCH response status is set to ERR.
+     */
+    class PacketBatch
+    {
+    public:
+        static constexpr unsigned ENTRY_HEADER_SIZE = 2;
+        static constexpr unsigned MAX_ENTRIES = (Packet::MAX_SIZE - Packet::Header::SIZE) / ENTRY_HEADER_SIZE;
+
+        PacketBatch() : _count(0)
+        {
+            _request.setType(Packet::Type::BATCH);
+        }
+
+        /**
+         * @brief Appends the type and payload of a command.
+         * @return the entry index, negative value if the command can't be batched or doesn't fit
+         */
+        int add(Packet &cmd)
+        {
+            if (!isBatchable(cmd.getType()) || _count >= MAX_ENTRIES)
+            {
+                return -1;
+            }
+
+            if (appendEntry(_request, static_cast<uint8_t>(cmd.getType()), 
+                            cmd.getPayloadBuffer(), cmd.getPayloadLength()) < 0)
+            {
+                return -1;
+            }
+
+            _types[_count] = cmd.getType();
+            return _count++;
+        }
+
+        /**
+         * @brief Decodes the response of an entry into a packet.
+         * @return zero on success, negative value if the device didn't answer this entry
+         */
+        int getResult(const unsigned index, Packet &rsp)
+        {
+            if (index >= _count || _response.getType() != Packet::Type::BATCH)
+            {
+                return -1;
+            }
+
+            const uint8_t *pld = _response.getPayloadBuffer();
+            const unsigned pldLen = _response.getPayloadLength();
+            unsigned offset = 0;
+
+            for (unsigned i = 0; offset + ENTRY_HEADER_SIZE <= pldLen; i++)
+            {
+                const unsigned len = pld[offset];
+                if (offset + ENTRY_HEADER_SIZE + len > pldLen)
+                {
+                    break;
+                }
+
+                if (i == index)
+                {
+                    rsp.reset();
+                    rsp.setType(_types[index]);
+                    rsp.setSeqNum(_response.getSeqNum());
+                    rsp.setStatus(static_cast<Packet::Status>(pld[offset + 1]));
+                    return rsp.addPayloadBuffer(pld + offset + ENTRY_HEADER_SIZE, len) < 0 ? -1 : 0;
+                }
+                offset += ENTRY_HEADER_SIZE + len;
+            }
+
+            return -1;
+        }
+
+        inline unsigned size() const
+        {
+            return _count;
+        }
+
+        inline void clear()
+        {
+            _request.reset();
+            _request.setType(Packet::Type::BATCH);
+            _response.reset();
+            _count = 0;
+        }
+
+        inline Packet &getRequest()
+        {
+            return _request;
+        }
+
+        inline Packet &getResponse()
+        {
+            return _response;
+        }
+
+        /**
+         * @brief Appends an entry to a BATCH packet payload.
+         * @param code The sub-command type (request) or status (response).
+         * @return the payload length, negative value if the entry doesn't fit
+         */
+        static inline int appendEntry(Packet &pkt, const uint8_t code, const uint8_t *pld, const unsigned len)
+        {
+            if (ENTRY_HEADER_SIZE + len > pkt.getFreePayloadSlots())
+            {
+                return -1;
+            }
+            pkt.addPayloadItem8(len);
+            pkt.addPayloadItem8(code);
+            pkt.addPayloadBuffer(pld, len);
+            return pkt.getPayloadLength();
+        }
+
+        /**
+         * @brief Commands that change the device state or stream data are refused in a batch.
+         */
+        static inline bool isBatchable(const Packet::Type type)
+        {
+            switch (type)
+            {
+            case Packet::Type::SYS_INIT:
+            case Packet::Type::SYS_HW_RESET:
+            case Packet::Type::SYS_SW_RESET:
+            case Packet::Type::GPIO_EVENT:
+            case Packet::Type::SERIAL_EVENT:
+            case Packet::Type::BATCH:
+            case Packet::Type::XFER_DATA:
+            case Packet::Type::XFER_EXEC:
+            case Packet::Type::XFER_READ:
+            case Packet::Type::NONE:
+                return false;
+            default:
+                return true;
+            }
+        }
+
+    private:
+        Packet _request;
+        Packet _response;
+        Packet::Type _types[MAX_ENTRIES];
+        unsigned _count;
     };
-}
\ No newline at end of file
+
+
+    /**
+     * @brief Commands on buffers larger than a packet.
+     *
+     * The host streams the buffer in XFER_DATA fragments to a staging buffer
+     * of the device, then XFER_EXEC runs the bus command on the whole buffer
+     * as a single transaction, and XFER_READ fetches the bytes the command
+     * read back. The device has one staging buffer: a new transfer ID
+     * discards the staged data of the previous one.
+     *
+     * XFER_DATA payload: [id][offset:16][flags][data...]
+     * XFER_EXEC payload: [id][type][len:16][command params...], response: [rx_len:16]
+     * XFER_READ payload: [id][offset:16][len], response: [data...]
+     *
+     * Fragments are MAX_FRAGMENT_SIZE long, except the FLAG_FINAL one.
+     */
+    class PacketXfer
+    {
+    public:
+        static constexpr unsigned STAGING_SIZE = 4096;
+        static constexpr unsigned HEADER_SIZE = 4;
+        static constexpr unsigned MAX_FRAGMENT_SIZE = Packet::MAX_SIZE - Packet::Header::SIZE - HEADER_SIZE;
+        static constexpr unsigned MAX_FRAGMENTS = (STAGING_SIZE + MAX_FRAGMENT_SIZE - 1) / MAX_FRAGMENT_SIZE;
+        static constexpr unsigned EXEC_PARAMS = 4;  /**< Payload offset of the command params in XFER_EXEC */
+        static constexpr uint8_t FLAG_FINAL = 0x01;
+
+        static inline int addData(Packet &pkt, const uint8_t id, const unsigned offset,
+                                  const uint8_t *data, const unsigned len, const bool final)
+        {
+            pkt.reset();
+            pkt.setType(Packet::Type::XFER_DATA);
+            pkt.addPayloadItem8(id);
+            pkt.addPayloadItem16(offset);
+            pkt.addPayloadItem8(final ? FLAG_FINAL : 0);
+            return pkt.addPayloadBuffer(data, len);
+        }
+
+        /**
+         * @note The command params are added after, with the Packet::addPayload* methods.
+         */
+        static inline void addExec(Packet &pkt, const uint8_t id, const Packet::Type type, const unsigned len)
+        {
+            pkt.reset();
+            pkt.setType(Packet::Type::XFER_EXEC);
+            pkt.addPayloadItem8(id);
+            pkt.addPayloadItem8(static_cast<uint8_t>(type));
+            pkt.addPayloadItem16(len);
+        }
+
+        static inline void addRead(Packet &pkt, const uint8_t id, const unsigned offset, const unsigned len)
+        {
+            pkt.reset();
+            pkt.setType(Packet::Type::XFER_READ);
+            pkt.addPayloadItem8(id);
+            pkt.addPayloadItem16(offset);
+            pkt.addPayloadItem8(len);
+        }
+
+        /**
+         * @return true if the command moves data from the host to the bus (XFER_DATA needed before XFER_EXEC)
+         */
+        static inline bool hasTxData(const Packet::Type type)
+        {
+            switch (type)
+            {
+            case Packet::Type::SPI_TRANSFER:
+            case Packet::Type::SPI_WRITE:
+            case Packet::Type::I2C_WRITE:
+            case Packet::Type::SERIAL_WRITE:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        /**
+         * @return true if the command reads data back (XFER_READ after XFER_EXEC)
+         */
+        static inline bool hasRxData(const Packet::Type type)
+        {
+            switch (type)
+            {
+            case Packet::Type::SPI_TRANSFER:
+            case Packet::Type::SPI_READ:
+            case Packet::Type::I2C_READ:
+                return true;
+            default:
+                return false;
+            }
+        }
+    };
+
+}
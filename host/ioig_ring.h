@@ -0,0 +1,292 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace ioig
+{
+
+    /**
+     * @class MpscRing
+     *
+     * @brief Bounded multi producer, single consumer queue.
+     *
+     * Lock-free: each cell carries the ring position it is ready for, a
+     * producer claims a position with one compare and swap and publishes the
+     * cell by bumping its position. A full ring fails the push, it never
+     * waits. The capacity is rounded up to a power of two.
+     */
+    template <typename T>
+    class MpscRing
+    {
+    public:
+        explicit MpscRing(size_t capacity)
+            : _capacity(1),
+              _tail(0),
+              _head(0)
+        {
+            while (_capacity < capacity)
+            {
+                _capacity <<= 1;
+            }
+            _mask = _capacity - 1;
+
+            _cells.reset(new Cell[_capacity]);
+            for (size_t i = 0; i < _capacity; i++)
+            {
+                _cells[i].seq.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpscRing(const MpscRing &) = delete;
+        MpscRing &operator=(const MpscRing &) = delete;
+
+        /**
+         * @brief Claims a cell and calls fill(T &) to write it in place.
+         * @note Thread safe.
+         * @return false if the ring is full, fill is not called
+         */
+        template <typename Fill>
+        bool push(Fill &&fill)
+        {
+            //a cell is free for position pos when its seq is pos
+            size_t pos = _tail.load(std::memory_order_relaxed);
+            Cell *cell;
+
+            while (true)
+            {
+                cell = &_cells[pos & _mask];
+                size_t seq = cell->seq.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+                if (diff == 0)
+                {
+                    if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    return false; //full, the consumer is behind
+                }
+                else
+                {
+                    pos = _tail.load(std::memory_order_relaxed);
+                }
+            }
+
+            fill(cell->value);
+            cell->seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @note Consumer side only.
+         * @return false if the ring is empty, or the oldest cell is not published yet
+         */
+        bool pop(T &value)
+        {
+            Cell &cell = _cells[_head & _mask];
+
+            if (cell.seq.load(std::memory_order_acquire) != _head + 1)
+            {
+                return false;
+            }
+
+            value = cell.value;
+            cell.seq.store(_head + _capacity, std::memory_order_release);
+            _head++;
+            return true;
+        }
+
+        size_t capacity() const { return _capacity; }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> seq;  /**< Ring position the cell is ready for */
+            T value;
+        };
+
+        std::unique_ptr<Cell[]> _cells;
+        size_t _capacity;
+        size_t _mask;
+
+        std::atomic<size_t> _tail;  /**< Next position to push, shared by the producers */
+        char _pad[64 - sizeof(std::atomic<size_t>)]; /**< Tail and head on distinct cache lines */
+        size_t _head;               /**< Next position to pop, consumer only */
+    };
+
+
+    /**
+     * @class RingWriter
+     *
+     * @brief An MpscRing switched on at runtime, drained by a writer thread.
+     *
+     * Shared by the recorders (Tracer, PacketCapture): the producers push
+     * without ever waiting, a full ring drops the item and counts it. The
+     * writer thread calls drain every period, and a last time when stopped.
+     * stop() first waits for the producers past the enabled check, so
+     * nothing pushed before it returns is lost.
+     */
+    template <typename T>
+    class RingWriter
+    {
+    public:
+        using Drain = std::function<size_t(MpscRing<T> &)>;  /**< Returns the number of items written */
+
+        RingWriter(size_t capacity, unsigned periodMs)
+            : _capacity(capacity),
+              _periodMs(periodMs),
+              _enabled(false),
+              _producers(0),
+              _recorded(0),
+              _dropped(0),
+              _stopping(false)
+        {
+        }
+
+        ~RingWriter() { stop(); }
+
+        RingWriter(const RingWriter &) = delete;
+        RingWriter &operator=(const RingWriter &) = delete;
+
+        /**
+         * @brief Starts the writer thread, the pushes are accepted from now.
+         * @note Not thread safe against stop(), the owner serializes them.
+         * @return false if already running
+         */
+        bool start(Drain drain)
+        {
+            if (_writer.joinable())
+            {
+                return false;
+            }
+
+            if (!_ring)
+            {
+                //never freed while the object lives, a late producer may still look at it
+                _ring.reset(new MpscRing<T>(_capacity));
+            }
+
+            _drain = std::move(drain);
+            _stopping = false;
+            _recorded.store(0, std::memory_order_relaxed);
+            _dropped.store(0, std::memory_order_relaxed);
+            _writer = std::thread(&RingWriter::writerThread, this);
+
+            _enabled.store(true);
+            return true;
+        }
+
+        /**
+         * @brief Stops the pushes, then the writer once it has drained the ring.
+         * @return false if it was not running
+         */
+        bool stop()
+        {
+            if (!_enabled.exchange(false) && !_writer.joinable())
+            {
+                return false;
+            }
+
+            while (_producers.load() != 0)
+            {
+                std::this_thread::yield();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stopping = true;
+                _cv.notify_all();
+            }
+
+            _writer.join();
+            return true;
+        }
+
+        bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+        /**
+         * @brief Claims a cell and calls fill(T &) to write it in place.
+         * @note Thread safe, lock-free, never blocks.
+         * @return false if stopped or full, fill is not called
+         */
+        template <typename Fill>
+        bool push(Fill &&fill)
+        {
+            _producers.fetch_add(1);
+
+            bool pushed = false;
+            if (_enabled.load())
+            {
+                pushed = _ring->push(std::forward<Fill>(fill));
+                if (!pushed)
+                {
+                    _dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            _producers.fetch_sub(1);
+            return pushed;
+        }
+
+        /**
+         * @brief Counts items lost by the drain itself, a write error.
+         */
+        void addDropped(uint64_t count) { _dropped.fetch_add(count, std::memory_order_relaxed); }
+
+        /**
+         * @return the items written by the drain, since start()
+         */
+        uint64_t getRecorded() const { return _recorded.load(std::memory_order_relaxed); }
+
+        /**
+         * @return the items lost, since start()
+         */
+        uint64_t getDropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    private:
+
+        void writerThread()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            while (!_stopping)
+            {
+                _cv.wait_for(lock, std::chrono::milliseconds(_periodMs));
+
+                lock.unlock();
+                _recorded.fetch_add(_drain(*_ring), std::memory_order_relaxed);
+                lock.lock();
+            }
+
+            //stop() saw no producer left
+            _recorded.fetch_add(_drain(*_ring), std::memory_order_relaxed);
+        }
+
+        std::unique_ptr<MpscRing<T>> _ring;  /**< Allocated by the first start() */
+        size_t _capacity;
+        unsigned _periodMs;
+        Drain _drain;
+
+        std::atomic_bool _enabled;
+        std::atomic<unsigned> _producers;  /**< push() calls past the enabled check */
+        std::atomic<uint64_t> _recorded;
+        std::atomic<uint64_t> _dropped;
+
+        std::thread _writer;
+        bool _stopping;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+    };
+
+}
@@ -0,0 +1,269 @@
+#include <cmath>
+#include <memory.h>
+
+#include "ioig_stats.h"
+
+using namespace ioig;
+
+constexpr unsigned LatencyHistogram::SUB_BUCKET_BITS;
+constexpr unsigned LatencyHistogram::SUB_BUCKET_COUNT;
+constexpr unsigned LatencyHistogram::SUB_BUCKET_HALF;
+constexpr unsigned LatencyHistogram::MAX_US_BITS;
+constexpr uint64_t LatencyHistogram::MAX_US;
+constexpr unsigned LatencyHistogram::BUCKET_COUNT;
+constexpr unsigned TransferStats::TYPE_COUNT;
+
+//==========================================================
+// LatencyHistogram
+//==========================================================
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+unsigned LatencyHistogram::bucketIndex(uint64_t us)
+{
+    if (us < SUB_BUCKET_COUNT)
+    {
+        return us;
+    }
+
+    if (us > MAX_US)
+    {
+        us = MAX_US;
+    }
+
+    unsigned msb = SUB_BUCKET_BITS;
+    while (us >> (msb + 1))
+    {
+        msb++;
+    }
+
+    //keep the SUB_BUCKET_BITS-1 bits below the msb
+    unsigned shift = msb - (SUB_BUCKET_BITS - 1);
+    unsigned sub = us >> shift;
+
+    return SUB_BUCKET_COUNT + (shift - 1) * SUB_BUCKET_HALF + (sub - SUB_BUCKET_HALF);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(unsigned idx)
+{
+    if (idx < SUB_BUCKET_COUNT)
+    {
+        return idx;
+    }
+
+    idx -= SUB_BUCKET_COUNT;
+    unsigned shift = idx / SUB_BUCKET_HALF + 1;
+    uint64_t sub = idx % SUB_BUCKET_HALF + SUB_BUCKET_HALF;
+
+    return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us)
+{
+    _counts[bucketIndex(us)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sumUs.fetch_add(us, std::memory_order_relaxed);
+
+    uint64_t max = _maxUs.load(std::memory_order_relaxed);
+    while (us > max && !_maxUs.compare_exchange_weak(max, us, std::memory_order_relaxed))
+    {
+    }
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const
+{
+    Snapshot snap;
+
+    for (unsigned i = 0; i < BUCKET_COUNT; i++)
+    {
+        snap.counts[i] = _counts[i].load(std::memory_order_relaxed);
+    }
+    snap.count = _count.load(std::memory_order_relaxed);
+    snap.sumUs = _sumUs.load(std::memory_order_relaxed);
+    snap.maxUs = _maxUs.load(std::memory_order_relaxed);
+
+    return snap;
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto &c : _counts)
+    {
+        c.store(0, std::memory_order_relaxed);
+    }
+    _count.store(0, std::memory_order_relaxed);
+    _sumUs.store(0, std::memory_order_relaxed);
+    _maxUs.store(0, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Snapshot::Snapshot()
+    : count(0),
+      sumUs(0),
+      maxUs(0)
+{
+    memset(counts, 0, sizeof(counts));
+}
+
+void LatencyHistogram::Snapshot::merge(const Snapshot &other)
+{
+    for (unsigned i = 0; i < BUCKET_COUNT; i++)
+    {
+        counts[i] += other.counts[i];
+    }
+    count += other.count;
+    sumUs += other.sumUs;
+    if (other.maxUs > maxUs)
+    {
+        maxUs = other.maxUs;
+    }
+}
+
+uint64_t LatencyHistogram::Snapshot::percentile(double percent) const
+{
+    //bucket counts and total are read separately, use the bucket sum as total
+    uint64_t total = 0;
+    for (unsigned i = 0; i < BUCKET_COUNT; i++)
+    {
+        total += counts[i];
+    }
+
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    if (percent < 0.0)
+    {
+        percent = 0.0;
+    }
+    else if (percent > 100.0)
+    {
+        percent = 100.0;
+    }
+
+    uint64_t rank = (uint64_t)std::ceil(percent / 100.0 * total);
+    if (rank == 0)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+        {
+            //the bucket bound may overshoot the largest recorded value
+            uint64_t bound = bucketUpperBound(i);
+            return (maxUs != 0 && bound > maxUs) ? maxUs : bound;
+        }
+    }
+
+    return maxUs;
+}
+
+
+//==========================================================
+// TransferStats
+//==========================================================
+
+TransferStats::Counters::Counters()
+    : count(0),
+      txBytes(0),
+      rxBytes(0),
+      retries(0),
+      timeouts(0),
+      failures(0),
+      seqMismatches(0)
+{
+}
+
+void TransferStats::Counters::merge(const Counters &other)
+{
+    count += other.count;
+    txBytes += other.txBytes;
+    rxBytes += other.rxBytes;
+    retries += other.retries;
+    timeouts += other.timeouts;
+    failures += other.failures;
+    seqMismatches += other.seqMismatches;
+    latency.merge(other.latency);
+}
+
+TransferStats::Counters TransferStats::Snapshot::total() const
+{
+    Counters sum;
+    for (auto &c : perType)
+    {
+        sum.merge(c);
+    }
+    return sum;
+}
+
+void TransferStats::onComplete(Packet::Type type, size_t txBytes, size_t rxBytes, uint64_t latencyUs)
+{
+    auto &c = _perType[typeIndex(type)];
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.txBytes.fetch_add(txBytes, std::memory_order_relaxed);
+    c.rxBytes.fetch_add(rxBytes, std::memory_order_relaxed);
+    c.latency.record(latencyUs);
+}
+
+void TransferStats::onTimeout(Packet::Type type)
+{
+    _perType[typeIndex(type)].timeouts.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransferStats::onRetry(Packet::Type type)
+{
+    _perType[typeIndex(type)].retries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransferStats::onFailure(Packet::Type type)
+{
+    _perType[typeIndex(type)].failures.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransferStats::onSeqMismatch(Packet::Type type)
+{
+    _perType[typeIndex(type)].seqMismatches.fetch_add(1, std::memory_order_relaxed);
+}
+
+TransferStats::Snapshot TransferStats::snapshot() const
+{
+    Snapshot snap;
+
+    for (unsigned i = 0; i < TYPE_COUNT; i++)
+    {
+        auto &live = _perType[i];
+        auto &c = snap.perType[i];
+        c.count = live.count.load(std::memory_order_relaxed);
+        c.txBytes = live.txBytes.load(std::memory_order_relaxed);
+        c.rxBytes = live.rxBytes.load(std::memory_order_relaxed);
+        c.retries = live.retries.load(std::memory_order_relaxed);
+        c.timeouts = live.timeouts.load(std::memory_order_relaxed);
+        c.failures = live.failures.load(std::memory_order_relaxed);
+        c.seqMismatches = live.seqMismatches.load(std::memory_order_relaxed);
+        c.latency = live.latency.snapshot();
+    }
+
+    return snap;
+}
+
+void TransferStats::reset()
+{
+    for (auto &live : _perType)
+    {
+        live.count.store(0, std::memory_order_relaxed);
+        live.txBytes.store(0, std::memory_order_relaxed);
+        live.rxBytes.store(0, std::memory_order_relaxed);
+        live.retries.store(0, std::memory_order_relaxed);
+        live.timeouts.store(0, std::memory_order_relaxed);
+        live.failures.store(0, std::memory_order_relaxed);
+        live.seqMismatches.store(0, std::memory_order_relaxed);
+        live.latency.reset();
+    }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+#include "ioig_protocol.h"
+
+namespace ioig
+{
+
+    /**
+     * @class LatencyHistogram
+     *
+     * @brief HDR-style latency histogram, in microseconds.
+     *
+     * Log-linear buckets: values below 2^SUB_BUCKET_BITS have their own
+     * bucket, above that every power of two is split in 2^(SUB_BUCKET_BITS-1)
+     * linear buckets, so the relative error stays below 1/2^(SUB_BUCKET_BITS-1)
+     * over the whole range. Values above MAX_US are counted in the last bucket.
+     *
+     * record() is a few relaxed atomic operations, no lock.
+     */
+    class LatencyHistogram
+    {
+    public:
+
+        static constexpr unsigned SUB_BUCKET_BITS = 5;  /**< ~6% resolution */
+        static constexpr unsigned SUB_BUCKET_COUNT = 1u << SUB_BUCKET_BITS;
+        static constexpr unsigned SUB_BUCKET_HALF = SUB_BUCKET_COUNT / 2;
+        static constexpr unsigned MAX_US_BITS = 26;  /**< ~67s, above any transfer timeout */
+        static constexpr uint64_t MAX_US = (1ull << MAX_US_BITS) - 1;
+        static constexpr unsigned BUCKET_COUNT = SUB_BUCKET_COUNT + (MAX_US_BITS - SUB_BUCKET_BITS) * SUB_BUCKET_HALF;
+
+        /**
+         * @brief Plain copy of a histogram, safe to read and merge.
+         */
+        struct Snapshot
+        {
+            uint32_t counts[BUCKET_COUNT];
+            uint64_t count;
+            uint64_t sumUs;
+            uint64_t maxUs;
+
+            Snapshot();
+
+            void merge(const Snapshot &other);
+
+            /**
+             * @brief Value at or below which `percent` of the samples fall.
+             * @note Reported as the upper bound of the bucket holding that sample.
+             * @param percent 0 to 100
+             * @return the value in microseconds, zero if there are no samples
+             */
+            uint64_t percentile(double percent) const;
+
+            double meanUs() const { return count ? (double)sumUs / count : 0.0; }
+        };
+
+        LatencyHistogram();
+
+        LatencyHistogram(const LatencyHistogram &) = delete;
+        LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+        void record(uint64_t us);
+
+        Snapshot snapshot() const;
+
+        /**
+         * @note Not atomic with concurrent record() calls, a sample may be lost or kept.
+         */
+        void reset();
+
+        static unsigned bucketIndex(uint64_t us);
+
+        /**
+         * @return the highest value counted in bucket idx
+         */
+        static uint64_t bucketUpperBound(unsigned idx);
+
+    private:
+
+        std::atomic<uint32_t> _counts[BUCKET_COUNT];
+        std::atomic<uint64_t> _count;
+        std::atomic<uint64_t> _sumUs;
+        std::atomic<uint64_t> _maxUs;
+    };
+
+
+    /**
+     * @class TransferStats
+     *
+     * @brief Always-on transfer counters of one device, per command type.
+     *
+     * Updated by TransferEngine with relaxed atomics, read with snapshot().
+     */
+    class TransferStats
+    {
+    public:
+
+        /** Command types are indexed by value (XFER_READ is the last one), unknown types share index 0 */
+        static constexpr unsigned TYPE_COUNT = (unsigned)Packet::Type::XFER_READ + 1;
+
+        struct Counters
+        {
+            uint64_t count;          /**< Completed transfers */
+            uint64_t txBytes;
+            uint64_t rxBytes;
+            uint64_t retries;        /**< Attempts after the first one */
+            uint64_t timeouts;       /**< Attempts without response in time */
+            uint64_t failures;       /**< Transfers given up after the last retry */
+            uint64_t seqMismatches;  /**< Responses without pending request (late or unknown request id) */
+            LatencyHistogram::Snapshot latency;  /**< Send to receive time of completed attempts */
+
+            Counters();
+            void merge(const Counters &other);
+        };
+
+        struct Snapshot
+        {
+            Counters perType[TYPE_COUNT];
+
+            const Counters &get(Packet::Type type) const { return perType[TransferStats::typeIndex(type)]; }
+
+            /**
+             * @return the counters of all command types merged
+             */
+            Counters total() const;
+        };
+
+        TransferStats() = default;
+
+        TransferStats(const TransferStats &) = delete;
+        TransferStats &operator=(const TransferStats &) = delete;
+
+        void onComplete(Packet::Type type, size_t txBytes, size_t rxBytes, uint64_t latencyUs);
+        void onTimeout(Packet::Type type);
+        void onRetry(Packet::Type type);
+        void onFailure(Packet::Type type);
+        void onSeqMismatch(Packet::Type type);
+
+        Snapshot snapshot() const;
+        void reset();
+
+        static unsigned typeIndex(Packet::Type type)
+        {
+            return (unsigned)type < TYPE_COUNT ? (unsigned)type : 0;
+        }
+
+    private:
+
+        struct LiveCounters
+        {
+            std::atomic<uint64_t> count{0};
+            std::atomic<uint64_t> txBytes{0};
+            std::atomic<uint64_t> rxBytes{0};
+            std::atomic<uint64_t> retries{0};
+            std::atomic<uint64_t> timeouts{0};
+            std::atomic<uint64_t> failures{0};
+            std::atomic<uint64_t> seqMismatches{0};
+            LatencyHistogram latency;
+        };
+
+        LiveCounters _perType[TYPE_COUNT];
+    };
+
+}
@@ -0,0 +1,304 @@
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+#include "ioig_private.h"
+#include "ioig_ring.h"
+#include "ioig_trace.h"
+
+using namespace ioig;
+
+constexpr unsigned TraceEvent::MAX_ARGS;
+constexpr unsigned Tracer::DEFAULT_CAPACITY;
+constexpr unsigned Tracer::WRITER_PERIOD_MS;
+
+std::atomic_bool Tracer::_enabled(false);
+
+
+namespace
+{
+    /**
+     * Writer side of the tracer, created by the first start().
+     * Never freed, threads may trace until exit.
+     */
+    struct TraceState
+    {
+        TraceState() : writer(Tracer::DEFAULT_CAPACITY, Tracer::WRITER_PERIOD_MS) {}
+
+        RingWriter<TraceEvent> writer;
+        std::atomic<unsigned> session{0};    /**< Bumped by each start(), thread names are written once per session */
+        std::atomic<uint32_t> nextTid{1};
+        uint64_t startedAtNs = 0;
+
+        FILE *file = nullptr;
+    };
+
+    std::mutex traceMutex;
+    std::atomic<TraceState *> traceState(nullptr);
+
+    thread_local uint32_t threadId = 0;
+    thread_local const char *threadName = nullptr;
+    thread_local unsigned threadNamedSession = 0;
+    thread_local TraceSpan *currentSpan = nullptr;
+
+
+    //names and keys are literals of this library, written without escaping
+    void writeEvent(FILE *file, const TraceEvent &evt, uint64_t startedAtNs)
+    {
+        if (evt.phase == 'M')
+        {
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    evt.tid, evt.name);
+            return;
+        }
+
+        double tsUs = static_cast<int64_t>(evt.tsNs - startedAtNs) / 1000.0;
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+                evt.name, evt.category, evt.phase, evt.tid, tsUs);
+
+        if (evt.phase == 'X')
+        {
+            fprintf(file, ",\"dur\":%.3f", evt.durNs / 1000.0);
+        }
+        else
+        {
+            fputs(",\"s\":\"t\"", file);
+        }
+
+        fputs(",\"args\":{", file);
+        for (unsigned i = 0; i < evt.argCount; i++)
+        {
+            fprintf(file, "%s\"%s\":%lld", i == 0 ? "" : ",", evt.args[i].key, (long long)evt.args[i].value);
+        }
+        fputs("}}", file);
+    }
+
+    size_t drain(TraceState &state, MpscRing<TraceEvent> &ring)
+    {
+        TraceEvent evt;
+        size_t count = 0;
+
+        while (ring.pop(evt))
+        {
+            writeEvent(state.file, evt, state.startedAtNs);
+            count++;
+        }
+        return count;
+    }
+
+    bool pushEvent(TraceState &state, char phase, const char *category, const char *name, uint64_t tsNs,
+                   uint64_t durNs, const TraceArg *args, size_t count)
+    {
+        return state.writer.push([&](TraceEvent &evt) {
+            evt.category = category;
+            evt.name = name;
+            evt.phase = phase;
+            evt.tid = threadId;
+            evt.tsNs = tsNs;
+            evt.durNs = durNs;
+            evt.argCount = static_cast<uint8_t>(std::min<size_t>(count, TraceEvent::MAX_ARGS));
+            for (unsigned i = 0; i < evt.argCount; i++)
+            {
+                evt.args[i] = args[i];
+            }
+        });
+    }
+}
+
+
+//==========================================================
+// Tracer
+//==========================================================
+
+int Tracer::start(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(traceMutex);
+
+    if (traceState.load() != nullptr && traceState.load()->file != nullptr)
+    {
+        LOG_ERR(TAG, "Trace already running");
+        return -1;
+    }
+
+    FILE *file = fopen(path.c_str(), "w");
+    if (file == nullptr)
+    {
+        LOG_ERR(TAG, "Can't create trace file %s", path.c_str());
+        return -1;
+    }
+
+    //the events that follow all start with a separator
+    fputs("{\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ioig\"}}", file);
+
+    if (traceState.load() == nullptr)
+    {
+        traceState.store(new TraceState());
+    }
+
+    TraceState &state = *traceState.load();
+    state.file = file;
+    state.startedAtNs = now();
+    state.session.fetch_add(1);
+    state.writer.start([&state](MpscRing<TraceEvent> &ring) { return drain(state, ring); });
+
+    _enabled.store(true);
+    return 0;
+}
+
+void Tracer::stop()
+{
+    std::lock_guard<std::mutex> lock(traceMutex);
+
+    TraceState *state = traceState.load();
+    _enabled.store(false);
+
+    if (state == nullptr || !state->writer.stop())
+    {
+        return;
+    }
+
+    fputs("\n]}\n", state->file);
+    fclose(state->file);
+    state->file = nullptr;
+
+    if (state->writer.getDropped() > 0)
+    {
+        LOG_WARN(TAG, "Trace: %llu events written, %llu lost", (unsigned long long)state->writer.getRecorded(),
+                 (unsigned long long)state->writer.getDropped());
+    }
+}
+
+uint64_t Tracer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::setThreadName(const char *name)
+{
+    threadName = name;
+    threadNamedSession = 0;
+}
+
+uint64_t Tracer::getRecorded()
+{
+    TraceState *state = traceState.load();
+    return state != nullptr ? state->writer.getRecorded() : 0;
+}
+
+uint64_t Tracer::getDropped()
+{
+    TraceState *state = traceState.load();
+    return state != nullptr ? state->writer.getDropped() : 0;
+}
+
+void Tracer::push(char phase, const char *category, const char *name, uint64_t tsNs, uint64_t durNs,
+                  const TraceArg *args, size_t count)
+{
+    //set before _enabled by start(), never freed
+    TraceState &state = *traceState.load();
+
+    if (!state.writer.enabled())
+    {
+        return;
+    }
+
+    if (threadId == 0)
+    {
+        threadId = state.nextTid.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    unsigned session = state.session.load(std::memory_order_relaxed);
+    if (threadName != nullptr && threadNamedSession != session)
+    {
+        if (pushEvent(state, 'M', "__metadata", threadName, tsNs, 0, nullptr, 0))
+        {
+            threadNamedSession = session;
+        }
+    }
+
+    //a full ring drops the event, counted by the writer
+    pushEvent(state, phase, category, name, tsNs, durNs, args, count);
+}
+
+
+//==========================================================
+// TraceSpan
+//==========================================================
+
+TraceSpan::TraceSpan(const char *category, const char *name, std::initializer_list<TraceArg> args)
+    : _category(category),
+      _name(name),
+      _beginNs(0),
+      _parent(nullptr),
+      _active(Tracer::enabled()),
+      _argCount(0)
+{
+    if (!_active)
+    {
+        return;
+    }
+
+    for (auto &a : args)
+    {
+        arg(a.key, a.value);
+    }
+
+    _parent = currentSpan;
+    currentSpan = this;
+    _beginNs = Tracer::now();
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (!_active)
+    {
+        return;
+    }
+
+    currentSpan = _parent;
+    Tracer::complete(_category, _name, _beginNs, _args, _argCount);
+}
+
+void TraceSpan::arg(const char *key, int64_t value)
+{
+    if (!_active)
+    {
+        return;
+    }
+
+    for (unsigned i = 0; i < _argCount; i++)
+    {
+        if (strcmp(_args[i].key, key) == 0)
+        {
+            _args[i].value = value;
+            return;
+        }
+    }
+
+    if (_argCount < TraceEvent::MAX_ARGS)
+    {
+        _args[_argCount++] = {key, value};
+    }
+}
+
+void TraceSpan::add(const char *key, int64_t delta)
+{
+    for (unsigned i = 0; i < _argCount; i++)
+    {
+        if (strcmp(_args[i].key, key) == 0)
+        {
+            _args[i].value += delta;
+            return;
+        }
+    }
+
+    arg(key, delta);
+}
+
+TraceSpan *TraceSpan::current()
+{
+    return Tracer::enabled() ? currentSpan : nullptr;
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <initializer_list>
+#include <string>
+
+namespace ioig
+{
+
+    /**
+     * @brief Integer argument of a trace event. Key strings must outlive the trace, use literals.
+     */
+    struct TraceArg
+    {
+        const char *key;
+        int64_t value;
+    };
+
+
+    /**
+     * @brief One trace event, as buffered for the writer.
+     */
+    struct TraceEvent
+    {
+        static constexpr unsigned MAX_ARGS = 6;
+
+        const char *category;  /**< Literal */
+        const char *name;      /**< Literal, the thread name of a 'M' event */
+        char phase;            /**< 'X' span, 'i' instant, 'M' thread name */
+        uint32_t tid;
+        uint64_t tsNs;         /**< Tracer::now() */
+        uint64_t durNs;        /**< 'X' only */
+        uint8_t argCount;
+        TraceArg args[MAX_ARGS];
+    };
+
+
+    /**
+     * @class Tracer
+     *
+     * @brief Process wide timeline of the transfers and events, in the Chrome
+     *        trace-event JSON format, switched on at runtime.
+     *
+     * The file loads in chrome://tracing or https://ui.perfetto.dev: one row
+     * per thread, the transfer spans of the callers, the contended lock and
+     * window waits, the reader thread delivering the events and the event
+     * callbacks on the executor threads.
+     *
+     * Events are copied to a RingWriter, its writer thread formats them to
+     * the file. A stopped tracer costs one relaxed load per trace point.
+     */
+    class Tracer
+    {
+    public:
+        static constexpr unsigned DEFAULT_CAPACITY = 16384;  /**< Events buffered for the writer */
+        static constexpr unsigned WRITER_PERIOD_MS = 10;
+
+        /**
+         * @brief Creates the file and starts tracing, timestamps count from now.
+         * @return zero on success, negative value if the file can't be created or a trace is running
+         */
+        static int start(const std::string &path);
+
+        /**
+         * @brief Stops tracing, writes the events still buffered and closes the file.
+         */
+        static void stop();
+
+        static inline bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+
+        /**
+         * @return the monotonic time of the trace clock, in ns
+         */
+        static uint64_t now();
+
+        /**
+         * @brief Records a span of the calling thread, from begin (now()) to now.
+         */
+        static inline void complete(const char *category, const char *name, uint64_t beginNs,
+                                    std::initializer_list<TraceArg> args = {})
+        {
+            if (enabled())
+            {
+                push('X', category, name, beginNs, now() - beginNs, args.begin(), args.size());
+            }
+        }
+
+        static inline void complete(const char *category, const char *name, uint64_t beginNs,
+                                    const TraceArg *args, size_t count)
+        {
+            if (enabled())
+            {
+                push('X', category, name, beginNs, now() - beginNs, args, count);
+            }
+        }
+
+        /**
+         * @brief Records an instant event of the calling thread.
+         */
+        static inline void instant(const char *category, const char *name, std::initializer_list<TraceArg> args = {})
+        {
+            if (enabled())
+            {
+                push('i', category, name, now(), 0, args.begin(), args.size());
+            }
+        }
+
+        /**
+         * @brief Names the row of the calling thread in the trace, a literal.
+         * @note Call at the start of the thread, it is emitted with the first event of each trace.
+         */
+        static void setThreadName(const char *name);
+
+        /**
+         * @return the events written to the file, since start()
+         */
+        static uint64_t getRecorded();
+
+        /**
+         * @return the events lost because the ring was full, since start()
+         */
+        static uint64_t getDropped();
+
+    private:
+
+        static void push(char phase, const char *category, const char *name, uint64_t tsNs, uint64_t durNs,
+                         const TraceArg *args, size_t count);
+
+        static std::atomic_bool _enabled;  /**< Follows the RingWriter, checked inline before any push */
+
+        static constexpr const char* TAG = "Tracer";
+    };
+
+
+    /**
+     * @class TraceSpan
+     *
+     * @brief Scoped span: records a complete event from construction to destruction.
+     *
+     * Spans of a thread nest, current() is the innermost one still open, so
+     * a callee can tag the span of its caller (the engine counts the retries
+     * of the transfer span this way).
+     */
+    class TraceSpan
+    {
+    public:
+        TraceSpan(const char *category, const char *name, std::initializer_list<TraceArg> args = {});
+        ~TraceSpan();
+
+        TraceSpan(const TraceSpan &) = delete;
+        TraceSpan &operator=(const TraceSpan &) = delete;
+
+        /**
+         * @brief Sets an argument, recorded when the span ends.
+         */
+        void arg(const char *key, int64_t value);
+
+        /**
+         * @brief Adds delta to an argument, created at zero.
+         */
+        void add(const char *key, int64_t delta);
+
+        /**
+         * @return the innermost open span of the calling thread, nullptr if none or not tracing
+         */
+        static TraceSpan *current();
+
+    private:
+        const char *_category;
+        const char *_name;
+        uint64_t _beginNs;
+        TraceSpan *_parent;
+        bool _active;
+        uint8_t _argCount;
+        TraceArg _args[TraceEvent::MAX_ARGS];
+    };
+
+
+    /**
+     * @brief Locks, recording a "lock" span named name only when the lock was contended.
+     */
+    template <typename Lock>
+    inline void lockTraced(Lock &lock, const char *name)
+    {
+        if (!Tracer::enabled())
+        {
+            lock.lock();
+        }
+        else if (!lock.try_lock())
+        {
+            TraceSpan span("lock", name);
+            lock.lock();
+        }
+    }
+
+}
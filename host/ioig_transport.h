@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ioig_protocol.h"
+#include "ioig_engine.h"
+
+namespace ioig
+{
+
+    /**
+     * @class Transport
+     *
+     * @brief Connection to one IOIG device: the data link used by the
+     *        TransferEngine plus the device event channel.
+     *
+     * LibUsbTransport talks to a dongle, LoopbackTransport (fw/sim) runs the
+     * firmware tasks in-process against a simulated board.
+     */
+    class Transport : public TransferEngine::Link
+    {
+    public:
+        virtual ~Transport() {}
+
+        /**
+         * @brief Opens the device and brings the firmware to a known state.
+         * @note Called once, before start().
+         * @return zero on success, negative value on error
+         */
+        virtual int open() { return 0; }
+
+        /**
+         * @brief Stops the link and releases the device.
+         */
+        virtual void close() { stop(); }
+
+        /**
+         * @return true if readEvent() delivers device events
+         */
+        virtual bool hasEvents() const { return false; }
+
+        /**
+         * @brief Waits for the next event packet.
+         *
+         * @param evtPkt The packet received.
+         * @param timeout_ms Timeout in milliseconds, 0 waits indefinitely.
+         * @return zero on success, negative value on error or timeout
+         */
+        virtual int readEvent(Packet &evtPkt, unsigned timeout_ms)
+        {
+            (void)evtPkt;
+            (void)timeout_ms;
+            return -1;
+        }
+
+    protected:
+        static constexpr int LEGACY_FIRMWARE = 0;             /**< checkReadyResponse(): no ready handshake */
+        static constexpr unsigned LEGACY_RESET_DELAY_MS = 50;  /**< After SYS_SW_RESET, for the firmware without handshake */
+
+        /**
+         * @brief SYS_INIT request of the ready handshake: [token:32][host header version:8].
+         *
+         * The firmware keeps the lower of the two versions for the session,
+         * it decides the layout of what the firmware sends unasked (events).
+         */
+        static void makeReadyRequest(Packet &txPkt, uint32_t token, uint8_t max_protocol)
+        {
+            txPkt.reset();
+            txPkt.setType(Packet::Type::SYS_INIT);
+            txPkt.setStatus(Packet::Status::CMD);
+            txPkt.addPayloadItem32(token);
+            txPkt.addPayloadItem8(max_protocol);
+        }
+
+        /**
+         * @brief Checks a response to the ready handshake.
+         *
+         * The firmware answers SYS_INIT with the token once its reset is
+         * done, then its header version. Firmware predating the handshake
+         * answers at once with an empty payload and doesn't reset: the caller
+         * falls back to SYS_SW_RESET and LEGACY_RESET_DELAY_MS.
+         *
+         * @return the header version of the firmware, LEGACY_FIRMWARE if it predates
+         *         the handshake, negative value if rxPkt doesn't answer token
+         */
+        static int checkReadyResponse(Packet &rxPkt, uint32_t token)
+        {
+            if (rxPkt.getType() != Packet::Type::SYS_INIT)
+            {
+                return -1;
+            }
+
+            if (rxPkt.getPayloadLength() == 0)
+            {
+                return LEGACY_FIRMWARE;
+            }
+
+            if (rxPkt.getPayloadLength() < 4 || (uint32_t)rxPkt.getPayloadItem32(0) != token)
+            {
+                return -1; //left over by a previous session
+            }
+
+            //no version after the token: v1 firmware
+            return rxPkt.getPayloadLength() > 4 ? rxPkt.getPayloadItem8(4) : Packet::PROTOCOL_V1;
+        }
+    };
+
+}
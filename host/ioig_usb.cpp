@@ -1,11 +1,14 @@
+
 #include <iostream>
 #include <sstream>
 #include <chrono>
 #include <algorithm>
 #include <memory.h>
+#include <new>
 
 #include "ioig.h"
 #include "ioig_usb.h"
+#include "ioig_trace.h"
 
 
 #define PKT_DEBUG 0
@@ -30,409 +33,1800 @@ using namespace ioig;
 using namespace std::chrono_literals;
 
 //static members of UsbManager
-std::vector<libusb_device_handle *> UsbManager::_usbDevHandlerVec;
-std::vector<libusb_context *> UsbManager::_usbContextVec;
-std::vector<EventHandler *> UsbManager::_eventHandlerVec[MAX_USB_DEVICES];
-std::atomic_bool UsbManager::_running{false};
-std::mutex UsbManager::_mutex;
-std::mutex UsbManager::_printMutex;
-std::bitset<MAX_USB_DEVICES> UsbManager::_usbIndexInitMap;
-uint64_t UsbManager::_pktSeqNum{0};
+std::once_flag UsbManager::_deviceOnceVec[MAX_USB_DEVICES];
+UsbDevice * UsbManager::_deviceVec[MAX_USB_DEVICES] = {nullptr};
 
+//static members of UsbRegistry
+std::mutex UsbRegistry::_mutex;
+libusb_context * UsbRegistry::_ctx = nullptr;
+bool UsbRegistry::_enumerated = false;
+std::vector<UsbRegistry::Entry> UsbRegistry::_entries;
 
-void UsbManager::deinit()
+#if PKT_DEBUG
+static std::mutex printMutex;
+#endif
+
+constexpr uint32_t PacketPool::NIL;
+constexpr unsigned LibUsbTransport::IN_XFER_COUNT;
+constexpr unsigned LibUsbTransport::IN_XFER_SIZE;
+constexpr unsigned LibUsbTransport::OUT_XFER_COUNT;
+constexpr unsigned LibUsbTransport::OUT_STREAM_COUNT;
+constexpr unsigned LibUsbTransport::READY_TIMEOUT_MS;
+constexpr unsigned LibUsbTransport::READY_RETRIES;
+constexpr unsigned LibUsbTransport::LEGACY_RESET_TIMEOUT_MS;
+constexpr int Transport::LEGACY_FIRMWARE;
+constexpr unsigned Transport::LEGACY_RESET_DELAY_MS;
+constexpr unsigned UsbDevice::ROUTE_COUNT;
+constexpr unsigned UsbDevice::EVENT_POOL_SIZE;
+constexpr unsigned UsbDevice::EVENT_RING_SIZE;
+constexpr unsigned UsbDevice::EVENT_RING_DATA_SIZE;
+
+
+//==========================================================
+// PacketPool
+//==========================================================
+
+PacketPool::PacketPool(unsigned capacity)
+    : _capacity(capacity),
+      _head(NIL)
 {
-    std::lock_guard<std::mutex> lock(_mutex);
+    //over-aligned new[] needs C++17, align the slots by hand
+    const size_t align = alignof(Slot);
+    _storage.reset(new uint8_t[capacity * sizeof(Slot) + align]);
+    auto addr = reinterpret_cast<uintptr_t>(_storage.get());
+    _slots = reinterpret_cast<Slot *>((addr + align - 1) & ~(uintptr_t)(align - 1));
 
-    if (!_running.load()) 
+    for (unsigned i = 0; i < capacity; i++)
     {
-        return;        
+        new (&_slots[i]) Slot();
+        _slots[i].next.store(i + 1 < capacity ? i + 1 : NIL, std::memory_order_relaxed);
     }
+    _head.store(capacity > 0 ? 0 : NIL);
+}
 
-    _running.store(false);
-    
-    for (unsigned i=0; i < MAX_USB_DEVICES ; i++) 
+PacketPool::~PacketPool()
+{
+    for (unsigned i = 0; i < _capacity; i++)
+    {
+        _slots[i].~Slot();
+    }
+}
+
+PacketPool::Handle PacketPool::acquire()
+{
+    uint64_t head = _head.load(std::memory_order_acquire);
+
+    while (true)
+    {
+        uint32_t index = static_cast<uint32_t>(head);
+        if (index == NIL)
+        {
+            return Handle();
+        }
+
+        uint32_t next = _slots[index].next.load(std::memory_order_relaxed);
+        if (_head.compare_exchange_weak(head, makeHead(head, next),
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_acquire))
+        {
+            _slots[index].pkt.reset();
+            return Handle(this, index);
+        }
+    }
+}
+
+void PacketPool::release(unsigned index)
+{
+    uint64_t head = _head.load(std::memory_order_relaxed);
+
+    do
+    {
+        _slots[index].next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+    } while (!_head.compare_exchange_weak(head, makeHead(head, index),
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+}
+
+
+//==========================================================
+// UsbRegistry
+//==========================================================
+
+bool UsbRegistry::init()
+{
+    if (_ctx != nullptr)
     {
-        closeUsbDevice(i);
+        return true;
     }
+
+    int ret = libusb_init(&_ctx);
+    if (ret != LIBUSB_SUCCESS)
+    {
+        LOG_ERR(TAG, "Failed to initialize libusb, error : %s", LIBUSB_ERR(ret));
+        _ctx = nullptr;
+        return false;
+    }
+
+    return true;
 }
 
+libusb_context *UsbRegistry::getContext()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return init() ? _ctx : nullptr;
+}
 
-bool UsbManager::openUsbDevice(int usb_port)
+std::string UsbRegistry::readBusPath(libusb_device *device)
 {
-    bool deviceFound=false;
+    uint8_t ports[8];
+    int depth = libusb_get_port_numbers(device, ports, sizeof(ports));
 
-    libusb_device** deviceList;
-    int targetDevCnt=0;
+    std::ostringstream path;
+    path << (int)libusb_get_bus_number(device);
+    for (int i = 0; i < depth; i++)
+    {
+        path << (i == 0 ? '-' : '.') << (int)ports[i];
+    }
+    return path.str();
+}
 
-    auto & context = _usbContextVec[usb_port];
- 
- 
-    ssize_t deviceCount = libusb_get_device_list(context, &deviceList);
+void UsbRegistry::enumerate()
+{
+    libusb_device **deviceList;
+    ssize_t deviceCount = libusb_get_device_list(_ctx, &deviceList);
 
-    if (deviceCount < 0) 
+    if (deviceCount < 0)
     {
         LOG_ERR(TAG, "Can't get device list!");
-        libusb_free_device_list(deviceList, true);   
-        return false;          
+        return;
     }
-    
-    // Iterate through the list and find the specified device    
-    for (ssize_t i = 0; i < deviceCount; ++i) 
+
+    std::vector<Entry> found;
+
+    for (ssize_t i = 0; i < deviceCount; ++i)
     {
-        libusb_device* device = deviceList[i];
+        libusb_device *device = deviceList[i];
         libusb_device_descriptor descriptor;
 
-        if (libusb_get_device_descriptor(device, &descriptor) != LIBUSB_SUCCESS && usb_port == i) 
+        if (libusb_get_device_descriptor(device, &descriptor) != LIBUSB_SUCCESS ||
+            descriptor.idVendor != IOIG_VID ||
+            (descriptor.idProduct != IOIG_PID && descriptor.idProduct != IOIG_VENDOR_PID))
         {
-            LOG_ERR(TAG, "Can't get descriptor for device : %d" , usb_port);   
-            libusb_free_device_list(deviceList, true);  
-            return false;                   
+            continue;
         }
 
-        if (descriptor.idVendor == IOIG_VID && descriptor.idProduct == IOIG_PID) 
+        //already known, libusb keeps the same device while it stays connected
+        auto known = std::find_if(_entries.begin(), _entries.end(), [device](const Entry &e)
         {
-            if (usb_port == targetDevCnt)
-            {
-                libusb_device_handle* dhandle = libusb_open_device_with_vid_pid(context, IOIG_VID, IOIG_PID);     
-                if (dhandle == NULL) 
-                {
-                    LOG_ERR(TAG, "Can't open device : %d" , usb_port); 
-                    return false;
-                }
-                _usbDevHandlerVec[usb_port] = dhandle;
-                deviceFound=true;
-            }                                
-            targetDevCnt += 1;            
-        }
-    }     
-
-    // Free the list of devices
+            return e.device == device;
+        });
+        if (known != _entries.end())
+        {
+            continue;
+        }
+
+        Entry entry = {device, nullptr, "", readBusPath(device)};
+
+        int ret = libusb_open(device, &entry.handle);
+        if (ret != LIBUSB_SUCCESS)
+        {
+            LOG_WARN(TAG, "Can't open device at %s, error : %s", entry.busPath.c_str(), LIBUSB_ERR(ret));
+            continue;
+        }
+
+        unsigned char serial[64] = {0};
+        if (descriptor.iSerialNumber != 0 &&
+            libusb_get_string_descriptor_ascii(entry.handle, descriptor.iSerialNumber, serial, sizeof(serial)) > 0)
+        {
+            entry.serial = (const char *)serial;
+        }
+
+        libusb_ref_device(device);
+        found.push_back(entry);
+    }
+
     libusb_free_device_list(deviceList, 1);
 
-    if (!deviceFound) 
-    { 
-        LOG_ERR(TAG, "Can't find device index %d", usb_port); 
+    std::sort(found.begin(), found.end(), [](const Entry &a, const Entry &b)
+    {
+        return a.serial != b.serial ? a.serial < b.serial : a.busPath < b.busPath;
+    });
+
+    for (auto &entry : found)
+    {
+        //a dongle plugged again keeps its port
+        auto known = std::find_if(_entries.begin(), _entries.end(), [&entry](const Entry &e)
+        {
+            return !entry.serial.empty() && e.serial == entry.serial;
+        });
+
+        if (known == _entries.end())
+        {
+            _entries.push_back(entry);
+            continue;
+        }
+
+        if (known->handle != nullptr)
+        {
+            libusb_close(known->handle);
+        }
+        libusb_unref_device(known->device);
+        *known = entry;
     }
 
-    return deviceFound;    
+    _enumerated = true;
 }
 
+int UsbRegistry::open(int usb_port, libusb_device_handle **handle)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
 
-void UsbManager::initUsbDevice(int usb_port)
-{    
-    if (!openUsbDevice(usb_port))   //creates a device handle in _usbDevHandlerVec[usb_port]
+    if (!init())
     {
-        std::exit(-1);
+        return LIBUSB_ERROR_OTHER;
     }
 
+    if (!_enumerated || usb_port >= (int)_entries.size())
+    {
+        enumerate();
+    }
 
-    auto & usbDevHandler =  _usbDevHandlerVec[usb_port];    
+    if (usb_port < 0 || usb_port >= (int)_entries.size())
+    {
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
 
-#ifdef __linux__
-    int ret = libusb_set_auto_detach_kernel_driver(usbDevHandler, true);
-    if (ret != LIBUSB_SUCCESS)
-    {        
-        LOG_ERR(TAG, "Failed to detach kernel driver, error : %s" , LIBUSB_ERR(ret));
-        std::exit(ret);        
+    auto &entry = _entries[usb_port];
+
+    if (entry.handle != nullptr)
+    {
+        *handle = entry.handle;
+        entry.handle = nullptr;
+        return LIBUSB_SUCCESS;
     }
-#endif    
-    
-    auto claimItf = [&](const char * iname, const unsigned inum) 
-    {        
-        int ret = libusb_claim_interface(usbDevHandler, inum);
-        if (ret != LIBUSB_SUCCESS)
-        {            
-            LOG_ERR(TAG, "Can't claim interface %d (%s), error : %s", inum, iname , LIBUSB_ERR(ret));                      
-            std::exit(ret);
-        }
-    };
-  
-    claimItf("Data  Notif",0);  
-    claimItf("Data",1);  
-    claimItf("Event Notif",2);  
-    claimItf("Event",3);  
+
+    return libusb_open(entry.device, handle);
 }
 
-void UsbManager::closeUsbDevice(int usb_port)
+std::vector<UsbDeviceInfo> UsbRegistry::list()
 {
-    if (_usbDevHandlerVec[usb_port] != nullptr) 
-    {    
-        auto & devHanlder = _usbDevHandlerVec[usb_port];
-        libusb_release_interface(devHanlder, 0);
-        libusb_release_interface(devHanlder, 1);
-        libusb_release_interface(devHanlder, 2);
-        libusb_release_interface(devHanlder, 3);
-        libusb_close(devHanlder);      
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::vector<UsbDeviceInfo> devices;
+
+    if (!init())
+    {
+        return devices;
+    }
+
+    if (!_enumerated)
+    {
+        enumerate();
+    }
+
+    for (size_t i = 0; i < _entries.size(); i++)
+    {
+        devices.push_back({(int)i, _entries[i].serial, _entries[i].busPath});
     }
+
+    return devices;
 }
 
-void UsbManager::sendResetCmd(int usb_port)
+int UsbRegistry::findPort(const std::string &serial)
 {
-    //Request firmware reset
-    Packet txPkt(16);
-    Packet rxPkt(16);
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!init())
+    {
+        return -1;
+    }
+
+    //rescan once if the dongle was plugged after the first enumeration
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (!_enumerated || pass > 0)
+        {
+            enumerate();
+        }
+
+        for (size_t i = 0; i < _entries.size(); i++)
+        {
+            if (_entries[i].serial == serial)
+            {
+                return i;
+            }
+        }
+    }
+
+    return -1;
+}
 
-    txPkt.setType(Packet::Type::SYS_SW_RESET);    
-    txPkt.setStatus(Packet::Status::CMD); 
 
-    sendPacket(txPkt, CDC_DATA_EP_OUT, usb_port, 1000);
-    recvPacket(rxPkt, CDC_DATA_EP_IN, usb_port, 1000);
-    std::this_thread::sleep_for(50ms); //wait fw reset   
+//==========================================================
+// LibUsbTransport
+//==========================================================
+
+LibUsbTransport::LibUsbTransport(int usb_port)
+    : _usbPort(usb_port),
+      _ctx(nullptr),
+      _devHandle(nullptr),
+      _itfCount(0),
+      _protocol(Packet::PROTOCOL_V1),
+      _engine(nullptr),
+      _outPool(OUT_XFER_COUNT),
+      _streamPool(OUT_STREAM_COUNT),
+      _running(false),
+      _submitted(0)
+{
+    for (auto &xfer : _inXfers)
+    {
+        xfer = nullptr;
+    }
+    for (unsigned i = 0; i < OUT_XFER_COUNT; i++)
+    {
+        _outXfers[i] = nullptr;
+        _outContexts[i].transport = this;
+        _outContexts[i].pool = &_outPool;
+        _outContexts[i].slot = i;
+    }
+    for (unsigned i = 0; i < OUT_STREAM_COUNT; i++)
+    {
+        _streamXfers[i] = nullptr;
+        _streamContexts[i].transport = this;
+        _streamContexts[i].pool = &_streamPool;
+        _streamContexts[i].slot = i;
+    }
 }
 
+LibUsbTransport::~LibUsbTransport()
+{
+    close();
+}
 
-void UsbManager::eventThread(int usb_port)
+int LibUsbTransport::open()
 {
-    Packet evtPkt;
+    _ctx = UsbRegistry::getContext();
+    if (_ctx == nullptr)
+    {
+        return LIBUSB_ERROR_OTHER;
+    }
 
-    auto & myEventHandlerVec  = _eventHandlerVec[usb_port];
-    
-    while (_running.load()) 
-    {           
-        //Wait indefinitely for an async event         
-        recvPacket(evtPkt, CDC_EVENT_EP_IN , usb_port ,0); 
+    initUsbDevice();
 
-        for ( size_t i = 0 ; i < myEventHandlerVec.size() ; ++i ) 
-        {
-            auto evtHandler = myEventHandlerVec[i];         
-            evtHandler->onEvent(evtPkt);
-        }
-         
+    //Synchronous handshake before any pipelined traffic
+    if (waitReady() != 0)
+    {
+        LOG_ERR(TAG, "Device %d not ready", _usbPort);
+        closeUsbDevice();
+        return -1;
     }
+    return 0;
 }
 
+void LibUsbTransport::close()
+{
+    stop();
+    closeUsbDevice();
+    _ctx = nullptr;
+}
 
-void UsbManager::registerEventHandler(EventHandler * evHandler, int usb_port)
+int LibUsbTransport::readEvent(Packet &evtPkt, unsigned timeout_ms)
 {
-    checkAndInitialize(usb_port);
+    int ret = recvPacket(evtPkt, CDC_EVENT_EP_IN, timeout_ms);
+    return ret < 0 ? ret : 0;
+}
 
+int LibUsbTransport::start(TransferEngine &engine)
+{
     std::unique_lock<std::mutex> lock(_mutex);
 
-    if (usb_port >= (int)MAX_USB_DEVICES) 
+    if (_running.load())
     {
-        LOG_ERR(TAG, "Can't register event handler for USB device %d, max USB device index = %d", usb_port, MAX_USB_DEVICES-1);
-        return;
+        return 0;
     }
-    auto & eventHandlerVec  = _eventHandlerVec[usb_port]; //get the vector for this port
-    bool evHandlerFound = false;
 
-    for (auto it = eventHandlerVec.begin(); it != eventHandlerVec.end(); ++it) 
+    for (auto &xfer : _outXfers)
     {
-        if (*it == evHandler) 
-        {
-            evHandlerFound = true;            
-        }
+        xfer = libusb_alloc_transfer(0);
     }
-    
-    
-    if (eventHandlerVec.empty())
+
+    for (auto &xfer : _streamXfers)
     {
-        eventHandlerVec.push_back(evHandler);        
-        std::thread th = std::thread(&UsbManager::eventThread, usb_port);
-        th.detach();  
-    }else 
+        xfer = libusb_alloc_transfer(0);
+    }
+
+    _engine = &engine;
+    _running.store(true);
+    _eventThread = std::thread(&LibUsbTransport::eventLoop, this);
+
+    int ret = LIBUSB_SUCCESS;
+
+    for (unsigned i = 0; i < IN_XFER_COUNT; i++)
     {
-        if (!evHandlerFound) 
-        {
-            eventHandlerVec.push_back(evHandler);       
-        }else 
+        auto &xfer = _inXfers[i];
+        xfer = libusb_alloc_transfer(0);
+        libusb_fill_bulk_transfer(xfer, _devHandle, CDC_DATA_EP_IN, _inBuffers[i], IN_XFER_SIZE, &LibUsbTransport::onInComplete, this, 0);
+
+        _submitted++;
+        ret = libusb_submit_transfer(xfer);
+        if (ret != LIBUSB_SUCCESS)
         {
-            LOG_WARN(TAG,"Event handler already registered");
+            _submitted--;
+            LOG_ERR(TAG, "Can't submit rx transfer, error : %s", LIBUSB_ERR(ret));
+            break;
         }
-    }  
+    }
+
+    lock.unlock();
+
+    if (ret != LIBUSB_SUCCESS)
+    {
+        stop();
+    }
+
+    return ret;
 }
 
-void UsbManager::removeEventHandler(EventHandler * evHandler, int usb_port)
+void LibUsbTransport::stop()
 {
-    std::unique_lock<std::mutex> lock(_mutex);
-
-    auto & eventHandlerVec  = _eventHandlerVec[usb_port]; //get the vector for this port
-    for (auto it = eventHandlerVec.begin(); it != eventHandlerVec.end(); ++it) 
     {
-        if (*it == evHandler) 
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_running.load())
         {
-            eventHandlerVec.erase(it);
-            break;
+            return;
+        }
+        _running.store(false);
+
+        for (auto xfer : _inXfers)
+        {
+            if (xfer != nullptr)
+            {
+                libusb_cancel_transfer(xfer);
+            }
         }
     }
-}
 
+    //The event loop exits once all submitted transfers are returned
+    if (_eventThread.joinable())
+    {
+        _eventThread.join();
+    }
 
-int UsbManager::sendPacket(Packet &pkt, int ep, int usb_port, unsigned timeout_ms)
-{   
-    int transferred = 0;
-    int ret = 0;    
-    int length = pkt.getBufferLength();
-    uint8_t *buf = pkt.getBuffer();
-    pkt.setStatus(Packet::Status::CMD);   
-    auto & usbHandler = _usbDevHandlerVec[usb_port];
+    freeTransfers();
+}
 
-    if (length > (int)Packet::MAX_SIZE) 
+int LibUsbTransport::write(const uint8_t *buf, size_t len, unsigned timeout_ms)
+{
+    if (len > TransferEngine::MAX_WRITE_SIZE)
     {
-        LOG_ERR(TAG, "Tx packet length(%d) > max(%d)", length, Packet::MAX_SIZE);
+        LOG_ERR(TAG, "Tx length(%d) > max(%d)", (int)len, TransferEngine::MAX_WRITE_SIZE);
         std::exit(-1);
     }
-   
-    PRINT_PKT("tx:", pkt, _printMutex);  
 
-    ret = libusb_bulk_transfer(usbHandler, ep, buf, length, &transferred, timeout_ms);
+    if (!_running.load())
+    {
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+
+    //No ZLP needed after a write ending on a packet boundary: the
+    //device arms one max-size packet at a time (CFG_TUD_CDC_EP_BUFSIZE)
+    const bool stream = len > Packet::MAX_SIZE;
+
+    auto pkt = stream ? _streamPool.acquire() : _outPool.acquire();
+    if (!pkt)
+    {
+        LOG_ERR(TAG, "No free tx transfer!");
+        return LIBUSB_ERROR_BUSY;
+    }
+
+    uint8_t *txBuf = stream ? _streamBuffers[pkt.index()] : pkt->getBuffer();
+    memcpy(txBuf, buf, len);
+
+    auto xfer = stream ? _streamXfers[pkt.index()] : _outXfers[pkt.index()];
+    auto ctx = stream ? &_streamContexts[pkt.index()] : &_outContexts[pkt.index()];
+    libusb_fill_bulk_transfer(xfer, _devHandle, CDC_DATA_EP_OUT, txBuf, len, &LibUsbTransport::onOutComplete, ctx, timeout_ms);
+
+    _submitted++;
+    int ret = libusb_submit_transfer(xfer);
 
     switch (ret)
     {
     case LIBUSB_SUCCESS:
-        break;
+        pkt.detach(); //released by onOutComplete
+        return 0;
     case LIBUSB_ERROR_NO_DEVICE:
         LOG_ERR(TAG, "Device disconnected!");
-        exit(ret);
-        break;
-    case LIBUSB_ERROR_PIPE:
-        libusb_clear_halt(usbHandler, ep);
+        std::exit(ret);
         break;
     default:
-        LOG_ERR(TAG, "tx err = %s" , LIBUSB_ERR(ret));
+        LOG_ERR(TAG, "tx err = %s", LIBUSB_ERR(ret));
         break;
     }
 
-    if (transferred != length)
+    _submitted--;
+    return ret;
+}
+
+void LibUsbTransport::freeTransfers()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (auto &xfer : _inXfers)
     {
-        LOG_ERR(TAG, "Tx transferred bytes=%d, expected=%d" , transferred, length);
+        libusb_free_transfer(xfer);
+        xfer = nullptr;
     }
 
-    return ret == LIBUSB_SUCCESS ? transferred : ret;
+    for (auto &xfer : _outXfers)
+    {
+        libusb_free_transfer(xfer);
+        xfer = nullptr;
+    }
 
+    for (auto &xfer : _streamXfers)
+    {
+        libusb_free_transfer(xfer);
+        xfer = nullptr;
+    }
 }
 
-int UsbManager::recvPacket(Packet &pkt, int ep, int usb_port, unsigned timeout_ms)
+void LibUsbTransport::eventLoop()
 {
-    int transferred = 0;
-    int ret = 0;
-    uint8_t *buf = pkt.getBuffer();
-    int length = pkt.getBufferSize(); 
-    auto & usbHandler = _usbDevHandlerVec[usb_port];
+    Tracer::setThreadName("libusb events");
 
-    if (length > (int)Packet::MAX_SIZE) 
+    while (_running.load() || _submitted.load() > 0)
     {
-        LOG_ERR(TAG, "Rx packet length(%d) > max(%d)", length, Packet::MAX_SIZE);
-        std::exit(-1);
+        struct timeval tv = {0, 100000};
+        libusb_handle_events_timeout_completed(_ctx, &tv, nullptr);
     }
+}
 
-    pkt.reset();
-    ret = libusb_bulk_transfer(usbHandler, ep, buf, length, &transferred, timeout_ms);
-    pkt.flush(); 
-
-    PRINT_PKT("rx:", pkt, _printMutex);   
+void LIBUSB_CALL LibUsbTransport::onOutComplete(libusb_transfer *xfer)
+{
+    auto ctx = static_cast<OutContext *>(xfer->user_data);
+    auto self = ctx->transport;
 
-    switch (ret)
+    switch (xfer->status)
     {
-    case LIBUSB_SUCCESS:
+    case LIBUSB_TRANSFER_COMPLETED:
+        if (xfer->actual_length != xfer->length)
+        {
+            LOG_ERR(TAG, "Tx transferred bytes=%d, expected=%d", xfer->actual_length, xfer->length);
+        }
         break;
-    case LIBUSB_ERROR_NO_DEVICE:
+    case LIBUSB_TRANSFER_NO_DEVICE:
         LOG_ERR(TAG, "Device disconnected!");
-        std::exit(ret);
-        break;
-    case LIBUSB_ERROR_PIPE:
-        libusb_clear_halt(usbHandler, ep);
+        std::exit(LIBUSB_ERROR_NO_DEVICE);
         break;
     default:
-        LOG_ERR(TAG, "Rx err = %s" , LIBUSB_ERR(ret));
+        //the engine retries once its response timeout expires
+        LOG_ERR(TAG, "tx err, transfer status = %d", (int)xfer->status);
         break;
     }
 
-    bool pktErr = pkt.checkErr(transferred);
-
-    if (pktErr)
-    {
-        LOG_ERR(TAG, "Tx transferred bytes=%d" , transferred);
-    }
-
-    return ret == LIBUSB_SUCCESS ? transferred : ret;   
+    ctx->pool->release(ctx->slot);
+    self->_submitted--;
 }
 
-int UsbManager::transfer(Packet &txPkt, Packet &rxPkt, int usb_port, unsigned timeout_ms)
+void LIBUSB_CALL LibUsbTransport::onInComplete(libusb_transfer *xfer)
 {
-    checkAndInitialize(usb_port);
-
-    std::lock_guard<std::mutex> lock(_mutex); 
-    
-    int txRet = 0;
-    int rxRet = 0;
-    
-    uint64_t seqNum = _pktSeqNum++ & MAX_PKT_SEQ_NUM; // range 0..maxPktSeqNum
-    txPkt.setSeqNum(seqNum);        
+    auto self = static_cast<LibUsbTransport *>(xfer->user_data);
 
-    int retry = 4;
-    while (retry-- > 0) 
-    {                           
-        txRet = sendPacket(txPkt, CDC_DATA_EP_OUT, usb_port, timeout_ms);
-        rxRet = recvPacket(rxPkt, CDC_DATA_EP_IN, usb_port, timeout_ms);       
+    switch (xfer->status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED:
+        self->_engine->onReceive(xfer->buffer, xfer->actual_length);
+        break;
+    case LIBUSB_TRANSFER_CANCELLED:
+        self->_submitted--;
+        return;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        LOG_ERR(TAG, "Device disconnected!");
+        std::exit(LIBUSB_ERROR_NO_DEVICE);
+        break;
+    default:
+        LOG_ERR(TAG, "Rx err, transfer status = %d", (int)xfer->status);
+        break;
+    }
 
-        if (rxRet > 0 && txRet > 0) 
+    //Re-arm under lock, so stop() can't miss a transfer while cancelling
+    std::lock_guard<std::mutex> lock(self->_mutex);
+    if (self->_running.load())
+    {
+        int ret = libusb_submit_transfer(xfer);
+        if (ret == LIBUSB_SUCCESS)
         {
-            break; //success
-        } 
-        
-        continue;        
+            return;
+        }
+        LOG_ERR(TAG, "Can't re-arm rx transfer, error : %s", LIBUSB_ERR(ret));
     }
+    self->_submitted--;
+}
 
-    if (retry < 0) 
-    {   
-        LOG_ERR(TAG, "Impossible to transfer!");       
-        std::exit(-1);
-    }
 
-    if (rxPkt.getType() != txPkt.getType())
-    {
-        LOG_ERR(TAG, "Tx/Rx packet type mismatch!");  
-    }
+bool LibUsbTransport::openUsbDevice()
+{
+    int ret = UsbRegistry::open(_usbPort, &_devHandle);
 
-    if (rxPkt.getSeqNum() != seqNum)
+    switch (ret)
     {
-        LOG_ERR(TAG, "Error: Invalid packet sequence number = %d, expected =  %d" , (int)rxPkt.getSeqNum() , (int)seqNum);  
-        std::exit(-1);
-    }   
+    case LIBUSB_SUCCESS:
+        return true;
+    case LIBUSB_ERROR_NOT_FOUND:
+        LOG_ERR(TAG, "Can't find device index %d", _usbPort);
+        break;
+    default:
+        LOG_ERR(TAG, "Can't open device : %d, error : %s", _usbPort, LIBUSB_ERR(ret));
+        break;
+    }
 
-    return 0;   
+    _devHandle = nullptr;
+    return false;
 }
 
-void UsbManager::checkAndInitialize(int usb_port)
-{ 
-    std::unique_lock<std::mutex> lock(_mutex);
 
-    if (usb_port >= MAX_USB_DEVICES)
+void LibUsbTransport::initUsbDevice()
+{
+    if (!openUsbDevice())   //creates the device handle
     {
-        LOG_ERR(TAG, "Can't request USB device index %d, max index = %d", usb_port , MAX_USB_DEVICES-1);
         std::exit(-1);
     }
 
-    if (_usbIndexInitMap.test(usb_port)) //already initialized
-    {           
-        return;
-    }
-    _usbIndexInitMap.set(usb_port);    
-
+    int ret = LIBUSB_SUCCESS;
 
-    if (_usbDevHandlerVec.empty()) 
+#ifdef __linux__
+    ret = libusb_set_auto_detach_kernel_driver(_devHandle, true);
+    if (ret != LIBUSB_SUCCESS)
+    {
+        LOG_ERR(TAG, "Failed to detach kernel driver, error : %s" , LIBUSB_ERR(ret));
+        std::exit(ret);
+    }
+#endif
+
+    libusb_device_descriptor descriptor;
+    ret = libusb_get_device_descriptor(libusb_get_device(_devHandle), &descriptor);
+    if (ret != LIBUSB_SUCCESS)
+    {
+        LOG_ERR(TAG, "Can't read device descriptor, error : %s", LIBUSB_ERR(ret));
+        std::exit(ret);
+    }
+
+    //CDC-ACM: notification and data interface of each channel, vendor: one interface per channel
+    static const char *cdcItfNames[IOIG_CDC_ITF_COUNT] = {"Data  Notif", "Data", "Event Notif", "Event"};
+    static const char *vendorItfNames[IOIG_VENDOR_ITF_COUNT] = {"Data", "Event"};
+
+    bool vendor = descriptor.idProduct == IOIG_VENDOR_PID;
+    const char **itfNames = vendor ? vendorItfNames : cdcItfNames;
+    unsigned itfCount = vendor ? IOIG_VENDOR_ITF_COUNT : IOIG_CDC_ITF_COUNT;
+
+    for (_itfCount = 0; _itfCount < itfCount; _itfCount++)
+    {
+        ret = libusb_claim_interface(_devHandle, _itfCount);
+        if (ret != LIBUSB_SUCCESS)
+        {
+            LOG_ERR(TAG, "Can't claim interface %d (%s), error : %s", _itfCount, itfNames[_itfCount], LIBUSB_ERR(ret));
+            std::exit(ret);
+        }
+    }
+}
+
+void LibUsbTransport::closeUsbDevice()
+{
+    if (_devHandle != nullptr)
+    {
+        for (unsigned i = 0; i < _itfCount; i++)
+        {
+            libusb_release_interface(_devHandle, i);
+        }
+        _itfCount = 0;
+        libusb_close(_devHandle);
+        _devHandle = nullptr;
+    }
+}
+
+int LibUsbTransport::waitReady()
+{
+    //Any value works, it only has to differ from the tokens of a previous session
+    static std::atomic<uint32_t> tokenCount(0);
+    const uint32_t token = (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count()
+                           ^ (tokenCount++ << 24) ^ _usbPort;
+
+    Packet txPkt(16);
+    Packet rxPkt;
+
+    makeReadyRequest(txPkt, token, Packet::PROTOCOL_VERSION);
+
+    for (unsigned attempt = 0; attempt < READY_RETRIES; attempt++)
+    {
+        if (sendPacket(txPkt, CDC_DATA_EP_OUT, READY_TIMEOUT_MS) < 0)
+        {
+            continue;
+        }
+
+        //Responses left over by a previous session are dropped
+        while (recvPacket(rxPkt, CDC_DATA_EP_IN, READY_TIMEOUT_MS) >= 0)
+        {
+            int version = checkReadyResponse(rxPkt, token);
+            if (version < 0)
+            {
+                continue;
+            }
+
+            if (version == LEGACY_FIRMWARE)
+            {
+                LOG_WARN(TAG, "Device %d firmware predates the ready handshake, using v1", _usbPort);
+                _protocol = Packet::PROTOCOL_V1;
+                return legacyReset();
+            }
+
+            _protocol = std::min<int>(version, Packet::PROTOCOL_VERSION);
+            if (_protocol < Packet::PROTOCOL_V2)
+            {
+                LOG_WARN(TAG, "Device %d firmware predates the v2 header, using v1", _usbPort);
+            }
+            return 0;
+        }
+
+        LOG_WARN(TAG, "No ready token from device %d, retrying", _usbPort);
+    }
+
+    return -1;
+}
+
+int LibUsbTransport::legacyReset()
+{
+    Packet txPkt(16);
+    Packet rxPkt;
+
+    txPkt.setType(Packet::Type::SYS_SW_RESET);
+
+    if (sendPacket(txPkt, CDC_DATA_EP_OUT, LEGACY_RESET_TIMEOUT_MS) < 0)
+    {
+        return -1;
+    }
+
+    recvPacket(rxPkt, CDC_DATA_EP_IN, LEGACY_RESET_TIMEOUT_MS);
+    std::this_thread::sleep_for(std::chrono::milliseconds(LEGACY_RESET_DELAY_MS)); //wait fw reset
+    return 0;
+}
+
+int LibUsbTransport::sendPacket(Packet &pkt, int ep, unsigned timeout_ms)
+{
+    int transferred = 0;
+    int ret = 0;
+    int length = pkt.getBufferLength();
+    uint8_t *buf = pkt.getBuffer();
+    pkt.setStatus(Packet::Status::CMD);
+
+    if (length > (int)Packet::MAX_SIZE)
+    {
+        LOG_ERR(TAG, "Tx packet length(%d) > max(%d)", length, Packet::MAX_SIZE);
+        std::exit(-1);
+    }
+
+    PRINT_PKT("tx:", pkt, printMutex);
+
+    ret = libusb_bulk_transfer(_devHandle, ep, buf, length, &transferred, timeout_ms);
+
+    switch (ret)
+    {
+    case LIBUSB_SUCCESS:
+        break;
+    case LIBUSB_ERROR_NO_DEVICE:
+        LOG_ERR(TAG, "Device disconnected!");
+        exit(ret);
+        break;
+    case LIBUSB_ERROR_PIPE:
+        libusb_clear_halt(_devHandle, ep);
+        break;
+    default:
+        LOG_ERR(TAG, "tx err = %s" , LIBUSB_ERR(ret));
+        break;
+    }
+
+    if (transferred != length)
+    {
+        LOG_ERR(TAG, "Tx transferred bytes=%d, expected=%d" , transferred, length);
+    }
+
+    return ret == LIBUSB_SUCCESS ? transferred : ret;
+
+}
+
+int LibUsbTransport::recvPacket(Packet &pkt, int ep, unsigned timeout_ms)
+{
+    int transferred = 0;
+    int ret = 0;
+    uint8_t *buf = pkt.getBuffer();
+    int length = pkt.getBufferSize();
+
+    if (length > (int)Packet::MAX_SIZE)
+    {
+        LOG_ERR(TAG, "Rx packet length(%d) > max(%d)", length, Packet::MAX_SIZE);
+        std::exit(-1);
+    }
+
+    pkt.reset();
+    ret = libusb_bulk_transfer(_devHandle, ep, buf, length, &transferred, timeout_ms);
+    pkt.flush();
+
+    PRINT_PKT("rx:", pkt, printMutex);
+
+    switch (ret)
+    {
+    case LIBUSB_SUCCESS:
+        break;
+    case LIBUSB_ERROR_NO_DEVICE:
+        LOG_ERR(TAG, "Device disconnected!");
+        std::exit(ret);
+        break;
+    case LIBUSB_ERROR_PIPE:
+        libusb_clear_halt(_devHandle, ep);
+        break;
+    default:
+        LOG_ERR(TAG, "Rx err = %s" , LIBUSB_ERR(ret));
+        break;
+    }
+
+    bool pktErr = pkt.checkErr(transferred);
+
+    if (pktErr)
+    {
+        LOG_ERR(TAG, "Tx transferred bytes=%d" , transferred);
+    }
+
+    return ret == LIBUSB_SUCCESS ? transferred : ret;
+}
+
+//==========================================================
+// UsbManager
+//==========================================================
+
+UsbDevice & UsbManager::getDevice(int usb_port)
+{
+    if (usb_port < 0 || usb_port >= MAX_USB_DEVICES)
+    {
+        LOG_ERR(TAG, "Can't request USB device index %d, max index = %d", usb_port , MAX_USB_DEVICES-1);
+        std::exit(-1);
+    }
+
+    std::call_once(_deviceOnceVec[usb_port], [usb_port]()
+    {
+        _deviceVec[usb_port] = new UsbDevice(usb_port);
+    });
+
+    return *_deviceVec[usb_port];
+}
+
+void UsbManager::deinit()
+{
+    for (int i=0; i < MAX_USB_DEVICES ; i++)
+    {
+        if (_deviceVec[i] != nullptr)
+        {
+            _deviceVec[i]->close();
+        }
+    }
+}
+
+void UsbManager::registerEventHandler(EventHandler * evHandler, const EventKey &key, int usb_port)
+{
+    if (usb_port >= (int)MAX_USB_DEVICES)
+    {
+        LOG_ERR(TAG, "Can't register event handler for USB device %d, max USB device index = %d", usb_port, MAX_USB_DEVICES-1);
+        return;
+    }
+
+    getDevice(usb_port).registerEventHandler(evHandler, key);
+}
+
+void UsbManager::removeEventHandler(EventHandler * evHandler, int usb_port)
+{
+    getDevice(usb_port).removeEventHandler(evHandler);
+}
+
+int UsbManager::transfer(Packet &txPkt, Packet &rxPkt, int usb_port, unsigned timeout_ms)
+{
+    return getDevice(usb_port).transfer(txPkt, rxPkt, timeout_ms);
+}
+
+int UsbManager::transfer(PacketBatch &batch, int usb_port, unsigned timeout_ms)
+{
+    return getDevice(usb_port).transfer(batch, timeout_ms);
+}
+
+void UsbManager::transferAsync(Packet &txPkt, Packet &rxPkt, int usb_port,
+                               TransferEngine::Completion done, unsigned timeout_ms)
+{
+    getDevice(usb_port).transferAsync(txPkt, rxPkt, timeout_ms, std::move(done));
+}
+
+int UsbManager::transferStaged(Packet &execPkt, const uint8_t *txBuf, uint8_t *rxBuf, Packet &rspPkt,
+                               int usb_port, unsigned timeout_ms)
+{
+    return getDevice(usb_port).transferStaged(execPkt, txBuf, rxBuf, rspPkt, timeout_ms);
+}
+
+int UsbManager::attachTransport(std::unique_ptr<Transport> transport, int usb_port)
+{
+    return getDevice(usb_port).attachTransport(std::move(transport));
+}
+
+int UsbManager::initAll()
+{
+    auto devices = UsbRegistry::list();
+    std::vector<std::thread> threads;
+
+    //the handshakes of independent dongles overlap
+    for (auto &dev : devices)
+    {
+        if (dev.usbPort >= MAX_USB_DEVICES)
+        {
+            LOG_WARN(TAG, "Ignoring device %s, max USB device index = %d", dev.serial.c_str(), MAX_USB_DEVICES-1);
+            continue;
+        }
+
+        int port = dev.usbPort;
+        threads.emplace_back([port]()
+        {
+            getDevice(port).checkAndInitialize();
+        });
+    }
+
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    return threads.size();
+}
+
+std::vector<UsbDeviceInfo> UsbManager::listDevices()
+{
+    return UsbRegistry::list();
+}
+
+int UsbManager::findPort(const std::string &serial)
+{
+    return UsbRegistry::findPort(serial);
+}
+
+void UsbManager::setEventExecutor(std::shared_ptr<EventExecutor> executor, int usb_port)
+{
+    getDevice(usb_port).setEventExecutor(std::move(executor));
+}
+
+int UsbManager::getEventFd(int usb_port)
+{
+    return getDevice(usb_port).getEventFd();
+}
+
+size_t UsbManager::drainEvents(int usb_port)
+{
+    return getDevice(usb_port).drainEvents();
+}
+
+size_t UsbManager::pollEvents(EventRecord *records, size_t max, int usb_port)
+{
+    return getDevice(usb_port).pollEvents(records, max);
+}
+
+size_t UsbManager::pollEvents(EventRecord *records, size_t max, uint8_t *data, size_t dataSize, int usb_port)
+{
+    return getDevice(usb_port).pollEvents(records, max, data, dataSize);
+}
+
+void UsbManager::setEventOverflowPolicy(EventOverflowPolicy policy, int usb_port)
+{
+    getDevice(usb_port).setEventOverflowPolicy(policy);
+}
+
+EventStats UsbManager::getEventStats(int usb_port)
+{
+    return getDevice(usb_port).getEventStats();
+}
+
+TransferStats::Snapshot UsbManager::getStats(int usb_port)
+{
+    return getDevice(usb_port).getStats();
+}
+
+void UsbManager::resetStats(int usb_port)
+{
+    getDevice(usb_port).resetStats();
+}
+
+uint8_t UsbManager::getProtocol(int usb_port)
+{
+    return getDevice(usb_port).getProtocol();
+}
+
+int UsbManager::startCapture(const std::string &path, int usb_port)
+{
+    return getDevice(usb_port).startCapture(path);
+}
+
+void UsbManager::stopCapture(int usb_port)
+{
+    getDevice(usb_port).stopCapture();
+}
+
+int UsbManager::startTrace(const std::string &path)
+{
+    return Tracer::start(path);
+}
+
+void UsbManager::stopTrace()
+{
+    Tracer::stop();
+}
+
+
+//==========================================================
+// UsbDevice
+//==========================================================
+
+UsbDevice::UsbDevice(int usb_port)
+    : _usbPort(usb_port),
+      _eventThreadStarted(false),
+      _eventPool(EVENT_POOL_SIZE),
+      _eventRing(EVENT_RING_SIZE, EVENT_RING_DATA_SIZE),
+      _activeExecutor(nullptr),
+      _hasPollExecutor(false),
+      _eventsScheduled(false),
+      _overflowPolicy(EventOverflowPolicy::DROP_NEWEST),
+      _pullMode(false),
+      _eventsQueued(0),
+      _eventsDispatched(0),
+      _eventsDropped(0),
+      _eventsMaxDepth(0),
+      _initialized(false),
+      _running(false),
+      _xferId(0)
+{
+    for (unsigned i = 0; i < ROUTE_COUNT; i++)
+    {
+        _routes[i].store(nullptr);
+        _inFlight[i].store(0);
+    }
+    _routeWaiters.store(0);
+}
+
+void UsbDevice::close()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!_running.load())
+    {
+        return;
+    }
+
+    _running.store(false);
+
+    if (_transport != nullptr)
+    {
+        _transport->close();
+    }
+
+    _capture.stop();
+}
+
+
+void UsbDevice::startEngine()
+{
+    _engine.reset(new TransferEngine(*_transport));
+    _engine->setCapture(&_capture);
+
+    if (_engine->start() != 0)
+    {
+        LOG_ERR(TAG, "Can't start transfer engine for USB device %d", _usbPort);
+        std::exit(-1);
+    }
+}
+
+
+void UsbDevice::eventThread()
+{
+    Tracer::setThreadName("ioig events");
+
+    while (_running.load())
+    {
+        auto evtPkt = _eventPool.acquire();
+        if (!evtPkt)
+        {
+            LOG_ERR(TAG, "Event packet pool exhausted!");
+            std::this_thread::sleep_for(1ms);
+            continue;
+        }
+
+        //Wait indefinitely for an async event
+        if (_transport->readEvent(*evtPkt, 0) != 0)
+        {
+            continue;
+        }
+
+        _capture.record(CaptureRecord::Direction::EVENT, evtPkt->getBuffer(), evtPkt->getBufferLength());
+        queueEvents(*evtPkt);
+    }
+}
+
+/**
+ * The executor shared by the ports without their own one.
+ * Never freed, event threads may post until exit.
+ */
+static std::shared_ptr<EventExecutor> &defaultEventExecutor()
+{
+    static auto executor = new std::shared_ptr<EventExecutor>(new ThreadPoolExecutor());
+    return *executor;
+}
+
+namespace
+{
+    /**
+     * A callback running on this thread. A handler removed from a callback
+     * doesn't wait for the callbacks below it on the stack, they return after it.
+     */
+    struct RouteDispatch
+    {
+        const UsbDevice *device;
+        int route;
+        RouteDispatch *parent;
+    };
+
+    thread_local RouteDispatch *currentDispatch = nullptr;
+}
+
+void UsbDevice::queueEvents(Packet &evtPkt)
+{
+    EventRecord records[EventRecord::MAX_PER_PACKET];
+    unsigned count = EventRecord::decode(evtPkt, records, EventRecord::MAX_PER_PACKET, _transport->getProtocol());
+
+    if (count == 0 && evtPkt.getType() != Packet::Type::GPIO_EVENT && evtPkt.getType() != Packet::Type::SERIAL_EVENT)
+    {
+        LOG_WARN(TAG, "Unexpected event packet type %d", (int)evtPkt.getType());
+        return;
+    }
+
+    //time the reader is not reading the device
+    TraceSpan span("events", "queue events", {{"port", _usbPort}, {"count", count}});
+
+    bool queued = false;
+    bool pull = _pullMode.load();
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        //events nobody listens to are not queued, unless they are pulled
+        auto &rec = records[i];
+        EventHandler *handler = findRoute(rec.key().type, rec.id);
+        if (handler == nullptr && !(pull && routeIndex(rec.key()) >= 0))
+        {
+            continue;
+        }
+
+        const uint8_t *data = rec.len > 0 && rec.key().type == Packet::Type::SERIAL_EVENT ?
+                              evtPkt.getPayloadBuffer(rec.offset) : nullptr;
+
+        bool pushed = _eventRing.push(rec, data);
+        if (!pushed && _overflowPolicy.load() == EventOverflowPolicy::BLOCK)
+        {
+            TraceSpan full("events", "queue full", {{"port", _usbPort}});
+            while (!pushed && _running.load())
+            {
+                //let the executor make room
+                scheduleEvents();
+                std::this_thread::sleep_for(100us);
+                pushed = _eventRing.push(rec, data);
+            }
+        }
+
+        if (!pushed)
+        {
+            if (handler != nullptr)
+            {
+                handler->onDropped();
+            }
+            _eventsDropped.fetch_add(1, std::memory_order_relaxed);
+            Tracer::instant("events", "event dropped", {{"port", _usbPort}, {"type", rec.type}, {"id", rec.id}});
+            continue;
+        }
+
+        queued = true;
+        _eventsQueued.fetch_add(1, std::memory_order_relaxed);
+
+        //single producer, no lost update
+        uint64_t depth = _eventRing.size();
+        if (depth > _eventsMaxDepth.load(std::memory_order_relaxed))
+        {
+            _eventsMaxDepth.store(depth, std::memory_order_relaxed);
+        }
+
+        if (Tracer::enabled())
+        {
+            if (rec.key().type == Packet::Type::GPIO_EVENT)
+            {
+                Tracer::instant("events", "gpio event", {{"port", _usbPort}, {"pin", rec.id},
+                                                         {"flags", rec.flags}, {"depth", (int64_t)depth}});
+            }
+            else
+            {
+                Tracer::instant("events", "uart event", {{"port", _usbPort}, {"uart", rec.id},
+                                                         {"len", rec.len}, {"depth", (int64_t)depth}});
+            }
+        }
+    }
+
+    if (queued)
+    {
+        scheduleEvents();
+    }
+}
+
+int UsbDevice::routeIndex(const EventKey &key)
+{
+    switch (key.type)
+    {
+    case Packet::Type::GPIO_EVENT:
+        return key.id < TARGET_PINS_COUNT ? key.id : -1;
+    case Packet::Type::SERIAL_EVENT:
+        return key.id < UART_INSTANCES ? TARGET_PINS_COUNT + key.id : -1;
+    default:
+        return -1;
+    }
+}
+
+EventHandler *UsbDevice::findRoute(Packet::Type type, unsigned id)
+{
+    EventKey key = {type, static_cast<uint8_t>(id)};
+    int idx = id <= 0xFF ? routeIndex(key) : -1;
+
+    if (idx < 0)
+    {
+        LOG_WARN(TAG, "Invalid event key: type = %d, id = %d", (int)type, (int)id);
+        return nullptr;
+    }
+
+    return _routes[idx].load(std::memory_order_acquire);
+}
+
+void UsbDevice::scheduleEvents()
+{
+    //pulled events: only a poll loop needs to be woken up
+    if (_pullMode.load() && !_hasPollExecutor.load())
+    {
+        return;
+    }
+
+    if (_eventsScheduled.exchange(true))
+    {
+        return; //runEvents() pending or running, it will see the new events
+    }
+
+    //no lock on the reader path: a replaced executor is retired, never freed before the device
+    EventExecutor *executor = _activeExecutor.load(std::memory_order_acquire);
+    if (executor == nullptr)
     {
-        for (unsigned i=0; i < MAX_USB_DEVICES; i++) 
-        {        
-            _usbDevHandlerVec.push_back( nullptr );        
-            _usbContextVec.push_back( nullptr );
+        executor = defaultEventExecutor().get();
+    }
+
+    executor->post([this] { runEvents(); });
+}
+
+void UsbDevice::runEvents()
+{
+    EventRecord record;
+    uint8_t data[EventRecord::MAX_DATA];
+
+    do
+    {
+        {
+            std::lock_guard<std::mutex> lock(_consumerMutex);
+            while (!_pullMode.load() && _eventRing.pop(record, data))
+            {
+                dispatch(record, data);
+            }
+        }
+        _eventsScheduled.store(false);
+
+        //events queued after the last pop, unless the reader scheduled a new run.
+        //In pull mode the run only wakes up the PollExecutor, if any.
+    } while (!_pullMode.load() && !_eventRing.empty() && !_eventsScheduled.exchange(true));
+}
+
+size_t UsbDevice::pollEvents(EventRecord *records, size_t max, uint8_t *data, size_t dataSize)
+{
+    _pullMode.store(true);
+
+    std::lock_guard<std::mutex> lock(_consumerMutex);
+
+    size_t count = 0;
+    size_t used = 0;
+    const EventRecord *next;
+    while (count < max && (next = _eventRing.front()) != nullptr)
+    {
+        bool serial = next->key().type == Packet::Type::SERIAL_EVENT;
+        if (serial && data != nullptr && used + next->len > dataSize)
+        {
+            break; //its bytes go with the next call
+        }
+
+        EventRecord &rec = records[count++];
+        _eventRing.pop(rec, serial && data != nullptr ? data + used : nullptr);
+        if (serial && data == nullptr)
+        {
+            //no buffer, the bytes are dropped
+            rec.len = 0;
+            rec.offset = 0;
+        }
+        else if (serial)
+        {
+            rec.offset = used;
+            used += rec.len;
+        }
+    }
+
+    _eventsDispatched.fetch_add(count, std::memory_order_relaxed);
+    return count;
+}
+
+void UsbDevice::dispatch(const EventRecord &record, const uint8_t *data)
+{
+    int idx = routeIndex(record.key());
+    if (idx < 0)
+    {
+        LOG_WARN(TAG, "Invalid event key: type = %d, id = %d", (int)record.type, (int)record.id);
+        return;
+    }
+
+    //counted before the route is read: removeEventHandler() clears the route, then
+    //waits for the count, so it either sees this callback or the callback sees no handler
+    _inFlight[idx].fetch_add(1);
+    EventHandler *handler = _routes[idx].load();
+    if (handler == nullptr)
+    {
+        releaseRoute(idx); //removed since the event was queued
+        return;
+    }
+
+    Event evt = {};
+    evt.key = record.key();
+    if (evt.key.type == Packet::Type::SERIAL_EVENT)
+    {
+        evt.data = data;
+        evt.len = record.len;
+    }
+    else
+    {
+        evt.flags = record.flags;
+        evt.timestamp = record.timestamp;
+    }
+
+    {
+        TraceSpan span("events", evt.key.type == Packet::Type::GPIO_EVENT ? "gpio callback" : "uart callback",
+                       {{"port", _usbPort}, {"id", evt.key.id}});
+        RouteDispatch frame = {this, idx, currentDispatch};
+        currentDispatch = &frame;
+        handler->onEvent(evt);
+        currentDispatch = frame.parent;
+    }
+    _eventsDispatched.fetch_add(1, std::memory_order_relaxed);
+
+    releaseRoute(idx);
+}
+
+void UsbDevice::releaseRoute(int idx)
+{
+    _inFlight[idx].fetch_sub(1);
+
+    if (_routeWaiters.load() > 0)
+    {
+        //the waiter is either before its check or in wait(), not in between
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
         }
+        _routeIdle.notify_all();
     }
-    // Initialize libusb for the given context
-    if (libusb_init(&_usbContextVec[usb_port]) != LIBUSB_SUCCESS) 
+}
+
+void UsbDevice::waitRoute(std::unique_lock<std::mutex> &lock, int idx)
+{
+    unsigned own = 0;
+    for (RouteDispatch *frame = currentDispatch; frame != nullptr; frame = frame->parent)
     {
-        LOG_ERR(TAG, "Failed to initialize libusb!");        
-        std::exit(-1);            
-    }    
+        if (frame->device == this && frame->route == idx)
+        {
+            own++;
+        }
+    }
 
-    _running.store(true);    
+    _routeWaiters.fetch_add(1);
+    _routeIdle.wait(lock, [this, idx, own] { return _inFlight[idx].load() <= own; });
+    _routeWaiters.fetch_sub(1);
+}
 
-    initUsbDevice(usb_port);
-    lock.unlock();
+void UsbDevice::dispatchEvent(Packet &evtPkt)
+{
+    EventRecord records[EventRecord::MAX_PER_PACKET];
+    unsigned count = EventRecord::decode(evtPkt, records, EventRecord::MAX_PER_PACKET, _transport->getProtocol());
+
+    if (count == 0 && evtPkt.getType() != Packet::Type::GPIO_EVENT && evtPkt.getType() != Packet::Type::SERIAL_EVENT)
+    {
+        LOG_WARN(TAG, "Unexpected event packet type %d", (int)evtPkt.getType());
+        return;
+    }
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        auto &rec = records[i];
+        dispatch(rec, rec.key().type == Packet::Type::SERIAL_EVENT ? evtPkt.getPayloadBuffer(rec.offset) : nullptr);
+    }
+}
+
+void UsbDevice::setEventExecutor(std::shared_ptr<EventExecutor> executor)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_executor != nullptr)
+    {
+        _retiredExecutors.push_back(_executor);
+    }
+    _pollExecutor = std::dynamic_pointer_cast<PollExecutor>(executor);
+    _executor = std::move(executor);
+
+    _activeExecutor.store(_executor.get(), std::memory_order_release);
+    _hasPollExecutor.store(_pollExecutor != nullptr);
+}
+
+int UsbDevice::getEventFd()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_pollExecutor == nullptr)
+    {
+        if (_executor != nullptr)
+        {
+            _retiredExecutors.push_back(_executor);
+        }
+        _pollExecutor = std::make_shared<PollExecutor>();
+        _executor = _pollExecutor;
+
+        _activeExecutor.store(_executor.get(), std::memory_order_release);
+        _hasPollExecutor.store(true);
+    }
+
+    return _pollExecutor->fd();
+}
+
+size_t UsbDevice::drainEvents()
+{
+    std::shared_ptr<PollExecutor> executor;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        executor = _pollExecutor;
+    }
+
+    return executor != nullptr ? executor->drain() : 0;
+}
+
+EventStats UsbDevice::getEventStats()
+{
+    EventStats stats;
+    stats.queued = _eventsQueued.load(std::memory_order_relaxed);
+    stats.dispatched = _eventsDispatched.load(std::memory_order_relaxed);
+    stats.dropped = _eventsDropped.load(std::memory_order_relaxed);
+    stats.maxDepth = _eventsMaxDepth.load(std::memory_order_relaxed);
+    return stats;
+}
+
+
+void UsbDevice::registerEventHandler(EventHandler * evHandler, const EventKey &key)
+{
+    int idx = routeIndex(key);
+    if (idx < 0)
+    {
+        LOG_ERR(TAG, "Invalid event key: type = %d, id = %d", (int)key.type, (int)key.id);
+        return;
+    }
+
+    checkAndInitialize();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_routes[idx].load() == evHandler)
+    {
+        LOG_WARN(TAG,"Event handler already registered");
+        return;
+    }
+
+    EventHandler *replaced = _routes[idx].load();
+    if (replaced != nullptr)
+    {
+        LOG_WARN(TAG,"Replacing event handler of type = %d, id = %d", (int)key.type, (int)key.id);
+    }
+
+    _routes[idx].store(evHandler);
+
+    if (!_eventThreadStarted && _transport->hasEvents())
+    {
+        _eventThreadStarted = true;
+        std::thread th = std::thread(&UsbDevice::eventThread, this);
+        th.detach();
+    }
+
+    //the old handler may be freed once we return
+    if (replaced != nullptr)
+    {
+        waitRoute(lock, idx);
+    }
+}
+
+void UsbDevice::removeEventHandler(EventHandler * evHandler)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (unsigned i = 0; i < ROUTE_COUNT; i++)
+    {
+        if (_routes[i].load() == evHandler)
+        {
+            _routes[i].store(nullptr);
+            waitRoute(lock, i);
+        }
+    }
+}
+
+
+int UsbDevice::transfer(Packet &txPkt, Packet &rxPkt, unsigned timeout_ms)
+{
+    checkAndInitialize();
+
+    TraceSpan span("transfer", "transfer", {{"port", _usbPort}, {"type", (int)txPkt.getType()}, {"retries", 0}});
+
+    //No lock, the engine matches responses by sequence number
+    if (_engine->transfer(txPkt, rxPkt, timeout_ms) < 0)
+    {
+        LOG_ERR(TAG, "Impossible to transfer!");
+        std::exit(-1);
+    }
+
+    span.arg("tx_bytes", txPkt.getFrameLength());
+    span.arg("rx_bytes", rxPkt.getFrameLength());
+
+    PRINT_PKT("tx:", txPkt, printMutex);
+    PRINT_PKT("rx:", rxPkt, printMutex);
+
+    if (rxPkt.getType() != txPkt.getType())
+    {
+        LOG_ERR(TAG, "Tx/Rx packet type mismatch!");
+    }
+
+    return 0;
+}
+
+void UsbDevice::transferAsync(Packet &txPkt, Packet &rxPkt, unsigned timeout_ms, TransferEngine::Completion done)
+{
+    checkAndInitialize();
+
+    _engine->transferAsync(txPkt, rxPkt, timeout_ms, [&txPkt, &rxPkt, done](int ret)
+    {
+        if (ret < 0)
+        {
+            LOG_ERR(TAG, "Async transfer failed!");
+        }
+        else
+        {
+            PRINT_PKT("tx:", txPkt, printMutex);
+            PRINT_PKT("rx:", rxPkt, printMutex);
+
+            if (rxPkt.getType() != txPkt.getType())
+            {
+                LOG_ERR(TAG, "Tx/Rx packet type mismatch!");
+                ret = -1;
+            }
+        }
+
+        done(ret);
+    });
+}
+
+int UsbDevice::transfer(PacketBatch &batch, unsigned timeout_ms)
+{
+    if (batch.size() == 0)
+    {
+        return 0;
+    }
+
+    transfer(batch.getRequest(), batch.getResponse(), timeout_ms);
+
+    if (batch.getResponse().getStatus() == Packet::Status::ERR)
+    {
+        LOG_WARN(TAG, "Batch response overflow, results are incomplete");
+        return -1;
+    }
+
+    return 0;
+}
+
+int UsbDevice::transferStaged(Packet &execPkt, const uint8_t *txBuf, uint8_t *rxBuf, Packet &rspPkt, unsigned timeout_ms)
+{
+    auto type = static_cast<Packet::Type>(execPkt.getPayloadItem8(1));
+    int len = execPkt.getPayloadItem16(2);
+
+    if (len <= 0 || len > (int)PacketXfer::STAGING_SIZE)
+    {
+        LOG_ERR(TAG, "Invalid staged transfer length %d, max = %d", len, PacketXfer::STAGING_SIZE);
+        return -1;
+    }
+
+    checkAndInitialize();
+
+    TraceSpan span("transfer", "transfer staged", {{"port", _usbPort}, {"type", (int)type}, {"len", len}, {"retries", 0}});
+
+    std::unique_lock<std::mutex> lock(_xferMutex, std::defer_lock);
+    lockTraced(lock, "staging mutex");
+
+    uint8_t id = ++_xferId;
+    execPkt.setPayloadItem8(0, id);
+
+    if (PacketXfer::hasTxData(type))
+    {
+        size_t count = (len + PacketXfer::MAX_FRAGMENT_SIZE - 1) / PacketXfer::MAX_FRAGMENT_SIZE;
+        std::vector<Packet> txPkts(count);
+        std::vector<Packet> rxPkts(count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            unsigned offset = i * PacketXfer::MAX_FRAGMENT_SIZE;
+            unsigned n = std::min<unsigned>(len - offset, PacketXfer::MAX_FRAGMENT_SIZE);
+            PacketXfer::addData(txPkts[i], id, offset, txBuf + offset, n, i == count - 1);
+        }
+
+        //Fragments are independent, the engine keeps the window full
+        if (_engine->transfer(txPkts.data(), rxPkts.data(), count, timeout_ms) < 0)
+        {
+            LOG_ERR(TAG, "Impossible to transfer!");
+            std::exit(-1);
+        }
+
+        for (auto &rxPkt : rxPkts)
+        {
+            if (rxPkt.getStatus() != Packet::Status::RSP)
+            {
+                LOG_ERR(TAG, "Staged transfer %d: fragment rejected", id);
+                return -1;
+            }
+        }
+    }
+
+    transfer(execPkt, rspPkt, timeout_ms);
+
+    int rxLen = rspPkt.getPayloadItem16(0);
+    if (rspPkt.getStatus() == Packet::Status::ERR || rxLen < 0 || rxLen > len)
+    {
+        LOG_ERR(TAG, "Staged transfer %d: execution failed", id);
+        return -1;
+    }
+
+    if (PacketXfer::hasRxData(type) && rxBuf != nullptr && rxLen > 0)
+    {
+        const unsigned chunk = Packet::MAX_SIZE - Packet::Header::SIZE;
+        size_t count = (rxLen + chunk - 1) / chunk;
+        std::vector<Packet> txPkts(count);
+        std::vector<Packet> rxPkts(count);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            unsigned offset = i * chunk;
+            PacketXfer::addRead(txPkts[i], id, offset, std::min<unsigned>(rxLen - offset, chunk));
+        }
+
+        if (_engine->transfer(txPkts.data(), rxPkts.data(), count, timeout_ms) < 0)
+        {
+            LOG_ERR(TAG, "Impossible to transfer!");
+            std::exit(-1);
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            auto &rxPkt = rxPkts[i];
+            unsigned offset = i * chunk;
+
+            if (rxPkt.getStatus() != Packet::Status::RSP ||
+                rxPkt.getPayloadLength() != std::min<unsigned>(rxLen - offset, chunk))
+            {
+                LOG_ERR(TAG, "Staged transfer %d: read back failed", id);
+                return -1;
+            }
+            memcpy(rxBuf + offset, rxPkt.getPayloadBuffer(), rxPkt.getPayloadLength());
+        }
+    }
+
+    span.arg("rx_len", rxLen);
+    return rxLen;
+}
+
+TransferStats::Snapshot UsbDevice::getStats()
+{
+    if (!_initialized.load())
+    {
+        return TransferStats::Snapshot();
+    }
+
+    return _engine->getStats();
+}
+
+void UsbDevice::resetStats()
+{
+    if (_initialized.load())
+    {
+        _engine->resetStats();
+    }
+}
+
+uint8_t UsbDevice::getProtocol()
+{
+    checkAndInitialize();
+    return _transport->getProtocol();
+}
+
+void UsbDevice::stopCapture()
+{
+    _capture.stop();
+
+    if (_capture.getDropped() > 0)
+    {
+        LOG_WARN(TAG, "Capture of USB device %d: %llu frames written, %llu lost", _usbPort,
+                 (unsigned long long)_capture.getRecorded(), (unsigned long long)_capture.getDropped());
+    }
+}
+
+int UsbDevice::attachTransport(std::unique_ptr<Transport> transport)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
 
-    sendResetCmd(usb_port);
+    if (_initialized.load())
+    {
+        LOG_ERR(TAG, "Can't attach a transport, USB device %d already initialized", _usbPort);
+        return -1;
+    }
+
+    if (transport->open() != 0)
+    {
+        LOG_ERR(TAG, "Can't open transport for USB device %d", _usbPort);
+        return -1;
+    }
+
+    _transport = std::move(transport);
+    _running.store(true);
+    startEngine();
+
+    _initialized.store(true);
+    return 0;
 }
 
+void UsbDevice::checkAndInitialize()
+{
+    if (_initialized.load()) //fast path, already initialized
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_initialized.load())
+    {
+        return;
+    }
+
+    _transport.reset(new LibUsbTransport(_usbPort));
+
+    if (_transport->open() != 0)
+    {
+        LOG_ERR(TAG, "Can't open USB device %d", _usbPort);
+        std::exit(-1);
+    }
+
+    _running.store(true);
+    startEngine();
 
+    _initialized.store(true);
+}
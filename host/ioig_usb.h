@@ -11,20 +11,537 @@
 #include <cstring>
 #include <bitset>
 #include <memory>
+#include <string>
 
 #include "fw/device.h" //firmware definitions
+#include "fw/targets/rp2040/hw_defs.h"
 
 #include "ioig_private.h"
+#include "ioig_capture.h"
+#include "ioig_engine.h"
+#include "ioig_events.h"
+#include "ioig_transport.h"
 
 namespace ioig
 {
 
-    class EventHandler  
+    /**
+     * @class PacketPool
+     *
+     * @brief Fixed set of pre-allocated packets with a lock-free free list.
+     *
+     * Slots are cache-line aligned and handed out through RAII handles, so
+     * the transfer and event paths don't allocate once running.
+     * The free list is a Treiber stack; the head carries a tag to avoid ABA.
+     */
+    class PacketPool
     {
-        public: 
-            EventHandler() = default;
-            virtual ~EventHandler() {}
-            virtual void onEvent(Packet & evtPkt) = 0;
+    public:
+
+        class Handle
+        {
+        public:
+            Handle() : _pool(nullptr), _index(0) {}
+            Handle(PacketPool *pool, unsigned index) : _pool(pool), _index(index) {}
+            ~Handle() { release(); }
+
+            Handle(const Handle &) = delete;
+            Handle &operator=(const Handle &) = delete;
+
+            Handle(Handle &&other) noexcept : _pool(other._pool), _index(other._index)
+            {
+                other._pool = nullptr;
+            }
+
+            Handle &operator=(Handle &&other) noexcept
+            {
+                if (this != &other)
+                {
+                    release();
+                    _pool = other._pool;
+                    _index = other._index;
+                    other._pool = nullptr;
+                }
+                return *this;
+            }
+
+            explicit operator bool() const { return _pool != nullptr; }
+            Packet &operator*() const { return _pool->at(_index); }
+            Packet *operator->() const { return &_pool->at(_index); }
+            unsigned index() const { return _index; }
+
+            /**
+             * @brief Returns the packet to its pool.
+             */
+            void release()
+            {
+                if (_pool != nullptr)
+                {
+                    _pool->release(_index);
+                    _pool = nullptr;
+                }
+            }
+
+            /**
+             * @brief Gives up ownership without releasing (e.g. to cross a C callback).
+             * @return the slot index, to be returned with PacketPool::release()
+             */
+            unsigned detach()
+            {
+                _pool = nullptr;
+                return _index;
+            }
+
+        private:
+            PacketPool *_pool;
+            unsigned _index;
+        };
+
+        explicit PacketPool(unsigned capacity);
+        ~PacketPool();
+
+        PacketPool(const PacketPool &) = delete;
+        PacketPool &operator=(const PacketPool &) = delete;
+
+        /**
+         * @brief Takes a free packet, reset to an empty MAX_SIZE packet.
+         * @note Lock-free. The handle is empty if the pool is exhausted.
+         */
+        Handle acquire();
+
+        void release(unsigned index);
+
+        Packet &at(unsigned index) { return _slots[index].pkt; }
+
+        unsigned capacity() const { return _capacity; }
+
+    private:
+
+        struct alignas(64) Slot
+        {
+            Packet pkt;
+            std::atomic<uint32_t> next;
+        };
+
+        static constexpr uint32_t NIL = 0xFFFFFFFF;
+
+        static inline uint64_t makeHead(uint64_t head, uint32_t index)
+        {
+            return (((head >> 32) + 1) << 32) | index; //bump the tag on every update
+        }
+
+        unsigned _capacity;
+        std::unique_ptr<uint8_t[]> _storage;
+        Slot *_slots;
+        std::atomic<uint64_t> _head; /**< [tag:32][index:32] */
+    };
+
+
+    /**
+     * @brief Identification of a connected dongle.
+     */
+    struct UsbDeviceInfo
+    {
+        int usbPort;
+        std::string serial;   /**< USB serial number string, unique per board */
+        std::string busPath;  /**< bus-port[.port...], as in /sys/bus/usb/devices */
+    };
+
+
+    /**
+     * @class UsbRegistry
+     *
+     * @brief Shared libusb context and cache of the connected dongles.
+     *
+     * The bus is enumerated once, on first use, and the dongles found are
+     * assigned to usb ports in serial number order, so the mapping doesn't
+     * depend on the enumeration order. A port beyond the known dongles
+     * triggers a rescan, which keeps the ports already assigned and appends
+     * the new dongles.
+     */
+    class UsbRegistry
+    {
+    public:
+
+        UsbRegistry() = delete;
+        UsbRegistry(const UsbRegistry &) = delete;
+        UsbRegistry &operator=(const UsbRegistry &) = delete;
+
+        /**
+         * @return the libusb context shared by all ports, nullptr on error
+         */
+        static libusb_context *getContext();
+
+        /**
+         * @brief Opens the dongle assigned to a usb port.
+         * @note The caller owns the handle and closes it with libusb_close().
+         * @return zero on success, libusb error code otherwise
+         */
+        static int open(int usb_port, libusb_device_handle **handle);
+
+        /**
+         * @return the connected dongles, in usb port order
+         */
+        static std::vector<UsbDeviceInfo> list();
+
+        /**
+         * @return the usb port of the dongle with this serial number, negative value if not found
+         */
+        static int findPort(const std::string &serial);
+
+    private:
+
+        struct Entry
+        {
+            libusb_device        *device;  /**< Referenced until replaced by a rescan */
+            libusb_device_handle *handle;  /**< Opened to read the serial, handed over by open() */
+            std::string serial;
+            std::string busPath;
+        };
+
+        static bool init();
+        static void enumerate();
+        static std::string readBusPath(libusb_device *device);
+
+        static std::mutex _mutex;
+        static libusb_context *_ctx;  /**< Never freed, transports may use it until exit */
+        static bool _enumerated;
+        static std::vector<Entry> _entries;  /**< Indexed by usb port */
+
+        static constexpr const char* TAG = "UsbRegistry";
+    };
+
+
+    /**
+     * @class LibUsbTransport
+     *
+     * @brief Transport over the dongle CDC bulk endpoints, using the libusb async API for data.
+     *
+     * Firmware built with IOIG_USB_VENDOR exposes the same endpoints on
+     * vendor class interfaces; the mode is told by the product id.
+     *
+     * Two IN transfers are kept armed so the device never waits for the host
+     * to post a read. They span several max-size USB packets and complete on
+     * a short packet or a ZLP, so back to back responses arrive together.
+     * Each OUT transfer is bound to a PacketPool slot that holds the copy of
+     * the request until the transfer completes; writes of several packets
+     * use a slot of the stream pool, whose index selects a larger buffer.
+     * Events are read synchronously on the event endpoint.
+     * The libusb context and the device come from UsbRegistry.
+     */
+    class LibUsbTransport : public Transport
+    {
+    public:
+        LibUsbTransport(int usb_port);
+        ~LibUsbTransport();
+
+        int open() override;
+        void close() override;
+
+        int start(TransferEngine &engine) override;
+        void stop() override;
+        int write(const uint8_t *buf, size_t len, unsigned timeout_ms) override;
+
+        bool hasEvents() const override { return true; }
+        int readEvent(Packet &evtPkt, unsigned timeout_ms) override;
+
+        uint8_t getProtocol() const override { return _protocol; }
+
+    private:
+
+        bool openUsbDevice();
+        void initUsbDevice();
+        void closeUsbDevice();
+
+        /**
+         * @brief Resets the firmware and waits until it is ready.
+         *
+         * Sends SYS_INIT with a random token; the firmware answers with the
+         * same token once its reset is done, then its header version.
+         * Stale responses are dropped. Firmware predating the handshake
+         * is reset with legacyReset().
+         * @return zero on success, negative value if the device never answered
+         */
+        int waitReady();
+
+        /**
+         * @brief Reset of the firmware predating the ready handshake: SYS_SW_RESET, then a fixed delay.
+         * @return zero on success, negative value on error
+         */
+        int legacyReset();
+
+        /**
+         * @brief Sends a packet to the device.
+         *
+         * @param pkt The packet to send.
+         * @param ep The endpoint.
+         * @param timeout_ms Timeout in milliseconds.
+         * @return zero on success, negative value on error
+         */
+        int sendPacket(Packet &pkt, int ep, unsigned timeout_ms);
+
+        /**
+         * @brief Receives a packet from the device.
+         *
+         * @param pkt The packet received.
+         * @param ep The endpoint.
+         * @param timeout_ms Timeout in milliseconds.
+         * @return zero on success, negative value on error
+         */
+        int recvPacket(Packet &pkt, int ep, unsigned timeout_ms);
+
+        static void LIBUSB_CALL onOutComplete(libusb_transfer *xfer);
+        static void LIBUSB_CALL onInComplete(libusb_transfer *xfer);
+
+        void eventLoop();
+        void freeTransfers();
+
+        static constexpr unsigned READY_TIMEOUT_MS = 100;
+        static constexpr unsigned READY_RETRIES = 10;
+        static constexpr unsigned LEGACY_RESET_TIMEOUT_MS = 1000;
+        static constexpr unsigned IN_XFER_COUNT = 2;
+        static constexpr unsigned IN_XFER_SIZE = TransferEngine::MAX_WRITE_SIZE;
+        static constexpr unsigned OUT_XFER_COUNT = 2 * TransferEngine::MAX_WINDOW;
+        static constexpr unsigned OUT_STREAM_COUNT = 8;
+
+        int _usbPort;
+        libusb_context       *_ctx;        /**< Shared, owned by UsbRegistry */
+        libusb_device_handle *_devHandle;
+        unsigned _itfCount;                /**< Claimed interfaces, IOIG_CDC_ITF_COUNT or IOIG_VENDOR_ITF_COUNT */
+        uint8_t  _protocol;                /**< Header version, from the SYS_INIT response */
+
+        TransferEngine *_engine;
+
+        struct OutContext
+        {
+            LibUsbTransport *transport;
+            PacketPool *pool;
+            unsigned slot;    /**< PacketPool slot of the transfer buffer */
+        };
+
+        PacketPool _outPool;
+        libusb_transfer *_outXfers[OUT_XFER_COUNT];  /**< Indexed by PacketPool slot */
+        OutContext _outContexts[OUT_XFER_COUNT];
+
+        PacketPool _streamPool;  /**< Slots of the multi-packet writes, the packets are unused */
+        libusb_transfer *_streamXfers[OUT_STREAM_COUNT];
+        OutContext _streamContexts[OUT_STREAM_COUNT];
+        uint8_t _streamBuffers[OUT_STREAM_COUNT][TransferEngine::MAX_WRITE_SIZE];
+
+        libusb_transfer *_inXfers[IN_XFER_COUNT];
+        uint8_t _inBuffers[IN_XFER_COUNT][IN_XFER_SIZE];
+
+        std::atomic_bool _running;
+        std::atomic<int> _submitted;  /**< Transfers owned by libusb */
+        std::mutex _mutex;
+        std::thread _eventThread;
+
+        static constexpr const char* TAG = "LibUsbTransport";
+    };
+
+
+    /**
+     * @class UsbDevice
+     *
+     * @brief State of one IOIG device (one usb port).
+     *
+     * Each device owns its transport, transfer engine, lock and event
+     * thread, so independent devices never contend with each other.
+     *
+     * The event thread only reads and decodes: events are queued in an
+     * EventRing and the callbacks run on an EventExecutor, so a slow
+     * handler doesn't stop the device event endpoint from being drained.
+     * Neither side takes the device lock per event: the routes and the
+     * executor are read with atomic loads.
+     */
+    class UsbDevice
+    {
+    public:
+
+        UsbDevice(int usb_port);
+
+        UsbDevice(const UsbDevice &) = delete;
+        UsbDevice &operator=(const UsbDevice &) = delete;
+
+        /**
+         * @brief Opens the device on first call, no-op afterwards.
+         */
+        void checkAndInitialize();
+
+        /**
+         * @brief Uses the given transport instead of a libusb device.
+         * @note Must be called before the first transfer on this port.
+         * @return zero on success, negative value on error or if the device is already initialized
+         */
+        int attachTransport(std::unique_ptr<Transport> transport);
+
+        int transfer(Packet &txPkt, Packet &rxPkt, unsigned timeout_ms);
+        int transfer(PacketBatch &batch, unsigned timeout_ms);
+        void transferAsync(Packet &txPkt, Packet &rxPkt, unsigned timeout_ms, TransferEngine::Completion done);
+
+        /**
+         * @brief Stages txBuf on the device, runs execPkt, reads the result back to rxBuf.
+         * @param execPkt XFER_EXEC command built with PacketXfer::addExec, its ID is set here
+         * @param rspPkt XFER_EXEC response, holds the command status
+         * @return the number of bytes read back, negative value on error
+         */
+        int transferStaged(Packet &execPkt, const uint8_t *txBuf, uint8_t *rxBuf, Packet &rspPkt, unsigned timeout_ms);
+
+        /**
+         * @return the transfer counters, empty if the device is not initialized yet
+         */
+        TransferStats::Snapshot getStats();
+        void resetStats();
+
+        /**
+         * @return the header version agreed with the device, initializes it if needed
+         */
+        uint8_t getProtocol();
+
+        /**
+         * @brief Starts a binary capture of the requests, responses and events of the device.
+         * @return zero on success, negative value on error
+         */
+        int startCapture(const std::string &path) { return _capture.start(path); }
+
+        /**
+         * @brief Stops the capture, a warning tells the frames lost if the writer fell behind.
+         */
+        void stopCapture();
+
+        /**
+         * @note Replacing the handler of key waits for the callbacks of the old one, like removeEventHandler().
+         */
+        void registerEventHandler(EventHandler * evHandler, const EventKey &key);
+
+        /**
+         * @brief Unroutes evHandler, then waits for its callbacks still running on other threads.
+         * @note Once it returns evHandler is never called again and can be freed. From a callback,
+         *       the callbacks of the calling thread are not waited for, they return after it.
+         */
+        void removeEventHandler(EventHandler * evHandler);
+
+        /**
+         * @brief Decodes an event packet and calls the handler of each event, on the caller's thread.
+         */
+        void dispatchEvent(Packet &evtPkt);
+
+        /**
+         * @brief Decodes an event packet and queues its events for the executor.
+         * @note Called by the event thread, the only producer of the event queue.
+         */
+        void queueEvents(Packet &evtPkt);
+
+        /**
+         * @brief Runs the callbacks on executor instead of the default thread pool.
+         */
+        void setEventExecutor(std::shared_ptr<EventExecutor> executor);
+
+        /**
+         * @brief Switches the device to a PollExecutor, unless it already has one.
+         * @return its file descriptor, -1 if not supported
+         */
+        int getEventFd();
+
+        /**
+         * @brief Runs the callbacks pending on the PollExecutor of the device, without blocking.
+         * @return the number of callback batches run, 0 without a PollExecutor
+         */
+        size_t drainEvents();
+
+        /**
+         * @brief Pops up to max queued events, without blocking. The handlers are not called anymore.
+         * @param data Receives the SERIAL bytes, at the offset of their record. Without it, the
+         *        SERIAL records are returned with len 0 and their bytes dropped.
+         * @return the number of records written, it stops before a SERIAL event not fitting data
+         */
+        size_t pollEvents(EventRecord *records, size_t max, uint8_t *data = nullptr, size_t dataSize = 0);
+
+        void setEventOverflowPolicy(EventOverflowPolicy policy) { _overflowPolicy.store(policy); }
+
+        EventStats getEventStats();
+
+        /**
+         * @brief Stops the engine and releases the usb device.
+         */
+        void close();
+
+    private:
+
+        void startEngine();
+
+        void eventThread();
+
+        /**
+         * @brief Posts runEvents() to the executor, unless it is already pending.
+         */
+        void scheduleEvents();
+
+        /**
+         * @brief Calls the handlers of the queued events, the only consumer of the event queue.
+         */
+        void runEvents();
+
+        void dispatch(const EventRecord &record, const uint8_t *data);
+
+        /**
+         * @return the routing table index of key, negative value if the key is invalid
+         */
+        static int routeIndex(const EventKey &key);
+
+        EventHandler *findRoute(Packet::Type type, unsigned id);
+
+        /**
+         * @brief Ends a callback on route idx, wakes up waitRoute() if needed.
+         */
+        void releaseRoute(int idx);
+
+        /**
+         * @brief Waits until the callbacks in flight on route idx all run on the calling thread.
+         */
+        void waitRoute(std::unique_lock<std::mutex> &lock, int idx);
+
+        int _usbPort;
+
+        PacketCapture _capture;  /**< Before the engine, which records to it */
+        std::unique_ptr<Transport> _transport;
+        std::unique_ptr<TransferEngine> _engine;
+
+        static constexpr unsigned ROUTE_COUNT = TARGET_PINS_COUNT + UART_INSTANCES;
+
+        std::atomic<EventHandler *> _routes[ROUTE_COUNT];  /**< Gpio pins first, then UART instances, written under _mutex */
+        std::atomic<unsigned> _inFlight[ROUTE_COUNT];      /**< Callbacks running, per route */
+        std::atomic<unsigned> _routeWaiters;               /**< waitRoute() calls, the callbacks then notify _routeIdle */
+        std::condition_variable _routeIdle;
+        bool _eventThreadStarted;
+        PacketPool _eventPool;
+
+        EventRing _eventRing;
+        std::shared_ptr<EventExecutor> _executor;  /**< nullptr: the default thread pool, under _mutex */
+        std::shared_ptr<PollExecutor> _pollExecutor;  /**< _executor, if it is a PollExecutor, under _mutex */
+        std::vector<std::shared_ptr<EventExecutor>> _retiredExecutors;  /**< Replaced, the reader may still post to them */
+        std::atomic<EventExecutor *> _activeExecutor;  /**< _executor, read by the reader without lock */
+        std::atomic_bool _hasPollExecutor;
+        std::atomic_bool _eventsScheduled;
+        std::atomic<EventOverflowPolicy> _overflowPolicy;
+        std::atomic_bool _pullMode;  /**< Events are popped by pollEvents(), not dispatched */
+        std::mutex _consumerMutex;   /**< runEvents() and pollEvents() share the consumer side of the queue */
+        std::atomic<uint64_t> _eventsQueued;
+        std::atomic<uint64_t> _eventsDispatched;
+        std::atomic<uint64_t> _eventsDropped;
+        std::atomic<uint64_t> _eventsMaxDepth;
+
+        std::atomic_bool _initialized;
+        std::atomic_bool _running;
+        std::mutex _mutex;
+
+        std::mutex _xferMutex;  /**< The device has a single staging buffer */
+        uint8_t _xferId;
+
+        static constexpr unsigned EVENT_POOL_SIZE = 4;
+        static constexpr unsigned EVENT_RING_SIZE = 1024;
+        static constexpr unsigned EVENT_RING_DATA_SIZE = 8192;  /**< SERIAL bytes queued, ~140 full SERIAL_EVENT packets */
+        static constexpr const char* TAG = "UsbDevice";
     };
 
 
@@ -47,82 +564,205 @@ namespace ioig
 
         /**
          * @brief Registers a peripheral to handle events
+         * @param evHandler The handler, called only for events matching key
+         * @param key The event type and pin or UART instance
          * @param usb_port The usb device index
-         * @param
          * 
          */     
-        static void registerEventHandler(EventHandler * evHandler, int usb_port);
+        static void registerEventHandler(EventHandler * evHandler, const EventKey &key, int usb_port);
+
+        /**
+         * @brief Stops the events of evHandler.
+         * @note Waits for its callbacks running on other threads: evHandler can be freed once it returns.
+         *       Safe from the handler's own callback, which is not waited for.
+         */
         static void removeEventHandler(EventHandler * evHandler, int usb_port);
 
+        /**
+         * @brief Selects where the event callbacks of a usb port run.
+         * @note By default, on a ThreadPoolExecutor shared by all ports. A ManualExecutor
+         *       runs them from the caller's loop. The callbacks of a port never run
+         *       concurrently, whatever the executor.
+         */
+        static void setEventExecutor(std::shared_ptr<EventExecutor> executor, int usb_port);
+
+        /**
+         * @brief File descriptor readable when callbacks of a usb port are pending, for epoll/poll loops.
+         * @note Switches the port to a PollExecutor: the callbacks then only run from drainEvents().
+         *       Ports sharing a PollExecutor, see setEventExecutor(), share its file descriptor.
+         * @return the file descriptor, -1 if not supported (Windows)
+         */
+        static int getEventFd(int usb_port);
+
+        /**
+         * @brief Runs the pending callbacks of a usb port on the caller's thread, never blocks.
+         * @return the number of callback batches run
+         */
+        static size_t drainEvents(int usb_port);
+
+        /**
+         * @brief Pull API: copies up to max queued GPIO and SERIAL events of a usb port to records.
+         * @note Never blocks, see getEventFd() to wait for events. After the first call the
+         *       events of the port are only returned here, the handlers are not called anymore.
+         *       The interrupts are still enabled per pin/UART with setInterrupt().
+         *       The SERIAL records come with len 0, their bytes are dropped: see the overload with data.
+         * @return the number of records written
+         */
+        static size_t pollEvents(EventRecord *records, size_t max, int usb_port);
+
+        /**
+         * @brief Pull API with the SERIAL bytes: those of a record are at data + record.offset.
+         * @note A SERIAL event not fitting the rest of data stays queued for the next call,
+         *       dataSize of EventRecord::MAX_DATA or more always makes progress.
+         * @return the number of records written
+         */
+        static size_t pollEvents(EventRecord *records, size_t max, uint8_t *data, size_t dataSize, int usb_port);
+
+        /**
+         * @brief What to do when the event queue of a usb port is full, DROP_NEWEST by default.
+         */
+        static void setEventOverflowPolicy(EventOverflowPolicy policy, int usb_port);
+
+        /**
+         * @brief Event counters of a usb port: queued, dispatched, dropped and queue high watermark.
+         * @note Drops are also counted per handler, see EventHandler::getDroppedEvents().
+         */
+        static EventStats getEventStats(int usb_port);
+
 
         /**
          * @brief Transfers data to the device and waits for a response.
-         * @note Blocking operation.
+         * @note Blocking operation. Requests from several threads are pipelined,
+         *       see TransferEngine. Ports don't share any lock.
          *
          * @param txPkt The packet to transmit.
          * @param rxPkt The packet to receive.
          */
         static int transfer(Packet &txPkt, Packet &rxPkt, int usb_port, unsigned timeout_ms=600);
 
-        
-        
-    private:
-
-        static void checkAndInitialize(int usb_port);
+        /**
+         * @brief Transfers a batch of commands in a single round trip.
+         * @note Blocking operation. Use PacketBatch::getResult() to read each response.
+         *
+         * @param batch The commands to transfer.
+         * @return zero on success, negative value if the device couldn't answer every command
+         */
+        static int transfer(PacketBatch &batch, int usb_port, unsigned timeout_ms=600);
 
- 
         /**
-         * @brief Deinitializes the USB host controller.
+         * @brief Starts a transfer, done is called with its result when the response arrives.
+         * @note Non blocking, see TransferEngine::transferAsync(): done runs on the
+         *       transport completion path and must not block. The packets must stay
+         *       valid until then. No retry, a lost response fails after timeout_ms.
          */
-        static void deinit();            
+        static void transferAsync(Packet &txPkt, Packet &rxPkt, int usb_port,
+                                  TransferEngine::Completion done, unsigned timeout_ms=600);
 
+        /**
+         * @brief Runs a command on a buffer larger than a packet (up to PacketXfer::STAGING_SIZE).
+         * @note Blocking operation. The buffer is streamed in fragments, pipelined by
+         *       the TransferEngine, and the command runs as a single bus transaction.
+         *
+         * @param execPkt XFER_EXEC command built with PacketXfer::addExec, plus the command params.
+         * @param txBuf Data to write, for the commands moving data to the bus.
+         * @param rxBuf Data read back, for the commands reading the bus.
+         * @param rspPkt The XFER_EXEC response, holds the command status.
+         * @param timeout_ms Time to wait for each response, the command execution included.
+         * @return the number of bytes read back, negative value on error
+         */
+        static int transferStaged(Packet &execPkt, const uint8_t *txBuf, uint8_t *rxBuf, Packet &rspPkt,
+                                  int usb_port, unsigned timeout_ms=600);
 
-        static libusb_device_handle * getDeviceHandler(const unsigned usb_port);
+        /**
+         * @brief Attaches a custom transport (fake device, simulator...) to a usb port.
+         * @note Must be called before any other access to this port.
+         * @return zero on success, negative value on error
+         */
+        static int attachTransport(std::unique_ptr<Transport> transport, int usb_port);
 
+        /**
+         * @brief Opens every connected dongle, concurrently.
+         * @note Optional, ports are otherwise opened on first use.
+         * @return the number of ports initialized
+         */
+        static int initAll();
 
+        /**
+         * @brief Lists the connected dongles and the usb port of each one.
+         */
+        static std::vector<UsbDeviceInfo> listDevices();
 
+        /**
+         * @return the usb port of the dongle with this serial number, negative value if not found
+         */
+        static int findPort(const std::string &serial);
 
-        static bool openUsbDevice(int usb_port);
-        static void initUsbDevice(int usb_port);
+        /**
+         * @brief Snapshot of the transfer counters of a usb port, per command type:
+         *        count, bytes, retries, timeouts, sequence mismatches and
+         *        send to receive latency histogram.
+         * @note Counters are always on, the snapshot doesn't stop transfers.
+         */
+        static TransferStats::Snapshot getStats(int usb_port);
 
-        static void closeUsbDevice(int usb_port);
-        static void sendResetCmd(int usb_port);
+        /**
+         * @brief Clears the transfer counters of a usb port.
+         */
+        static void resetStats(int usb_port);
 
+        /**
+         * @brief Header version agreed with the firmware of a usb port at open:
+         *        GPIO events carry the device timestamp from PROTOCOL_V2.
+         */
+        static uint8_t getProtocol(int usb_port);
 
         /**
-         * @brief Sends a packet to the device.
+         * @brief Captures the frames of a usb port to a binary file, with their timestamps.
          *
-         * @param pkt The packet to send.
-         * @param ep The endpoint.
-         * @param timeout_ms Timeout in milliseconds.
-         * @return zero on success, negative value on error
+         * Requests, responses and events are copied to a lock-free ring and
+         * written by a background thread, the transfers don't wait on the
+         * file. The capture can be replayed against the simulator with the
+         * ioig_replay tool.
+         *
+         * @return zero on success, negative value if the file can't be created or a capture is running
          */
-        static int sendPacket(Packet &pkt, int ep, int usb_port, unsigned timeout_ms);
+        static int startCapture(const std::string &path, int usb_port);
 
         /**
-         * @brief Receives a packet from the device.
+         * @brief Stops the capture of a usb port and closes its file.
+         */
+        static void stopCapture(int usb_port);
+
+        /**
+         * @brief Records a timeline of all the ports to a Chrome trace-event JSON file.
          *
-         * @param pkt The packet received.
-         * @param ep The endpoint.
-         * @param timeout_ms Timeout in milliseconds.
-         * @return zero on success, negative value on error
+         * Spans of the blocking transfers (port, command type, bytes and
+         * retries), of the contended locks and window waits, of the reader
+         * thread queuing the events and of the event callbacks, plus an
+         * instant event per GPIO or UART event queued. Open the file in
+         * https://ui.perfetto.dev or chrome://tracing.
+         *
+         * @return zero on success, negative value if the file can't be created or a trace is running
          */
-        static int recvPacket(Packet &pkt, int ep, int usb_port, unsigned timeout_ms);
+        static int startTrace(const std::string &path);
 
+        /**
+         * @brief Stops the trace and closes its file.
+         */
+        static void stopTrace();
+        
+    private:
 
-        static std::vector<libusb_device_handle *> _usbDevHandlerVec;
-        static std::vector<libusb_context *> _usbContextVec;
-        static std::vector<EventHandler *>  _eventHandlerVec[MAX_USB_DEVICES]; //An event vector per usb device
-        static void eventThread(int usb_port);
+        static UsbDevice & getDevice(int usb_port);
+ 
+        /**
+         * @brief Deinitializes the USB host controller.
+         */
+        static void deinit();            
 
-        static std::atomic_bool _running;
-        static std::mutex _mutex;
-        static std::mutex _printMutex;
-        static std::bitset<MAX_USB_DEVICES> _usbIndexInitMap;  /**< Each bit represents an usb index */
-        
-        static uint64_t _pktSeqNum;
+        static std::once_flag _deviceOnceVec[MAX_USB_DEVICES];
+        static UsbDevice * _deviceVec[MAX_USB_DEVICES];  /**< Never freed, event threads may run until exit */
 
-        static constexpr unsigned MAX_PKT_SEQ_NUM = 255;
         static constexpr const char* TAG = "UsbManager";
 
     };
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <future>
+#include <memory>
+
+#include "ioig.h"
+#include "ioig_usb.h"
+#include "loopback_transport.h"
+
+#if !IOIG_HAS_COROUTINES
+#error "async_tests needs C++20 coroutines, built with CXX_STANDARD 20"
+#endif
+
+using namespace ioig;
+
+#define USB_PORT 0
+
+
+static void attachSimulator()
+{
+  static bool attached = false;
+  if (!attached)
+  {
+    LoopbackTransport::wire(GP10, GP11);
+    ASSERT_EQ(UsbManager::attachTransport(std::unique_ptr<Transport>(new LoopbackTransport()), USB_PORT), 0);
+    attached = true;
+  }
+}
+
+static AsyncResult<int> transferAsync(Packet &txPkt, Packet &rxPkt)
+{
+  AsyncResult<int> result;
+  UsbManager::transferAsync(txPkt, rxPkt, USB_PORT, [result](int ret) { result.complete(ret); });
+  return result;
+}
+
+/**
+ * Resumes on the completion path after each co_await, reports through done.
+ * The frame owns done: set_value() may still run when the test ends.
+ */
+static DetachedTask readBack(Packet &txPkt, Packet &rxPkt, std::shared_ptr<std::promise<int>> done)
+{
+  int ret = co_await transferAsync(txPkt, rxPkt);
+  done->set_value(ret);
+}
+
+static DetachedTask echo(Gpio &driver, Gpio &input, int value, std::shared_ptr<std::promise<int>> done)
+{
+  int ret = co_await driver.writeAsync(value);
+  if (ret < 0)
+  {
+    done->set_value(-1);
+    co_return;
+  }
+
+  int level = co_await input.readAsync();
+  done->set_value(level);
+}
+
+
+TEST(AsyncTestSuite, AwaitTransfer)
+{
+  attachSimulator();
+
+  Packet txPkt, rxPkt;
+  txPkt.setType(Packet::Type::GPIO_GET_VALUE);
+  txPkt.addPayloadItem8(GP10);
+
+  auto done = std::make_shared<std::promise<int>>();
+  auto value = done->get_future();
+  readBack(txPkt, rxPkt, done);
+
+  ASSERT_EQ(value.wait_for(std::chrono::seconds(1)), std::future_status::ready);
+  EXPECT_GE(value.get(), 0);
+  EXPECT_EQ(rxPkt.getType(), Packet::Type::GPIO_GET_VALUE);
+  EXPECT_EQ(rxPkt.getStatus(), Packet::Status::RSP);
+}
+
+TEST(AsyncTestSuite, AwaitPeripheralCalls)
+{
+  attachSimulator();
+
+  Gpio driver(GP10, PinDirection::Output);
+  Gpio input(GP11, PinDirection::Input, PinMode::PullNone);
+
+  //the pins initialize on their first call, a blocking one: not from the coroutine
+  driver.write(0);
+  input.read();
+
+  for (int value : {1, 0})
+  {
+    auto done = std::make_shared<std::promise<int>>();
+    auto level = done->get_future();
+    echo(driver, input, value, done);
+
+    ASSERT_EQ(level.wait_for(std::chrono::seconds(1)), std::future_status::ready);
+    EXPECT_EQ(level.get(), value);
+  }
+}
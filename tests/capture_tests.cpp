@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <memory.h>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ioig.h"
+#include "ioig_engine.h"
+#include "ioig_capture.h"
+#include "echo_link.h"
+
+using namespace ioig;
+
+
+static std::string tempPath(const char *name)
+{
+  return ::testing::TempDir() + name;
+}
+
+
+TEST(CaptureTestSuite, ConcurrentProducers)
+{
+  constexpr unsigned THREADS = 4;
+  constexpr unsigned COUNT = 5000;
+  std::string path = tempPath("ioig_capture_producers.bin");
+
+  PacketCapture capture(256);
+
+  //stopped, nothing recorded
+  uint8_t frame[Packet::MAX_SIZE] = {0};
+  capture.record(CaptureRecord::Direction::TX, frame, Packet::Header::SIZE);
+
+  ASSERT_EQ(capture.start(path), 0);
+  EXPECT_TRUE(capture.running());
+  EXPECT_NE(capture.start(path), 0);
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < THREADS; t++)
+  {
+    threads.emplace_back([&capture, t] {
+      Packet pkt;
+      pkt.setType(Packet::Type::GPIO_SET_VALUE);
+      pkt.addPayloadItem8(t);
+      pkt.addPayloadItem32(0);
+
+      for (uint32_t i = 0; i < COUNT; i++)
+      {
+        uint8_t *pld = pkt.getPayloadBuffer(1);
+        memcpy(pld, &i, sizeof(i));
+        capture.record(CaptureRecord::Direction::TX, pkt.getBuffer(), pkt.getBufferLength());
+        if (i % 64 == 0)
+        {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  for (auto &th : threads)
+  {
+    th.join();
+  }
+  capture.stop();
+  EXPECT_FALSE(capture.running());
+
+  EXPECT_EQ(capture.getRecorded() + capture.getDropped(), (uint64_t)THREADS * COUNT);
+  EXPECT_GT(capture.getRecorded(), 0u);
+
+  //every frame intact, in order for each producer
+  CaptureReader reader;
+  ASSERT_EQ(reader.open(path), 0);
+
+  CaptureRecord rec;
+  uint64_t read = 0;
+  uint64_t lastTs[THREADS] = {0};
+  int64_t lastSeq[THREADS];
+  std::fill(lastSeq, lastSeq + THREADS, -1);
+
+  while (reader.next(rec))
+  {
+    read++;
+    ASSERT_EQ(rec.direction, CaptureRecord::Direction::TX);
+    ASSERT_EQ(rec.len, Packet::Header::SIZE + 5);
+    ASSERT_EQ(Packet::getFrameType(rec.frame), Packet::Type::GPIO_SET_VALUE);
+
+    unsigned t = rec.frame[Packet::Header::SIZE];
+    ASSERT_LT(t, THREADS);
+
+    uint32_t seq;
+    memcpy(&seq, rec.frame + Packet::Header::SIZE + 1, sizeof(seq));
+    EXPECT_GT((int64_t)seq, lastSeq[t]);
+    EXPECT_GE(rec.timestampNs, lastTs[t]);
+    lastSeq[t] = seq;
+    lastTs[t] = rec.timestampNs;
+  }
+  EXPECT_EQ(read, capture.getRecorded());
+
+  std::remove(path.c_str());
+}
+
+TEST(CaptureTestSuite, EngineFrames)
+{
+  std::string path = tempPath("ioig_capture_engine.bin");
+
+  PacketCapture capture;
+  EchoLink link;
+  TransferEngine engine(link);
+  engine.setCapture(&capture);
+  engine.start();
+
+  Packet tx[3], rx[3];
+  for (unsigned i = 0; i < 3; i++)
+  {
+    tx[i].setType(Packet::Type::XFER_DATA);
+    tx[i].addPayloadItem8(i);
+  }
+
+  //not captured yet
+  EXPECT_EQ(engine.transfer(tx[0], rx[0], 100), 0);
+
+  ASSERT_EQ(capture.start(path), 0);
+  EXPECT_EQ(engine.transfer(tx[0], rx[0], 100), 0);
+  //several frames in one write
+  EXPECT_EQ(engine.transfer(tx, rx, 3, 100), 0);
+  capture.stop();
+
+  engine.stop();
+
+  CaptureReader reader;
+  ASSERT_EQ(reader.open(path), 0);
+
+  CaptureRecord rec;
+  unsigned txCount = 0, rxCount = 0;
+  while (reader.next(rec))
+  {
+    Packet pkt;
+    ASSERT_EQ(pkt.setFrame(rec.frame, rec.len), 0);
+    EXPECT_EQ(pkt.getType(), Packet::Type::XFER_DATA);
+
+    if (rec.direction == CaptureRecord::Direction::TX)
+    {
+      EXPECT_EQ(pkt.getStatus(), Packet::Status::CMD);
+      txCount++;
+    }
+    else
+    {
+      EXPECT_EQ(rec.direction, CaptureRecord::Direction::RX);
+      EXPECT_EQ(pkt.getStatus(), Packet::Status::RSP);
+      rxCount++;
+    }
+  }
+
+  EXPECT_EQ(txCount, 4u);
+  EXPECT_EQ(rxCount, 4u);
+
+  //not a capture
+  FILE *f = fopen(path.c_str(), "wb");
+  fputs("not a capture file", f);
+  fclose(f);
+  EXPECT_NE(reader.open(path), 0);
+
+  std::remove(path.c_str());
+}
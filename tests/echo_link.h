@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ioig.h"
+#include "ioig_engine.h"
+
+/**
+ * Answers synchronously by echoing the requests of a write, one response per
+ * frame, v1 or v2 framed as the request. Drops the first `drops` writes.
+ */
+class EchoLink : public ioig::TransferEngine::Link
+{
+public:
+  int start(ioig::TransferEngine &engine) override { _engine = &engine; return 0; }
+  void stop() override {}
+  int write(const uint8_t *buf, size_t len, unsigned) override
+  {
+    if (drops > 0)
+    {
+      drops--;
+      return 0;
+    }
+
+    while (len > 0)
+    {
+      size_t frameLen = ioig::Packet::getFrameLength(buf, len);
+      if (frameLen > len)
+      {
+        return -1; //cut frame
+      }
+
+      ioig::Packet rsp;
+      rsp.setFrame(buf, frameLen);
+      rsp.setStatus(ioig::Packet::Status::RSP);
+
+      uint8_t frame[ioig::Packet::MAX_FRAME_SIZE];
+      _engine->onReceive(frame, rsp.writeFrame(frame));
+      buf += frameLen;
+      len -= frameLen;
+    }
+    return 0;
+  }
+
+  unsigned drops = 0;
+
+private:
+  ioig::TransferEngine *_engine = nullptr;
+};
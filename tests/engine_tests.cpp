@@ -0,0 +1,342 @@
+#include <gtest/gtest.h>
+#include <memory.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ioig.h"
+#include "ioig_engine.h"
+
+using namespace ioig;
+
+
+/**
+ * Echoes the requests from its own thread, like a device answering later,
+ * and drops the first write of the packets whose first payload byte is in `drops`.
+ * A write can carry several frames. In `hold` mode nothing is answered,
+ * the frames are kept in `held`; frames flagged FLAG_NO_RESPONSE go to `unanswered`.
+ */
+class DeviceLink : public TransferEngine::Link
+{
+public:
+  int start(TransferEngine &engine) override
+  {
+    _engine = &engine;
+    _running = true;
+    _thread = std::thread(&DeviceLink::run, this);
+    return 0;
+  }
+
+  void stop() override
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _running = false;
+      _cv.notify_all();
+    }
+    _thread.join();
+  }
+
+  uint8_t getProtocol() const override { return protocol; }
+
+  int write(const uint8_t *buf, size_t len, unsigned) override
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    maxWriteLength = std::max(maxWriteLength, len);
+
+    while (len > 0)
+    {
+      size_t frameLen = Packet::getFrameLength(buf, len);
+      Packet pkt;
+      pkt.setFrame(buf, frameLen);
+
+      if (pkt.getFlags() & Packet::FLAG_NO_RESPONSE)
+      {
+        unanswered.push_back(pkt);
+      }
+      else if (hold)
+      {
+        held.push_back(pkt);
+      }
+      else if (!drop(pkt.getPayloadItem8(0)))
+      {
+        _queue.push_back(pkt);
+      }
+      buf += frameLen;
+      len -= frameLen;
+    }
+
+    maxOutstanding = std::max(maxOutstanding, (unsigned)_queue.size());
+    _cv.notify_all();
+    return 0;
+  }
+
+  uint8_t protocol = Packet::PROTOCOL_V1;
+  bool hold = false;
+  std::vector<uint8_t> drops;
+  std::vector<Packet> held;
+  std::vector<Packet> unanswered;
+  unsigned maxOutstanding = 0;
+  size_t maxWriteLength = 0;
+
+private:
+  bool drop(uint8_t key)
+  {
+    for (auto it = drops.begin(); it != drops.end(); ++it)
+    {
+      if (*it == key)
+      {
+        drops.erase(it);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run()
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (_running)
+    {
+      //let the window fill up before answering
+      _cv.wait_for(lock, std::chrono::milliseconds(1));
+      if (_queue.empty())
+      {
+        continue;
+      }
+
+      Packet rsp = _queue.front();
+      _queue.pop_front();
+      rsp.setStatus(Packet::Status::RSP);
+
+      uint8_t frame[Packet::MAX_FRAME_SIZE];
+      size_t frameLen = rsp.writeFrame(frame);
+
+      lock.unlock();
+      _engine->onReceive(frame, frameLen);
+      lock.lock();
+    }
+  }
+
+  TransferEngine *_engine = nullptr;
+  std::thread _thread;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<Packet> _queue;
+  bool _running = false;
+};
+
+
+TEST(EngineTestSuite, WindowedTransfer)
+{
+  DeviceLink link;
+  TransferEngine engine(link);
+  engine.start();
+
+  constexpr size_t COUNT = 40;
+  std::vector<Packet> tx(COUNT);
+  std::vector<Packet> rx(COUNT);
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    tx[i].setType(Packet::Type::XFER_DATA);
+    tx[i].addPayloadItem8(i);
+  }
+
+  //two packets lost, resent after their timeout while the others go on
+  link.drops = {3, 17};
+
+  EXPECT_EQ(engine.transfer(tx.data(), rx.data(), COUNT, 50), 0);
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    EXPECT_EQ(rx[i].getStatus(), Packet::Status::RSP);
+    EXPECT_EQ(rx[i].getPayloadItem8(0), (int)i) << "response " << i;
+  }
+
+  EXPECT_LE(link.maxOutstanding, engine.getWindow());
+  EXPECT_GT(link.maxOutstanding, 1u);
+
+  //the first window goes out in one write
+  EXPECT_EQ(link.maxWriteLength, engine.getWindow() * tx[0].getBufferLength());
+
+  auto stats = engine.getStats().get(Packet::Type::XFER_DATA);
+  EXPECT_EQ(stats.count, COUNT);
+  EXPECT_EQ(stats.retries, 2u);
+  EXPECT_EQ(stats.failures, 0u);
+
+  //every attempt of a packet lost
+  link.drops = {5, 5};
+  EXPECT_NE(engine.transfer(tx.data(), rx.data(), 8, 20, 2), 0);
+  EXPECT_EQ(engine.getStats().get(Packet::Type::XFER_DATA).failures, 1u);
+
+  //the engine is usable afterwards, no slot leaked
+  Packet one, rsp;
+  one.setType(Packet::Type::GPIO_GET_VALUE);
+  one.addPayloadItem8(1);
+  for (unsigned i = 0; i < 2 * engine.getWindow(); i++)
+  {
+    EXPECT_EQ(engine.transfer(one, rsp, 100), 0);
+  }
+
+  engine.stop();
+}
+
+TEST(EngineTestSuite, AsyncTransfer)
+{
+  DeviceLink link;
+  TransferEngine engine(link);
+  engine.start();
+
+  constexpr size_t COUNT = 40;
+  std::vector<Packet> tx(COUNT);
+  std::vector<Packet> rx(COUNT);
+  std::vector<int> results(COUNT, 1);
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t done = 0;
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    tx[i].setType(Packet::Type::XFER_DATA);
+    tx[i].addPayloadItem8(i);
+  }
+
+  //lost packets are not resent, they time out
+  link.drops = {7, 30};
+
+  //more requests than the window, the rest waits in the backlog
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    engine.transferAsync(tx[i], rx[i], 50, [&, i](int ret) {
+      std::lock_guard<std::mutex> lock(mutex);
+      results[i] = ret;
+      done++;
+      cv.notify_all();
+    });
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    EXPECT_TRUE(cv.wait_for(lock, std::chrono::seconds(5), [&] { return done == COUNT; }));
+  }
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    if (i == 7 || i == 30)
+    {
+      EXPECT_EQ(results[i], -1) << "request " << i;
+      continue;
+    }
+    EXPECT_EQ(results[i], 0) << "request " << i;
+    EXPECT_EQ(rx[i].getPayloadItem8(0), (int)i) << "response " << i;
+  }
+
+  EXPECT_LE(link.maxOutstanding, engine.getWindow());
+
+  auto stats = engine.getStats().get(Packet::Type::XFER_DATA);
+  EXPECT_EQ(stats.count, COUNT - 2);
+  EXPECT_EQ(stats.failures, 2u);
+  EXPECT_EQ(stats.retries, 0u);
+
+  //blocking and async callers share the window
+  Packet one, rsp;
+  one.setType(Packet::Type::GPIO_GET_VALUE);
+  one.addPayloadItem8(1);
+  EXPECT_EQ(engine.transfer(one, rsp, 100), 0);
+
+  //pending requests fail when the engine stops
+  link.drops = {3};
+  int stopped = 1;
+  engine.transferAsync(tx[3], rx[3], 0, [&](int ret) { stopped = ret; });
+  engine.stop();
+  EXPECT_EQ(stopped, -1);
+}
+
+TEST(EngineTestSuite, RequestIdsV2)
+{
+  DeviceLink link;
+  link.protocol = Packet::PROTOCOL_V2;
+  link.hold = true;
+  TransferEngine engine(link);
+  engine.start();
+  EXPECT_EQ(engine.getProtocol(), Packet::PROTOCOL_V2);
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t done = 0;
+
+  //a full round of ids, none answered in time
+  constexpr size_t COUNT = 256;
+  std::vector<Packet> tx(COUNT + 1);
+  std::vector<Packet> rx(COUNT + 1);
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    tx[i].setType(Packet::Type::XFER_DATA);
+    tx[i].addPayloadItem8(i);
+    engine.transferAsync(tx[i], rx[i], 1, [&](int ret) {
+      EXPECT_EQ(ret, -1);
+      std::lock_guard<std::mutex> lock(mutex);
+      done++;
+      cv.notify_all();
+    });
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    EXPECT_TRUE(cv.wait_for(lock, std::chrono::seconds(5), [&] { return done == COUNT; }));
+  }
+
+  //the next request reuses the slot of the first one, with another id
+  int result = 1;
+  tx[COUNT].setType(Packet::Type::XFER_DATA);
+  tx[COUNT].addPayloadItem8(0xAA);
+  engine.transferAsync(tx[COUNT], rx[COUNT], 1000, [&](int ret) {
+    std::lock_guard<std::mutex> lock(mutex);
+    result = ret;
+    cv.notify_all();
+  });
+
+  ASSERT_EQ(link.held.size(), COUNT + 1);
+  Packet late = link.held[0];
+  Packet current = link.held[COUNT];
+  EXPECT_EQ(late.getRequestId(), 0);
+  EXPECT_EQ(current.getRequestId(), COUNT);
+
+  //the late response of the first request is not taken for the new one
+  uint8_t frame[Packet::MAX_FRAME_SIZE];
+  late.setStatus(Packet::Status::RSP);
+  engine.onReceive(frame, late.writeFrame(frame));
+  EXPECT_EQ(engine.getStats().get(Packet::Type::XFER_DATA).seqMismatches, 1u);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(result, 1);
+  }
+
+  current.setStatus(Packet::Status::RSP);
+  engine.onReceive(frame, current.writeFrame(frame));
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    EXPECT_TRUE(cv.wait_for(lock, std::chrono::seconds(1), [&] { return result != 1; }));
+    EXPECT_EQ(result, 0);
+  }
+  EXPECT_EQ(rx[COUNT].getPayloadItem8(0), 0xAA);
+
+  //no response asked, nothing waited for
+  Packet one;
+  one.setType(Packet::Type::GPIO_SET_VALUE);
+  one.addPayloadItem8(1);
+  EXPECT_EQ(engine.send(one, 100), 0);
+  ASSERT_EQ(link.unanswered.size(), 1u);
+  EXPECT_EQ(link.unanswered[0].getType(), Packet::Type::GPIO_SET_VALUE);
+  EXPECT_EQ(link.unanswered[0].getRequestId(), COUNT + 1);
+
+  engine.stop();
+}
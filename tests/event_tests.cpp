@@ -0,0 +1,511 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <string>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+#include "ioig.h"
+#include "ioig_usb.h"
+
+using namespace ioig;
+
+
+class NullTransport : public Transport
+{
+public:
+  explicit NullTransport(uint8_t protocol = Packet::PROTOCOL_VERSION) : _protocol(protocol) {}
+
+  int start(TransferEngine &) override { return 0; }
+  void stop() override {}
+  int write(const uint8_t *, size_t, unsigned) override { return 0; }
+  uint8_t getProtocol() const override { return _protocol; }
+
+private:
+  uint8_t _protocol;
+};
+
+class RecordingHandler : public EventHandler
+{
+public:
+  void onEvent(const Event &evt) override
+  {
+    ids.push_back(evt.key.id);
+    flags.push_back(evt.flags);
+    timestamps.push_back(evt.timestamp);
+    if (evt.data != nullptr)
+    {
+      data.append((const char *)evt.data, evt.len);
+    }
+  }
+
+  std::vector<unsigned> ids;
+  std::vector<uint32_t> flags;
+  std::vector<uint32_t> timestamps;
+  std::string data;
+};
+
+static UsbDevice &makeDevice()
+{
+  static UsbDevice dev(0);
+  static bool attached = false;
+  if (!attached)
+  {
+    dev.attachTransport(std::unique_ptr<Transport>(new NullTransport()));
+    attached = true;
+  }
+  return dev;
+}
+
+
+TEST(EventRoutingTestSuite, GpioEventsReachOnlyTheirPin)
+{
+  UsbDevice &dev = makeDevice();
+  RecordingHandler pin3, pin5;
+
+  dev.registerEventHandler(&pin3, {Packet::Type::GPIO_EVENT, 3});
+  dev.registerEventHandler(&pin5, {Packet::Type::GPIO_EVENT, 5});
+
+  Packet evtPkt;
+  evtPkt.setType(Packet::Type::GPIO_EVENT);
+  evtPkt.addPayloadItem8(3);
+  evtPkt.addPayloadItem32((3 << 16) | 0x4);
+  evtPkt.addPayloadItem32(1000);
+  evtPkt.addPayloadItem32((7 << 16) | 0x8); //no subscriber
+  evtPkt.addPayloadItem32(1500);
+  evtPkt.addPayloadItem32((3 << 16) | 0x8);
+  evtPkt.addPayloadItem32(0xFFFFFFF0); //device time of the irq, any value
+
+  dev.dispatchEvent(evtPkt);
+
+  ASSERT_EQ(pin3.ids.size(), 2u);
+  EXPECT_EQ(pin3.ids[0], 3u);
+  EXPECT_EQ(pin3.flags[0], 0x4u);
+  EXPECT_EQ(pin3.flags[1], 0x8u);
+  EXPECT_EQ(pin3.timestamps[0], 1000u);
+  EXPECT_EQ(pin3.timestamps[1], 0xFFFFFFF0u);
+  EXPECT_TRUE(pin5.ids.empty());
+
+  dev.removeEventHandler(&pin3);
+  dev.removeEventHandler(&pin5);
+
+  dev.dispatchEvent(evtPkt);
+  EXPECT_EQ(pin3.ids.size(), 2u);
+}
+
+TEST(EventRoutingTestSuite, GpioEventsOfV1Session)
+{
+  UsbDevice dev(5);
+  dev.attachTransport(std::unique_ptr<Transport>(new NullTransport(Packet::PROTOCOL_V1)));
+  RecordingHandler pin3;
+
+  dev.registerEventHandler(&pin3, {Packet::Type::GPIO_EVENT, 3});
+
+  //no timestamp in the entries
+  Packet evtPkt;
+  evtPkt.setType(Packet::Type::GPIO_EVENT);
+  evtPkt.addPayloadItem8(2);
+  evtPkt.addPayloadItem32((3 << 16) | 0x4);
+  evtPkt.addPayloadItem32((3 << 16) | 0x8);
+
+  dev.dispatchEvent(evtPkt);
+
+  ASSERT_EQ(pin3.ids.size(), 2u);
+  EXPECT_EQ(pin3.flags[0], 0x4u);
+  EXPECT_EQ(pin3.flags[1], 0x8u);
+  EXPECT_EQ(pin3.timestamps[0], 0u);
+  EXPECT_EQ(pin3.timestamps[1], 0u);
+
+  dev.removeEventHandler(&pin3);
+}
+
+TEST(EventRoutingTestSuite, SerialEventsRoutedByInstance)
+{
+  UsbDevice &dev = makeDevice();
+  RecordingHandler uart0, uart1, pin1;
+
+  dev.registerEventHandler(&uart0, {Packet::Type::SERIAL_EVENT, 0});
+  dev.registerEventHandler(&uart1, {Packet::Type::SERIAL_EVENT, 1});
+  dev.registerEventHandler(&pin1, {Packet::Type::GPIO_EVENT, 1});
+
+  Packet evtPkt;
+  evtPkt.setType(Packet::Type::SERIAL_EVENT);
+  evtPkt.addPayloadItem8(1);
+  evtPkt.addPayloadItem8(3);
+  evtPkt.addPayloadBuffer((const uint8_t *)"abc", 3);
+
+  dev.dispatchEvent(evtPkt);
+
+  EXPECT_EQ(uart1.data, "abc");
+  EXPECT_TRUE(uart0.ids.empty());
+  EXPECT_TRUE(pin1.ids.empty());
+
+  dev.removeEventHandler(&uart0);
+  dev.removeEventHandler(&uart1);
+  dev.removeEventHandler(&pin1);
+}
+
+
+//entries of a v2 session that fit a packet
+static constexpr unsigned GPIO_EVENTS_PER_PACKET =
+    (Packet::MAX_SIZE - Packet::Header::SIZE - 1) / EventRecord::GPIO_ENTRY_SIZE_V2;
+
+static void addGpioEvents(Packet &evtPkt, uint8_t pin, unsigned count)
+{
+  evtPkt.reset();
+  evtPkt.setType(Packet::Type::GPIO_EVENT);
+  evtPkt.addPayloadItem8(count);
+  for (unsigned i = 0; i < count; i++)
+  {
+    evtPkt.addPayloadItem32((pin << 16) | 0x4);
+    evtPkt.addPayloadItem32(i);
+  }
+}
+
+TEST(EventRoutingTestSuite, RingWrapsAround)
+{
+  EventRing ring(5);
+  EXPECT_EQ(ring.capacity(), 8u);
+
+  EventRecord in = {}, out = {};
+  for (uint32_t i = 0; i < 20; i++)
+  {
+    in.timestamp = i;
+    EXPECT_TRUE(ring.push(in));
+    EXPECT_TRUE(ring.pop(out));
+    EXPECT_EQ(out.timestamp, i);
+  }
+  EXPECT_FALSE(ring.pop(out));
+
+  for (unsigned i = 0; i < ring.capacity(); i++)
+  {
+    EXPECT_TRUE(ring.push(in));
+  }
+  EXPECT_FALSE(ring.push(in));
+  EXPECT_EQ(ring.size(), ring.capacity());
+}
+
+TEST(EventRoutingTestSuite, RingKeepsSerialBytesInOrder)
+{
+  EventRing ring(8, 10);
+  EXPECT_EQ(ring.dataCapacity(), 16u);
+  EXPECT_EQ(sizeof(EventRecord), 8u);
+
+  EventRecord in = {}, out = {};
+  in.type = static_cast<uint8_t>(Packet::Type::SERIAL_EVENT);
+  uint8_t bytes[EventRecord::MAX_DATA];
+
+  //5 byte records wrap around the byte ring
+  for (unsigned i = 0; i < 10; i++)
+  {
+    in.len = 5;
+    EXPECT_TRUE(ring.push(in, (const uint8_t *)"abcde"));
+    in.len = 6;
+    EXPECT_TRUE(ring.push(in, (const uint8_t *)"012345"));
+    EXPECT_FALSE(ring.push(in, (const uint8_t *)"012345")); //no room for the bytes
+
+    EXPECT_TRUE(ring.pop(out, bytes));
+    EXPECT_EQ(std::string((const char *)bytes, out.len), "abcde");
+    EXPECT_TRUE(ring.pop(out, bytes));
+    EXPECT_EQ(std::string((const char *)bytes, out.len), "012345");
+  }
+  EXPECT_TRUE(ring.empty());
+}
+
+TEST(EventRoutingTestSuite, ManualExecutorRunsCallbacksOnCaller)
+{
+  UsbDevice dev(1);
+  dev.attachTransport(std::unique_ptr<Transport>(new NullTransport()));
+
+  auto executor = std::make_shared<ManualExecutor>();
+  dev.setEventExecutor(executor);
+
+  RecordingHandler pin4;
+  dev.registerEventHandler(&pin4, {Packet::Type::GPIO_EVENT, 4});
+
+  //fills the queue, nobody runs the callbacks meanwhile
+  Packet evtPkt;
+  unsigned sent = 0;
+  while (sent < 1100)
+  {
+    addGpioEvents(evtPkt, 4, GPIO_EVENTS_PER_PACKET);
+    dev.queueEvents(evtPkt);
+    sent += GPIO_EVENTS_PER_PACKET;
+  }
+  EXPECT_TRUE(pin4.ids.empty());
+
+  auto stats = dev.getEventStats();
+  EXPECT_EQ(stats.queued + stats.dropped, sent);
+  EXPECT_GT(stats.dropped, 0u);
+  EXPECT_EQ(pin4.getDroppedEvents(), stats.dropped);
+  EXPECT_EQ(stats.maxDepth, stats.queued);
+
+  //a single task per burst, it drains everything
+  EXPECT_EQ(executor->run(), 1u);
+  EXPECT_EQ(pin4.ids.size(), stats.queued);
+  EXPECT_EQ(dev.getEventStats().dispatched, stats.queued);
+  EXPECT_EQ(executor->run(), 0u);
+
+  dev.removeEventHandler(&pin4);
+}
+
+TEST(EventRoutingTestSuite, SlowHandlerDoesntStallReader)
+{
+  UsbDevice dev(2);
+  dev.attachTransport(std::unique_ptr<Transport>(new NullTransport()));
+
+  class SlowHandler : public EventHandler
+  {
+  public:
+    void onEvent(const Event &) override
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      count++;
+    }
+    std::atomic<unsigned> count{0};
+  } slow;
+
+  dev.setEventExecutor(std::make_shared<ThreadPoolExecutor>(1));
+  dev.registerEventHandler(&slow, {Packet::Type::GPIO_EVENT, 2});
+
+  Packet evtPkt;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < 4; i++)
+  {
+    addGpioEvents(evtPkt, 2, 1);
+    dev.queueEvents(evtPkt);
+  }
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+
+  for (int i = 0; i < 100 && slow.count < 4; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(slow.count, 4u);
+  EXPECT_EQ(dev.getEventStats().dropped, 0u);
+
+  dev.removeEventHandler(&slow);
+}
+
+TEST(EventRoutingTestSuite, RemoveWaitsForRunningCallback)
+{
+  UsbDevice dev(6);
+  dev.attachTransport(std::unique_ptr<Transport>(new NullTransport()));
+
+  class BusyHandler : public EventHandler
+  {
+  public:
+    void onEvent(const Event &) override
+    {
+      entered = true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      returned = true;
+    }
+    std::atomic_bool entered{false};
+    std::atomic_bool returned{false};
+  } busy;
+
+  dev.setEventExecutor(std::make_shared<ThreadPoolExecutor>(1));
+  dev.registerEventHandler(&busy, {Packet::Type::GPIO_EVENT, 6});
+
+  Packet evtPkt;
+  addGpioEvents(evtPkt, 6, 1);
+  dev.queueEvents(evtPkt);
+
+  for (int i = 0; i < 100 && !busy.entered; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  ASSERT_TRUE(busy.entered);
+
+  //the callback is still running on the executor thread: busy can't be freed before it returns
+  dev.removeEventHandler(&busy);
+  EXPECT_TRUE(busy.returned);
+}
+
+TEST(EventRoutingTestSuite, HandlerRemovesItselfFromCallback)
+{
+  UsbDevice dev(7);
+  dev.attachTransport(std::unique_ptr<Transport>(new NullTransport()));
+
+  class OneShotHandler : public EventHandler
+  {
+  public:
+    explicit OneShotHandler(UsbDevice &dev) : _dev(dev) {}
+    void onEvent(const Event &) override
+    {
+      count++;
+      _dev.removeEventHandler(this);
+    }
+    std::atomic<unsigned> count{0};
+
+  private:
+    UsbDevice &_dev;
+  } oneShot(dev);
+
+  //on the caller's thread
+  dev.registerEventHandler(&oneShot, {Packet::Type::GPIO_EVENT, 7});
+  Packet evtPkt;
+  addGpioEvents(evtPkt, 7, 2);
+  dev.dispatchEvent(evtPkt);
+  EXPECT_EQ(oneShot.count, 1u);
+
+  //on an executor thread
+  dev.setEventExecutor(std::make_shared<ThreadPoolExecutor>(1));
+  dev.registerEventHandler(&oneShot, {Packet::Type::GPIO_EVENT, 7});
+  addGpioEvents(evtPkt, 7, 2);
+  dev.queueEvents(evtPkt);
+
+  for (int i = 0; i < 100 && oneShot.count < 2; i++)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(oneShot.count, 2u);
+}
+
+TEST(EventRoutingTestSuite, PullModeReturnsRecords)
+{
+  UsbDevice dev(4);
+  dev.attachTransport(std::unique_ptr<Transport>(new NullTransport()));
+
+  //the handler enables the events, it is not called in pull mode
+  RecordingHandler pin5;
+  dev.registerEventHandler(&pin5, {Packet::Type::GPIO_EVENT, 5});
+
+  EventRecord records[16];
+  EXPECT_EQ(dev.pollEvents(records, 16), 0u);
+
+  Packet evtPkt;
+  addGpioEvents(evtPkt, 5, 6);
+  dev.queueEvents(evtPkt);
+
+  //no handler needed for pulled events
+  evtPkt.reset();
+  evtPkt.setType(Packet::Type::SERIAL_EVENT);
+  evtPkt.addPayloadItem8(1);
+  evtPkt.addPayloadItem8(3);
+  evtPkt.addPayloadBuffer((const uint8_t *)"abc", 3);
+  dev.queueEvents(evtPkt);
+
+  //the SERIAL bytes need room in data
+  uint8_t data[8];
+  EXPECT_EQ(dev.pollEvents(records, 4), 4u);
+  EXPECT_EQ(dev.pollEvents(records + 4, 16, data + 1, 2), 2u);
+  EXPECT_EQ(dev.pollEvents(records + 6, 16, data + 1, 2), 0u);
+  EXPECT_EQ(dev.pollEvents(records + 6, 16, data + 1, 3), 1u);
+  EXPECT_EQ(dev.pollEvents(records, 16, data, sizeof(data)), 0u);
+
+  for (uint32_t i = 0; i < 6; i++)
+  {
+    EXPECT_EQ(records[i].key().type, Packet::Type::GPIO_EVENT);
+    EXPECT_EQ(records[i].id, 5);
+    EXPECT_EQ(records[i].flags, 0x4u);
+    EXPECT_EQ(records[i].timestamp, i);
+  }
+
+  EXPECT_EQ(records[6].key().type, Packet::Type::SERIAL_EVENT);
+  EXPECT_EQ(records[6].id, 1);
+  EXPECT_EQ(records[6].offset, 0u);
+  EXPECT_EQ(std::string((const char *)data + 1 + records[6].offset, records[6].len), "abc");
+
+  EXPECT_TRUE(pin5.ids.empty());
+  EXPECT_EQ(dev.getEventStats().dispatched, 7u);
+
+  dev.removeEventHandler(&pin5);
+}
+
+TEST(EventRoutingTestSuite, PullWithoutDataDropsSerialBytes)
+{
+  UsbDevice dev(8);
+  dev.attachTransport(std::unique_ptr<Transport>(new NullTransport()));
+
+  EventRecord records[16];
+  EXPECT_EQ(dev.pollEvents(records, 16), 0u);
+
+  Packet evtPkt;
+  evtPkt.setType(Packet::Type::SERIAL_EVENT);
+  evtPkt.addPayloadItem8(0);
+  evtPkt.addPayloadItem8(3);
+  evtPkt.addPayloadBuffer((const uint8_t *)"abc", 3);
+  dev.queueEvents(evtPkt);
+
+  addGpioEvents(evtPkt, 8, 2);
+  dev.queueEvents(evtPkt);
+
+  //the UART event doesn't hold back the GPIO events queued after it
+  ASSERT_EQ(dev.pollEvents(records, 16), 3u);
+  EXPECT_EQ(records[0].key().type, Packet::Type::SERIAL_EVENT);
+  EXPECT_EQ(records[0].id, 0);
+  EXPECT_EQ(records[0].len, 0u);
+  for (uint32_t i = 1; i < 3; i++)
+  {
+    EXPECT_EQ(records[i].key().type, Packet::Type::GPIO_EVENT);
+    EXPECT_EQ(records[i].id, 8);
+    EXPECT_EQ(records[i].timestamp, i - 1);
+  }
+
+  //the dropped bytes free their room in the queue
+  evtPkt.reset();
+  evtPkt.setType(Packet::Type::SERIAL_EVENT);
+  evtPkt.addPayloadItem8(0);
+  evtPkt.addPayloadItem8(2);
+  evtPkt.addPayloadBuffer((const uint8_t *)"de", 2);
+  dev.queueEvents(evtPkt);
+
+  uint8_t data[4];
+  ASSERT_EQ(dev.pollEvents(records, 16, data, sizeof(data)), 1u);
+  EXPECT_EQ(std::string((const char *)data + records[0].offset, records[0].len), "de");
+}
+
+#ifndef _WIN32
+static bool readable(int fd)
+{
+  struct pollfd pfd = {fd, POLLIN, 0};
+  return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
+TEST(EventRoutingTestSuite, EventFdDrainedFromCallerLoop)
+{
+  UsbDevice dev(3);
+  dev.attachTransport(std::unique_ptr<Transport>(new NullTransport()));
+
+  RecordingHandler pin7;
+  dev.registerEventHandler(&pin7, {Packet::Type::GPIO_EVENT, 7});
+
+  int fd = dev.getEventFd();
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(dev.getEventFd(), fd);
+  EXPECT_FALSE(readable(fd));
+  EXPECT_EQ(dev.drainEvents(), 0u);
+
+  Packet evtPkt;
+  addGpioEvents(evtPkt, 7, 3);
+  dev.queueEvents(evtPkt);
+  addGpioEvents(evtPkt, 7, 2);
+  dev.queueEvents(evtPkt);
+
+  EXPECT_TRUE(readable(fd));
+  EXPECT_TRUE(pin7.ids.empty());
+
+  EXPECT_EQ(dev.drainEvents(), 1u);
+  EXPECT_EQ(pin7.ids.size(), 5u);
+  EXPECT_FALSE(readable(fd));
+
+  //readable again for the next burst
+  addGpioEvents(evtPkt, 7, 1);
+  dev.queueEvents(evtPkt);
+  EXPECT_TRUE(readable(fd));
+  EXPECT_EQ(dev.drainEvents(), 1u);
+  EXPECT_EQ(pin7.ids.size(), 6u);
+
+  //another executor, drainEvents() has nothing left to run
+  dev.setEventExecutor(std::make_shared<ManualExecutor>());
+  EXPECT_EQ(dev.drainEvents(), 0u);
+
+  dev.removeEventHandler(&pin7);
+}
+#endif
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include <chrono>
+
+#include "ioig.h"
+#include "ioig_engine.h"
+#include "loopback_transport.h"
+
+using namespace ioig;
+
+
+/**
+ * Opens the simulated device, then runs a command through an engine on it.
+ */
+static void checkSession(LoopbackTransport &transport)
+{
+  TransferEngine engine(transport);
+  ASSERT_EQ(engine.start(), 0);
+
+  Packet txPkt, rxPkt;
+  txPkt.setType(Packet::Type::GPIO_GET_VALUE);
+  txPkt.addPayloadItem8(GP10);
+
+  EXPECT_EQ(engine.transfer(txPkt, rxPkt, 600), 0);
+  EXPECT_EQ(rxPkt.getType(), Packet::Type::GPIO_GET_VALUE);
+  EXPECT_EQ(rxPkt.getStatus(), Packet::Status::RSP);
+  EXPECT_EQ(rxPkt.getProtocol(), transport.getProtocol());
+
+  engine.stop();
+}
+
+
+TEST(HandshakeTestSuite, BaselineFirmware)
+{
+  //SYS_INIT answered at once with an empty payload: SYS_SW_RESET and the fixed delay instead
+  LoopbackTransport::setBaselineHandshake(true);
+
+  LoopbackTransport transport;
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_EQ(transport.open(), 0);
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(50));
+  EXPECT_EQ(transport.getProtocol(), Packet::PROTOCOL_V1);
+
+  checkSession(transport);
+  transport.close();
+
+  LoopbackTransport::setBaselineHandshake(false);
+}
+
+TEST(HandshakeTestSuite, CurrentFirmware)
+{
+  LoopbackTransport transport;
+  ASSERT_EQ(transport.open(), 0);
+  EXPECT_EQ(transport.getProtocol(), Packet::PROTOCOL_VERSION);
+
+  checkSession(transport);
+  transport.close();
+}
@@ -12,11 +12,20 @@
 #include <random>
 #include <functional>
 #include <list>
+#include <vector>
+#include <fstream>
 
 #include "ioig.h"
 #include <gtest/gtest.h>
 #include <cstdint>
 
+#ifdef IOIG_FW_SIM
+#include "ioig_usb.h"
+#include "ioig_capture.h"
+#include "ioig_trace.h"
+#include "loopback_transport.h"
+#endif
+
 using namespace ioig;
 using namespace std::chrono_literals;
 
@@ -367,12 +376,303 @@ TEST(IoIgTests, Gpio_TestBench)
     test.run();
 }
 
+TEST(IoIgTests, Gpio_EventTimestamps) 
+{
+    if (UsbManager::getProtocol(USB_PORT) < Packet::PROTOCOL_V2)
+    {
+        GTEST_SKIP() << "no device timestamps before a v2 session";
+    }
+
+    ioig::Gpio driver(GP10);
+    ioig::Gpio echo(GP11);
+    driver.output();
+    driver = 0;
+    echo.input();
+    echo.mode(PullNone);
+
+    std::mutex mutex;
+    std::vector<uint32_t> timestamps;
+    echo.setInterrupt(RiseEdge | FallEdge, [&](const int, const uint32_t, const uint32_t timestamp_us, void *)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        timestamps.push_back(timestamp_us);
+    });
+
+    //the pulse width is at least the host sleep, whatever the USB latency
+    constexpr unsigned PULSES = 5;
+    constexpr uint32_t WIDTH_US = 5000;
+    for (unsigned i = 0; i < PULSES; i++)
+    {
+        driver = 1;
+        WAIT_MS(WIDTH_US / 1000);
+        driver = 0;
+        WAIT_MS(WIDTH_US / 1000);
+    }
+    WAIT_MS(100);
+    echo.disableInterrupt();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ASSERT_EQ(timestamps.size(), 2 * PULSES);
+    for (unsigned i = 1; i < timestamps.size(); i++)
+    {
+        uint32_t interval = timestamps[i] - timestamps[i - 1];
+        EXPECT_GE(interval, WIDTH_US) << "edge " << i;
+        EXPECT_LT(interval, 4 * WIDTH_US) << "edge " << i;
+    }
+}
+
+#ifdef IOIG_FW_SIM
+TEST(IoIgTests, Gpio_Capture) 
+{
+    ioig::Gpio driver(GP10);
+    ioig::Gpio echo(GP11);
+    driver.output();
+    driver = 0;
+    echo.input();
+    echo.mode(PullNone);
+    echo.setInterrupt(RiseEdge | FallEdge, [](const int, const uint32_t, const uint32_t, void *) {});
+
+    std::string path = ::testing::TempDir() + "ioig_tests_capture.bin";
+    ASSERT_EQ(UsbManager::startCapture(path, USB_PORT), 0);
+
+    constexpr unsigned PULSES = 3;
+    for (unsigned i = 0; i < PULSES; i++)
+    {
+        driver = 1;
+        EXPECT_EQ(echo.read(), 1);
+        driver = 0;
+        EXPECT_EQ(echo.read(), 0);
+    }
+    WAIT_MS(50);
+    UsbManager::stopCapture(USB_PORT);
+    echo.disableInterrupt();
+
+    CaptureReader reader;
+    ASSERT_EQ(reader.open(path), 0);
+
+    CaptureRecord rec;
+    unsigned txCount = 0, rxCount = 0, evtCount = 0;
+    uint64_t lastTs[3] = {0, 0, 0};
+    while (reader.next(rec))
+    {
+        //ordered per recording thread only, here one per direction
+        unsigned dir = static_cast<unsigned>(rec.direction);
+        ASSERT_LT(dir, 3u);
+        EXPECT_GE(rec.timestampNs, lastTs[dir]);
+        lastTs[dir] = rec.timestampNs;
+
+        switch (rec.direction)
+        {
+        case CaptureRecord::Direction::TX: txCount++; break;
+        case CaptureRecord::Direction::RX: rxCount++; break;
+        case CaptureRecord::Direction::EVENT:
+            EXPECT_EQ(Packet::getFrameType(rec.frame), Packet::Type::GPIO_EVENT);
+            evtCount++;
+            break;
+        }
+    }
+
+    //a write and a read per level
+    EXPECT_EQ(txCount, 4 * PULSES);
+    EXPECT_EQ(rxCount, txCount);
+    EXPECT_GT(evtCount, 0u);
+
+    std::remove(path.c_str());
+}
+
+TEST(IoIgTests, Gpio_Trace) 
+{
+    ioig::Gpio driver(GP10);
+    ioig::Gpio echo(GP11);
+    driver.output();
+    driver = 0;
+    echo.input();
+    echo.mode(PullNone);
+
+    std::atomic<unsigned> callbacks(0);
+    echo.setInterrupt(RiseEdge | FallEdge, [](const int, const uint32_t, const uint32_t, void *arg) {
+        (*static_cast<std::atomic<unsigned> *>(arg))++;
+    }, &callbacks);
+
+    std::string path = ::testing::TempDir() + "ioig_tests_trace.json";
+    ASSERT_EQ(UsbManager::startTrace(path), 0);
+
+    constexpr unsigned PULSES = 3;
+    for (unsigned i = 0; i < PULSES; i++)
+    {
+        driver = 1;
+        driver = 0;
+    }
+    WAIT_MS(50);
+    UsbManager::stopTrace();
+    echo.disableInterrupt();
+
+    std::ifstream in(path);
+    std::string line;
+    unsigned transfers = 0, events = 0, spans = 0;
+    while (std::getline(in, line))
+    {
+        if (line.find("\"name\":\"transfer\"") != std::string::npos)
+        {
+            EXPECT_NE(line.find("\"port\":" + std::to_string(USB_PORT)), std::string::npos);
+            EXPECT_NE(line.find("\"type\":" + std::to_string((int)Packet::Type::GPIO_SET_VALUE)), std::string::npos);
+            EXPECT_NE(line.find("\"retries\":0"), std::string::npos);
+            transfers++;
+        }
+        events += line.find("\"name\":\"gpio event\"") != std::string::npos;
+        spans += line.find("\"name\":\"gpio callback\"") != std::string::npos;
+    }
+
+    EXPECT_EQ(transfers, 2 * PULSES);
+    EXPECT_GT(events, 0u);
+    EXPECT_EQ(spans, events);
+    EXPECT_EQ(callbacks.load(), spans);
+    EXPECT_EQ(Tracer::getDropped(), 0u);
+
+    std::remove(path.c_str());
+}
+#endif
+
 TEST(IoIgTests, SPI_TestBench) 
 {
     SpiTestBench test;
     test.run();    
 }
 
+TEST(IoIgTests, SPI_LargeTransfer) 
+{
+    ioig::Spi spi(SPI0_PINOUT0);
+
+    //single packet limit, a staging buffer, and more than one
+    for (size_t len : {59, 1000, 4096 + 100})
+    {
+        std::vector<uint8_t> txBuf(len);
+        std::vector<uint8_t> rxBuf(len, 0);
+        for (auto &b : txBuf)
+        {
+            b = static_cast<uint8_t>(std::rand() % 256);
+        }
+
+        EXPECT_EQ(spi.transfer(txBuf.data(), rxBuf.data(), len), (int)len);
+        EXPECT_EQ(rxBuf, txBuf) << "SPI tx != rx , length = " << len;
+    }
+
+    std::vector<uint8_t> rxBuf(300, 0);
+    EXPECT_EQ(spi.transfer((uint8_t)0x5A, rxBuf.data(), rxBuf.size()), (int)rxBuf.size());
+    EXPECT_EQ(rxBuf, std::vector<uint8_t>(300, 0x5A));
+}
+
+TEST(IoIgTests, Async_Peripherals) 
+{
+    ioig::Spi spi(SPI0_PINOUT0);
+    ioig::Gpio driver(GP10);
+    ioig::Gpio echo(GP11);
+    ioig::I2C i2c(I2C1_PINOUT0, 100'000, I2C_1);
+    driver.output();
+    driver = 0;
+    echo.input();
+    echo.mode(PullNone);
+    i2c.setTimeout(50'000);
+
+    //more transfers in flight than the engine window
+    constexpr unsigned COUNT = 20;
+    constexpr unsigned LEN = 32;
+    std::vector<std::vector<uint8_t>> txBufs(COUNT, std::vector<uint8_t>(LEN));
+    std::vector<std::vector<uint8_t>> rxBufs(COUNT, std::vector<uint8_t>(LEN, 0));
+    std::vector<AsyncResult<int>> results;
+
+    for (unsigned i = 0; i < COUNT; i++)
+    {
+        for (auto &b : txBufs[i])
+        {
+            b = static_cast<uint8_t>(std::rand() % 256);
+        }
+        results.push_back(spi.transferAsync(txBufs[i].data(), rxBufs[i].data(), LEN));
+    }
+
+    for (unsigned i = 0; i < COUNT; i++)
+    {
+        EXPECT_EQ(results[i].get(), (int)LEN) << "transfer " << i;
+        EXPECT_EQ(rxBufs[i], txBufs[i]) << "SPI tx != rx , transfer " << i;
+    }
+
+    //continuations run from the completion path
+    std::atomic<int> chained(0);
+    uint8_t one = 0xA5, back = 0;
+    AsyncResult<int> last;
+    spi.transferAsync(&one, &back, 1).then([&](int ret)
+    {
+        chained = ret;
+        last.complete(back);
+    });
+    EXPECT_EQ(last.get(), 0xA5);
+    EXPECT_EQ(chained.load(), 1);
+
+    auto edge = echo.waitForEdge(RiseEdge);
+    WAIT_MS(20);
+    EXPECT_FALSE(edge.ready());
+    driver = 1;
+    EXPECT_EQ(edge.get().pin, GP11);
+    EXPECT_EQ(edge.get().events & RiseEdge, (uint32_t)RiseEdge);
+    EXPECT_EQ(echo.readAsync().get(), 1);
+
+    auto cancelled = echo.waitForEdge(FallEdge);
+    echo.disableInterrupt();
+    EXPECT_EQ(cancelled.get().events, 0u);
+    driver = 0;
+
+    //no device on the bus
+    uint8_t rx[4];
+    EXPECT_LT(i2c.readAsync(0x12, rx, sizeof(rx)).get(), 0);
+}
+
+TEST(IoIgTests, Async_Futures) 
+{
+    ioig::Spi spi(SPI0_PINOUT0);
+    ioig::I2C i2c(I2C1_PINOUT0, 100'000, I2C_1);
+    ioig::UART serial(UART1_PINOUT1, 115200, UART_1);
+    ioig::Gpio driver(GP10);
+    ioig::Gpio echo(GP11);
+    driver.output();
+    echo.input();
+    echo.mode(PullNone);
+    i2c.setTimeout(50'000);
+
+    //calls on several peripherals in flight together
+    uint8_t tx[16], rx[16] = {0}, i2cRx[2];
+    for (auto &b : tx)
+    {
+        b = static_cast<uint8_t>(std::rand() % 256);
+    }
+    const char text[] = "future";
+
+    std::future<int> spiDone = spi.transferAsync(tx, rx, sizeof(tx));
+    std::future<int> i2cDone = i2c.readAsync(0x12, i2cRx, sizeof(i2cRx));
+    std::future<int> uartDone = serial.writeAsync((const uint8_t *)text, sizeof(text));
+    std::future<int> gpioDone = driver.writeAsync(1);
+
+    EXPECT_EQ(spiDone.get(), (int)sizeof(tx));
+    EXPECT_EQ(memcmp(tx, rx, sizeof(tx)), 0);
+    EXPECT_LT(i2cDone.get(), 0); //no device on the bus
+    EXPECT_EQ(uartDone.get(), (int)sizeof(text));
+    EXPECT_EQ(gpioDone.get(), 0);
+    EXPECT_EQ(echo.readAsync().get(), 1);
+
+    EXPECT_EQ(spi.writeAsync(tx, sizeof(tx)).future().get(), (int)sizeof(tx));
+    EXPECT_EQ(spi.readAsync(rx, sizeof(rx)).future().get(), (int)sizeof(rx));
+    //the loopback bytes
+    memset(rx, 0, sizeof(rx));
+    EXPECT_EQ(serial.readAsync(rx, sizeof(rx)).future().get(), (int)sizeof(text));
+    EXPECT_STREQ((const char *)rx, text);
+    EXPECT_LT(i2c.writeAsync(0x12, tx, 2).future().get(), 0);
+
+    //larger than a packet
+    uint8_t big[128] = {0};
+    EXPECT_EQ(serial.writeAsync(big, sizeof(big)).get(), -1);
+
+    driver = 0;
+}
+
 TEST(IoIgTests, Serial_TestBench) 
 {
     SerialTestBench test;
@@ -424,8 +724,43 @@ TEST(IoIgTests, GPIO_Serial_Test)
 
 
 
+#ifdef IOIG_FW_SIM
+/**
+ * @brief Runs the test bench against the in-process firmware, with the
+ *        wiring below done on the simulated board.
+ * @param baseline true answers SYS_INIT as the firmware predating the
+ *        handshake: the session falls back to the v1 header and events.
+ */
+static void attachSimulator(bool baseline)
+{
+    LoopbackTransport::wire(GP8, GP9);
+    LoopbackTransport::wire(GP10, GP11);
+    LoopbackTransport::wire(GP12, GP13);
+    LoopbackTransport::wire(GP19, GP16);
+    LoopbackTransport::setBaselineHandshake(baseline);
+
+    if (UsbManager::attachTransport(std::unique_ptr<Transport>(new LoopbackTransport()), USB_PORT) != 0)
+    {
+        std::cerr << "Can't attach the simulator" << std::endl;
+        std::exit(-1);
+    }
+}
+#endif
+
 int main(int argc, char **argv) 
 {
+#ifdef IOIG_FW_SIM
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]) == "--sim" || std::string(argv[i]) == "--sim-v1")
+        {
+            attachSimulator(std::string(argv[i]) == "--sim-v1");
+            testing::InitGoogleTest(&argc, argv);
+            return RUN_ALL_TESTS();
+        }
+    }
+#endif
+
     // Code here will be called immediately after the constructor (right
     // before each test).
     std::string msg =
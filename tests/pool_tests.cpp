@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+#include "ioig.h"
+#include "ioig_usb.h"
+
+using namespace ioig;
+
+
+TEST(PacketPoolTestSuite, AcquireRelease) 
+{
+  PacketPool pool(2);
+  EXPECT_EQ(pool.capacity(), 2);
+
+  auto pkt1 = pool.acquire();
+  auto pkt2 = pool.acquire();
+  auto pkt3 = pool.acquire();
+  EXPECT_TRUE(pkt1);
+  EXPECT_TRUE(pkt2);
+  EXPECT_FALSE(pkt3); //exhausted
+  EXPECT_NE(pkt1.index(), pkt2.index());
+
+  //slots are cache line aligned
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(pkt1->getBuffer()) % 64, 0);
+  EXPECT_EQ(pkt1->getBufferSize(), Packet::MAX_SIZE);
+
+  pkt1->setType(Packet::Type::GPIO_INIT);
+  pkt1->addPayloadItem8(42);
+  unsigned idx = pkt1.index();
+  pkt1.release();
+  EXPECT_FALSE(pkt1);
+
+  pkt3 = pool.acquire();
+  EXPECT_TRUE(pkt3);
+  EXPECT_EQ(pkt3.index(), idx);
+  EXPECT_EQ(pkt3->getType(), Packet::Type::NONE); //reset on acquire
+  EXPECT_TRUE(pkt3->isEmpty());
+
+  //detached slots go back by index
+  unsigned detached = pkt2.detach();
+  EXPECT_FALSE(pkt2);
+  EXPECT_FALSE(pool.acquire());
+  pool.release(detached);
+  EXPECT_TRUE(pool.acquire());
+}
+
+
+TEST(PacketPoolTestSuite, Concurrent) 
+{
+  const unsigned capacity = 8;
+  const int threadCount = 4;
+  const int loops = 20000;
+
+  PacketPool pool(capacity);
+  std::atomic<int> owners[capacity];
+  for (auto &o : owners) 
+  {
+    o = 0;
+  }
+  std::atomic<bool> sharedSlot{false};
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < threadCount; t++) 
+  {
+    threads.emplace_back([&]() 
+    {
+      for (int i = 0; i < loops; i++) 
+      {
+        auto pkt = pool.acquire();
+        if (!pkt) 
+        {
+          continue;
+        }
+        if (owners[pkt.index()].fetch_add(1) != 0) 
+        {
+          sharedSlot = true;
+        }
+        pkt->addPayloadItem32(i);
+        owners[pkt.index()].fetch_sub(1);
+      }
+    });
+  }
+
+  for (auto &th : threads) 
+  {
+    th.join();
+  }
+
+  EXPECT_FALSE(sharedSlot) << "a slot was handed out twice";
+
+  //every slot is back
+  std::vector<PacketPool::Handle> all;
+  for (unsigned i = 0; i < capacity; i++) 
+  {
+    all.push_back(pool.acquire());
+    EXPECT_TRUE(all.back());
+  }
+  EXPECT_FALSE(pool.acquire());
+}
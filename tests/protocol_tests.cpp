@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "ioig_protocol.h"
+#include "ioig_messages.h"
 #include <cstdint>
 
 using namespace ioig;
@@ -358,3 +359,223 @@ TEST(PacketTestSuite, ProcessPacket)
 }
 
 
+
+TEST(PacketTestSuite, Batch)
+{
+  PacketBatch batch;
+
+  Packet cmd(2);
+  cmd.setType(Packet::Type::GPIO_SET_VALUE);
+  cmd.addPayloadItem8(25);
+  cmd.addPayloadItem8(1);
+
+  EXPECT_EQ(batch.add(cmd), 0);
+  EXPECT_EQ(batch.add(cmd), 1);
+  EXPECT_EQ(batch.size(), 2);
+
+  Packet &req = batch.getRequest();
+  EXPECT_EQ(req.getType(), Packet::Type::BATCH);
+  EXPECT_EQ(req.getPayloadLength(), 2 * (PacketBatch::ENTRY_HEADER_SIZE + 2));
+  EXPECT_EQ(req.getPayloadItem8(0), 2);
+  EXPECT_EQ(req.getPayloadItem8(1), static_cast<int>(Packet::Type::GPIO_SET_VALUE));
+  EXPECT_EQ(req.getPayloadItem8(2), 25);
+
+  Packet reset(0);
+  reset.setType(Packet::Type::SYS_SW_RESET);
+  EXPECT_EQ(batch.add(reset), -1);
+
+  //device response: first entry answered, second one missing
+  Packet &rsp = batch.getResponse();
+  rsp.setType(Packet::Type::BATCH);
+  rsp.setSeqNum(7);
+  const uint8_t pinVal[] = {25, 1};
+  EXPECT_GT(PacketBatch::appendEntry(rsp, static_cast<uint8_t>(Packet::Status::RSP), pinVal, sizeof(pinVal)), 0);
+
+  Packet result;
+  EXPECT_EQ(batch.getResult(0, result), 0);
+  EXPECT_EQ(result.getType(), Packet::Type::GPIO_SET_VALUE);
+  EXPECT_EQ(result.getStatus(), Packet::Status::RSP);
+  EXPECT_EQ(result.getSeqNum(), 7);
+  EXPECT_EQ(result.getPayloadLength(), 2);
+  EXPECT_EQ(result.getPayloadItem8(1), 1);
+  EXPECT_EQ(batch.getResult(1, result), -1);
+
+  //fill up
+  batch.clear();
+  int n = 0;
+  while (batch.add(cmd) >= 0) 
+  {
+    n++;
+  }
+  EXPECT_EQ(n, (Packet::MAX_SIZE - Packet::getHeaderLength()) / (PacketBatch::ENTRY_HEADER_SIZE + 2));
+}
+
+
+TEST(PacketTestSuite, Xfer)
+{
+  EXPECT_EQ(PacketXfer::HEADER_SIZE + PacketXfer::MAX_FRAGMENT_SIZE + Packet::getHeaderLength(), Packet::MAX_SIZE);
+  EXPECT_GE(PacketXfer::MAX_FRAGMENTS * PacketXfer::MAX_FRAGMENT_SIZE, PacketXfer::STAGING_SIZE);
+
+  uint8_t data[PacketXfer::MAX_FRAGMENT_SIZE];
+  for (unsigned i = 0; i < sizeof(data); i++)
+  {
+    data[i] = i;
+  }
+
+  Packet pkt;
+  EXPECT_GT(PacketXfer::addData(pkt, 9, 3 * PacketXfer::MAX_FRAGMENT_SIZE, data, sizeof(data), true), 0);
+  EXPECT_EQ(pkt.getType(), Packet::Type::XFER_DATA);
+  EXPECT_EQ(pkt.getPayloadItem8(0), 9);
+  EXPECT_EQ(pkt.getPayloadItem16(1), (int)(3 * PacketXfer::MAX_FRAGMENT_SIZE));
+  EXPECT_EQ(pkt.getPayloadItem8(3), PacketXfer::FLAG_FINAL);
+  EXPECT_EQ(pkt.getPayloadLength(), Packet::MAX_SIZE - Packet::getHeaderLength());
+  EXPECT_EQ(memcmp(pkt.getPayloadBuffer(PacketXfer::HEADER_SIZE), data, sizeof(data)), 0);
+
+  //a fragment can't be larger than MAX_FRAGMENT_SIZE
+  uint8_t big[PacketXfer::MAX_FRAGMENT_SIZE + 1] = {0};
+  EXPECT_LT(PacketXfer::addData(pkt, 9, 0, big, sizeof(big), true), 0);
+
+  PacketXfer::addExec(pkt, 10, Packet::Type::SPI_TRANSFER, PacketXfer::STAGING_SIZE);
+  pkt.addPayloadItem8(1);
+  EXPECT_EQ(pkt.getType(), Packet::Type::XFER_EXEC);
+  EXPECT_EQ(pkt.getPayloadItem8(0), 10);
+  EXPECT_EQ(pkt.getPayloadItem8(1), static_cast<int>(Packet::Type::SPI_TRANSFER));
+  EXPECT_EQ(pkt.getPayloadItem16(2), (int)PacketXfer::STAGING_SIZE);
+  EXPECT_EQ(pkt.getPayloadItem8(PacketXfer::EXEC_PARAMS), 1);
+
+  PacketXfer::addRead(pkt, 10, 120, 60);
+  EXPECT_EQ(pkt.getType(), Packet::Type::XFER_READ);
+  EXPECT_EQ(pkt.getPayloadItem16(1), 120);
+  EXPECT_EQ(pkt.getPayloadItem8(3), 60);
+
+  EXPECT_TRUE(PacketXfer::hasTxData(Packet::Type::SPI_WRITE));
+  EXPECT_FALSE(PacketXfer::hasTxData(Packet::Type::SPI_READ));
+  EXPECT_TRUE(PacketXfer::hasRxData(Packet::Type::I2C_READ));
+  EXPECT_FALSE(PacketXfer::hasRxData(Packet::Type::SERIAL_WRITE));
+  EXPECT_FALSE(PacketBatch::isBatchable(Packet::Type::XFER_DATA));
+}
+
+
+TEST(PacketTestSuite, FrameV2)
+{
+  Packet pkt;
+  pkt.setType(Packet::Type::SPI_WRITE);
+  pkt.setRequestId(0x1234);
+  pkt.addPayloadItem16(0xBEEF);
+
+  //v1: the buffer as is, the low byte of the id only
+  EXPECT_EQ(pkt.getProtocol(), Packet::PROTOCOL_V1);
+  EXPECT_EQ(pkt.getRequestId(), 0x34);
+  EXPECT_EQ(pkt.getFrameLength(), pkt.getBufferLength());
+
+  uint8_t frame[Packet::MAX_FRAME_SIZE];
+  EXPECT_EQ(pkt.writeFrame(frame), pkt.getBufferLength());
+  EXPECT_EQ(memcmp(frame, pkt.getBuffer(), pkt.getBufferLength()), 0);
+
+  //v2: the header extension in front
+  pkt.setProtocol(Packet::PROTOCOL_V2);
+  pkt.setFlags(Packet::FLAG_NO_RESPONSE);
+  EXPECT_EQ(pkt.getRequestId(), 0x1234);
+  EXPECT_EQ(pkt.getFrameLength(), Packet::EXT_SIZE + pkt.getBufferLength());
+
+  size_t len = pkt.writeFrame(frame);
+  EXPECT_EQ(len, pkt.getFrameLength());
+  EXPECT_EQ(frame[Packet::EXT_TAG], Packet::V2_TAG);
+  EXPECT_EQ(frame[Packet::EXT_FLAGS], Packet::FLAG_NO_RESPONSE);
+  EXPECT_EQ(Packet::getFrameRequestId(frame), 0x1234);
+  EXPECT_EQ(Packet::getFrameType(frame), Packet::Type::SPI_WRITE);
+
+  //stream framing, the header first
+  EXPECT_EQ(Packet::getFrameLength(frame, 0), Packet::Header::SIZE);
+  EXPECT_EQ(Packet::getFrameLength(frame, 1), Packet::EXT_SIZE + Packet::Header::SIZE);
+  EXPECT_EQ(Packet::getFrameLength(frame, len), len);
+
+  Packet rx;
+  EXPECT_EQ(rx.setFrame(frame, len), 0);
+  EXPECT_EQ(rx.getProtocol(), Packet::PROTOCOL_V2);
+  EXPECT_EQ(rx.getRequestId(), 0x1234);
+  EXPECT_EQ(rx.getFlags(), Packet::FLAG_NO_RESPONSE);
+  EXPECT_EQ(rx.getType(), Packet::Type::SPI_WRITE);
+  EXPECT_EQ(rx.getPayloadItem16(0), 0xBEEF);
+
+  //the response keeps the framing and the id, not the flags
+  Packet rsp;
+  rsp.cloneHeader(rx);
+  EXPECT_EQ(rsp.getProtocol(), Packet::PROTOCOL_V2);
+  EXPECT_EQ(rsp.getRequestId(), 0x1234);
+  EXPECT_EQ(rsp.getFlags(), 0);
+
+  //a v1 frame resets the extension
+  pkt.setProtocol(Packet::PROTOCOL_V1);
+  len = pkt.writeFrame(frame);
+  EXPECT_EQ(rx.setFrame(frame, len), 0);
+  EXPECT_EQ(rx.getProtocol(), Packet::PROTOCOL_V1);
+  EXPECT_EQ(rx.getRequestId(), 0x34);
+  EXPECT_EQ(rx.getFlags(), 0);
+
+  //a full payload doesn't fit a smaller packet
+  Packet full;
+  full.setProtocol(Packet::PROTOCOL_V2);
+  full.addRepeatedPayloadItems(0xAA, full.getFreePayloadSlots());
+  len = full.writeFrame(frame);
+  EXPECT_EQ(len, Packet::MAX_FRAME_SIZE);
+  Packet small(8);
+  EXPECT_LT(small.setFrame(frame, len), 0);
+  EXPECT_EQ(small.getPayloadLength(), 8);
+}
+
+
+TEST(MessageTestSuite, Layout)
+{
+  using Write = msg::AnalogWrite;
+
+  static_assert(Write::offset(Write::PIN) == 0, "pin");
+  static_assert(Write::offset(Write::SLICE) == 1, "slice");
+  static_assert(Write::offset(Write::VALUE) == 5, "value");
+  static_assert(Write::offset(Write::COUNT_TOP) == 7, "count top");
+  static_assert(Write::offset(Write::RESOLUTION) == 11, "resolution");
+  static_assert(Write::SIZE == 12, "size");
+  static_assert(msg::AnalogReadTemp::SIZE == 0, "empty");
+
+  //same bytes as the item by item encoding
+  Packet ref;
+  ref.setType(Packet::Type::ANALOG_WRITE);
+  ref.addPayloadItem8(7);
+  ref.addPayloadItem32(3);
+  ref.addPayloadItem16(0xBEEF);
+  ref.addPayloadItem32(1000);
+  ref.addPayloadItem8(12);
+
+  Packet pkt;
+  pkt.addPayloadItem8(0xFF); //replaced
+  EXPECT_TRUE(Write::encode(pkt, 7, 3, 0xBEEF, 1000, 12));
+  EXPECT_EQ(pkt.getType(), Packet::Type::ANALOG_WRITE);
+  ASSERT_EQ(pkt.getBufferLength(), ref.getBufferLength());
+  EXPECT_EQ(memcmp(pkt.getBuffer(), ref.getBuffer(), ref.getBufferLength()), 0);
+
+  EXPECT_TRUE(Write::fits(pkt));
+  EXPECT_EQ(Write::get<Write::PIN>(pkt), 7);
+  EXPECT_EQ(Write::get<Write::SLICE>(pkt), 3u);
+  EXPECT_EQ(Write::get<Write::VALUE>(pkt), 0xBEEF);
+  EXPECT_EQ(Write::get<Write::COUNT_TOP>(pkt), 1000u);
+  EXPECT_EQ(Write::get<Write::RESOLUTION>(pkt), 12);
+
+  using PulseIn = msg::GpioPulseIn;
+  EXPECT_TRUE(PulseIn::encode(pkt, 2, 1, 0x0102030405060708ull));
+  EXPECT_EQ(pkt.getPayloadItem64(2), 0x0102030405060708ll);
+  EXPECT_EQ(PulseIn::get<PulseIn::TIMEOUT_US>(pkt), 0x0102030405060708ull);
+
+  using Temp = msg::AnalogReadTempRsp;
+  EXPECT_TRUE(Temp::encode(pkt, 21.5f));
+  EXPECT_EQ(pkt.getPayloadItemFloat(0), 21.5f);
+  EXPECT_EQ(Temp::get<Temp::CELSIUS>(pkt), 21.5f);
+
+  //too small a packet is left as is, a short payload doesn't fit
+  Packet small(8);
+  EXPECT_FALSE(Write::encode(small, 7, 3, 0xBEEF, 1000, 12));
+  EXPECT_EQ(small.getPayloadLength(), 0u);
+  EXPECT_FALSE(Write::fits(small));
+
+  small.addPayloadItem8(1);
+  EXPECT_FALSE(msg::AnalogReadRsp::fits(small));
+}
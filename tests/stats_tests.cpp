@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+
+#include "ioig.h"
+#include "ioig_engine.h"
+#include "ioig_stats.h"
+#include "echo_link.h"
+
+using namespace ioig;
+
+
+TEST(StatsTestSuite, HistogramBuckets)
+{
+  //exact below SUB_BUCKET_COUNT, then bounded relative error
+  for (uint64_t v = 0; v < LatencyHistogram::SUB_BUCKET_COUNT; v++)
+  {
+    EXPECT_EQ(LatencyHistogram::bucketUpperBound(LatencyHistogram::bucketIndex(v)), v);
+  }
+
+  unsigned prev = 0;
+  for (uint64_t v = 1; v <= LatencyHistogram::MAX_US; v += v / 7 + 1)
+  {
+    unsigned idx = LatencyHistogram::bucketIndex(v);
+    uint64_t bound = LatencyHistogram::bucketUpperBound(idx);
+    EXPECT_GE(idx, prev);
+    EXPECT_LT(idx, LatencyHistogram::BUCKET_COUNT);
+    EXPECT_GE(bound, v);
+    EXPECT_LE(bound - v, v / LatencyHistogram::SUB_BUCKET_HALF);
+    prev = idx;
+  }
+
+  EXPECT_EQ(LatencyHistogram::bucketIndex(~0ull), LatencyHistogram::BUCKET_COUNT - 1);
+}
+
+
+TEST(StatsTestSuite, HistogramPercentiles)
+{
+  LatencyHistogram hist;
+  EXPECT_EQ(hist.snapshot().percentile(99), 0u);
+
+  for (uint64_t us = 1; us <= 1000; us++)
+  {
+    hist.record(us);
+  }
+
+  auto snap = hist.snapshot();
+  EXPECT_EQ(snap.count, 1000u);
+  EXPECT_EQ(snap.maxUs, 1000u);
+  EXPECT_DOUBLE_EQ(snap.meanUs(), 500.5);
+  EXPECT_NEAR((double)snap.percentile(50), 500, 500 / 16.0);
+  EXPECT_NEAR((double)snap.percentile(99), 990, 990 / 16.0);
+  EXPECT_EQ(snap.percentile(100), 1000u);
+
+  LatencyHistogram::Snapshot merged;
+  merged.merge(snap);
+  merged.merge(snap);
+  EXPECT_EQ(merged.count, 2000u);
+  EXPECT_EQ(merged.percentile(50), snap.percentile(50));
+
+  hist.reset();
+  EXPECT_EQ(hist.snapshot().count, 0u);
+}
+
+
+TEST(StatsTestSuite, EngineCounters)
+{
+  EchoLink link;
+  TransferEngine engine(link);
+  engine.start();
+
+  Packet tx, rx;
+  tx.setType(Packet::Type::GPIO_SET_VALUE);
+  tx.addPayloadItem8(3);
+  tx.addPayloadItem8(1);
+
+  for (int i = 0; i < 10; i++)
+  {
+    EXPECT_EQ(engine.transfer(tx, rx, 100), 0);
+  }
+
+  //first attempt gets no response
+  link.drops = 1;
+  EXPECT_EQ(engine.transfer(tx, rx, 10, 2), 0);
+
+  //every attempt times out
+  Packet fwVer, rsp;
+  fwVer.setType(Packet::Type::SYS_GET_FW_VER);
+  link.drops = 2;
+  EXPECT_NE(engine.transfer(fwVer, rsp, 10, 2), 0);
+
+  //response nobody waits for
+  Packet late;
+  late.setType(Packet::Type::SYS_GET_FW_VER);
+  late.setSeqNum(200);
+  engine.onReceive(late.getBuffer(), late.getBufferLength());
+
+  auto stats = engine.getStats();
+
+  auto &gpio = stats.get(Packet::Type::GPIO_SET_VALUE);
+  EXPECT_EQ(gpio.count, 11u);
+  EXPECT_EQ(gpio.txBytes, 11u * tx.getBufferLength());
+  EXPECT_EQ(gpio.rxBytes, 11u * tx.getBufferLength());
+  EXPECT_EQ(gpio.retries, 1u);
+  EXPECT_EQ(gpio.timeouts, 1u);
+  EXPECT_EQ(gpio.failures, 0u);
+  EXPECT_EQ(gpio.latency.count, 11u);
+
+  auto &sys = stats.get(Packet::Type::SYS_GET_FW_VER);
+  EXPECT_EQ(sys.count, 0u);
+  EXPECT_EQ(sys.retries, 1u);
+  EXPECT_EQ(sys.timeouts, 2u);
+  EXPECT_EQ(sys.failures, 1u);
+  EXPECT_EQ(sys.seqMismatches, 1u);
+
+  auto total = stats.total();
+  EXPECT_EQ(total.count, 11u);
+  EXPECT_EQ(total.timeouts, 3u);
+
+  engine.resetStats();
+  EXPECT_EQ(engine.getStats().total().count, 0u);
+  EXPECT_EQ(engine.getStats().total().latency.count, 0u);
+
+  engine.stop();
+}
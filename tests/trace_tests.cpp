@@ -0,0 +1,219 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ioig.h"
+#include "ioig_engine.h"
+#include "ioig_trace.h"
+#include "echo_link.h"
+
+using namespace ioig;
+
+
+static std::string tempPath(const char *name)
+{
+  return ::testing::TempDir() + name;
+}
+
+/**
+ * The events of a trace file, one per line as written by the Tracer.
+ */
+static std::vector<std::string> readEvents(const std::string &path)
+{
+  std::ifstream in(path);
+  std::vector<std::string> lines;
+  std::string line;
+
+  while (std::getline(in, line))
+  {
+    lines.push_back(line);
+  }
+
+  EXPECT_GE(lines.size(), 2u);
+  EXPECT_EQ(lines.front(), "{\"traceEvents\":[");
+  EXPECT_EQ(lines.back(), "]}");
+
+  std::vector<std::string> events(lines.begin() + 1, lines.end() - 1);
+  for (size_t i = 0; i < events.size(); i++)
+  {
+    //separators between the events only
+    std::string &evt = events[i];
+    if (i + 1 < events.size())
+    {
+      EXPECT_EQ(evt.back(), ',');
+      evt.pop_back();
+    }
+    EXPECT_EQ(evt.front(), '{');
+    EXPECT_EQ(evt.back(), '}');
+  }
+  return events;
+}
+
+static const std::string *findEvent(const std::vector<std::string> &events, const std::string &name)
+{
+  for (auto &evt : events)
+  {
+    if (evt.find("\"name\":\"" + name + "\"") != std::string::npos)
+    {
+      return &evt;
+    }
+  }
+  return nullptr;
+}
+
+static double field(const std::string &evt, const std::string &key)
+{
+  size_t pos = evt.find("\"" + key + "\":");
+  return pos == std::string::npos ? -1 : std::stod(evt.substr(pos + key.size() + 3));
+}
+
+
+TEST(TraceTestSuite, SpansAndInstants)
+{
+  std::string path = tempPath("ioig_trace_spans.json");
+
+  //stopped, nothing recorded
+  {
+    TraceSpan span("test", "ignored");
+    EXPECT_EQ(TraceSpan::current(), nullptr);
+    Tracer::instant("test", "ignored");
+  }
+
+  Tracer::setThreadName("trace test");
+
+  ASSERT_EQ(Tracer::start(path), 0);
+  EXPECT_TRUE(Tracer::enabled());
+  EXPECT_NE(Tracer::start(path), 0);
+
+  {
+    TraceSpan outer("test", "outer", {{"a", 1}});
+    EXPECT_EQ(TraceSpan::current(), &outer);
+    {
+      TraceSpan inner("test", "inner");
+      EXPECT_EQ(TraceSpan::current(), &inner);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(TraceSpan::current(), &outer);
+    outer.add("retries", 1);
+    outer.add("retries", 1);
+  }
+  EXPECT_EQ(TraceSpan::current(), nullptr);
+
+  Tracer::instant("test", "mark", {{"v", 42}});
+
+  //a contended lock shows up as a span of the waiting thread, a free one doesn't
+  std::mutex mutex;
+  {
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    lockTraced(lock, "free mutex");
+  }
+
+  std::unique_lock<std::mutex> held(mutex);
+  std::thread waiter([&mutex] {
+    Tracer::setThreadName("waiter");
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    lockTraced(lock, "test mutex");
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  held.unlock();
+  waiter.join();
+
+  Tracer::stop();
+  EXPECT_FALSE(Tracer::enabled());
+  EXPECT_EQ(Tracer::getDropped(), 0u);
+
+  auto events = readEvents(path);
+  EXPECT_EQ(events.size(), Tracer::getRecorded() + 1); //process name
+
+  EXPECT_EQ(findEvent(events, "ignored"), nullptr);
+  EXPECT_EQ(findEvent(events, "free mutex"), nullptr);
+
+  auto outer = findEvent(events, "outer");
+  auto inner = findEvent(events, "inner");
+  ASSERT_NE(outer, nullptr);
+  ASSERT_NE(inner, nullptr);
+  EXPECT_NE(outer->find("\"ph\":\"X\""), std::string::npos);
+  EXPECT_NE(outer->find("\"args\":{\"a\":1,\"retries\":2}"), std::string::npos);
+  EXPECT_GE(field(*inner, "ts"), field(*outer, "ts"));
+  EXPECT_LE(field(*inner, "ts") + field(*inner, "dur"), field(*outer, "ts") + field(*outer, "dur"));
+  EXPECT_GE(field(*inner, "dur"), 1000.0);
+
+  auto mark = findEvent(events, "mark");
+  ASSERT_NE(mark, nullptr);
+  EXPECT_NE(mark->find("\"ph\":\"i\""), std::string::npos);
+  EXPECT_NE(mark->find("\"v\":42"), std::string::npos);
+
+  auto wait = findEvent(events, "test mutex");
+  ASSERT_NE(wait, nullptr);
+  EXPECT_GE(field(*wait, "dur"), 10000.0);
+  EXPECT_NE(field(*wait, "tid"), field(*outer, "tid"));
+
+  //thread names, once per thread
+  unsigned names = 0;
+  for (auto &evt : events)
+  {
+    if (evt.find("\"name\":\"thread_name\"") != std::string::npos)
+    {
+      names++;
+      bool main = evt.find("\"args\":{\"name\":\"trace test\"}") != std::string::npos;
+      EXPECT_EQ(field(evt, "tid"), main ? field(*outer, "tid") : field(*wait, "tid"));
+    }
+  }
+  EXPECT_EQ(names, 2u);
+
+  std::remove(path.c_str());
+}
+
+TEST(TraceTestSuite, EngineRetriesAndWindow)
+{
+  std::string path = tempPath("ioig_trace_engine.json");
+
+  EchoLink link;
+  TransferEngine engine(link, 1);
+  engine.start();
+
+  ASSERT_EQ(Tracer::start(path), 0);
+
+  Packet tx, rx;
+  tx.setType(Packet::Type::GPIO_SET_VALUE);
+  tx.addPayloadItem8(0);
+
+  //the first attempt is lost, the retry is counted on the caller span
+  link.drops = 1;
+  {
+    TraceSpan span("transfer", "transfer", {{"retries", 0}});
+    EXPECT_EQ(engine.transfer(tx, rx, 20), 0);
+  }
+
+  //a window of one: the second caller waits for the slot of the first
+  link.drops = 1;
+  std::thread first([&engine] {
+    Packet tx, rx;
+    tx.setType(Packet::Type::GPIO_SET_VALUE);
+    tx.addPayloadItem8(1);
+    engine.transfer(tx, rx, 50);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  EXPECT_EQ(engine.transfer(tx, rx, 50), 0);
+  first.join();
+
+  Tracer::stop();
+  engine.stop();
+
+  auto events = readEvents(path);
+
+  auto transfer = findEvent(events, "transfer");
+  ASSERT_NE(transfer, nullptr);
+  EXPECT_NE(transfer->find("\"retries\":1"), std::string::npos);
+
+  auto wait = findEvent(events, "wait slot");
+  ASSERT_NE(wait, nullptr);
+  EXPECT_NE(wait->find("\"window\":1"), std::string::npos);
+  EXPECT_GT(field(*wait, "dur"), 0.0);
+
+  std::remove(path.c_str());
+}
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ioig.h"
+#include "ioig_usb.h"
+#include "ioig_capture.h"
+#include "loopback_transport.h"
+
+using namespace ioig;
+
+/*
+ * Replays the requests of a capture (UsbManager::startCapture) against the
+ * firmware built for the host (fw/sim), to reproduce a timing problem seen
+ * on the field, or to compare a change against real traffic.
+ *
+ * The requests are sent in timestamp order, at their captured time
+ * offsets, without waiting for the responses: the pipelining of the
+ * original run is kept. Responses are matched by request id, so their
+ * status can be compared to the captured ones. Captured events are counted
+ * only, the simulator raises its own.
+ *
+ * Board wiring, as for ioig_tests:
+ *   UART1: GP8 + GP9, GPIO: GP10 + GP11, GP12 + GP13, SPI0: GP19 + GP16
+ *
+ * Usage: ioig_replay <capture> [options]
+ *   --fast           send as fast as the window allows, ignore the timestamps
+ *   --speed=X        time scale, 2 replays twice as fast (default 1)
+ *   --v1             run the simulator as a firmware predating the ready handshake, v1 header and events
+ *   --capture=FILE   capture the replay itself, for a side by side comparison
+ */
+
+static constexpr int USB_PORT = 0;
+static constexpr unsigned TIMEOUT_MS = 600;
+
+struct Request
+{
+    uint64_t timestampNs;
+    uint16_t requestId;
+    Packet txPkt;
+    Packet rxPkt;
+    int capturedStatus;  /**< -1 without captured response */
+    int result;
+};
+
+static void usage()
+{
+    std::cerr << "usage: ioig_replay <capture> [--fast] [--speed=X] [--v1] [--capture=FILE]" << std::endl;
+    std::exit(-1);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage();
+    }
+
+    std::string path = argv[1];
+    std::string capturePath;
+    bool fast = false;
+    double speed = 1.0;
+    bool baseline = false;
+
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--fast")
+        {
+            fast = true;
+        }
+        else if (arg.rfind("--speed=", 0) == 0)
+        {
+            speed = std::atof(arg.c_str() + 8);
+        }
+        else if (arg == "--v1")
+        {
+            baseline = true;
+        }
+        else if (arg.rfind("--capture=", 0) == 0)
+        {
+            capturePath = arg.substr(10);
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    if (speed <= 0)
+    {
+        usage();
+    }
+
+    CaptureReader reader;
+    if (reader.open(path) != 0)
+    {
+        std::cerr << "Can't read capture " << path << std::endl;
+        return -1;
+    }
+
+    //Requests in order, the status of their captured response by request id
+    std::vector<std::unique_ptr<Request>> requests;
+    std::map<uint16_t, Request *> pending;
+    uint64_t rxCount = 0;
+    uint64_t eventCount = 0;
+    uint64_t spanNs = 0;
+    CaptureRecord rec;
+
+    while (reader.next(rec))
+    {
+        spanNs = std::max(spanNs, rec.timestampNs);
+
+        switch (rec.direction)
+        {
+        case CaptureRecord::Direction::TX:
+        {
+            std::unique_ptr<Request> req(new Request());
+            req->timestampNs = rec.timestampNs;
+            req->requestId = Packet::getFrameRequestId(rec.frame);
+            req->capturedStatus = -1;
+            req->result = 1;
+            req->txPkt.setFrame(rec.frame, rec.len);
+            pending[req->requestId] = req.get();
+            requests.push_back(std::move(req));
+            break;
+        }
+        case CaptureRecord::Direction::RX:
+        {
+            rxCount++;
+            auto it = pending.find(Packet::getFrameRequestId(rec.frame));
+            if (it != pending.end())
+            {
+                Packet rsp;
+                rsp.setFrame(rec.frame, rec.len);
+                it->second->capturedStatus = static_cast<int>(rsp.getStatus());
+                pending.erase(it);
+            }
+            break;
+        }
+        case CaptureRecord::Direction::EVENT:
+            eventCount++;
+            break;
+        }
+    }
+
+    //the capture is ordered per recording thread only, see PacketCapture
+    std::stable_sort(requests.begin(), requests.end(),
+                     [](const std::unique_ptr<Request> &a, const std::unique_ptr<Request> &b)
+                     { return a->timestampNs < b->timestampNs; });
+
+    printf("Capture %s: %zu requests, %llu responses, %llu events over %.3f ms\n", path.c_str(), requests.size(),
+           (unsigned long long)rxCount, (unsigned long long)eventCount, spanNs / 1e6);
+
+    if (requests.empty())
+    {
+        return 0;
+    }
+
+    LoopbackTransport::wire(GP8, GP9);
+    LoopbackTransport::wire(GP10, GP11);
+    LoopbackTransport::wire(GP12, GP13);
+    LoopbackTransport::wire(GP19, GP16);
+    LoopbackTransport::setBaselineHandshake(baseline);
+
+    if (UsbManager::attachTransport(std::unique_ptr<Transport>(new LoopbackTransport()), USB_PORT) != 0)
+    {
+        std::cerr << "Can't attach the simulator" << std::endl;
+        return -1;
+    }
+
+    if (!capturePath.empty() && UsbManager::startCapture(capturePath, USB_PORT) != 0)
+    {
+        return -1;
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t done = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t firstNs = requests.front()->timestampNs;
+
+    for (auto &req : requests)
+    {
+        if (!fast)
+        {
+            auto offset = std::chrono::nanoseconds(static_cast<uint64_t>((req->timestampNs - firstNs) / speed));
+            std::this_thread::sleep_until(start + offset);
+        }
+
+        Request *r = req.get();
+        UsbManager::transferAsync(r->txPkt, r->rxPkt, USB_PORT, [&, r](int ret)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            r->result = ret;
+            done++;
+            cv.notify_all();
+        }, TIMEOUT_MS);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return done == requests.size(); });
+    }
+
+    double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (!capturePath.empty())
+    {
+        UsbManager::stopCapture(USB_PORT);
+    }
+
+    size_t failures = 0;
+    size_t statusMismatches = 0;
+
+    for (auto &req : requests)
+    {
+        if (req->result != 0)
+        {
+            failures++;
+            continue;
+        }
+
+        if (req->capturedStatus >= 0 && req->capturedStatus != static_cast<int>(req->rxPkt.getStatus()))
+        {
+            statusMismatches++;
+        }
+    }
+
+    printf("Replayed %zu requests in %.3f ms: %zu failed, %zu responses with another status than captured\n",
+           requests.size(), elapsedMs, failures, statusMismatches);
+
+    auto stats = UsbManager::getStats(USB_PORT);
+
+    printf("%6s %8s %8s %8s %8s %8s\n", "type", "count", "p50_us", "p99_us", "max_us", "timeouts");
+    for (unsigned t = 0; t < TransferStats::TYPE_COUNT; t++)
+    {
+        auto &c = stats.perType[t];
+        if (c.count == 0 && c.timeouts == 0)
+        {
+            continue;
+        }
+
+        printf("%6u %8llu %8llu %8llu %8llu %8llu\n", t, (unsigned long long)c.count,
+               (unsigned long long)c.latency.percentile(50), (unsigned long long)c.latency.percentile(99),
+               (unsigned long long)c.latency.maxUs, (unsigned long long)c.timeouts);
+    }
+
+    return failures == 0 ? 0 : 1;
+}